@@ -5,6 +5,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -62,7 +64,7 @@ struct buf_t {
 
 
 #define NUM_NAMESPACES 7
-const char const *ns_names[NUM_NAMESPACES] =
+const char *const ns_names[NUM_NAMESPACES] =
 		{ NULL, NULL /*html*/, "math", "svg", "xlink", "xml", "xmlns" };
 
 
@@ -70,25 +72,33 @@ node_t *Document;
 
 
 
-static int create_comment(void *ctx, const hubbub_string *data, void **result);
-static int create_doctype(void *ctx, const hubbub_doctype *doctype,
+static hubbub_error create_comment(void *ctx, const hubbub_string *data,
 		void **result);
-static int create_element(void *ctx, const hubbub_tag *tag, void **result);
-static int create_text(void *ctx, const hubbub_string *data, void **result);
-static int ref_node(void *ctx, void *node);
-static int unref_node(void *ctx, void *node);
-static int append_child(void *ctx, void *parent, void *child, void **result);
-static int insert_before(void *ctx, void *parent, void *child, void *ref_child,
+static hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype,
 		void **result);
-static int remove_child(void *ctx, void *parent, void *child, void **result);
-static int clone_node(void *ctx, void *node, bool deep, void **result);
-static int reparent_children(void *ctx, void *node, void *new_parent);
-static int get_parent(void *ctx, void *node, bool element_only, void **result);
-static int has_children(void *ctx, void *node, bool *result);
-static int form_associate(void *ctx, void *form, void *node);
-static int add_attributes(void *ctx, void *node,
+static hubbub_error create_element(void *ctx, const hubbub_tag *tag,
+		void **result);
+static hubbub_error create_text(void *ctx, const hubbub_string *data,
+		void **result);
+static hubbub_error ref_node(void *ctx, void *node);
+static hubbub_error unref_node(void *ctx, void *node);
+static hubbub_error append_child(void *ctx, void *parent, void *child,
+		void **result);
+static hubbub_error insert_before(void *ctx, void *parent, void *child,
+		void *ref_child, void **result);
+static hubbub_error remove_child(void *ctx, void *parent, void *child,
+		void **result);
+static hubbub_error clone_node(void *ctx, void *node, bool deep,
+		void **result);
+static hubbub_error reparent_children(void *ctx, void *node,
+		void *new_parent);
+static hubbub_error get_parent(void *ctx, void *node, bool element_only,
+		void **result);
+static hubbub_error has_children(void *ctx, void *node, bool *result);
+static hubbub_error form_associate(void *ctx, void *form, void *node);
+static hubbub_error add_attributes(void *ctx, void *node,
 		const hubbub_attribute *attributes, uint32_t n_attributes);
-static int set_quirks_mode(void *ctx, hubbub_quirks_mode mode);
+static hubbub_error set_quirks_mode(void *ctx, hubbub_quirks_mode mode);
 
 static hubbub_tree_handler tree_handler = {
 	create_comment,
@@ -120,7 +130,16 @@ static void *myrealloc(void *ptr, size_t len, void *pw)
 
 
 
-int main(int argc, char **argv)
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double parse_file(const char *filename, size_t *size)
 {
 	hubbub_parser *parser;
 	hubbub_parser_optparams params;
@@ -128,14 +147,7 @@ int main(int argc, char **argv)
 	struct stat info;
 	int fd;
 	uint8_t *file;
-
-	if (argc != 3) {
-		printf("Usage: %s <aliases_file> <filename>\n", argv[0]);
-		return 1;
-	}
-
-	/* Initialise library */
-	assert(hubbub_initialise(argv[1], myrealloc, NULL) == HUBBUB_OK);
+	double start, end;
 
 	assert(hubbub_parser_create("UTF-8", false, myrealloc, NULL, &parser) ==
 			HUBBUB_OK);
@@ -148,14 +160,63 @@ int main(int argc, char **argv)
 	assert(hubbub_parser_setopt(parser, HUBBUB_PARSER_DOCUMENT_NODE,
 			&params) == HUBBUB_OK);
 
-	stat(argv[2], &info);
-	fd = open(argv[2], 0);
+	Document = NULL;
+
+	assert(stat(filename, &info) == 0);
+	fd = open(filename, 0);
+	assert(fd >= 0);
 	file = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	assert(file != MAP_FAILED);
+
+	/* Fault the file in, so that only parsing is timed */
+	madvise(file, info.st_size, MADV_WILLNEED);
+	for (off_t i = 0; i < info.st_size; i += 4096)
+		((volatile uint8_t *) file)[i];
+
+	start = now();
 
 	assert(hubbub_parser_parse_chunk(parser, file, info.st_size)
 			== HUBBUB_OK);
+	assert(hubbub_parser_completed(parser) == HUBBUB_OK);
+
+	end = now();
+
+	hubbub_parser_destroy(parser);
+
+	munmap(file, info.st_size);
+	close(fd);
+
+	*size = info.st_size;
+
+	return end - start;
+}
+
+int main(int argc, char **argv)
+{
+	double total_time = 0;
+	size_t total_size = 0;
 
-	assert(hubbub_finalise(myrealloc, NULL) == HUBBUB_OK);
+	if (argc < 2) {
+		printf("Usage: %s <filename> [<filename> ...]\n", argv[0]);
+		return 1;
+	}
+
+	for (int i = 1; i < argc; i++) {
+		size_t size;
+		double t = parse_file(argv[i], &size);
+
+		printf("%s: %zu bytes in %.3f s (%.2f MB/s)\n", argv[i],
+				size, t, size / t / (1024 * 1024));
+
+		total_time += t;
+		total_size += size;
+	}
+
+	if (argc > 2) {
+		printf("Total: %zu bytes in %.3f s (%.2f MB/s)\n",
+				total_size, total_time,
+				total_size / total_time / (1024 * 1024));
+	}
 
 	return 0;
 }
@@ -163,7 +224,7 @@ int main(int argc, char **argv)
 
 /*** Tree construction functions ***/
 
-int create_comment(void *ctx, const hubbub_string *data, void **result)
+hubbub_error create_comment(void *ctx, const hubbub_string *data, void **result)
 {
 	node_t *node = calloc(1, sizeof *node);
 
@@ -174,10 +235,10 @@ int create_comment(void *ctx, const hubbub_string *data, void **result)
 
 	*result = node;
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int create_doctype(void *ctx, const hubbub_doctype *doctype, void **result)
+hubbub_error create_doctype(void *ctx, const hubbub_doctype *doctype, void **result)
 {
 	node_t *node = calloc(1, sizeof *node);
 
@@ -202,10 +263,10 @@ int create_doctype(void *ctx, const hubbub_doctype *doctype, void **result)
 
 	*result = node;
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int create_element(void *ctx, const hubbub_tag *tag, void **result)
+hubbub_error create_element(void *ctx, const hubbub_tag *tag, void **result)
 {
 	node_t *node = calloc(1, sizeof *node);
 
@@ -241,10 +302,10 @@ int create_element(void *ctx, const hubbub_tag *tag, void **result)
 
 	*result = node;
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int create_text(void *ctx, const hubbub_string *data, void **result)
+hubbub_error create_text(void *ctx, const hubbub_string *data, void **result)
 {
 	node_t *node = calloc(1, sizeof *node);
 
@@ -255,26 +316,26 @@ int create_text(void *ctx, const hubbub_string *data, void **result)
 
 	*result = node;
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int ref_node(void *ctx, void *node)
+hubbub_error ref_node(void *ctx, void *node)
 {
 	UNUSED(ctx);
 	UNUSED(node);
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int unref_node(void *ctx, void *node)
+hubbub_error unref_node(void *ctx, void *node)
 {
 	UNUSED(ctx);
 	UNUSED(node);
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int append_child(void *ctx, void *parent, void *child, void **result)
+hubbub_error append_child(void *ctx, void *parent, void *child, void **result)
 {
 	node_t *tparent = parent;
 	node_t *tchild = child;
@@ -319,11 +380,11 @@ int append_child(void *ctx, void *parent, void *child, void **result)
 		}
 	}
 
-	return 0;
+	return HUBBUB_OK;
 }
 
 /* insert 'child' before 'ref_child', under 'parent' */
-int insert_before(void *ctx, void *parent, void *child, void *ref_child,
+hubbub_error insert_before(void *ctx, void *parent, void *child, void *ref_child,
 		void **result)
 {
 	node_t *tparent = parent;
@@ -357,10 +418,10 @@ int insert_before(void *ctx, void *parent, void *child, void *ref_child,
 		*result = child;
 	}
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int remove_child(void *ctx, void *parent, void *child, void **result)
+hubbub_error remove_child(void *ctx, void *parent, void *child, void **result)
 {
 	node_t *tparent = parent;
 	node_t *tchild = child;
@@ -385,10 +446,10 @@ int remove_child(void *ctx, void *parent, void *child, void **result)
 
 	*result = child;
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int clone_node(void *ctx, void *node, bool deep, void **result)
+hubbub_error clone_node(void *ctx, void *node, bool deep, void **result)
 {
 	node_t *old_node = node;
 	node_t *new_node = calloc(1, sizeof *new_node);
@@ -403,7 +464,7 @@ int clone_node(void *ctx, void *node, bool deep, void **result)
 			NULL;
 
 	if (deep == false)
-		return 0;
+		return HUBBUB_OK;
 
 	if (old_node->next) {
 		void *n;
@@ -423,11 +484,11 @@ int clone_node(void *ctx, void *node, bool deep, void **result)
 		new_node->child->parent = new_node;
 	}
 
-	return 0;
+	return HUBBUB_OK;
 }
 
 /* Take all of the child nodes of "node" and append them to "new_parent" */
-int reparent_children(void *ctx, void *node, void *new_parent)
+hubbub_error reparent_children(void *ctx, void *node, void *new_parent)
 {
 	node_t *parent = new_parent;
 	node_t *old_parent = node;
@@ -438,7 +499,7 @@ int reparent_children(void *ctx, void *node, void *new_parent)
 	UNUSED(ctx);
 
 	kids = old_parent->child;
-	if (!kids) return 0;
+	if (!kids) return HUBBUB_OK;
 
 	old_parent->child = NULL;
 
@@ -459,38 +520,38 @@ int reparent_children(void *ctx, void *node, void *new_parent)
 		kids = kids->next;
 	}
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int get_parent(void *ctx, void *node, bool element_only, void **result)
+hubbub_error get_parent(void *ctx, void *node, bool element_only, void **result)
 {
 	UNUSED(ctx);
 	UNUSED(element_only);
 
 	*result = ((node_t *)node)->parent;
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int has_children(void *ctx, void *node, bool *result)
+hubbub_error has_children(void *ctx, void *node, bool *result)
 {
 	UNUSED(ctx);
 
 	*result = ((node_t *)node)->child ? true : false;
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int form_associate(void *ctx, void *form, void *node)
+hubbub_error form_associate(void *ctx, void *form, void *node)
 {
 	UNUSED(ctx);
 	UNUSED(form);
 	UNUSED(node);
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int add_attributes(void *ctx, void *vnode,
+hubbub_error add_attributes(void *ctx, void *vnode,
 		const hubbub_attribute *attributes, uint32_t n_attributes)
 {
 	node_t *node = vnode;
@@ -521,13 +582,13 @@ int add_attributes(void *ctx, void *vnode,
 	}
 
 
-	return 0;
+	return HUBBUB_OK;
 }
 
-int set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
+hubbub_error set_quirks_mode(void *ctx, hubbub_quirks_mode mode)
 {
 	UNUSED(ctx);
 	UNUSED(mode);
 
-	return 0;
+	return HUBBUB_OK;
 }
@@ -14,6 +14,7 @@
 #include <parserutils/charset/utf8.h>
 
 #include "utils/parserutilserror.h"
+#include "utils/string.h"
 #include "utils/utils.h"
 
 #include "tokeniser/entities.h"
@@ -43,6 +44,15 @@ static const uint8_t lf = '\n';
 static const hubbub_string lf_str = { &lf, 1 };
 
 
+/**
+ * Octets which may end a run of characters in the various text states
+ */
+static const uint8_t pcdata_stops[] = { '&', '<', '\0', '\r' };
+static const uint8_t cdata_stops[] = { '&', '-', '<', '>', '\0', '\r' };
+static const uint8_t value_dq_stops[] = { '"', '&', '\0', '\r' };
+static const uint8_t value_sq_stops[] = { '\'', '&', '\0', '\r' };
+
+
 /**
  * Tokeniser states
  */
@@ -611,6 +621,53 @@ hubbub_error hubbub_tokeniser_run(hubbub_tokeniser *tokeniser)
 	} while (0)
 
 
+/**
+ * Find the length of the run of characters which follows the pending ones
+ * and contains no octet from a set.
+ *
+ * The run is contiguous in the input stream's buffer, so may be collected
+ * in one go from the pointer returned when peeking at its start.
+ *
+ * \param tokeniser  Tokeniser instance
+ * \param offset     Offset of the run from the stream's cursor
+ * \param stops      Octets which end the run
+ * \param n_stops    Number of octets in \a stops
+ * \return Length of run, in bytes
+ */
+static inline size_t hubbub_tokeniser_run_length(hubbub_tokeniser *tokeniser,
+		size_t offset, const uint8_t *stops, size_t n_stops)
+{
+	const parserutils_buffer *utf8 = tokeniser->input->utf8;
+	size_t start = tokeniser->input->cursor + offset;
+	const uint8_t *data;
+	size_t avail, run;
+
+	if (start >= utf8->length)
+		return 0;
+
+	data = utf8->data + start;
+	avail = utf8->length - start;
+
+	run = hubbub_string_cspn(data, avail, stops, n_stops);
+
+	if (run == avail) {
+		/* Leave any partial character at the end of the buffer
+		 * for parserutils_inputstream_peek() to deal with */
+		uint32_t last;
+		size_t clen;
+
+		if (parserutils_charset_utf8_prev(data, run, &last) !=
+				PARSERUTILS_OK)
+			return 0;
+
+		if (parserutils_charset_utf8_char_byte_length(data + last,
+				&clen) != PARSERUTILS_OK || last + clen > run)
+			run = last;
+	}
+
+	return run;
+}
+
 /* this should always be called with an empty "chars" buffer */
 hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 {
@@ -729,8 +786,24 @@ hubbub_error hubbub_tokeniser_handle_data(hubbub_tokeniser *tokeniser)
 			/* Advance over */
 			parserutils_inputstream_advance(tokeniser->input, 1);
 		} else {
-			/* Just collect into buffer */
+			/* Just collect into buffer, along with the run of
+			 * ordinary characters that follows */
 			tokeniser->context.pending += len;
+
+			if (tokeniser->content_model ==
+					HUBBUB_CONTENT_MODEL_PCDATA) {
+				tokeniser->context.pending +=
+					hubbub_tokeniser_run_length(tokeniser,
+						tokeniser->context.pending,
+						pcdata_stops,
+						sizeof(pcdata_stops));
+			} else {
+				tokeniser->context.pending +=
+					hubbub_tokeniser_run_length(tokeniser,
+						tokeniser->context.pending,
+						cdata_stops,
+						sizeof(cdata_stops));
+			}
 		}
 	}
 
@@ -1428,6 +1501,11 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_dq(
 		/* Consume '\r' */
 		tokeniser->context.pending += 1;
 	} else {
+		/* Collect the character and the run that follows it */
+		len += hubbub_tokeniser_run_length(tokeniser,
+				tokeniser->context.pending + len,
+				value_dq_stops, sizeof(value_dq_stops));
+
 		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
 				cptr, len);
 		tokeniser->context.pending += len;
@@ -1490,6 +1568,11 @@ hubbub_error hubbub_tokeniser_handle_attribute_value_sq(
 		/* Consume \r */
 		tokeniser->context.pending += 1;
 	} else {
+		/* Collect the character and the run that follows it */
+		len += hubbub_tokeniser_run_length(tokeniser,
+				tokeniser->context.pending + len,
+				value_sq_stops, sizeof(value_sq_stops));
+
 		COLLECT_MS(ctag->attributes[ctag->n_attributes - 1].value,
 				cptr, len);
 		tokeniser->context.pending += len;
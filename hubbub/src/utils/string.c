@@ -5,10 +5,18 @@
  * Copyright 2008 Andrew Sidwell
  */
 
+#include <assert.h>
 #include <stddef.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <string.h>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
 #include "utils/string.h"
 
 
@@ -56,3 +64,100 @@ bool hubbub_string_match_ci(const uint8_t *a, size_t a_len,
 
 	return true;
 }
+
+/**
+ * Find the length of the initial run of a string containing no octets
+ * from a set
+ *
+ * Whole blocks of the string are tested at once, using AVX2 or SSE2
+ * where the compiler targets them and word-at-a-time tests otherwise.
+ * No octet beyond the end of the string is read.
+ *
+ * \param s		String to scan
+ * \param len		Length of string, in bytes
+ * \param set		Octets to stop at
+ * \param set_len	Number of octets in set (at most HUBBUB_STRING_MAX_SET)
+ * \return Offset of first octet from set, or len if there is none
+ */
+size_t hubbub_string_cspn(const uint8_t *s, size_t len,
+		const uint8_t *set, size_t set_len)
+{
+	uint64_t pattern[HUBBUB_STRING_MAX_SET];
+	size_t off = 0;
+	size_t i;
+
+	assert(set_len <= HUBBUB_STRING_MAX_SET);
+
+#if defined(__AVX2__)
+	if (len >= 32) {
+		__m256i needle[HUBBUB_STRING_MAX_SET];
+
+		for (i = 0; i < set_len; i++)
+			needle[i] = _mm256_set1_epi8((char) set[i]);
+
+		for (; len - off >= 32; off += 32) {
+			__m256i block = _mm256_loadu_si256(
+					(const __m256i *) (const void *) (s + off));
+			__m256i hit = _mm256_setzero_si256();
+
+			for (i = 0; i < set_len; i++)
+				hit = _mm256_or_si256(hit,
+					_mm256_cmpeq_epi8(block, needle[i]));
+
+			if (_mm256_movemask_epi8(hit) != 0)
+				break;
+		}
+	}
+#elif defined(__SSE2__)
+	if (len >= 16) {
+		__m128i needle[HUBBUB_STRING_MAX_SET];
+
+		for (i = 0; i < set_len; i++)
+			needle[i] = _mm_set1_epi8((char) set[i]);
+
+		for (; len - off >= 16; off += 16) {
+			__m128i block = _mm_loadu_si128(
+					(const __m128i *) (const void *) (s + off));
+			__m128i hit = _mm_setzero_si128();
+
+			for (i = 0; i < set_len; i++)
+				hit = _mm_or_si128(hit,
+					_mm_cmpeq_epi8(block, needle[i]));
+
+			if (_mm_movemask_epi8(hit) != 0)
+				break;
+		}
+	}
+#endif
+
+	/* Test 8 octets at a time: an octet of (word ^ pattern) is zero
+	 * exactly where the word contains the pattern's octet */
+	for (i = 0; i < set_len; i++)
+		pattern[i] = UINT64_C(0x0101010101010101) * set[i];
+
+	for (; len - off >= 8; off += 8) {
+		uint64_t word, hit = 0;
+
+		memcpy(&word, s + off, sizeof(word));
+
+		for (i = 0; i < set_len; i++) {
+			uint64_t x = word ^ pattern[i];
+
+			hit |= (x - UINT64_C(0x0101010101010101)) & ~x &
+					UINT64_C(0x8080808080808080);
+		}
+
+		if (hit != 0)
+			break;
+	}
+
+	/* Locate the octet within the block, or finish the tail */
+	for (; off < len; off++) {
+		for (i = 0; i < set_len; i++) {
+			if (s[off] == set[i])
+				return off;
+		}
+	}
+
+	return len;
+}
@@ -16,4 +16,11 @@ bool hubbub_string_match(const uint8_t *a, size_t a_len,
 bool hubbub_string_match_ci(const uint8_t *a, size_t a_len,
 		const uint8_t *b, size_t b_len);
 
+/** Maximum number of octets in the set passed to hubbub_string_cspn */
+#define HUBBUB_STRING_MAX_SET 8
+
+/** Find the length of the initial run of octets not in a set */
+size_t hubbub_string_cspn(const uint8_t *s, size_t len,
+		const uint8_t *set, size_t set_len);
+
 #endif
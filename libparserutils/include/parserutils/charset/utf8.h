@@ -39,6 +39,9 @@ parserutils_error parserutils_charset_utf8_next(const uint8_t *s, uint32_t len,
 parserutils_error parserutils_charset_utf8_next_paranoid(const uint8_t *s, 
 		uint32_t len, uint32_t off, uint32_t *nextoff);
 
+parserutils_error parserutils_charset_utf8_validate(const uint8_t *s,
+		size_t len, size_t *valid);
+
 #ifdef __cplusplus
 }
 #endif
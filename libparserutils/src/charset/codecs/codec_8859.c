@@ -12,6 +12,7 @@
 #include <parserutils/charset/mibenum.h>
 
 #include "charset/codecs/codec_impl.h"
+#include "charset/codecs/sbcs_impl.h"
 #include "utils/endian.h"
 #include "utils/utils.h"
 
@@ -46,6 +47,8 @@ static struct {
 typedef struct charset_8859_codec {
 	parserutils_charset_codec base;	/**< Base class */
 
+	sbcs_utf8_table utf8;		/**< UTF-8 table for 0x80-0xFF */
+
 	uint32_t *table;		/**< Mapping table for 0xA0-0xFF */
 
 #define READ_BUFSIZE (8)
@@ -78,6 +81,10 @@ static parserutils_error charset_8859_codec_decode(
 		uint8_t **dest, size_t *destlen);
 static parserutils_error charset_8859_codec_reset(
 		parserutils_charset_codec *codec);
+static parserutils_error charset_8859_codec_decode_utf8(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
 static inline parserutils_error charset_8859_codec_read_char(
 		charset_8859_codec *c,
 		const uint8_t **source, size_t *sourcelen,
@@ -139,6 +146,7 @@ parserutils_error charset_8859_codec_create(const char *charset,
 	uint16_t match = parserutils_charset_mibenum_from_name(
 			charset, strlen(charset));
 	uint32_t *table = NULL;
+	uint32_t ucs4[128];
 
 	for (i = 0; i < N_ELEMENTS(known_charsets); i++) {
 		if (known_charsets[i].mib == match) {
@@ -155,6 +163,13 @@ parserutils_error charset_8859_codec_create(const char *charset,
 
 	c->table = table;
 
+	/* C1 controls, then the charset's own characters */
+	for (i = 0; i < 0xA0 - 0x80; i++)
+		ucs4[i] = 0x80 + i;
+	memcpy(ucs4 + i, table, 96 * sizeof(uint32_t));
+
+	sbcs_utf8_table_init(&c->utf8, ucs4, 0);
+
 	c->read_buf[0] = 0;
 	c->read_len = 0;
 
@@ -166,6 +181,7 @@ parserutils_error charset_8859_codec_create(const char *charset,
 	c->base.handler.encode = charset_8859_codec_encode;
 	c->base.handler.decode = charset_8859_codec_decode;
 	c->base.handler.reset = charset_8859_codec_reset;
+	c->base.handler.decode_utf8 = charset_8859_codec_decode_utf8;
 
 	*codec = (parserutils_charset_codec *) c;
 
@@ -378,6 +394,33 @@ parserutils_error charset_8859_codec_decode(parserutils_charset_codec *codec,
 	return PARSERUTILS_OK;
 }
 
+/**
+ * Decode a chunk of ISO-8859-n data directly into UTF-8
+ *
+ * \param codec      The codec to use
+ * \param source     Pointer to pointer to source data
+ * \param sourcelen  Pointer to length (in bytes) of source data
+ * \param dest       Pointer to pointer to output buffer
+ * \param destlen    Pointer to length (in bytes) of output buffer
+ * \return PARSERUTILS_OK          on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ *         PARSERUTILS_INVALID     if a character cannot be represented and the
+ *                                 codec's error handling mode is set to STRICT,
+ *
+ * This must not be mixed with calls to charset_8859_codec_decode(), as
+ * the two do not share buffered output.
+ */
+parserutils_error charset_8859_codec_decode_utf8(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	charset_8859_codec *c = (charset_8859_codec *) codec;
+
+	return sbcs_decode_utf8(&c->utf8, c->base.errormode,
+			source, sourcelen, dest, destlen);
+}
+
 /**
  * Clear an ISO-8859-n codec's encoding state
  *
@@ -525,8 +568,8 @@ parserutils_error charset_8859_from_ucs4(charset_8859_codec *c,
 	if (*len < 1)
 		return PARSERUTILS_NOMEM;
 
-	if (ucs4 < 0x80) {
-		/* ASCII */
+	if (ucs4 < 0xA0) {
+		/* ASCII and C1 controls */
 		out = ucs4;
 	} else {
 		uint32_t i;
@@ -573,15 +616,14 @@ parserutils_error charset_8859_to_ucs4(charset_8859_codec *c,
 	if (len < 1)
 		return PARSERUTILS_NEEDDATA;
 
-	if (*s < 0x80) {
+	if (*s < 0xA0) {
+		/* ASCII and C1 controls map to themselves */
 		out = *s;
-	} else if (*s >= 0xA0) {
+	} else {
 		if (c->table[*s - 0xA0] == 0xFFFF)
 			return PARSERUTILS_INVALID;
 
 		out = c->table[*s - 0xA0];
-	} else {
-		return PARSERUTILS_INVALID;
 	}
 
 	*ucs4 = out;
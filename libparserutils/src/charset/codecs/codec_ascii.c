@@ -12,6 +12,7 @@
 #include <parserutils/charset/mibenum.h>
 
 #include "charset/codecs/codec_impl.h"
+#include "charset/codecs/sbcs_impl.h"
 #include "utils/endian.h"
 #include "utils/utils.h"
 
@@ -21,6 +22,8 @@
 typedef struct charset_ascii_codec {
 	parserutils_charset_codec base;	/**< Base class */
 
+	sbcs_utf8_table utf8;		/**< UTF-8 table for 0x80-0xFF */
+
 #define READ_BUFSIZE (8)
 	uint32_t read_buf[READ_BUFSIZE];	/**< Buffer for partial
 						 * output sequences (decode)
@@ -51,6 +54,10 @@ static parserutils_error charset_ascii_codec_decode(
 		uint8_t **dest, size_t *destlen);
 static parserutils_error charset_ascii_codec_reset(
 		parserutils_charset_codec *codec);
+static parserutils_error charset_ascii_codec_decode_utf8(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen);
 static inline parserutils_error charset_ascii_codec_read_char(
 		charset_ascii_codec *c,
 		const uint8_t **source, size_t *sourcelen,
@@ -109,6 +116,8 @@ parserutils_error charset_ascii_codec_create(const char *charset,
 	if (c == NULL)
 		return PARSERUTILS_NOMEM;
 
+	sbcs_utf8_table_init(&c->utf8, NULL, 0);
+
 	c->read_buf[0] = 0;
 	c->read_len = 0;
 
@@ -120,6 +129,7 @@ parserutils_error charset_ascii_codec_create(const char *charset,
 	c->base.handler.encode = charset_ascii_codec_encode;
 	c->base.handler.decode = charset_ascii_codec_decode;
 	c->base.handler.reset = charset_ascii_codec_reset;
+	c->base.handler.decode_utf8 = charset_ascii_codec_decode_utf8;
 
 	*codec = (parserutils_charset_codec *) c;
 
@@ -332,6 +342,33 @@ parserutils_error charset_ascii_codec_decode(parserutils_charset_codec *codec,
 	return PARSERUTILS_OK;
 }
 
+/**
+ * Decode a chunk of US-ASCII data directly into UTF-8
+ *
+ * \param codec      The codec to use
+ * \param source     Pointer to pointer to source data
+ * \param sourcelen  Pointer to length (in bytes) of source data
+ * \param dest       Pointer to pointer to output buffer
+ * \param destlen    Pointer to length (in bytes) of output buffer
+ * \return PARSERUTILS_OK          on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ *         PARSERUTILS_INVALID     if a character cannot be represented and the
+ *                                 codec's error handling mode is set to STRICT,
+ *
+ * This must not be mixed with calls to charset_ascii_codec_decode(), as
+ * the two do not share buffered output.
+ */
+parserutils_error charset_ascii_codec_decode_utf8(
+		parserutils_charset_codec *codec,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	charset_ascii_codec *c = (charset_ascii_codec *) codec;
+
+	return sbcs_decode_utf8(&c->utf8, c->base.errormode,
+			source, sourcelen, dest, destlen);
+}
+
 /**
  * Clear a US-ASCII codec's encoding state
  *
@@ -33,6 +33,11 @@ struct parserutils_charset_codec {
 				const uint8_t **source, size_t *sourcelen,
 				uint8_t **dest, size_t *destlen);
 		parserutils_error (*reset)(parserutils_charset_codec *codec);
+		/* Decode directly into UTF-8, or NULL if unsupported */
+		parserutils_error (*decode_utf8)(
+				parserutils_charset_codec *codec,
+				const uint8_t **source, size_t *sourcelen,
+				uint8_t **dest, size_t *destlen);
 	} handler; /**< Vtable for handler code */
 };
 
@@ -115,6 +115,7 @@ parserutils_error charset_utf16_codec_create(const char *charset,
 	c->base.handler.encode = charset_utf16_codec_encode;
 	c->base.handler.decode = charset_utf16_codec_decode;
 	c->base.handler.reset = charset_utf16_codec_reset;
+	c->base.handler.decode_utf8 = NULL;
 
 	*codec = (parserutils_charset_codec *) c;
 
@@ -116,6 +116,7 @@ parserutils_error charset_utf8_codec_create(const char *charset,
 	c->base.handler.encode = charset_utf8_codec_encode;
 	c->base.handler.decode = charset_utf8_codec_decode;
 	c->base.handler.reset = charset_utf8_codec_reset;
+	c->base.handler.decode_utf8 = NULL;
 
 	*codec = (parserutils_charset_codec *) c;
 
@@ -0,0 +1,152 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2012 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_charset_codecs_sbcsimpl_h_
+#define parserutils_charset_codecs_sbcsimpl_h_
+
+/** \file
+ * Table-driven decoding of single-byte charsets to UTF-8 (implementation).
+ */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <parserutils/charset/codec.h>
+
+#include "charset/encodings/utf8impl.h"
+#include "utils/ascii.h"
+
+/**
+ * UTF-8 encodings of the characters 0x80-0xFF of a single-byte charset
+ */
+typedef struct sbcs_utf8_table {
+	uint8_t len[128];	/**< Length of encoding, or 0 if undefined */
+	uint8_t utf8[128][3];	/**< UTF-8 encoding (BMP only) */
+} sbcs_utf8_table;
+
+/**
+ * Build the UTF-8 table for a single-byte charset
+ *
+ * \param table  The table to fill
+ * \param ucs4   Mapping to UCS-4 (host endian) for 0x80 + first onwards,
+ *               with U+FFFF for undefined characters, or NULL
+ * \param first  Offset of first character in \a ucs4 from 0x80
+ *
+ * Characters before \a first, and all of them if \a ucs4 is NULL, are
+ * undefined.
+ */
+static inline void sbcs_utf8_table_init(sbcs_utf8_table *table,
+		const uint32_t *ucs4, size_t first)
+{
+	size_t i;
+
+	for (i = 0; i < 128; i++) {
+		uint8_t *out = table->utf8[i];
+		size_t outlen = sizeof(table->utf8[i]);
+		parserutils_error error;
+		uint32_t c;
+
+		table->len[i] = 0;
+
+		if (ucs4 == NULL || i < first || ucs4[i - first] == 0xFFFF)
+			continue;
+
+		c = ucs4[i - first];
+
+		UTF8_FROM_UCS4(c, &out, &outlen, error);
+		if (error == PARSERUTILS_OK)
+			table->len[i] = sizeof(table->utf8[i]) - outlen;
+	}
+}
+
+/**
+ * Decode a chunk of single-byte charset data directly into UTF-8
+ *
+ * \param table      UTF-8 table for the charset
+ * \param errormode  Codec error handling mode
+ * \param source     Pointer to pointer to source data
+ * \param sourcelen  Pointer to length (in bytes) of source data
+ * \param dest       Pointer to pointer to output buffer
+ * \param destlen    Pointer to length (in bytes) of output buffer
+ * \return PARSERUTILS_OK          on success,
+ *         PARSERUTILS_NOMEM       if output buffer is too small,
+ *         PARSERUTILS_INVALID     if a character cannot be represented and
+ *                                 \a errormode is STRICT.
+ *
+ * Runs of ASCII are copied in bulk; other characters are looked up in
+ * \a table. Undefined characters become U+FFFD unless \a errormode is
+ * STRICT. Nothing is buffered: if a character's encoding will not fit in
+ * the output buffer, ::source is left pointing at it.
+ */
+static inline parserutils_error sbcs_decode_utf8(const sbcs_utf8_table *table,
+		parserutils_charset_codec_errormode errormode,
+		const uint8_t **source, size_t *sourcelen,
+		uint8_t **dest, size_t *destlen)
+{
+	static const uint8_t u_fffd[3] = { 0xEF, 0xBF, 0xBD };
+	const uint8_t *s = *source;
+	size_t slen = *sourcelen;
+	uint8_t *d = *dest;
+	size_t dlen = *destlen;
+	parserutils_error error = PARSERUTILS_OK;
+
+	while (slen > 0) {
+		const uint8_t *utf8;
+		size_t len;
+
+		/* Copy any run of ASCII */
+		len = parserutils__ascii_span(s, slen < dlen ? slen : dlen);
+		memcpy(d, s, len);
+		s += len;
+		slen -= len;
+		d += len;
+		dlen -= len;
+
+		if (slen == 0)
+			break;
+
+		if (s[0] < 0x80) {
+			/* Only stopped because the output buffer is full */
+			error = PARSERUTILS_NOMEM;
+			break;
+		}
+
+		len = table->len[s[0] - 0x80];
+		utf8 = table->utf8[s[0] - 0x80];
+
+		if (len == 0) {
+			if (errormode ==
+					PARSERUTILS_CHARSET_CODEC_ERROR_STRICT) {
+				error = PARSERUTILS_INVALID;
+				break;
+			}
+
+			len = sizeof(u_fffd);
+			utf8 = u_fffd;
+		}
+
+		if (dlen < len) {
+			error = PARSERUTILS_NOMEM;
+			break;
+		}
+
+		memcpy(d, utf8, len);
+		s++;
+		slen--;
+		d += len;
+		dlen -= len;
+	}
+
+	*source = s;
+	*sourcelen = slen;
+	*dest = d;
+	*destlen = dlen;
+
+	return error;
+}
+
+#endif
@@ -15,6 +15,7 @@
 
 #include <parserutils/charset/utf8.h>
 #include "charset/encodings/utf8impl.h"
+#include "utils/ascii.h"
 
 /** Number of continuation bytes for a given start byte */
 const uint8_t numContinuations[256] = {
@@ -173,3 +174,82 @@ parserutils_error parserutils_charset_utf8_next_paranoid(const uint8_t *s,
 	return error;
 }
 
+
+/**
+ * Find the length of the valid UTF-8 at the start of a string
+ *
+ * Runs of ASCII are skipped in bulk. A sequence is valid if it is the
+ * shortest encoding of a character in the range U+0000 to U+10FFFF other
+ * than a surrogate, U+FFFE or U+FFFF.
+ *
+ * \param s      The string
+ * \param len    Length of string, in bytes
+ * \param valid  Pointer to location to receive length of valid prefix
+ * \return PARSERUTILS_OK if the entire string is valid,
+ *         PARSERUTILS_NEEDDATA if the string ends in an incomplete sequence,
+ *         PARSERUTILS_INVALID if the string contains an invalid sequence,
+ *         PARSERUTILS_BADPARM on bad parameters.
+ */
+parserutils_error parserutils_charset_utf8_validate(const uint8_t *s,
+		size_t len, size_t *valid)
+{
+	size_t off = 0;
+
+	if (s == NULL || valid == NULL)
+		return PARSERUTILS_BADPARM;
+
+	while (off < len) {
+		uint8_t c, lo = 0x80, hi = 0xBF;
+		size_t n, i;
+
+		off += parserutils__ascii_span(s + off, len - off);
+		if (off == len)
+			break;
+
+		c = s[off];
+
+		/* Reject continuation bytes, overlong two byte sequences and
+		 * anything that would encode a character above U+10FFFF */
+		if (c < 0xC2 || c > 0xF4)
+			break;
+
+		n = numContinuations[c] + 1;
+
+		/* The second byte of some sequences has a narrower range,
+		 * to exclude overlong forms, surrogates and the top end */
+		if (c == 0xE0)
+			lo = 0xA0;
+		else if (c == 0xED)
+			hi = 0x9F;
+		else if (c == 0xF0)
+			lo = 0x90;
+		else if (c == 0xF4)
+			hi = 0x8F;
+
+		for (i = 1; i < n && off + i < len; i++) {
+			if (s[off + i] < lo || s[off + i] > hi)
+				break;
+
+			lo = 0x80;
+			hi = 0xBF;
+		}
+
+		if (i < n) {
+			*valid = off;
+
+			return off + i < len ? PARSERUTILS_INVALID
+					     : PARSERUTILS_NEEDDATA;
+		}
+
+		/* U+FFFE and U+FFFF */
+		if (c == 0xEF && s[off + 1] == 0xBF && s[off + 2] >= 0xBE)
+			break;
+
+		off += n;
+	}
+
+	*valid = off;
+
+	return off == len ? PARSERUTILS_OK : PARSERUTILS_INVALID;
+}
+
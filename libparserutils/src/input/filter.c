@@ -17,6 +17,7 @@
 #include <parserutils/charset/mibenum.h>
 #include <parserutils/charset/codec.h>
 
+#include "charset/codecs/codec_impl.h"
 #include "input/filter.h"
 #include "utils/utils.h"
 
@@ -28,6 +29,7 @@ struct parserutils_filter {
 #else
 	parserutils_charset_codec *read_codec;	/**< Read codec */
 	parserutils_charset_codec *write_codec;	/**< Write codec */
+	uint16_t utf8;			/**< MIB enum for UTF-8 */
 
 	uint32_t pivot_buf[64];		/**< Conversion pivot buffer */
 
@@ -82,6 +84,8 @@ parserutils_error parserutils__filter_create(const char *int_enc,
 		return PARSERUTILS_BADENCODING;
 	}
 #else
+	f->utf8 = parserutils_charset_mibenum_from_name("UTF-8",
+			SLEN("UTF-8"));
 	f->leftover = false;
 	f->pivot_left = NULL;
 	f->pivot_len = 0;
@@ -264,6 +268,16 @@ parserutils_error parserutils__filter_process_chunk(parserutils_filter *input,
 		input->leftover = false;
 	}
 
+	/* Single-byte charsets can be decoded straight into UTF-8,
+	 * without going through UCS-4.  Builds using iconv don't do this,
+	 * as iconv's stateful converters (e.g. for Windows-1258) produce
+	 * output the codec tables can't */
+	if (input->read_codec->handler.decode_utf8 != NULL &&
+			input->write_codec->mibenum == input->utf8) {
+		return input->read_codec->handler.decode_utf8(
+				input->read_codec, data, len, output, outlen);
+	}
+
 	while (*len > 0) {
 		parserutils_error read_error, write_error;
 		size_t pivot_len = sizeof(input->pivot_buf);
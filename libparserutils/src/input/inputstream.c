@@ -30,6 +30,9 @@ typedef struct parserutils_inputstream_private {
 	uint16_t mibenum;		/**< MIB enum for charset, or 0 */
 	uint32_t encsrc;		/**< Charset source */
 
+	bool passthrough;		/**< Whether valid input is used
+					 * without conversion */
+
 	parserutils_filter *input;	/**< Charset conversion filter */
 
 	parserutils_charset_detect_func csdetect; /**< Charset detection func.*/
@@ -92,6 +95,7 @@ parserutils_error parserutils_inputstream_create(const char *enc,
 	s->public.cursor = 0;
 	s->public.had_eof = false;
 	s->done_first_chunk = false;
+	s->passthrough = false;
 
 	error = parserutils__filter_create("UTF-8", alloc, pw, &s->input);
 	if (error != PARSERUTILS_OK) {
@@ -371,7 +375,7 @@ parserutils_error parserutils_inputstream_refill_buffer(
 {
 	const uint8_t *raw;
 	uint8_t *utf8;
-	size_t raw_length, utf8_space;
+	size_t raw_length, utf8_space, valid = 0;
 	parserutils_error error;
 
 	/* If this is the first chunk of data, we must detect the charset and
@@ -435,9 +439,44 @@ parserutils_error parserutils_inputstream_refill_buffer(
 		if (error != PARSERUTILS_OK)
 			return error;
 
+		/* UTF-8 input needs no conversion, as long as it's valid */
+		stream->passthrough = (stream->mibenum ==
+			parserutils_charset_mibenum_from_name("UTF-8",
+				SLEN("UTF-8")));
+
 		stream->done_first_chunk = true;
 	}
 
+	if (stream->passthrough) {
+		error = parserutils_charset_utf8_validate(stream->raw->data,
+				stream->raw->length, &valid);
+
+		if (error == PARSERUTILS_OK &&
+				stream->public.cursor ==
+				stream->public.utf8->length) {
+			/* Everything has been read from the utf8 buffer and
+			 * all the raw data is valid, so simply swap the
+			 * buffers over rather than copying the data */
+			parserutils_buffer *temp = stream->public.utf8;
+
+			stream->public.utf8 = stream->raw;
+			stream->public.cursor = 0;
+
+			stream->raw = temp;
+			stream->raw->length = 0;
+
+			return PARSERUTILS_OK;
+		}
+
+		if (valid == 0 && (error == PARSERUTILS_INVALID ||
+				stream->public.had_eof)) {
+			/* Leave the invalid sequence, or the incomplete one
+			 * at EOF, to the filter. It may keep state between
+			 * calls, so use it for the rest of the input. */
+			stream->passthrough = false;
+		}
+	}
+
 	/* Work out how to perform the buffer fill */
 	if (stream->public.cursor == stream->public.utf8->length) {
 		/* Cursor's at the end, so simply reuse the entire buffer */
@@ -468,13 +507,41 @@ parserutils_error parserutils_inputstream_refill_buffer(
 	raw = stream->raw->data;
 	raw_length = stream->raw->length;
 
-	/* Try to fill utf8 buffer from the raw data */
-	error = parserutils__filter_process_chunk(stream->input, 
-			&raw, &raw_length, &utf8, &utf8_space);
-	/* _NOMEM implies that there's more input to read than available space
-	 * in the utf8 buffer. That's fine, so we'll ignore that error. */
-	if (error != PARSERUTILS_OK && error != PARSERUTILS_NOMEM)
-		return error;
+	if (stream->passthrough) {
+		/* Copy as much of the valid data as will fit, without
+		 * splitting a character */
+		if (valid > utf8_space) {
+			uint32_t prev;
+			size_t clen;
+
+			error = parserutils_charset_utf8_prev(raw, utf8_space,
+					&prev);
+			if (error != PARSERUTILS_OK)
+				return error;
+
+			error = parserutils_charset_utf8_char_byte_length(
+					raw + prev, &clen);
+			if (error != PARSERUTILS_OK)
+				return error;
+
+			valid = (prev + clen > utf8_space) ? prev : utf8_space;
+		}
+
+		memcpy(utf8, raw, valid);
+
+		utf8_space -= valid;
+		raw += valid;
+		raw_length -= valid;
+	} else {
+		/* Try to fill utf8 buffer from the raw data */
+		error = parserutils__filter_process_chunk(stream->input, 
+				&raw, &raw_length, &utf8, &utf8_space);
+		/* _NOMEM implies that there's more input to read than
+		 * available space in the utf8 buffer. That's fine, so
+		 * we'll ignore that error. */
+		if (error != PARSERUTILS_OK && error != PARSERUTILS_NOMEM)
+			return error;
+	}
 
 	/* Remove the raw data we've processed from the raw buffer */
 	error = parserutils_buffer_discard(stream->raw, 0, 
@@ -0,0 +1,58 @@
+/*
+ * This file is part of LibParserUtils.
+ * Licensed under the MIT License,
+ *                http://www.opensource.org/licenses/mit-license.php
+ * Copyright 2012 John-Mark Bell <jmb@netsurf-browser.org>
+ */
+
+#ifndef parserutils_ascii_h_
+#define parserutils_ascii_h_
+
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * Find the length of the run of ASCII octets at the start of a buffer
+ *
+ * Where the compiler targets SSE2, 16 octets are tested at once.
+ * Otherwise, 8 octets are tested at once in a 64-bit word.
+ *
+ * \param s    The buffer to scan
+ * \param len  Length of buffer, in bytes
+ * \return Offset of the first non-ASCII octet, or len if there is none
+ */
+static inline size_t parserutils__ascii_span(const uint8_t *s, size_t len)
+{
+	size_t off = 0;
+
+#ifdef __SSE2__
+	for (; len - off >= 16; off += 16) {
+		__m128i block = _mm_loadu_si128(
+				(const __m128i *) (const void *) (s + off));
+
+		if (_mm_movemask_epi8(block) != 0)
+			break;
+	}
+#endif
+
+	for (; len - off >= 8; off += 8) {
+		uint64_t word;
+
+		memcpy(&word, s + off, sizeof(word));
+
+		if ((word & UINT64_C(0x8080808080808080)) != 0)
+			break;
+	}
+
+	while (off < len && s[off] < 0x80)
+		off++;
+
+	return off;
+}
+
+#endif
@@ -0,0 +1,226 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <parserutils/charset/codec.h>
+
+#include "utils/utils.h"
+
+#include "charset/codecs/codec_impl.h"
+
+#include "testutils.h"
+
+/* Size of generated input for each charset */
+#define INPUT_LEN (1024 * 1024)
+
+/* Proportion of non-ASCII bytes in generated input, in percent */
+#define HIGH_PERCENT 15
+
+static const char *charsets[] = {
+	"US-ASCII",
+	"ISO-8859-1", "ISO-8859-2", "ISO-8859-3", "ISO-8859-4",
+	"ISO-8859-5", "ISO-8859-6", "ISO-8859-7", "ISO-8859-8",
+	"ISO-8859-9", "ISO-8859-10", "ISO-8859-11", "ISO-8859-13",
+	"ISO-8859-14", "ISO-8859-15", "ISO-8859-16",
+	"Windows-1250", "Windows-1251", "Windows-1252", "Windows-1253",
+	"Windows-1254", "Windows-1255", "Windows-1256", "Windows-1257",
+	"Windows-1258"
+};
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+static double elapsed(clock_t start)
+{
+	return (double) (clock() - start) / CLOCKS_PER_SEC;
+}
+
+static double mbps(size_t len, double secs)
+{
+	if (secs <= 0)
+		return 0;
+
+	return len / secs / (1024 * 1024);
+}
+
+/* Decode via UCS-4 and re-encode as UTF-8, as the generic filter does */
+static size_t decode_pivot(parserutils_charset_codec *codec,
+		parserutils_charset_codec *utf8,
+		const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen)
+{
+	uint8_t pivot[4096];
+	uint8_t *o = out;
+
+	while (inlen > 0) {
+		uint8_t *p = pivot;
+		size_t plen = sizeof(pivot);
+		const uint8_t *pp = pivot;
+		parserutils_error error;
+
+		error = parserutils_charset_codec_decode(codec,
+				&in, &inlen, &p, &plen);
+		assert(error == PARSERUTILS_OK || error == PARSERUTILS_NOMEM);
+
+		plen = p - pivot;
+		assert(parserutils_charset_codec_encode(utf8, &pp, &plen,
+				&o, &outlen) == PARSERUTILS_OK);
+	}
+
+	return o - out;
+}
+
+/* Decode directly into UTF-8, using output chunks of random size */
+static size_t decode_direct(parserutils_charset_codec *codec,
+		const uint8_t *in, size_t inlen, uint8_t *out, size_t outlen,
+		bool chunked)
+{
+	uint8_t *o = out;
+
+	while (inlen > 0) {
+		/* Always room for at least one character */
+		size_t chunk = chunked ? (size_t) (3 + rand() % 14) : outlen;
+		size_t left = chunk;
+		parserutils_error error;
+
+		if (chunk > outlen)
+			chunk = left = outlen;
+
+		error = codec->handler.decode_utf8(codec,
+				&in, &inlen, &o, &left);
+		assert(error == PARSERUTILS_OK || error == PARSERUTILS_NOMEM);
+
+		outlen -= chunk - left;
+	}
+
+	return o - out;
+}
+
+static void test_strict(parserutils_charset_codec *codec,
+		const uint8_t *in, size_t inlen, const uint8_t *exp,
+		uint8_t *out, size_t outlen)
+{
+	parserutils_charset_codec_optparams params;
+	const uint8_t *src = in;
+	size_t srclen = inlen;
+	uint8_t *o = out;
+	parserutils_error error;
+
+	params.error_mode.mode = PARSERUTILS_CHARSET_CODEC_ERROR_STRICT;
+	assert(parserutils_charset_codec_setopt(codec,
+			PARSERUTILS_CHARSET_CODEC_ERROR_MODE,
+			&params) == PARSERUTILS_OK);
+
+	error = codec->handler.decode_utf8(codec, &src, &srclen, &o, &outlen);
+
+	/* Output up to the failure point must be identical */
+	assert(memcmp(out, exp, o - out) == 0);
+
+	if (error == PARSERUTILS_INVALID) {
+		/* And the codec must also reject the offending byte */
+		uint32_t ucs4;
+		uint8_t *u = (uint8_t *) &ucs4;
+		size_t ulen = sizeof(ucs4);
+		size_t blen = 1;
+
+		assert(srclen > 0);
+		assert(parserutils_charset_codec_decode(codec, &src, &blen,
+				&u, &ulen) == PARSERUTILS_INVALID);
+	} else {
+		assert(error == PARSERUTILS_OK);
+		assert(srclen == 0);
+	}
+
+	params.error_mode.mode = PARSERUTILS_CHARSET_CODEC_ERROR_LOOSE;
+	assert(parserutils_charset_codec_setopt(codec,
+			PARSERUTILS_CHARSET_CODEC_ERROR_MODE,
+			&params) == PARSERUTILS_OK);
+}
+
+int main(int argc, char **argv)
+{
+	parserutils_charset_codec *utf8;
+	uint8_t *in, *exp, *out;
+	size_t explen, outlen, i, c;
+	size_t total = 0;
+	double pivot_time = 0, direct_time = 0;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	in = malloc(INPUT_LEN);
+	exp = malloc(3 * INPUT_LEN);
+	out = malloc(3 * INPUT_LEN);
+	assert(in != NULL && exp != NULL && out != NULL);
+
+	srand(0);
+
+	for (i = 0; i < INPUT_LEN; i++) {
+		if (rand() % 100 < HIGH_PERCENT)
+			in[i] = 0x80 + rand() % 0x80;
+		else
+			in[i] = 0x20 + rand() % 0x5F;
+	}
+
+	assert(parserutils_charset_codec_create("UTF-8", myrealloc, NULL,
+			&utf8) == PARSERUTILS_OK);
+
+	for (c = 0; c < N_ELEMENTS(charsets); c++) {
+		parserutils_charset_codec *codec;
+		clock_t start;
+		double t_pivot, t_direct;
+
+		assert(parserutils_charset_codec_create(charsets[c],
+				myrealloc, NULL, &codec) == PARSERUTILS_OK);
+		assert(codec->handler.decode_utf8 != NULL);
+
+		start = clock();
+		explen = decode_pivot(codec, utf8, in, INPUT_LEN,
+				exp, 3 * INPUT_LEN);
+		t_pivot = elapsed(start);
+
+		start = clock();
+		outlen = decode_direct(codec, in, INPUT_LEN,
+				out, 3 * INPUT_LEN, false);
+		t_direct = elapsed(start);
+
+		assert(outlen == explen);
+		assert(memcmp(out, exp, explen) == 0);
+
+		/* Resumption after running out of output space */
+		outlen = decode_direct(codec, in, 64 * 1024,
+				out, 3 * INPUT_LEN, true);
+		assert(outlen <= explen);
+		assert(memcmp(out, exp, outlen) == 0);
+
+		test_strict(codec, in, INPUT_LEN, exp, out, 3 * INPUT_LEN);
+
+		printf("%-13s pivot: %8.1f MB/s  direct: %8.1f MB/s\n",
+				charsets[c], mbps(INPUT_LEN, t_pivot),
+				mbps(INPUT_LEN, t_direct));
+
+		total += INPUT_LEN;
+		pivot_time += t_pivot;
+		direct_time += t_direct;
+
+		parserutils_charset_codec_destroy(codec);
+	}
+
+	printf("%-13s pivot: %8.1f MB/s  direct: %8.1f MB/s\n", "Total",
+			mbps(total, pivot_time), mbps(total, direct_time));
+
+	parserutils_charset_codec_destroy(utf8);
+
+	free(out);
+	free(exp);
+	free(in);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -26,6 +26,7 @@ int main(int argc, char **argv)
 	size_t inlen, outlen;
 	const uint8_t *in = inbuf;
 	uint8_t *out = outbuf;
+	int i;
 
 	UNUSED(argc);
 	UNUSED(argv);
@@ -340,6 +341,115 @@ int main(int argc, char **argv)
 			SLEN("hell\xe2\x80\xa2o!")) == 0);
 
 
+	/* Single-byte input encoding, decoded straight into UTF-8 */
+	params.encoding.name = "Windows-1252";
+	assert(parserutils__filter_setopt(input, PARSERUTILS_FILTER_SET_ENCODING,
+			(parserutils_filter_optparams *) &params) ==
+			PARSERUTILS_OK);
+
+	in = inbuf;
+	out = outbuf;
+	strcpy((char *) inbuf, "hell\x80\xa0o!");
+	inlen = strlen((const char *) inbuf);
+	outbuf[0] = '\0';
+	outlen = 6;
+
+	assert(parserutils__filter_process_chunk(input, &in, &inlen,
+			&out, &outlen) == PARSERUTILS_NOMEM);
+
+	printf("'%.*s' %d '%.*s' %d\n", (int) inlen, in, (int) inlen,
+			(int) (out - ((uint8_t *) outbuf)),
+			outbuf, (int) outlen);
+
+	outlen = 64 - 6 + outlen;
+
+	assert(parserutils__filter_process_chunk(input, &in, &inlen,
+			&out, &outlen) == PARSERUTILS_OK);
+
+	printf("'%.*s' %d '%.*s' %d\n", (int) inlen, in, (int) inlen,
+			(int) (out - ((uint8_t *) outbuf)),
+			outbuf, (int) outlen);
+
+	assert(parserutils__filter_reset(input) == PARSERUTILS_OK);
+
+	assert(memcmp(outbuf, "hell\xe2\x82\xac\xc2\xa0o!",
+			SLEN("hell\xe2\x82\xac\xc2\xa0o!")) == 0);
+
+
+	/* C1 controls in ISO-8859-n map to U+0080-U+009F, as with iconv */
+	params.encoding.name = "ISO-8859-1";
+	for (i = 0; i < 2; i++) {
+		size_t j;
+
+		assert(parserutils__filter_setopt(input,
+				PARSERUTILS_FILTER_SET_ENCODING,
+				(parserutils_filter_optparams *) &params) ==
+				PARSERUTILS_OK);
+
+		in = inbuf;
+		out = outbuf;
+		for (j = 0; j < 32; j++)
+			inbuf[j] = 0x80 + j;
+		inlen = 32;
+		outlen = 64;
+
+		assert(parserutils__filter_process_chunk(input, &in, &inlen,
+				&out, &outlen) == PARSERUTILS_OK);
+		assert(inlen == 0 && outlen == 0);
+
+		for (j = 0; j < 32; j++) {
+			assert(outbuf[j * 2] == 0xc2 &&
+					outbuf[j * 2 + 1] == 0x80 + j);
+		}
+
+		in = inbuf;
+		out = outbuf;
+		strcpy((char *) inbuf, "A\x80" "B\x81" "C");
+		inlen = strlen((const char *) inbuf);
+		outlen = 64;
+
+		assert(parserutils__filter_process_chunk(input, &in, &inlen,
+				&out, &outlen) == PARSERUTILS_OK);
+
+		printf("'%.*s' %d '%.*s' %d\n", (int) inlen, in, (int) inlen,
+				(int) (out - ((uint8_t *) outbuf)),
+				outbuf, (int) outlen);
+
+		assert(parserutils__filter_reset(input) == PARSERUTILS_OK);
+
+		assert(out - outbuf == 7 && memcmp(outbuf,
+				"A\xc2\x80" "B\xc2\x81" "C", 7) == 0);
+
+		params.encoding.name = "ISO-8859-2";
+	}
+
+
+	/* And back to UTF-8 */
+	params.encoding.name = "UTF-8";
+	assert(parserutils__filter_setopt(input, PARSERUTILS_FILTER_SET_ENCODING,
+			(parserutils_filter_optparams *) &params) ==
+			PARSERUTILS_OK);
+
+	in = inbuf;
+	out = outbuf;
+	strcpy((char *) inbuf, "hell\xc2\xa0o!");
+	inlen = strlen((const char *) inbuf);
+	outbuf[0] = '\0';
+	outlen = 64;
+
+	assert(parserutils__filter_process_chunk(input, &in, &inlen,
+			&out, &outlen) == PARSERUTILS_OK);
+
+	printf("'%.*s' %d '%.*s' %d\n", (int) inlen, in, (int) inlen,
+			(int) (out - ((uint8_t *) outbuf)),
+			outbuf, (int) outlen);
+
+	assert(parserutils__filter_reset(input) == PARSERUTILS_OK);
+
+	assert(memcmp(outbuf, "hell\xc2\xa0o!",
+			SLEN("hell\xc2\xa0o!")) == 0);
+
+
 	/* Clean up */
 	parserutils__filter_destroy(input);
 
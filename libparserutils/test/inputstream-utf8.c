@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/parserutils.h>
+#include <parserutils/input/inputstream.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+static void *myrealloc(void *ptr, size_t len, void *pw)
+{
+	UNUSED(pw);
+
+	return realloc(ptr, len);
+}
+
+/**
+ * Append data to a stream and read characters until more data is needed
+ *
+ * \param stream  Stream to use
+ * \param data    Data to append, or NULL to mark EOF
+ * \param len     Length of data
+ * \param expect  Expected UTF-8 to be read from the stream
+ * \return Error which ended the read
+ */
+static parserutils_error append_and_read(parserutils_inputstream *stream,
+		const char *data, size_t len, const char *expect)
+{
+	parserutils_error error;
+	const uint8_t *c;
+	size_t clen, read = 0;
+	char buf[64];
+
+	assert(parserutils_inputstream_append(stream, (const uint8_t *) data,
+			len) == PARSERUTILS_OK);
+
+	while ((error = parserutils_inputstream_peek(stream, 0, &c, &clen)) ==
+			PARSERUTILS_OK) {
+		assert(read + clen <= sizeof(buf));
+		memcpy(buf + read, c, clen);
+		read += clen;
+
+		parserutils_inputstream_advance(stream, clen);
+	}
+
+	if (read != strlen(expect) || memcmp(buf, expect, read) != 0) {
+		printf("FAIL - read %u bytes, expected '%s'\n",
+				(unsigned) read, expect);
+		exit(EXIT_FAILURE);
+	}
+
+	return error;
+}
+
+#define APPEND(s) (s), SLEN(s)
+
+static void test_swap(void)
+{
+	parserutils_inputstream *stream;
+	parserutils_buffer *first, *second;
+	const uint8_t *c;
+	size_t clen;
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	/* Valid data with nothing unread is taken over wholesale */
+	first = stream->utf8;
+	assert(append_and_read(stream, APPEND("a\xc2\xa9\xe2\x82\xac"),
+			"a\xc2\xa9\xe2\x82\xac") == PARSERUTILS_NEEDDATA);
+	second = stream->utf8;
+	assert(second != first);
+
+	/* And again, swapping back */
+	assert(append_and_read(stream, APPEND("\xf0\x9f\x98\x80z"),
+			"\xf0\x9f\x98\x80z") == PARSERUTILS_NEEDDATA);
+	assert(stream->utf8 == first);
+
+	assert(parserutils_inputstream_append(stream,
+			APPEND("bc")) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_peek(stream, 0, &c, &clen) ==
+			PARSERUTILS_OK);
+	assert(stream->utf8 == second);
+	assert(clen == 1 && c[0] == 'b');
+
+	/* Data left unread must be copied instead */
+	assert(parserutils_inputstream_append(stream,
+			APPEND("\xc2\xa9")) == PARSERUTILS_OK);
+	assert(parserutils_inputstream_peek(stream, 2, &c, &clen) ==
+			PARSERUTILS_OK);
+	assert(stream->utf8 == second);
+	assert(clen == 2 && memcmp(c, "\xc2\xa9", 2) == 0);
+
+	assert(append_and_read(stream, NULL, 0, "bc\xc2\xa9") ==
+			PARSERUTILS_EOF);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+static void test_split(void)
+{
+	parserutils_inputstream *stream;
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	/* Characters split between chunks are held back until complete */
+	assert(append_and_read(stream, APPEND("a\xf0"), "a") ==
+			PARSERUTILS_NEEDDATA);
+	assert(append_and_read(stream, APPEND("\x9f\x98"), "") ==
+			PARSERUTILS_NEEDDATA);
+	assert(append_and_read(stream, APPEND("\x80" "b\xe2"),
+			"\xf0\x9f\x98\x80" "b") == PARSERUTILS_NEEDDATA);
+	assert(append_and_read(stream, APPEND("\x82\xac"),
+			"\xe2\x82\xac") == PARSERUTILS_NEEDDATA);
+	assert(append_and_read(stream, NULL, 0, "") == PARSERUTILS_EOF);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+static void test_invalid(void)
+{
+	parserutils_inputstream *stream;
+
+	assert(parserutils_inputstream_create("UTF-8", 1, NULL,
+			myrealloc, NULL, &stream) == PARSERUTILS_OK);
+
+	assert(append_and_read(stream, APPEND("ab"), "ab") ==
+			PARSERUTILS_NEEDDATA);
+
+	/* Invalid bytes mid-stream are replaced by the filter, and it
+	 * handles everything after them */
+	assert(append_and_read(stream, APPEND("c\x80" "d\xc2"),
+			"c\xef\xbf\xbd" "d") == PARSERUTILS_NEEDDATA);
+	assert(append_and_read(stream, APPEND("\xa9\x80" "e"),
+			"\xc2\xa9\xef\xbf\xbd" "e") == PARSERUTILS_NEEDDATA);
+	assert(append_and_read(stream, APPEND("\xe2\x82\xac"),
+			"\xe2\x82\xac") == PARSERUTILS_NEEDDATA);
+	assert(append_and_read(stream, NULL, 0, "") == PARSERUTILS_EOF);
+
+	parserutils_inputstream_destroy(stream);
+}
+
+int main(int argc, char **argv)
+{
+	UNUSED(argc);
+	UNUSED(argv);
+
+	test_swap();
+	test_split();
+	test_invalid();
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <parserutils/charset/utf8.h>
+
+#include "utils/utils.h"
+
+#include "testutils.h"
+
+typedef struct testcase {
+	const char *data;
+	size_t len;
+	parserutils_error error;
+	size_t valid;
+} testcase;
+
+#define T(s, e, v) { s, SLEN(s), PARSERUTILS_##e, v }
+
+static const testcase tests[] = {
+	T("", OK, 0),
+	T("abc", OK, 3),
+	T("a\xc2\xa9\xe2\x82\xac\xf0\x9f\x98\x80z", OK, 11),
+
+	/* Boundaries of each sequence length */
+	T("\xc2\x80\xdf\xbf", OK, 4),
+	T("\xe0\xa0\x80\xef\xbf\xbd", OK, 6),
+	T("\xf0\x90\x80\x80\xf4\x8f\xbf\xbf", OK, 8),
+
+	/* Overlong encodings */
+	T("\xc0\xaf", INVALID, 0),
+	T("a\xc1\xbf", INVALID, 1),
+	T("ab\xe0\x80\xaf", INVALID, 2),
+	T("\xe0\x9f\xbf", INVALID, 0),
+	T("\xf0\x80\x80\xaf", INVALID, 0),
+	T("\xf0\x8f\xbf\xbf", INVALID, 0),
+
+	/* UTF-16 surrogates */
+	T("\xed\x9f\xbf", OK, 3),
+	T("\xed\xa0\x80", INVALID, 0),
+	T("a\xed\xbf\xbf", INVALID, 1),
+
+	/* Above U+10FFFF, including the old 5 and 6 byte forms */
+	T("\xf4\x90\x80\x80", INVALID, 0),
+	T("\xf5\x80\x80\x80", INVALID, 0),
+	T("\xf8\x88\x80\x80\x80", INVALID, 0),
+	T("\xfc\x84\x80\x80\x80\x80", INVALID, 0),
+
+	/* Non-characters U+FFFE and U+FFFF */
+	T("\xef\xbf\xbe", INVALID, 0),
+	T("a\xef\xbf\xbf", INVALID, 1),
+
+	/* Bytes which can never appear */
+	T("ab\x80", INVALID, 2),
+	T("\xfe", INVALID, 0),
+	T("\xff", INVALID, 0),
+
+	/* Sequences broken before their end */
+	T("\xc2" "a", INVALID, 0),
+	T("a\xe2\x82" "b", INVALID, 1),
+	T("\xf0\x9f\x98\xc2\xa9", INVALID, 0),
+
+	/* Sequences truncated by the end of the data */
+	T("\xc2", NEEDDATA, 0),
+	T("ab\xe2\x82", NEEDDATA, 2),
+	T("\xc2\xa9\xf0", NEEDDATA, 2),
+	T("\xc2\xa9\xf0\x9f\x98", NEEDDATA, 2),
+
+	/* Truncated sequences which are already invalid */
+	T("\xe0\x80", INVALID, 0),
+	T("\xed\xa0", INVALID, 0),
+	T("\xf4\x90", INVALID, 0),
+
+	{ NULL, 0, PARSERUTILS_OK, 0 }
+};
+
+#undef T
+
+static void check(const uint8_t *data, size_t len,
+		parserutils_error error, size_t valid)
+{
+	parserutils_error perror;
+	size_t pvalid = (size_t) -1;
+
+	perror = parserutils_charset_utf8_validate(data, len, &pvalid);
+	if (perror != error || pvalid != valid) {
+		printf("FAIL - validating %u bytes: got %d/%u, "
+				"expected %d/%u\n", (unsigned) len,
+				perror, (unsigned) pvalid,
+				error, (unsigned) valid);
+		exit(EXIT_FAILURE);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	/* Mixture of sequence lengths */
+	const uint8_t mixed[] = "a\xc2\xa9" "b\xe2\x82\xac" "c\xf0\x9f\x98\x80";
+	/* Offsets in mixed at which characters start */
+	const size_t starts[] = { 0, 1, 3, 4, 7, 8, 12 };
+	uint8_t buf[80];
+	const testcase *t;
+	size_t split, i, valid;
+
+	UNUSED(argc);
+	UNUSED(argv);
+
+	for (t = tests; t->data != NULL; t++) {
+		check((const uint8_t *) t->data, t->len, t->error, t->valid);
+	}
+
+	/* Split the data at every offset, as a chunked reader would, and
+	 * ensure each part validates up to the last complete character and
+	 * the remainder from there on */
+	for (split = 0; split <= SLEN(mixed); split++) {
+		size_t boundary = 0;
+
+		for (i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+			if (starts[i] <= split)
+				boundary = starts[i];
+		}
+
+		check(mixed, split,
+				boundary == split ? PARSERUTILS_OK
+						: PARSERUTILS_NEEDDATA,
+				boundary);
+
+		check(mixed + boundary, SLEN(mixed) - boundary,
+				PARSERUTILS_OK, SLEN(mixed) - boundary);
+	}
+
+	/* Errors after long runs of ASCII are reported at the right offset */
+	for (i = 0; i < sizeof(buf) - 4; i++) {
+		memset(buf, 'a', sizeof(buf));
+
+		memcpy(buf + i, "\xe2\x82\xac", 3);
+		check(buf, sizeof(buf), PARSERUTILS_OK, sizeof(buf));
+
+		buf[i + 1] = 'a';
+		check(buf, sizeof(buf), PARSERUTILS_INVALID, i);
+
+		buf[i] = 0x80;
+		check(buf, sizeof(buf), PARSERUTILS_INVALID, i);
+
+		check(buf, i + 1, PARSERUTILS_INVALID, i);
+
+		buf[i] = 0xe2;
+		check(buf, i + 1, PARSERUTILS_NEEDDATA, i);
+	}
+
+	assert(parserutils_charset_utf8_validate(NULL, 1, &valid) ==
+			PARSERUTILS_BADPARM);
+	assert(parserutils_charset_utf8_validate(mixed, 1, NULL) ==
+			PARSERUTILS_BADPARM);
+
+	printf("PASS\n");
+
+	return 0;
+}
@@ -88,6 +88,27 @@ typedef enum lwc_error_e {
 extern lwc_error lwc_intern_string(const char *s, size_t slen,
                                    lwc_string **ret);
 
+/**
+ * Look up a string which may already be interned.
+ *
+ * Unlike the other functions here, this may be called from any thread,
+ * while one other thread interns and releases strings.  It never adds a
+ * string.
+ *
+ * @param s    Pointer to the start of the string to look up.
+ * @param slen Length of the string in characters. (Not including any
+ *	       terminators)
+ * @param ret  Pointer to ::lwc_string pointer to fill out, or set to NULL
+ *	       if the string isn't interned.
+ * @return     Result of operation.
+ *
+ * @note No reference is taken on the string found.  It may only be used
+ *	 while something else is known to hold a reference to it; for
+ *	 instance, to compare it with strings the caller holds.
+ */
+extern lwc_error lwc_lookup_string(const char *s, size_t slen,
+                                   lwc_string **ret);
+
 /**
  * Intern a substring.
  *
@@ -0,0 +1,175 @@
+/* perf/stress.c
+ *
+ * Stress test and benchmark for libwapcaplet
+ *
+ * Copyright 2012 The NetSurf Browser Project
+ */
+
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+#include <libwapcaplet/libwapcaplet.h>
+
+/* Default number of distinct strings */
+#define NR_STRINGS (2000000)
+
+/* Default number of threads looking strings up */
+#define NR_READERS (3)
+
+static unsigned int nr_strings = NR_STRINGS;
+static lwc_string **strings;
+static int writing;
+
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t
+make_string(char *buf, const char *prefix, unsigned int n)
+{
+	/* Similar to the identifiers and URL parts found in documents */
+	return sprintf(buf, "%s-%x-%u", prefix, n * 2654435761u, n);
+}
+
+static void
+report(const char *what, unsigned long count, double start)
+{
+	double t = now() - start;
+
+	printf("%-32s %10lu in %6.3fs: %11.0f/s\n", what, count, t,
+			count / t);
+}
+
+/* Repeatedly look up the first half of the strings, which are never
+ * released, checking they are always found */
+static void *
+reader(void *pw)
+{
+	unsigned long *count = pw;
+	unsigned int seed = (unsigned int) (uintptr_t) pw;
+	lwc_string *str;
+	char buf[64];
+	size_t len;
+	unsigned int n;
+
+	while (__atomic_load_n(&writing, __ATOMIC_RELAXED)) {
+		n = rand_r(&seed) % (nr_strings / 2);
+		len = make_string(buf, "held", n);
+
+		if (lwc_lookup_string(buf, len, &str) != lwc_error_ok ||
+				str != strings[n]) {
+			fprintf(stderr, "lookup of '%s' failed\n", buf);
+			abort();
+		}
+
+		(*count)++;
+	}
+
+	return NULL;
+}
+
+int
+main(int argc, char **argv)
+{
+	pthread_t threads[16];
+	unsigned long counts[16];
+	unsigned long total;
+	unsigned int nr_readers = NR_READERS;
+	unsigned int i;
+	lwc_string *str;
+	char buf[64];
+	size_t len;
+	double start;
+	struct rusage usage;
+
+	if (argc > 1)
+		nr_strings = strtoul(argv[1], NULL, 0);
+	if (argc > 2)
+		nr_readers = strtoul(argv[2], NULL, 0);
+	if (nr_strings < 2 || nr_readers > 16) {
+		fprintf(stderr, "Usage: %s [strings [readers]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	strings = malloc(sizeof(lwc_string *) * nr_strings);
+	if (strings == NULL)
+		return EXIT_FAILURE;
+
+	/* Intern distinct strings, growing the table from empty */
+	start = now();
+	for (i = 0; i < nr_strings; i++) {
+		len = make_string(buf, i < nr_strings / 2 ? "held" : "temp", i);
+		if (lwc_intern_string(buf, len, &strings[i]) != lwc_error_ok)
+			return EXIT_FAILURE;
+	}
+	report("intern new", nr_strings, start);
+
+	/* Intern them again, finding each in the table */
+	start = now();
+	for (i = 0; i < nr_strings; i++) {
+		len = make_string(buf, i < nr_strings / 2 ? "held" : "temp", i);
+		if (lwc_intern_string(buf, len, &str) != lwc_error_ok)
+			return EXIT_FAILURE;
+		assert(str == strings[i]);
+		lwc_string_unref(str);
+	}
+	report("intern existing", nr_strings, start);
+
+	/* Look them up while another thread replaces the second half with
+	 * new strings, growing the table further */
+	__atomic_store_n(&writing, 1, __ATOMIC_RELAXED);
+	for (i = 0; i < nr_readers; i++) {
+		counts[i] = 0;
+		if (pthread_create(&threads[i], NULL, reader, &counts[i]) != 0)
+			return EXIT_FAILURE;
+	}
+
+	start = now();
+	for (i = nr_strings / 2; i < nr_strings; i++) {
+		lwc_string_unref(strings[i]);
+
+		len = make_string(buf, "more", i);
+		if (lwc_intern_string(buf, len, &strings[i]) != lwc_error_ok)
+			return EXIT_FAILURE;
+		len = make_string(buf, "most", i);
+		if (lwc_intern_string(buf, len, &str) != lwc_error_ok)
+			return EXIT_FAILURE;
+		lwc_string_unref(str);
+	}
+	__atomic_store_n(&writing, 0, __ATOMIC_RELAXED);
+	report("replace while reading", nr_strings - nr_strings / 2, start);
+
+	total = 0;
+	for (i = 0; i < nr_readers; i++) {
+		pthread_join(threads[i], NULL);
+		total += counts[i];
+	}
+	report("concurrent lookups", total, start);
+
+	/* Strings released while readers were busy must not pile up */
+	if (getrusage(RUSAGE_SELF, &usage) == 0)
+		printf("%-32s %10ld KiB\n", "peak memory", usage.ru_maxrss);
+
+	/* Release everything */
+	start = now();
+	for (i = 0; i < nr_strings; i++)
+		lwc_string_unref(strings[i]);
+	report("release", nr_strings, start);
+
+	free(strings);
+
+	return EXIT_SUCCESS;
+}
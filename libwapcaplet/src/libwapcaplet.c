@@ -34,11 +34,77 @@ lwc__calculate_hash(const char *str, size_t len)
 #define STR_OF(str) ((char *)(str + 1))
 #define CSTR_OF(str) ((const char *)(str + 1))
 
-#define NR_BUCKETS_DEFAULT	(4091)
+/* Must be a power of two */
+#define NR_BUCKETS_DEFAULT	(4096)
+
+/* Number of buckets moved to a grown table each time a string is added */
+#define NR_BUCKETS_MIGRATE	(4)
+
+/* Number of reader counts, and their spacing to keep them in separate
+ * cache lines */
+#define NR_READER_SLOTS		(8)
+#define READER_SLOT_SPACING	(64 / sizeof(unsigned int))
+
+/* Number of strings unlinked between checks for readers */
+#define NR_RETIRED_MAX		(64)
+
+/*
+ * Threading
+ *
+ * One thread (the writer) may intern, destroy and iterate strings, while
+ * any number of others look strings up with lwc_lookup_string().  Readers
+ * only follow bucket and chain pointers, so the writer publishes every
+ * change to them with a release store.  Readers announce themselves in
+ * one of the context's reader counts, chosen by hash value so that
+ * readers on different threads rarely share one.
+ *
+ * Strings and tables which the writer unlinks are put on a list, as
+ * readers may still be looking at them.  Reader counts come in two sets,
+ * and readers use the set selected by the context's epoch.  To reclaim,
+ * the writer moves the list aside and advances the epoch, so that new
+ * readers use the other set.  Once the old set's counts reach zero, no
+ * reader can see anything on the list moved aside, and it is freed.
+ * Readers arriving meanwhile don't hold this up, so memory is reclaimed
+ * however busy the readers are.
+ *
+ * Moving strings to a grown table could send a reader down the wrong
+ * chain, so the writer makes the context's sequence number odd while it
+ * does so.  A reader which finds nothing retries if the sequence number
+ * has changed.
+ */
+
+#define LOAD(p) __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+#define STORE(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+typedef struct lwc_table_s {
+        struct lwc_table_s *	retired;	/* Next on retired list */
+        lwc_hash		mask;		/* Bucket count - 1 */
+        lwc_string *		buckets[];
+} lwc_table;
 
 typedef struct lwc_context_s {
-        lwc_string **		buckets;
-        lwc_hash		bucketcount;
+        unsigned int		readers[2][NR_READER_SLOTS *
+                                           READER_SLOT_SPACING];
+                                                /* Lookups in progress,
+                                                 * by epoch */
+        unsigned int		epoch;		/* Selects readers' counts */
+
+        lwc_table *		table;		/* Table strings are added to */
+        lwc_table *		old_table;	/* Table being migrated from */
+        lwc_hash		migrated;	/* Buckets migrated so far */
+        size_t			count;		/* Number of strings */
+
+        unsigned int		seq;		/* Odd while migrating */
+
+        lwc_string *		retired;	/* Strings unlinked this
+                                                 * epoch */
+        unsigned int		nr_retired;	/* Number of those */
+        lwc_table *		retired_tables;	/* Tables unlinked this
+                                                 * epoch */
+        lwc_string *		expiring;	/* Strings unlinked last
+                                                 * epoch */
+        lwc_table *		expiring_tables;/* Tables unlinked last
+                                                 * epoch */
 } lwc_context;
 
 static lwc_context *ctx = NULL;
@@ -50,33 +116,202 @@ typedef lwc_hash (*lwc_hasher)(const char *, size_t);
 typedef int (*lwc_strncmp)(const char *, const char *, size_t);
 typedef void (*lwc_memcpy)(char *, const char *, size_t);
 
+static lwc_table *
+lwc__table_create(lwc_hash bucketcount)
+{
+        lwc_table *table;
+
+        table = LWC_ALLOC(sizeof(lwc_table) +
+                          sizeof(lwc_string *) * bucketcount);
+        if (table == NULL)
+                return NULL;
+
+        table->retired = NULL;
+        table->mask = bucketcount - 1;
+        memset(table->buckets, 0, sizeof(lwc_string *) * bucketcount);
+
+        return table;
+}
+
 static lwc_error
 lwc__initialise(void)
 {
+        lwc_context *c;
+
         if (ctx != NULL)
                 return lwc_error_ok;
         
-        ctx = LWC_ALLOC(sizeof(lwc_context));
+        c = LWC_ALLOC(sizeof(lwc_context));
         
-        if (ctx == NULL)
+        if (c == NULL)
                 return lwc_error_oom;
         
-        memset(ctx, 0, sizeof(lwc_context));
+        memset(c, 0, sizeof(lwc_context));
         
-        ctx->bucketcount = NR_BUCKETS_DEFAULT;
-        ctx->buckets = LWC_ALLOC(sizeof(lwc_string *) * ctx->bucketcount);
+        c->table = lwc__table_create(NR_BUCKETS_DEFAULT);
         
-        if (ctx->buckets == NULL) {
-                LWC_FREE(ctx);
-		ctx = NULL;
+        if (c->table == NULL) {
+                LWC_FREE(c);
                 return lwc_error_oom;
         }
         
-        memset(ctx->buckets, 0, sizeof(lwc_string *) * ctx->bucketcount);
+        STORE(ctx, c);
         
         return lwc_error_ok;
 }
 
+static void
+lwc__free_string(lwc_string *str)
+{
+#ifndef NDEBUG
+        memset(str, 0xA5, sizeof(*str) + str->len);
+#endif
+        
+        LWC_FREE(str);
+}
+
+/* Free the strings and tables unlinked last epoch, if its readers are
+ * done with them */
+static bool
+lwc__expire(void)
+{
+        unsigned int *readers = ctx->readers[(ctx->epoch - 1) & 1];
+        lwc_string *str;
+        lwc_table *table;
+        unsigned int slot;
+
+        for (slot = 0; slot < NR_READER_SLOTS; slot++) {
+                if (__atomic_load_n(&readers[slot * READER_SLOT_SPACING],
+                                    __ATOMIC_SEQ_CST) != 0)
+                        return false;
+        }
+
+        while (ctx->expiring != NULL) {
+                str = ctx->expiring;
+                ctx->expiring = (lwc_string *) str->prevptr;
+                lwc__free_string(str);
+        }
+
+        while (ctx->expiring_tables != NULL) {
+                table = ctx->expiring_tables;
+                ctx->expiring_tables = table->retired;
+                LWC_FREE(table);
+        }
+
+        return true;
+}
+
+/* Free unlinked strings and tables which no reader can still see */
+static void
+lwc__reclaim(void)
+{
+        if (lwc__expire() == false)
+                return;
+
+        if (ctx->retired == NULL && ctx->retired_tables == NULL)
+                return;
+
+        /* Start a new epoch, leaving only readers which may have seen
+         * this epoch's strings using its counts */
+        ctx->expiring = ctx->retired;
+        ctx->expiring_tables = ctx->retired_tables;
+        ctx->retired = NULL;
+        ctx->retired_tables = NULL;
+        ctx->nr_retired = 0;
+
+        __atomic_store_n(&ctx->epoch, ctx->epoch + 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        /* Lookups are brief, so those readers have usually finished */
+        lwc__expire();
+}
+
+static inline void
+lwc__link(lwc_string **bucket, lwc_string *str)
+{
+        str->prevptr = bucket;
+        STORE(str->next, *bucket);
+        if (str->next != NULL)
+                str->next->prevptr = &(str->next);
+        STORE(*bucket, str);
+}
+
+/* Move a few buckets' strings from the old table to the new one */
+static void
+lwc__migrate(void)
+{
+        lwc_table *old = ctx->old_table;
+        lwc_hash end = ctx->migrated + NR_BUCKETS_MIGRATE;
+        lwc_string *str;
+
+        if (end > old->mask + 1)
+                end = old->mask + 1;
+
+        __atomic_store_n(&ctx->seq, ctx->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        for (; ctx->migrated < end; ctx->migrated++) {
+                while ((str = old->buckets[ctx->migrated]) != NULL) {
+                        STORE(old->buckets[ctx->migrated], str->next);
+                        if (str->next != NULL)
+                                str->next->prevptr =
+                                        &old->buckets[ctx->migrated];
+                        lwc__link(&ctx->table->buckets[
+                                          str->hash & ctx->table->mask],
+                                  str);
+                }
+        }
+
+        if (ctx->migrated > old->mask) {
+                STORE(ctx->old_table, NULL);
+                old->retired = ctx->retired_tables;
+                ctx->retired_tables = old;
+        }
+
+        __atomic_store_n(&ctx->seq, ctx->seq + 1, __ATOMIC_RELEASE);
+
+        if (ctx->old_table == NULL) {
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                lwc__reclaim();
+        }
+}
+
+/* Start migrating to a table twice the size, if there's memory for it */
+static void
+lwc__grow(void)
+{
+        lwc_table *table;
+
+        table = lwc__table_create((ctx->table->mask + 1) * 2);
+        if (table == NULL)
+                return;
+
+        __atomic_store_n(&ctx->seq, ctx->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        ctx->migrated = 0;
+        STORE(ctx->old_table, ctx->table);
+        STORE(ctx->table, table);
+
+        __atomic_store_n(&ctx->seq, ctx->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline lwc_string *
+lwc__find(lwc_table *table, const char *s, size_t slen, lwc_hash h,
+          lwc_strncmp compare)
+{
+        lwc_string *str;
+
+        for (str = LOAD(table->buckets[h & table->mask]); str != NULL;
+             str = LOAD(str->next)) {
+                if ((str->hash == h) && (str->len == slen) &&
+                    (compare(CSTR_OF(str), s, slen) == 0))
+                        return str;
+        }
+
+        return NULL;
+}
+
 static lwc_error
 lwc__intern(const char *s, size_t slen,
            lwc_string **ret,
@@ -85,7 +320,6 @@ lwc__intern(const char *s, size_t slen,
            lwc_memcpy copy)
 {
         lwc_hash h;
-        lwc_hash bucket;
         lwc_string *str;
         lwc_error eret;
         
@@ -99,18 +333,15 @@ lwc__intern(const char *s, size_t slen,
         }
         
         h = hasher(s, slen);
-        bucket = h % ctx->bucketcount;
-        str = ctx->buckets[bucket];
-        
-        while (str != NULL) {
-                if ((str->hash == h) && (str->len == slen)) {
-                        if (compare(CSTR_OF(str), s, slen) == 0) {
-                                str->refcnt++;
-                                *ret = str;
-                                return lwc_error_ok;
-                        }
-                }
-                str = str->next;
+        
+        str = lwc__find(ctx->table, s, slen, h, compare);
+        if (str == NULL && ctx->old_table != NULL)
+                str = lwc__find(ctx->old_table, s, slen, h, compare);
+        
+        if (str != NULL) {
+                str->refcnt++;
+                *ret = str;
+                return lwc_error_ok;
         }
         
         /* Add one for the additional NUL. */
@@ -119,12 +350,6 @@ lwc__intern(const char *s, size_t slen,
         if (str == NULL)
                 return lwc_error_oom;
         
-        str->prevptr = &(ctx->buckets[bucket]);
-        str->next = ctx->buckets[bucket];
-        if (str->next != NULL)
-                str->next->prevptr = &(str->next);
-        ctx->buckets[bucket] = str;
-
         str->len = slen;
         str->hash = h;
         str->refcnt = 1;
@@ -135,6 +360,15 @@ lwc__intern(const char *s, size_t slen,
         /* Guarantee NUL termination */
         STR_OF(str)[slen] = '\0';
         
+        lwc__link(&ctx->table->buckets[h & ctx->table->mask], str);
+        ctx->count++;
+
+        /* Keep chains short, spreading the cost of growing the table */
+        if (ctx->old_table != NULL)
+                lwc__migrate();
+        else if (ctx->count > ctx->table->mask + 1)
+                lwc__grow();
+        
         return lwc_error_ok;
 }
 
@@ -163,24 +397,80 @@ lwc_intern_substring(lwc_string *str,
         return lwc_intern_string(CSTR_OF(str) + ssoffset, sslen, ret);
 }
 
+lwc_error
+lwc_lookup_string(const char *s, size_t slen, lwc_string **ret)
+{
+        lwc_context *c = LOAD(ctx);
+        lwc_table *table;
+        lwc_string *str;
+        lwc_hash h;
+        unsigned int seq, epoch;
+        unsigned int *readers;
+        
+        assert((s != NULL) || (slen == 0));
+        assert(ret);
+        
+        *ret = NULL;
+        
+        if (c == NULL)
+                return lwc_error_ok;
+        
+        h = lwc__calculate_hash(s, slen);
+        
+        /* Count ourselves in the current epoch.  If it has moved on
+         * meanwhile, the writer may not have seen us, so try again. */
+        for (;;) {
+                epoch = __atomic_load_n(&c->epoch, __ATOMIC_SEQ_CST);
+                readers = &c->readers[epoch & 1][
+                        (h % NR_READER_SLOTS) * READER_SLOT_SPACING];
+                __atomic_add_fetch(readers, 1, __ATOMIC_SEQ_CST);
+                if (__atomic_load_n(&c->epoch, __ATOMIC_SEQ_CST) == epoch)
+                        break;
+                __atomic_sub_fetch(readers, 1, __ATOMIC_RELEASE);
+        }
+        
+        do {
+                while ((seq = LOAD(c->seq)) & 1)
+                        ;
+                
+                str = lwc__find(LOAD(c->table), s, slen, h, strncmp);
+                if (str == NULL && (table = LOAD(c->old_table)) != NULL)
+                        str = lwc__find(table, s, slen, h, strncmp);
+                
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        } while (str == NULL &&
+                 __atomic_load_n(&c->seq, __ATOMIC_RELAXED) != seq);
+        
+        *ret = str;
+        
+        __atomic_sub_fetch(readers, 1, __ATOMIC_RELEASE);
+        
+        return lwc_error_ok;
+}
+
 void
 lwc_string_destroy(lwc_string *str)
 {
         assert(str);
         
-        *(str->prevptr) = str->next;
+        STORE(*(str->prevptr), str->next);
         
         if (str->next != NULL)
                 str->next->prevptr = str->prevptr;
+        
+        ctx->count--;
 
         if (str->insensitive != NULL && str->refcnt == 0)
                 lwc_string_unref(str->insensitive);
 
-#ifndef NDEBUG
-        memset(str, 0xA5, sizeof(*str) + str->len);
-#endif
-        
-        LWC_FREE(str);
+        /* Readers may be looking at it, and checking for them is costly,
+         * so free strings in batches */
+        str->prevptr = (lwc_string **) ctx->retired;
+        ctx->retired = str;
+        if (++ctx->nr_retired % NR_RETIRED_MAX == 0) {
+                __atomic_thread_fence(__ATOMIC_SEQ_CST);
+                lwc__reclaim();
+        }
 }
 
 /**** Shonky caseless bits ****/
@@ -251,8 +541,17 @@ lwc_iterate_strings(lwc_iteration_callback_fn cb, void *pw)
 	if (ctx == NULL)
 		return;
  
-        for (n = 0; n < ctx->bucketcount; ++n) {
-                for (str = ctx->buckets[n]; str != NULL; str = str->next)
+        for (n = 0; n <= ctx->table->mask; ++n) {
+                for (str = ctx->table->buckets[n]; str != NULL; str = str->next)
+                        cb(str, pw);
+        }
+
+        if (ctx->old_table == NULL)
+                return;
+
+        for (n = ctx->migrated; n <= ctx->old_table->mask; ++n) {
+                for (str = ctx->old_table->buckets[n]; str != NULL;
+                     str = str->next)
                         cb(str, pw);
         }
 }
@@ -7,6 +7,7 @@
  */
 
 #include <check.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -342,6 +343,119 @@ START_TEST (test_lwc_string_iteration)
 }
 END_TEST
 
+START_TEST (test_lwc_lookup_string_ok)
+{
+        lwc_string *str = NULL;
+        fail_unless(lwc_lookup_string("one", 3, &str) == lwc_error_ok,
+                    "Unable to look up 'one'");
+        fail_unless(str == intern_one, "Looked up the wrong string");
+        fail_unless(str->refcnt == 1, "Look up took a reference");
+}
+END_TEST
+
+START_TEST (test_lwc_lookup_string_missing)
+{
+        lwc_string *str = intern_one;
+        fail_unless(lwc_lookup_string("four", 4, &str) == lwc_error_ok,
+                    "Unable to look up 'four'");
+        fail_unless(str == NULL, "Found a string which was never interned");
+}
+END_TEST
+
+/**** The next set of tests need enough strings to grow the table ****/
+
+#define MANY_STRINGS (20000)
+
+static lwc_string *many[MANY_STRINGS];
+
+static void
+with_many_strings_setup(void)
+{
+        char buf[16];
+        int i, len;
+        
+        for (i = 0; i < MANY_STRINGS; i++) {
+                len = sprintf(buf, "s%d", i);
+                fail_unless(lwc_intern_string(buf, len, &many[i]) ==
+                            lwc_error_ok, "Unable to intern string");
+        }
+}
+
+static void
+with_many_strings_teardown(void)
+{
+        int i;
+        
+        for (i = 0; i < MANY_STRINGS; i++) {
+                if (many[i] != NULL)
+                        lwc_string_unref(many[i]);
+        }
+}
+
+START_TEST (test_lwc_grown_interning_works)
+{
+        lwc_string *str;
+        char buf[16];
+        int i, len;
+        
+        for (i = 0; i < MANY_STRINGS; i++) {
+                len = sprintf(buf, "s%d", i);
+                fail_unless(lwc_intern_string(buf, len, &str) ==
+                            lwc_error_ok, "Unable to re-intern string");
+                fail_unless(str == many[i], "Re-interned a new string");
+                lwc_string_unref(str);
+                
+                fail_unless(lwc_lookup_string(buf, len, &str) ==
+                            lwc_error_ok, "Unable to look up string");
+                fail_unless(str == many[i], "Looked up the wrong string");
+        }
+}
+END_TEST
+
+START_TEST (test_lwc_grown_iteration)
+{
+        int counter = 0;
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == MANY_STRINGS, "Incorrect string count");
+}
+END_TEST
+
+START_TEST (test_lwc_grown_unref_ok)
+{
+        lwc_string *str;
+        char buf[16];
+        int counter = 0;
+        int i, len;
+        
+        /* Release every other string, then make the table grow */
+        for (i = 0; i < MANY_STRINGS; i += 2) {
+                lwc_string_unref(many[i]);
+                many[i] = NULL;
+        }
+        
+        for (i = 0; i < MANY_STRINGS; i += 2) {
+                len = sprintf(buf, "t%d", i);
+                fail_unless(lwc_intern_string(buf, len, &many[i]) ==
+                            lwc_error_ok, "Unable to intern string");
+        }
+        
+        for (i = 0; i < MANY_STRINGS; i++) {
+                len = sprintf(buf, "%c%d", (i & 1) ? 's' : 't', i);
+                fail_unless(lwc_lookup_string(buf, len, &str) ==
+                            lwc_error_ok, "Unable to look up string");
+                fail_unless(str == many[i], "Looked up the wrong string");
+                
+                len = sprintf(buf, "%c%d", (i & 1) ? 't' : 's', i);
+                fail_unless(lwc_lookup_string(buf, len, &str) ==
+                            lwc_error_ok, "Unable to look up string");
+                fail_unless(str == NULL, "Found a released string");
+        }
+        
+        lwc_iterate_strings(counting_cb, (void*)&counter);
+        fail_unless(counter == MANY_STRINGS, "Incorrect string count");
+}
+END_TEST
+
 /**** And the suites are set up here ****/
 
 void
@@ -411,6 +525,17 @@ lwc_basic_suite(SRunner *sr)
         tcase_add_test(tc_basic, test_lwc_intern_substring_bad_size);
         tcase_add_test(tc_basic, test_lwc_intern_substring_bad_offset);
         tcase_add_test(tc_basic, test_lwc_string_iteration);
+        tcase_add_test(tc_basic, test_lwc_lookup_string_ok);
+        tcase_add_test(tc_basic, test_lwc_lookup_string_missing);
+        suite_add_tcase(s, tc_basic);
+        
+        tc_basic = tcase_create("Ops with a grown context");
+        
+        tcase_add_checked_fixture(tc_basic, with_many_strings_setup,
+                                  with_many_strings_teardown);
+        tcase_add_test(tc_basic, test_lwc_grown_interning_works);
+        tcase_add_test(tc_basic, test_lwc_grown_iteration);
+        tcase_add_test(tc_basic, test_lwc_grown_unref_ok);
         suite_add_tcase(s, tc_basic);
         
         srunner_add_suite(sr, s);
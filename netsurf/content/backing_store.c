@@ -0,0 +1,763 @@
+/*
+ * Copyright 2012 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Persistent backing store for the low-level cache (implementation).
+ *
+ * Each URL is reduced to a 32 bit identifier, which names the files holding
+ * its items:
+ *
+ *	<path>/d/<xx>/<identifier>	Source data
+ *	<path>/m/<xx>/<identifier>	Metadata
+ *
+ * where \<xx\> is the low byte of the identifier, which keeps directories
+ * to a manageable size.  Distinct URLs may share an identifier; the
+ * low-level cache records the URL in the metadata and discards items
+ * which turn out to belong to another URL.
+ *
+ * The sizes and last use times of the entries are held in memory in an
+ * open-addressed table, which is written to \<path\>/index when the store
+ * is finalised and read back when it is next initialised.  The index is
+ * removed once read, so if the browser exits without finalising the store
+ * the table is instead rebuilt from the files on disc.
+ */
+
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "content/backing_store.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+/** Define to enable tracing of backing store operations. */
+#undef BACKING_STORE_TRACE
+
+/** Version of the index file format */
+#define STORE_INDEX_VERSION 1
+
+/** Magic number at start of index file */
+#define STORE_INDEX_MAGIC 0x4e534253 /* "NSBS" */
+
+/** Initial number of slots in the entry table (a power of 2) */
+#define STORE_INITIAL_SLOTS 1024
+
+/** Entry in the backing store */
+struct store_entry {
+	uint32_t ident;		/**< Entry identifier, or 0 if slot unused */
+	uint32_t data_size;	/**< Size of source data, or 0 if none */
+	uint32_t meta_size;	/**< Size of metadata, or 0 if none */
+	uint32_t padding;	/**< Unused; keeps the index layout stable */
+	int64_t last_used;	/**< Time entry was last stored or fetched */
+};
+
+/** Backing store state */
+struct store_state {
+	char *path;		/**< Root directory of store */
+
+	size_t limit;		/**< Target upper bound of store size */
+	size_t hysteresis;	/**< Hysteresis around target size */
+	time_t max_age;		/**< Maximum unused age of an entry */
+
+	struct store_entry *entries;	/**< Entry table */
+	uint32_t slots;		/**< Number of slots in the entry table */
+	uint32_t count;		/**< Number of entries in use */
+
+	uint64_t total_size;	/**< Total size of items in the store */
+
+	uint32_t hit_count;	/**< Number of successful fetches */
+	uint32_t miss_count;	/**< Number of failed fetches */
+};
+
+/** Backing store state, or NULL if not initialised */
+static struct store_state *store = NULL;
+
+
+/**
+ * Compute the identifier of a URL
+ *
+ * \param url  URL to compute identifier for
+ * \return identifier, which is never 0
+ *
+ * This is FNV-1a over the URL string, so it is stable between runs.
+ */
+static uint32_t store_ident(nsurl *url)
+{
+	const uint8_t *s = (const uint8_t *) nsurl_access(url);
+	size_t len = nsurl_length(url);
+	uint32_t hash = 0x811c9dc5;
+
+	while (len-- > 0) {
+		hash ^= *s++;
+		hash *= 0x01000193;
+	}
+
+	return hash != 0 ? hash : 1;
+}
+
+/**
+ * Find the slot of an entry in the entry table
+ *
+ * \param ident  Identifier to look for
+ * \return Pointer to slot holding entry, or to the empty slot where it
+ *	   would be inserted
+ */
+static struct store_entry *store_slot(uint32_t ident)
+{
+	uint32_t mask = store->slots - 1;
+	uint32_t i = ident & mask;
+
+	while (store->entries[i].ident != 0 &&
+			store->entries[i].ident != ident)
+		i = (i + 1) & mask;
+
+	return &store->entries[i];
+}
+
+/**
+ * Double the number of slots in the entry table
+ *
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+static nserror store_grow(void)
+{
+	struct store_entry *old = store->entries;
+	uint32_t old_slots = store->slots;
+	struct store_entry *entries;
+	uint32_t i;
+
+	entries = calloc(old_slots * 2, sizeof(struct store_entry));
+	if (entries == NULL)
+		return NSERROR_NOMEM;
+
+	store->entries = entries;
+	store->slots = old_slots * 2;
+
+	for (i = 0; i < old_slots; i++) {
+		if (old[i].ident != 0)
+			*store_slot(old[i].ident) = old[i];
+	}
+
+	free(old);
+
+	return NSERROR_OK;
+}
+
+/**
+ * Find an entry, creating it if it does not exist
+ *
+ * \param ident  Identifier of entry
+ * \param entry  Pointer to location to receive entry
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+static nserror store_entry_get(uint32_t ident, struct store_entry **entry)
+{
+	struct store_entry *e;
+
+	/* Keep the table at most half full */
+	if ((store->count + 1) * 2 > store->slots) {
+		nserror error = store_grow();
+		if (error != NSERROR_OK)
+			return error;
+	}
+
+	e = store_slot(ident);
+	if (e->ident == 0) {
+		memset(e, 0, sizeof(*e));
+		e->ident = ident;
+		store->count++;
+	}
+
+	*entry = e;
+
+	return NSERROR_OK;
+}
+
+/**
+ * Construct the filename of an item
+ *
+ * \param ident	 Identifier of entry
+ * \param flags	 Kind of item
+ * \return Filename, which the caller must free, or NULL on memory exhaustion
+ */
+static char *store_fname(uint32_t ident, enum backing_store_flags flags)
+{
+	size_t len = strlen(store->path) + SLEN("/d/xx/xxxxxxxx") + 1;
+	char *fname = malloc(len);
+
+	if (fname == NULL)
+		return NULL;
+
+	snprintf(fname, len, "%s/%c/%02x/%08x", store->path,
+			(flags & BACKING_STORE_META) ? 'm' : 'd',
+			ident & 0xff, ident);
+
+	return fname;
+}
+
+/**
+ * Remove the files of an entry, and the entry itself
+ *
+ * \param ident  Identifier of entry to remove
+ */
+static void store_entry_remove(uint32_t ident)
+{
+	struct store_entry *e = store_slot(ident);
+	uint32_t mask = store->slots - 1;
+	uint32_t hole, i;
+	char *fname;
+
+	if (e->ident == 0)
+		return;
+
+	fname = store_fname(ident, BACKING_STORE_NONE);
+	if (fname != NULL) {
+		unlink(fname);
+		free(fname);
+	}
+
+	fname = store_fname(ident, BACKING_STORE_META);
+	if (fname != NULL) {
+		unlink(fname);
+		free(fname);
+	}
+
+	store->total_size -= e->data_size + e->meta_size;
+	store->count--;
+
+	/* Close the hole by shifting back any following entries which
+	 * would otherwise become unreachable */
+	hole = e - store->entries;
+	e->ident = 0;
+
+	for (i = (hole + 1) & mask; store->entries[i].ident != 0;
+			i = (i + 1) & mask) {
+		uint32_t home = store->entries[i].ident & mask;
+
+		/* Entry can move if the hole lies cyclically between its
+		 * home slot and its current slot */
+		if ((i > hole && (home <= hole || home > i)) ||
+				(i < hole && (home <= hole && home > i))) {
+			store->entries[hole] = store->entries[i];
+			store->entries[i].ident = 0;
+			hole = i;
+		}
+	}
+}
+
+/**
+ * Sort entries by time of last use
+ */
+static int store_entry_cmp(const void *a, const void *b)
+{
+	const struct store_entry *ea = a;
+	const struct store_entry *eb = b;
+
+	if (ea->last_used < eb->last_used)
+		return -1;
+
+	return (ea->last_used > eb->last_used) ? 1 : 0;
+}
+
+/**
+ * Evict least recently used entries once the store exceeds its limit
+ *
+ * Entries are evicted until the store is the hysteresis below its limit,
+ * so that a store running at its limit is not trimmed on every store.
+ *
+ * \param now	   Current time
+ * \param expire  Whether to also evict entries which have gone unused for
+ *		   longer than the maximum age
+ */
+static void store_evict(time_t now, bool expire)
+{
+	struct store_entry *victims;
+	uint32_t num = 0, i;
+	uint64_t target;
+
+	if (store->total_size <= store->limit && expire == false)
+		return;
+
+	/* Take a copy of the entries, as removal reorders the table */
+	victims = malloc(store->count * sizeof(struct store_entry));
+	if (victims == NULL)
+		return;
+
+	for (i = 0; i < store->slots; i++) {
+		if (store->entries[i].ident != 0)
+			victims[num++] = store->entries[i];
+	}
+
+	qsort(victims, num, sizeof(struct store_entry), store_entry_cmp);
+
+	target = (store->limit > store->hysteresis) ?
+			store->limit - store->hysteresis : 0;
+
+	for (i = 0; i < num; i++) {
+		bool expired = expire && store->max_age != 0 &&
+				victims[i].last_used + store->max_age < now;
+
+		if (expired == false && store->total_size <= target)
+			break;
+
+#ifdef BACKING_STORE_TRACE
+		LOG(("Evicting %08x", victims[i].ident));
+#endif
+
+		store_entry_remove(victims[i].ident);
+	}
+
+	free(victims);
+}
+
+/**
+ * Create the parent directories of a file, if they don't already exist
+ *
+ * \param fname	 Filename to create parents of
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+static nserror store_mkdirs(char *fname)
+{
+	char *sep = fname + strlen(store->path);
+
+	while ((sep = strchr(sep + 1, '/')) != NULL) {
+		*sep = '\0';
+		if (mkdir(fname, S_IRWXU) != 0 && errno != EEXIST) {
+			*sep = '/';
+			return NSERROR_SAVE_FAILED;
+		}
+		*sep = '/';
+	}
+
+	return NSERROR_OK;
+}
+
+/**
+ * Construct the filename of the store index
+ *
+ * \return Filename, which the caller must free, or NULL on memory exhaustion
+ */
+static char *store_index_fname(void)
+{
+	size_t len = strlen(store->path) + SLEN("/index") + 1;
+	char *fname = malloc(len);
+
+	if (fname == NULL)
+		return NULL;
+
+	snprintf(fname, len, "%s/index", store->path);
+
+	return fname;
+}
+
+/**
+ * Read the store index
+ *
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * The index is removed once read, as it goes out of date as soon as the
+ * store is modified.  It is written again when the store is finalised.
+ */
+static nserror store_read_index(void)
+{
+	char *fname = store_index_fname();
+	struct store_entry entry;
+	uint32_t header[2];
+	FILE *fp;
+
+	if (fname == NULL)
+		return NSERROR_NOMEM;
+
+	fp = fopen(fname, "rb");
+	if (fp != NULL)
+		unlink(fname);
+	free(fname);
+	if (fp == NULL)
+		return NSERROR_NOT_FOUND;
+
+	if (fread(header, sizeof(header), 1, fp) != 1 ||
+			header[0] != STORE_INDEX_MAGIC ||
+			header[1] != STORE_INDEX_VERSION) {
+		LOG(("Ignoring invalid backing store index"));
+		fclose(fp);
+		return NSERROR_NOT_FOUND;
+	}
+
+	while (fread(&entry, sizeof(entry), 1, fp) == 1) {
+		struct store_entry *e;
+
+		if (entry.ident == 0)
+			continue;
+
+		if (store_entry_get(entry.ident, &e) != NSERROR_OK) {
+			fclose(fp);
+			return NSERROR_NOMEM;
+		}
+
+		*e = entry;
+		store->total_size += e->data_size + e->meta_size;
+	}
+
+	fclose(fp);
+
+	return NSERROR_OK;
+}
+
+/**
+ * Rebuild the entry table from the items on disc
+ *
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * This is used when there is no usable index.  Item sizes are taken from
+ * the files, and last use times from their modification times.
+ */
+static nserror store_rebuild_index(void)
+{
+	static const enum backing_store_flags kinds[] = {
+		BACKING_STORE_NONE, BACKING_STORE_META
+	};
+	size_t len = strlen(store->path) + SLEN("/d/xx/xxxxxxxx") + 1;
+	char *fname = malloc(len);
+	unsigned int kind, bucket;
+
+	if (fname == NULL)
+		return NSERROR_NOMEM;
+
+	for (kind = 0; kind < NOF_ELEMENTS(kinds); kind++) {
+		for (bucket = 0; bucket < 256; bucket++) {
+			struct dirent *ent;
+			DIR *dir;
+
+			snprintf(fname, len, "%s/%c/%02x", store->path,
+					(kinds[kind] & BACKING_STORE_META) ?
+					'm' : 'd', bucket);
+
+			dir = opendir(fname);
+			if (dir == NULL)
+				continue;
+
+			while ((ent = readdir(dir)) != NULL) {
+				struct store_entry *e;
+				struct stat st;
+				unsigned long ident;
+				char *end;
+
+				ident = strtoul(ent->d_name, &end, 16);
+				if (end - ent->d_name != 8 || *end != '\0' ||
+						ident == 0 || ident > UINT32_MAX ||
+						(ident & 0xff) != bucket)
+					continue;
+
+				snprintf(fname, len, "%s/%c/%02x/%08lx",
+						store->path,
+						(kinds[kind] & BACKING_STORE_META) ?
+						'm' : 'd', bucket, ident);
+
+				if (stat(fname, &st) != 0 ||
+						S_ISREG(st.st_mode) == false ||
+						(uint64_t) st.st_size > UINT32_MAX)
+					continue;
+
+				if (store_entry_get(ident, &e) != NSERROR_OK) {
+					closedir(dir);
+					free(fname);
+					return NSERROR_NOMEM;
+				}
+
+				if (kinds[kind] & BACKING_STORE_META)
+					e->meta_size = st.st_size;
+				else
+					e->data_size = st.st_size;
+				store->total_size += st.st_size;
+
+				if (e->last_used < st.st_mtime)
+					e->last_used = st.st_mtime;
+			}
+
+			closedir(dir);
+		}
+	}
+
+	free(fname);
+
+	return NSERROR_OK;
+}
+
+/**
+ * Write the store index
+ *
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+static nserror store_write_index(void)
+{
+	char *fname = store_index_fname();
+	uint32_t header[2] = { STORE_INDEX_MAGIC, STORE_INDEX_VERSION };
+	uint32_t i;
+	FILE *fp;
+
+	if (fname == NULL)
+		return NSERROR_NOMEM;
+
+	fp = fopen(fname, "wb");
+	free(fname);
+	if (fp == NULL)
+		return NSERROR_SAVE_FAILED;
+
+	if (fwrite(header, sizeof(header), 1, fp) != 1) {
+		fclose(fp);
+		return NSERROR_SAVE_FAILED;
+	}
+
+	for (i = 0; i < store->slots; i++) {
+		if (store->entries[i].ident == 0)
+			continue;
+
+		if (fwrite(&store->entries[i], sizeof(struct store_entry),
+				1, fp) != 1) {
+			fclose(fp);
+			return NSERROR_SAVE_FAILED;
+		}
+	}
+
+	if (fclose(fp) != 0)
+		return NSERROR_SAVE_FAILED;
+
+	return NSERROR_OK;
+}
+
+
+/* See backing_store.h for documentation */
+nserror backing_store_initialise(const struct backing_store_parameters *params)
+{
+	nserror error;
+
+	assert(store == NULL);
+
+	if (params->path == NULL || params->limit == 0)
+		return NSERROR_INIT_FAILED;
+
+	store = calloc(1, sizeof(struct store_state));
+	if (store == NULL)
+		return NSERROR_NOMEM;
+
+	store->path = strdup(params->path);
+	store->entries = calloc(STORE_INITIAL_SLOTS,
+			sizeof(struct store_entry));
+	if (store->path == NULL || store->entries == NULL) {
+		free(store->path);
+		free(store->entries);
+		free(store);
+		store = NULL;
+		return NSERROR_NOMEM;
+	}
+
+	store->slots = STORE_INITIAL_SLOTS;
+	store->limit = params->limit;
+	store->hysteresis = params->hysteresis;
+	store->max_age = params->max_age;
+
+	if (mkdir(store->path, S_IRWXU) != 0 && errno != EEXIST) {
+		LOG(("Unable to create backing store at %s", store->path));
+		backing_store_finalise();
+		return NSERROR_INIT_FAILED;
+	}
+
+	error = store_read_index();
+	if (error == NSERROR_NOT_FOUND) {
+		/* Not finalised last time; recover what is on disc */
+		LOG(("Rebuilding backing store index"));
+		error = store_rebuild_index();
+	}
+	if (error == NSERROR_NOMEM) {
+		backing_store_finalise();
+		return error;
+	}
+
+	/* Discard entries which have expired since the last run */
+	store_evict(time(NULL), true);
+
+	LOG(("Backing store at %s holds %u entries (%llu bytes, limit %u)",
+			store->path, store->count,
+			(unsigned long long) store->total_size,
+			(unsigned int) store->limit));
+
+	return NSERROR_OK;
+}
+
+/* See backing_store.h for documentation */
+nserror backing_store_finalise(void)
+{
+	nserror error;
+
+	if (store == NULL)
+		return NSERROR_INIT_FAILED;
+
+	error = store_write_index();
+
+	LOG(("Backing store hit/miss %u/%u", store->hit_count,
+			store->miss_count));
+
+	free(store->entries);
+	free(store->path);
+	free(store);
+	store = NULL;
+
+	return error;
+}
+
+/* See backing_store.h for documentation */
+nserror backing_store_store(nsurl *url, enum backing_store_flags flags,
+		const uint8_t *data, size_t len)
+{
+	uint32_t ident;
+	struct store_entry *e;
+	char *fname;
+	nserror error;
+	FILE *fp;
+
+	if (store == NULL)
+		return NSERROR_SAVE_FAILED;
+
+	/* Items must fit in the entry, and are not worth storing if they
+	 * would immediately cause the entire store to be evicted */
+	if (len > UINT32_MAX || len > store->limit / 2)
+		return NSERROR_SAVE_FAILED;
+
+	ident = store_ident(url);
+
+	error = store_entry_get(ident, &e);
+	if (error != NSERROR_OK)
+		return error;
+
+	fname = store_fname(ident, flags);
+	if (fname == NULL)
+		return NSERROR_NOMEM;
+
+	fp = fopen(fname, "wb");
+	if (fp == NULL && store_mkdirs(fname) == NSERROR_OK)
+		fp = fopen(fname, "wb");
+
+	if (fp == NULL || (len > 0 && fwrite(data, len, 1, fp) != 1) ||
+			fclose(fp) != 0) {
+		/* Don't leave partial items behind */
+		unlink(fname);
+		free(fname);
+		store_entry_remove(ident);
+		return NSERROR_SAVE_FAILED;
+	}
+
+	free(fname);
+
+#ifdef BACKING_STORE_TRACE
+	LOG(("Stored %s (%08x, %d)", nsurl_access(url), ident, flags));
+#endif
+
+	if (flags & BACKING_STORE_META) {
+		store->total_size -= e->meta_size;
+		e->meta_size = len;
+	} else {
+		store->total_size -= e->data_size;
+		e->data_size = len;
+	}
+	store->total_size += len;
+	e->last_used = time(NULL);
+
+	store_evict(e->last_used, false);
+
+	return NSERROR_OK;
+}
+
+/* See backing_store.h for documentation */
+nserror backing_store_fetch(nsurl *url, enum backing_store_flags flags,
+		uint8_t **data, size_t *len)
+{
+	uint32_t ident;
+	struct store_entry *e;
+	uint8_t *buf;
+	size_t size;
+	char *fname;
+	FILE *fp;
+
+	if (store == NULL)
+		return NSERROR_NOT_FOUND;
+
+	ident = store_ident(url);
+
+	e = store_slot(ident);
+	size = (flags & BACKING_STORE_META) ? e->meta_size : e->data_size;
+	if (e->ident == 0 || (size == 0 && (flags & BACKING_STORE_META))) {
+		store->miss_count++;
+		return NSERROR_NOT_FOUND;
+	}
+
+	fname = store_fname(ident, flags);
+	if (fname == NULL)
+		return NSERROR_NOMEM;
+
+	fp = fopen(fname, "rb");
+	free(fname);
+	if (fp == NULL) {
+		/* The item has gone away underneath us */
+		store_entry_remove(ident);
+		store->miss_count++;
+		return NSERROR_NOT_FOUND;
+	}
+
+	/* Allocate an extra byte, so an empty item has a buffer */
+	buf = malloc(size + 1);
+	if (buf == NULL) {
+		fclose(fp);
+		return NSERROR_NOMEM;
+	}
+
+	if (size > 0 && fread(buf, size, 1, fp) != 1) {
+		fclose(fp);
+		free(buf);
+		store_entry_remove(ident);
+		store->miss_count++;
+		return NSERROR_NOT_FOUND;
+	}
+
+	fclose(fp);
+
+	e->last_used = time(NULL);
+	store->hit_count++;
+
+	*data = buf;
+	*len = size;
+
+	return NSERROR_OK;
+}
+
+/* See backing_store.h for documentation */
+nserror backing_store_invalidate(nsurl *url)
+{
+	if (store == NULL)
+		return NSERROR_NOT_FOUND;
+
+	store_entry_remove(store_ident(url));
+
+	return NSERROR_OK;
+}
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2012 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Persistent backing store for the low-level cache (interface).
+ *
+ * The backing store keeps the source data and metadata of low-level cache
+ * objects on disc, so they survive the objects being cleaned from memory
+ * and persist between runs of the browser.  Entries are addressed by
+ * their URL.  The store has its own size limit, and entries are evicted
+ * in least recently used order when it is exceeded.
+ */
+
+#ifndef NETSURF_CONTENT_BACKING_STORE_H_
+#define NETSURF_CONTENT_BACKING_STORE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "utils/errors.h"
+#include "utils/nsurl.h"
+
+/** Kind of item held for a URL in the backing store */
+enum backing_store_flags {
+	BACKING_STORE_NONE = 0,		/**< Source data */
+	BACKING_STORE_META = 1		/**< Metadata */
+};
+
+struct backing_store_parameters {
+	/** Directory in which to keep the store */
+	const char *path;
+
+	/** The target upper bound for the store size */
+	size_t limit;
+
+	/** The hysteresis allowed round the target size */
+	size_t hysteresis;
+
+	/** Maximum time an entry may go unused before it is discarded */
+	time_t max_age;
+};
+
+/**
+ * Initialise the backing store
+ *
+ * \param params  Store parameters
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * Until the store is initialised, all operations on it fail.
+ */
+nserror backing_store_initialise(const struct backing_store_parameters *params);
+
+/**
+ * Finalise the backing store, writing out its index
+ *
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+nserror backing_store_finalise(void);
+
+/**
+ * Place an item in the backing store
+ *
+ * \param url	 URL the item belongs to
+ * \param flags	 Kind of item being stored
+ * \param data	 Item data
+ * \param len	 Byte length of \a data
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * Any existing item of the same kind for \a url is replaced.
+ */
+nserror backing_store_store(nsurl *url, enum backing_store_flags flags,
+		const uint8_t *data, size_t len);
+
+/**
+ * Retrieve an item from the backing store
+ *
+ * \param url	 URL the item belongs to
+ * \param flags	 Kind of item to retrieve
+ * \param data	 Pointer to location to receive data, which the caller
+ *		 must free
+ * \param len	 Pointer to location to receive byte length of data
+ * \return NSERROR_OK on success,
+ *	   NSERROR_NOT_FOUND if there is no such item,
+ *	   appropriate error otherwise
+ */
+nserror backing_store_fetch(nsurl *url, enum backing_store_flags flags,
+		uint8_t **data, size_t *len);
+
+/**
+ * Remove all items for a URL from the backing store
+ *
+ * \param url  URL to remove items for
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+nserror backing_store_invalidate(nsurl *url);
+
+#endif
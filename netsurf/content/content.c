@@ -165,7 +165,7 @@ nserror content_llcache_callback(llcache_handle *llcache,
 	{
 		size_t source_size;
 
-		(void) llcache_handle_get_source_data(llcache, &source_size);
+		source_size = llcache_handle_get_source_size(llcache);
 
 		content_set_status(c, messages_get("Processing"), source_size);
 		content_broadcast(c, CONTENT_MSG_STATUS, msg_data);
@@ -1063,6 +1063,49 @@ const char *content__get_source_data(struct content *c, unsigned long *size)
 	return (const char *) data;
 }
 
+/**
+ * Retrieve a contiguous span of a content's source data
+ *
+ * \param c       Content to retrieve source of
+ * \param offset  Offset into source of start of span
+ * \param size    Pointer to location to receive byte size of span
+ * \return Pointer to span data, or NULL if \a offset is beyond the source
+ *
+ * The span may end before the end of the source; walking the source a span
+ * at a time avoids flattening it.
+ */
+const char *content__get_source_span(struct content *c, unsigned long offset,
+		unsigned long *size)
+{
+	const uint8_t *data;
+	size_t len;
+
+	assert(size != NULL);
+
+	if (c == NULL)
+		return NULL;
+
+	data = llcache_handle_get_source_span(c->llcache, offset, &len);
+
+	*size = (unsigned long) len;
+
+	return (const char *) data;
+}
+
+/**
+ * Retrieve the byte length of a content's source data
+ *
+ * \param c  Content to retrieve source length of
+ * \return Byte length of source, without flattening the source data
+ */
+unsigned long content__get_source_size(struct content *c)
+{
+	if (c == NULL)
+		return 0;
+
+	return (unsigned long) llcache_handle_get_source_size(c->llcache);
+}
+
 /**
  * Invalidate content reuse data: causes subsequent requests for content URL 
  * to query server to determine if content can be reused. This is required 
@@ -1328,3 +1371,18 @@ nserror content_abort(struct content *c)
 	return llcache_handle_abort(c->llcache);
 }
 
+/**
+ * Change the fetch priority of a content object's source data
+ *
+ * \param c         The content object
+ * \param priority  New priority
+ * \return NSERROR_OK on success, otherwise appropriate error
+ */
+nserror content_set_priority(struct content *c, fetch_priority priority)
+{
+	if (c->status == CONTENT_STATUS_DONE || c->llcache == NULL)
+		return NSERROR_OK;
+
+	return llcache_handle_set_priority(c->llcache, priority);
+}
+
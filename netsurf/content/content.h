@@ -37,6 +37,7 @@
 #include "utils/types.h"
 #include "content/content_factory.h"
 #include "content/content_type.h"
+#include "content/fetch.h"
 #include "desktop/mouse.h"
 #include "desktop/plot_style.h"
 
@@ -157,6 +158,8 @@ struct content *content_clone(struct content *c);
 
 nserror content_abort(struct content *c);
 
+nserror content_set_priority(struct content *c, fetch_priority priority);
+
 /* Client functions */
 bool content_can_reformat(struct hlcache_handle *h);
 void content_reformat(struct hlcache_handle *h, bool background,
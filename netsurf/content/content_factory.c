@@ -21,6 +21,7 @@
  */
 
 #include <assert.h>
+#include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -29,20 +30,26 @@
 #include "content/content_protected.h"
 #include "content/llcache.h"
 
+/** Number of buckets in content handler table (must be a power of two) */
+#define CONTENT_HANDLER_BUCKETS 64
+
 /**
- * Entry in list of content handlers
+ * Entry in table of content handlers
  */
 typedef struct content_handler_entry {
-	/** Next entry */
+	/** Next entry in bucket */
 	struct content_handler_entry *next;
 
-	/** MIME type handled by handler */
+	/** MIME type handled by handler, in lower case */
 	lwc_string *mime_type;
 	/** Content handler object */
 	const content_handler *handler;
+	/** Generic content type of handler */
+	content_type type;
 } content_handler_entry;
 
-static content_handler_entry *content_handlers;
+/** Content handlers, hashed by MIME type */
+static content_handler_entry *content_handlers[CONTENT_HANDLER_BUCKETS];
 
 /**
  * Clean up after the content factory
@@ -50,19 +57,112 @@ static content_handler_entry *content_handlers;
 void content_factory_fini(void)
 {
 	content_handler_entry *victim;
+	unsigned int i;
+
+	for (i = 0; i < CONTENT_HANDLER_BUCKETS; i++) {
+		while (content_handlers[i] != NULL) {
+			victim = content_handlers[i];
 
-	while (content_handlers != NULL) {
-		victim = content_handlers;
+			content_handlers[i] = victim->next;
 
-		content_handlers = content_handlers->next;
+			if (victim->handler->fini != NULL)
+				victim->handler->fini();
 
-		if (victim->handler->fini != NULL)
-			victim->handler->fini();
+			lwc_string_unref(victim->mime_type);
+
+			free(victim);
+		}
+	}
+}
 
-		lwc_string_unref(victim->mime_type);
+/**
+ * Find the bucket for a MIME type in the content handler table
+ *
+ * \param mime_type  MIME type to hash
+ * \return Bucket index
+ */
+static inline unsigned int content_factory_bucket(lwc_string *mime_type)
+{
+	lwc_hash hash = lwc_string_hash_value(mime_type);
+
+	return (hash ^ (hash >> 16)) & (CONTENT_HANDLER_BUCKETS - 1);
+}
+
+/**
+ * Intern the lower case form of a MIME type
+ *
+ * \param mime_type  MIME type
+ * \param len        Byte length of \a mime_type
+ * \param result     Pointer to location to receive result
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+static nserror content_factory_intern_lower(const char *mime_type,
+		size_t len, lwc_string **result)
+{
+	char buf[64];
+	char *lower = buf;
+	lwc_error lerror;
+	size_t i;
 
-		free(victim);
+	if (len > sizeof(buf)) {
+		lower = malloc(len);
+		if (lower == NULL)
+			return NSERROR_NOMEM;
 	}
+
+	for (i = 0; i < len; i++)
+		lower[i] = tolower((unsigned char) mime_type[i]);
+
+	lerror = lwc_intern_string(lower, len, result);
+
+	if (lower != buf)
+		free(lower);
+
+	if (lerror != lwc_error_ok)
+		return NSERROR_NOMEM;
+
+	return NSERROR_OK;
+}
+
+/**
+ * Find the entry for a MIME type in the content handler table
+ *
+ * \param mime_type  MIME type to search for
+ * \return Entry for MIME type, or NULL if none
+ */
+static content_handler_entry *content_factory_find(lwc_string *mime_type)
+{
+	content_handler_entry *entry;
+	const char *s = lwc_string_data(mime_type);
+	size_t len = lwc_string_length(mime_type);
+	lwc_string *lower;
+	size_t i;
+
+	for (entry = content_handlers[content_factory_bucket(mime_type)];
+			entry != NULL; entry = entry->next) {
+		if (entry->mime_type == mime_type)
+			return entry;
+	}
+
+	/* MIME types are case insensitive, but rarely given in upper case */
+	for (i = 0; i < len; i++) {
+		if (s[i] >= 'A' && s[i] <= 'Z')
+			break;
+	}
+
+	if (i == len || content_factory_intern_lower(s, len,
+			&lower) != NSERROR_OK)
+		return NULL;
+
+	for (entry = content_handlers[content_factory_bucket(lower)];
+			entry != NULL; entry = entry->next) {
+		if (entry->mime_type == lower)
+			break;
+	}
+
+	lwc_string_unref(lower);
+
+	return entry;
 }
 
 /**
@@ -78,27 +178,28 @@ nserror content_factory_register_handler(const char *mime_type,
 		const content_handler *handler)
 {
 	lwc_string *imime_type;
-	lwc_error lerror;
 	content_handler_entry *entry;
-	bool match;
+	unsigned int bucket;
+	nserror error;
 
-	lerror = lwc_intern_string(mime_type, strlen(mime_type), &imime_type);
-	if (lerror != lwc_error_ok)
-		return NSERROR_NOMEM;
+	error = content_factory_intern_lower(mime_type, strlen(mime_type),
+			&imime_type);
+	if (error != NSERROR_OK)
+		return error;
 
-	for (entry = content_handlers; entry != NULL; entry = entry->next) {
-		if (lwc_string_caseless_isequal(imime_type, entry->mime_type,
-				&match) == lwc_error_ok && match)
-			break;
-	}
+	entry = content_factory_find(imime_type);
 
 	if (entry == NULL) {
 		entry = malloc(sizeof(content_handler_entry));
-		if (entry == NULL)
+		if (entry == NULL) {
+			lwc_string_unref(imime_type);
 			return NSERROR_NOMEM;
+		}
+
+		bucket = content_factory_bucket(imime_type);
 
-		entry->next = content_handlers;
-		content_handlers = entry;
+		entry->next = content_handlers[bucket];
+		content_handlers[bucket] = entry;
 
 		entry->mime_type = imime_type;
 	} else {
@@ -106,6 +207,7 @@ nserror content_factory_register_handler(const char *mime_type,
 	}
 
 	entry->handler = handler;
+	entry->type = handler->type();
 
 	return NSERROR_OK;
 }
@@ -119,14 +221,8 @@ nserror content_factory_register_handler(const char *mime_type,
 static const content_handler *content_lookup(lwc_string *mime_type)
 {
 	content_handler_entry *entry;
-	bool match;
-
-	for (entry = content_handlers; entry != NULL; entry = entry->next) {
-		if (lwc_string_caseless_isequal(mime_type, entry->mime_type,
-				&match) == lwc_error_ok && match)
-			break;
-	}
 
+	entry = content_factory_find(mime_type);
 	if (entry != NULL)
 		return entry->handler;
 
@@ -141,12 +237,12 @@ static const content_handler *content_lookup(lwc_string *mime_type)
  */
 content_type content_factory_type_from_mime_type(lwc_string *mime_type)
 {
-	const content_handler *handler;
+	content_handler_entry *entry;
 	content_type type = CONTENT_NONE;
 
-	handler = content_lookup(mime_type);
-	if (handler != NULL) {
-		type = handler->type();
+	entry = content_factory_find(mime_type);
+	if (entry != NULL) {
+		type = entry->type;
 	}
 
 	return type;
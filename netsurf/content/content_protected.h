@@ -185,6 +185,9 @@ int content__get_width(struct content *c);
 int content__get_height(struct content *c);
 int content__get_available_width(struct content *c);
 const char *content__get_source_data(struct content *c, unsigned long *size);
+const char *content__get_source_span(struct content *c, unsigned long offset,
+		unsigned long *size);
+unsigned long content__get_source_size(struct content *c);
 void content__invalidate_reuse_data(struct content *c);
 nsurl *content__get_refresh_url(struct content *c);
 struct bitmap *content__get_bitmap(struct content *c);
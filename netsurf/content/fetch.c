@@ -24,7 +24,21 @@
  * Active fetches are held in the circular linked list ::fetch_ring. There may
  * be at most ::option_max_fetchers_per_host active requests per Host: header.
  * There may be at most ::option_max_fetchers active requests overall. Inactive
- * fetchers are stored in the ::queue_ring waiting for use.
+ * fetchers are queued, waiting for use, on a ring per host.
+ *
+ * Each fetch has a priority, and a host keeps a queue for each priority.
+ * Each host with queued fetches and room for more active ones sits on the
+ * ::host_ring for the most urgent priority it has fetches queued at.
+ * Fetches are dispatched from the most urgent non-empty ring, taking the
+ * hosts on it in turn, so one host with many queued fetches doesn't hold up
+ * the others.
+ *
+ * Fetchers may also be told of fetches which are likely to be made soon, by
+ * fetch_preconnect(), so that they can resolve hosts and open connections
+ * ahead of time.  fetch_start() does this for fetches which have to be
+ * queued.  Hosts are remembered for a while after they have been
+ * preconnected to, so repeated references to a host cost nothing.  None of
+ * this happens unless the max_preconnects option is set.
  */
 
 #include <assert.h>
@@ -43,6 +57,7 @@
 #include "content/fetchers/curl.h"
 #include "content/fetchers/data.h"
 #include "content/fetchers/file.h"
+#include "content/fetchers/replay.h"
 #include "content/urldb.h"
 #include "desktop/netsurf.h"
 #include "desktop/options.h"
@@ -55,7 +70,11 @@
 /* Define this to turn on verbose fetch logging */
 #undef DEBUG_FETCH_VERBOSE
 
-bool fetch_active;	/**< Fetches in progress, please call fetch_poll(). */
+/** Fetches in progress which need polling, please call fetch_poll().
+ *
+ * Fetchers without a poll function drive themselves from the scheduler,
+ * so the frontend need not spin while only they are active. */
+bool fetch_active;
 
 /** Information about a fetcher for a given scheme. */
 typedef struct scheme_fetcher_s {
@@ -66,6 +85,7 @@ typedef struct scheme_fetcher_s {
 	fetcher_abort_fetch abort_fetch;	/**< Abort a fetch. */
 	fetcher_free_fetch free_fetch;		/**< Free a fetch. */
 	fetcher_poll_fetcher poll_fetcher;	/**< Poll this fetcher. */
+	fetcher_preconnect preconnect;		/**< Prepare for fetches. */
 	fetcher_finalise finaliser;		/**< Clean up this fetcher. */
 	int refcount;				/**< When zero, clean up the fetcher. */
 	struct scheme_fetcher_s *next_fetcher;	/**< Next fetcher in the list. */
@@ -88,18 +108,71 @@ struct fetch {
 				     NULL if not set. */
 	void *fetcher_handle;	/**< The handle for the fetcher. */
 	bool fetch_is_active;	/**< This fetch is active. */
-	struct fetch *r_prev;	/**< Previous active fetch in ::fetch_ring. */
-	struct fetch *r_next;	/**< Next active fetch in ::fetch_ring. */
+	fetch_priority priority;	/**< Priority of fetch. */
+	struct fetch_host *host_entry;	/**< Per-host state for fetch. */
+	struct fetch *r_prev;	/**< Previous fetch in ::fetch_ring, or
+				     host's queue. */
+	struct fetch *r_next;	/**< Next fetch in ::fetch_ring, or host's
+				     queue. */
+};
+
+/** Fetch state for a single host. */
+struct fetch_host {
+	lwc_string *host;	/**< Host, interned, or NULL for fetches of
+				     URLs without a host. */
+	int active;		/**< Number of active fetches for host. */
+	int queued;		/**< Number of queued fetches for host. */
+	/** Rings of queued fetches for host, by priority. */
+	struct fetch *queue[FETCH_PRIORITY_COUNT];
+	/** Priority of ::host_ring host is on, or FETCH_PRIORITY_COUNT if
+	 *  none. */
+	fetch_priority ready;
+	struct fetch_host *next;	/**< Next host in hash chain. */
+	struct fetch_host *r_prev;	/**< Previous host in ::host_ring. */
+	struct fetch_host *r_next;	/**< Next host in ::host_ring. */
+};
+
+/** A host that has been preconnected to. */
+struct fetch_preconnect_host {
+	lwc_string *scheme;	/**< Scheme of preconnection, interned */
+	lwc_string *host;	/**< Host preconnected to, interned, or NULL
+				     if entry unused */
+	time_t when;		/**< Time of preconnection */
 };
 
+/** Number of hash chains for per-host fetch state */
+#define FETCH_HOST_HASH_SIZE 64
+
+/** Number of hosts remembered as having been preconnected to */
+#define FETCH_PRECONNECT_HOSTS 16
+
+/** Time before a host may be preconnected to again, in seconds */
+#define FETCH_PRECONNECT_INTERVAL 60
+
 static struct fetch *fetch_ring = 0;	/**< Ring of active fetches. */
-static struct fetch *queue_ring = 0;	/**< Ring of queued fetches */
+static int fetch_active_count = 0;	/**< Number of active fetches. */
+static int fetch_queued_count = 0;	/**< Number of queued fetches. */
+static int fetch_polled_count = 0;	/**< Number of active fetches whose
+					     fetcher needs polling. */
+
+/** Per-host fetch state, hashed by host */
+static struct fetch_host *fetch_hosts[FETCH_HOST_HASH_SIZE];
+/** Rings of hosts with queued fetches that may be dispatched, by the
+ *  priority of the most urgent fetch queued for them */
+static struct fetch_host *host_ring[FETCH_PRIORITY_COUNT];
+
+/** Hosts recently preconnected to, replaced oldest first */
+static struct fetch_preconnect_host fetch_preconnects[FETCH_PRECONNECT_HOSTS];
+static unsigned int fetch_preconnect_next = 0;	/**< Entry to replace next */
 
 #define fetch_ref_fetcher(F) F->refcount++
 static void fetch_unref_fetcher(scheme_fetcher *fetcher);
 static void fetch_dispatch_jobs(void);
 static bool fetch_choose_and_dispatch(void);
 static bool fetch_dispatch_job(struct fetch *fetch);
+static struct fetch_host *fetch_host_find(lwc_string *host);
+static struct fetch_host *fetch_host_get(lwc_string *host);
+static void fetch_host_update(struct fetch_host *h);
 
 /* Static lwc_strings */
 static lwc_string *fetch_http_lwc;
@@ -112,7 +185,11 @@ static lwc_string *fetch_https_lwc;
 
 void fetch_init(void)
 {
-	fetch_curl_register();
+	/* Serve http and https from recorded responses, if asked to */
+	if (nsoption_charp(fetch_replay_path) != NULL)
+		fetch_replay_register();
+	else
+		fetch_curl_register();
 	fetch_data_register();
 	fetch_file_register();
 	fetch_resource_register();
@@ -141,6 +218,8 @@ void fetch_init(void)
 
 void fetch_quit(void)
 {
+	unsigned int i;
+
 	while (fetchers != NULL) {
 		if (fetchers->refcount != 1) {
 			LOG(("Fetcher for scheme %s still active?!",
@@ -151,6 +230,14 @@ void fetch_quit(void)
 		fetch_unref_fetcher(fetchers);
 	}
 
+	for (i = 0; i < FETCH_PRECONNECT_HOSTS; i++) {
+		if (fetch_preconnects[i].host != NULL) {
+			lwc_string_unref(fetch_preconnects[i].scheme);
+			lwc_string_unref(fetch_preconnects[i].host);
+			fetch_preconnects[i].host = NULL;
+		}
+	}
+
 	lwc_string_unref(fetch_http_lwc);
 	lwc_string_unref(fetch_https_lwc);
 }
@@ -164,6 +251,7 @@ bool fetch_add_fetcher(lwc_string *scheme,
 		  fetcher_abort_fetch abort_fetch,
 		  fetcher_free_fetch free_fetch,
 		  fetcher_poll_fetcher poll_fetcher,
+		  fetcher_preconnect preconnect,
 		  fetcher_finalise finaliser)
 {
 	scheme_fetcher *new_fetcher;
@@ -182,6 +270,7 @@ bool fetch_add_fetcher(lwc_string *scheme,
 	new_fetcher->abort_fetch = abort_fetch;
 	new_fetcher->free_fetch = free_fetch;
 	new_fetcher->poll_fetcher = poll_fetcher;
+	new_fetcher->preconnect = preconnect;
 	new_fetcher->finaliser = finaliser;
 	new_fetcher->next_fetcher = fetchers;
 	fetchers = new_fetcher;
@@ -235,7 +324,8 @@ struct fetch * fetch_start(nsurl *url, nsurl *referer,
 			   fetch_callback callback,
 			   void *p, bool only_2xx, const char *post_urlenc,
 			   const struct fetch_multipart_data *post_multipart,
-			   bool verifiable, const char *headers[])
+			   bool verifiable, const char *headers[],
+			   fetch_priority priority)
 {
 	struct fetch *fetch;
 	scheme_fetcher *fetcher = fetchers;
@@ -268,6 +358,8 @@ struct fetch * fetch_start(nsurl *url, nsurl *referer,
 	fetch->fetcher_handle = NULL;
 	fetch->ops = NULL;
 	fetch->fetch_is_active = false;
+	fetch->priority = priority;
+	fetch->host_entry = NULL;
 	fetch->host = nsurl_get_component(url, NSURL_HOST);
         
 	if (referer != NULL) {
@@ -317,6 +409,11 @@ struct fetch * fetch_start(nsurl *url, nsurl *referer,
 	if (fetch->ops == NULL)
 		goto failed;
 
+	/* Find the state for the fetch's host */
+	fetch->host_entry = fetch_host_get(fetch->host);
+	if (fetch->host_entry == NULL)
+		goto failed;
+
 	/* Got a scheme fetcher, try and set up the fetch */
 	fetch->fetcher_handle = fetch->ops->setup_fetch(fetch, url,
 					only_2xx, post_urlenc,
@@ -331,16 +428,28 @@ struct fetch * fetch_start(nsurl *url, nsurl *referer,
 	/* these aren't needed past here */
 	lwc_string_unref(scheme);
 
-	/* Dump us in the queue and ask the queue to run. */
-	RING_INSERT(queue_ring, fetch);
+	/* Dump us in the host's queue and ask the queue to run. */
+	RING_INSERT(fetch->host_entry->queue[priority], fetch);
+	fetch->host_entry->queued++;
+	fetch_queued_count++;
+	fetch_host_update(fetch->host_entry);
 	fetch_dispatch_jobs();
 
+	/* If the fetch had to be queued, get a connection to its host ready
+	 * for when it is dispatched */
+	if (fetch->fetch_is_active == false)
+		fetch_preconnect(url);
+
 	return fetch;
 
 failed:
 	if (scheme != NULL)
 		lwc_string_unref(scheme);
 
+	/* Discard the host's state if nothing else is using it */
+	if (fetch->host_entry != NULL)
+		fetch_host_update(fetch->host_entry);
+
 	if (fetch->host != NULL)
 		lwc_string_unref(fetch->host);
 	if (fetch->url != NULL)
@@ -354,31 +463,144 @@ failed:
 }
 
 
+/**
+ * Find the fetch state for a host.
+ *
+ * \param host  Host to find state for, or NULL for URLs without a host
+ * \return Host's state, or NULL if it has no fetches
+ */
+struct fetch_host *fetch_host_find(lwc_string *host)
+{
+	struct fetch_host *h;
+	bool match;
+
+	h = fetch_hosts[host == NULL ? 0 : 
+			lwc_string_hash_value(host) % FETCH_HOST_HASH_SIZE];
+
+	for (; h != NULL; h = h->next) {
+		if (h->host == NULL || host == NULL) {
+			if (h->host == host)
+				return h;
+		} else if (lwc_string_isequal(h->host, host, 
+				&match) == lwc_error_ok && match == true) {
+			return h;
+		}
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Find the fetch state for a host, creating it if necessary.
+ *
+ * \param host  Host to find state for, or NULL for URLs without a host
+ * \return Host's state, or NULL on memory exhaustion
+ *
+ * Newly created state is discarded by fetch_host_update() if nothing is
+ * added to it.
+ */
+struct fetch_host *fetch_host_get(lwc_string *host)
+{
+	struct fetch_host **bucket, *h;
+
+	h = fetch_host_find(host);
+	if (h != NULL)
+		return h;
+
+	bucket = &fetch_hosts[host == NULL ? 0 : 
+			lwc_string_hash_value(host) % FETCH_HOST_HASH_SIZE];
+
+	h = calloc(1, sizeof(*h));
+	if (h == NULL)
+		return NULL;
+
+	h->host = (host != NULL) ? lwc_string_ref(host) : NULL;
+	h->ready = FETCH_PRIORITY_COUNT;
+	h->next = *bucket;
+	*bucket = h;
+
+	return h;
+}
+
+
+/**
+ * Bring a host's place on ::host_ring up to date with its fetches.
+ *
+ * \param h  Host to update
+ *
+ * Call this whenever a host's fetches are queued, dispatched or removed.
+ * A host with no fetches is discarded.
+ */
+void fetch_host_update(struct fetch_host *h)
+{
+	fetch_priority ready = FETCH_PRIORITY_COUNT;
+
+	if (h->queued > 0 && h->active < nsoption_int(max_fetchers_per_host)) {
+		/* Find the most urgent queued fetch */
+		for (ready = 0; h->queue[ready] == NULL; ready++)
+			;
+	}
+
+	if (ready != h->ready) {
+		if (h->ready != FETCH_PRIORITY_COUNT) {
+			RING_REMOVE(host_ring[h->ready], h);
+		}
+		if (ready != FETCH_PRIORITY_COUNT) {
+			RING_INSERT(host_ring[ready], h);
+		}
+		h->ready = ready;
+	}
+
+	if (h->queued == 0 && h->active == 0) {
+		struct fetch_host **link;
+
+		link = &fetch_hosts[h->host == NULL ? 0 : 
+				lwc_string_hash_value(h->host) % 
+				FETCH_HOST_HASH_SIZE];
+		while (*link != h)
+			link = &(*link)->next;
+		*link = h->next;
+
+		if (h->host != NULL)
+			lwc_string_unref(h->host);
+		free(h);
+	}
+}
+
+
 /**
  * Dispatch as many jobs as we have room to dispatch.
  */
 void fetch_dispatch_jobs(void)
 {
-	int all_active, all_queued;
 #ifdef DEBUG_FETCH_VERBOSE
-	struct fetch *q;
+	struct fetch_host *h;
 	struct fetch *f;
+	int i;
 #endif
 
-	if (!queue_ring)
+	if (fetch_queued_count == 0)
 		return; /* Nothing to do, the queue is empty */
-	RING_GETSIZE(struct fetch, queue_ring, all_queued);
-	RING_GETSIZE(struct fetch, fetch_ring, all_active);
 
 #ifdef DEBUG_FETCH_VERBOSE
-	LOG(("queue_ring %i, fetch_ring %i", all_queued, all_active));
-
-	q = queue_ring;
-	if (q) {
-		do {
-			LOG(("queue_ring: %s", q->url));
-			q = q->r_next;
-		} while (q != queue_ring);
+	LOG(("queued %i, fetch_ring %i", fetch_queued_count, 
+			fetch_active_count));
+
+	for (i = 0; i < FETCH_HOST_HASH_SIZE; i++) {
+		for (h = fetch_hosts[i]; h != NULL; h = h->next) {
+			fetch_priority p;
+
+			for (p = 0; p < FETCH_PRIORITY_COUNT; p++) {
+				f = h->queue[p];
+				if (f == NULL)
+					continue;
+				do {
+					LOG(("queued (%d): %s", p, f->url));
+					f = f->r_next;
+				} while (f != h->queue[p]);
+			}
+		}
 	}
 	f = fetch_ring;
 	if (f) {
@@ -389,20 +611,19 @@ void fetch_dispatch_jobs(void)
 	}
 #endif
 
-	while ( all_queued && all_active < nsoption_int(max_fetchers) ) {
-		/*LOG(("%d queued, %d fetching", all_queued, all_active));*/
-		if (fetch_choose_and_dispatch()) {
-			all_queued--;
-			all_active++;
-		} else {
+	while (fetch_queued_count > 0 && 
+			fetch_active_count < nsoption_int(max_fetchers)) {
+		/*LOG(("%d queued, %d fetching", fetch_queued_count, 
+				fetch_active_count));*/
+		if (fetch_choose_and_dispatch() == false) {
 			/* Either a dispatch failed or we ran out. Just stop */
 			break;
 		}
 	}
-	fetch_active = (all_active > 0);
+	fetch_active = (fetch_polled_count > 0);
 #ifdef DEBUG_FETCH_VERBOSE
-	LOG(("Fetch ring is now %d elements.", all_active));
-	LOG(("Queue ring is now %d elements.", all_queued));
+	LOG(("Fetch ring is now %d elements.", fetch_active_count));
+	LOG(("Queue is now %d elements.", fetch_queued_count));
 #endif
 }
 
@@ -413,34 +634,34 @@ void fetch_dispatch_jobs(void)
  *
  * We don't check the overall dispatch size here because we're not called unless
  * there is room in the fetch queue for us.
+ *
+ * The hosts on the most urgent non-empty ::host_ring are taken in turn, and
+ * the fetch at the head of the chosen host's queue at that priority is
+ * dispatched.
  */
 bool fetch_choose_and_dispatch(void)
 {
-	bool same_host;
-	struct fetch *queueitem;
-	queueitem = queue_ring;
-	do {
-		/* We can dispatch the selected item if there is room in the
-		 * fetch ring
-		 */
-		int countbyhost;
-		RING_COUNTBYLWCHOST(struct fetch, fetch_ring, countbyhost,
-				queueitem->host);
-		if (countbyhost < nsoption_int(max_fetchers_per_host)) {
-			/* We can dispatch this item in theory */
-			return fetch_dispatch_job(queueitem);
-		}
-		/* skip over other items with the same host */
-		same_host = true;
-		while (same_host == true && queueitem->r_next != queue_ring) {
-			if (lwc_string_isequal(queueitem->host,
-					queueitem->r_next->host, &same_host) ==
-					lwc_error_ok && same_host == true) {
-				queueitem = queueitem->r_next;
+	struct fetch_host *h;
+	fetch_priority p;
+
+	for (p = 0; p < FETCH_PRIORITY_COUNT; p++) {
+		while (host_ring[p] != NULL) {
+			h = host_ring[p];
+
+			/* Start with the following host next time */
+			host_ring[p] = h->r_next;
+
+			/* The per-host limit may have been changed since
+			 * the host was placed on the ring */
+			if (h->active >= nsoption_int(max_fetchers_per_host)) {
+				fetch_host_update(h);
+				continue;
 			}
+
+			return fetch_dispatch_job(h->queue[p]);
 		}
-		queueitem = queueitem->r_next;
-	} while (queueitem != queue_ring);
+	}
+
 	return false;
 }
 
@@ -450,22 +671,153 @@ bool fetch_choose_and_dispatch(void)
  */
 bool fetch_dispatch_job(struct fetch *fetch)
 {
-	RING_REMOVE(queue_ring, fetch);
+	struct fetch_host *h = fetch->host_entry;
+
+	RING_REMOVE(h->queue[fetch->priority], fetch);
 #ifdef DEBUG_FETCH_VERBOSE
 	LOG(("Attempting to start fetch %p, fetcher %p, url %s", fetch,
 			fetch->fetcher_handle, nsurl_access(fetch->url)));
 #endif
 	if (!fetch->ops->start_fetch(fetch->fetcher_handle)) {
-		RING_INSERT(queue_ring, fetch); /* Put it back on the end of the queue */
+		RING_INSERT(h->queue[fetch->priority], fetch); /* Put it back on the end of the queue */
 		return false;
 	} else {
 		RING_INSERT(fetch_ring, fetch);
 		fetch->fetch_is_active = true;
+		h->queued--;
+		fetch_queued_count--;
+		fetch_active_count++;
+		if (fetch->ops->poll_fetcher != NULL)
+			fetch_polled_count++;
+		h->active++;
+		fetch_host_update(h);
 		return true;
 	}
 }
 
 
+/**
+ * Change the priority of a fetch.
+ *
+ * \param fetch     Fetch to change priority of
+ * \param priority  New priority
+ *
+ * This only has an effect on fetches which are still queued.
+ */
+
+void fetch_set_priority(struct fetch *fetch, fetch_priority priority)
+{
+	struct fetch_host *h = fetch->host_entry;
+
+	if (fetch->fetch_is_active || h == NULL) {
+		fetch->priority = priority;
+		return;
+	}
+
+	if (fetch->priority == priority)
+		return;
+
+	/* Requeue at the new priority */
+	RING_REMOVE(h->queue[fetch->priority], fetch);
+	fetch->priority = priority;
+	RING_INSERT(h->queue[priority], fetch);
+
+	fetch_host_update(h);
+}
+
+
+/**
+ * Prepare for a fetch which is likely to be made soon.
+ *
+ * \param url  URL likely to be fetched
+ *
+ * If the URL's fetcher supports it, the host is resolved and a connection
+ * opened to it in the background, so the fetch doesn't have to wait for
+ * that when it starts.  Nothing is done for hosts which already have
+ * fetches active, or were preconnected to recently.  The fetcher limits
+ * how many preconnections may be in progress at once, according to
+ * ::option_max_preconnects.
+ */
+
+void fetch_preconnect(nsurl *url)
+{
+	scheme_fetcher *fetcher = fetchers;
+	struct fetch_preconnect_host *entry;
+	struct fetch_host *h;
+	lwc_string *scheme, *host;
+	time_t now = time(NULL);
+	bool match1, match2;
+	unsigned int i;
+
+	if (nsoption_int(max_preconnects) <= 0)
+		return;
+
+	host = nsurl_get_component(url, NSURL_HOST);
+	if (host == NULL)
+		return;
+
+	/* A host with active fetches already has connections open */
+	h = fetch_host_find(host);
+	if (h != NULL && h->active > 0) {
+		lwc_string_unref(host);
+		return;
+	}
+
+	scheme = nsurl_get_component(url, NSURL_SCHEME);
+	if (scheme == NULL) {
+		lwc_string_unref(host);
+		return;
+	}
+
+	for (i = 0; i < FETCH_PRECONNECT_HOSTS; i++) {
+		entry = &fetch_preconnects[i];
+
+		if (entry->host == NULL ||
+				now - entry->when >= FETCH_PRECONNECT_INTERVAL)
+			continue;
+
+		lwc_string_isequal(entry->host, host, &match1);
+		lwc_string_isequal(entry->scheme, scheme, &match2);
+		if (match1 == true && match2 == true)
+			goto done;
+	}
+
+	while (fetcher != NULL) {
+		lwc_string_isequal(fetcher->scheme_name, scheme, &match1);
+		if (match1 == true)
+			break;
+
+		fetcher = fetcher->next_fetcher;
+	}
+
+	if (fetcher == NULL || fetcher->preconnect == NULL ||
+			fetcher->preconnect(url) == false)
+		goto done;
+
+#ifdef DEBUG_FETCH_VERBOSE
+	LOG(("preconnecting to %s", lwc_string_data(host)));
+#endif
+
+	/* Remember the host, in place of the oldest entry */
+	entry = &fetch_preconnects[fetch_preconnect_next];
+	fetch_preconnect_next = (fetch_preconnect_next + 1) % 
+			FETCH_PRECONNECT_HOSTS;
+
+	if (entry->host != NULL) {
+		lwc_string_unref(entry->scheme);
+		lwc_string_unref(entry->host);
+	}
+
+	entry->scheme = lwc_string_ref(scheme);
+	entry->host = lwc_string_ref(host);
+	entry->when = now;
+
+done:
+	lwc_string_unref(scheme);
+	lwc_string_unref(host);
+}
+
+
 /**
  * Abort a fetch.
  */
@@ -672,7 +1024,7 @@ fetch_send_callback(const fetch_msg *msg, struct fetch *fetch)
 
 void fetch_remove_from_queues(struct fetch *fetch)
 {
-	int all_active, all_queued;
+	struct fetch_host *h = fetch->host_entry;
 
 	/* Go ahead and free the fetch properly now */
 #ifdef DEBUG_FETCH_VERBOSE
@@ -681,18 +1033,25 @@ void fetch_remove_from_queues(struct fetch *fetch)
 
 	if (fetch->fetch_is_active) {
 		RING_REMOVE(fetch_ring, fetch);
+		fetch_active_count--;
+		if (fetch->ops->poll_fetcher != NULL)
+			fetch_polled_count--;
+		h->active--;
 	} else {
-		RING_REMOVE(queue_ring, fetch);
+		RING_REMOVE(h->queue[fetch->priority], fetch);
+		h->queued--;
+		fetch_queued_count--;
 	}
 
-	RING_GETSIZE(struct fetch, fetch_ring, all_active);
-	RING_GETSIZE(struct fetch, queue_ring, all_queued);
+	/* This may discard the host's state */
+	fetch->host_entry = NULL;
+	fetch_host_update(h);
 
-	fetch_active = (all_active > 0);
+	fetch_active = (fetch_polled_count > 0);
 
 #ifdef DEBUG_FETCH_VERBOSE
-	LOG(("Fetch ring is now %d elements.", all_active));
-	LOG(("Queue ring is now %d elements.", all_queued));
+	LOG(("Fetch ring is now %d elements.", fetch_active_count));
+	LOG(("Queue is now %d elements.", fetch_queued_count));
 #endif
 }
 
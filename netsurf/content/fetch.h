@@ -93,6 +93,15 @@ struct ssl_cert_info {
 	int cert_type;		/**< Certificate type */
 };
 
+/** Fetch priorities, most urgent first */
+typedef enum {
+	FETCH_PRIORITY_DOCUMENT,	/**< Top-level documents */
+	FETCH_PRIORITY_STYLESHEET,	/**< Resources which block layout */
+	FETCH_PRIORITY_VISIBLE,		/**< Objects known to be visible */
+	FETCH_PRIORITY_NORMAL,		/**< Everything else */
+	FETCH_PRIORITY_COUNT		/**< Number of priorities */
+} fetch_priority;
+
 extern bool fetch_active;
 
 typedef void (*fetch_callback)(const fetch_msg *msg, void *p);
@@ -104,7 +113,9 @@ struct fetch * fetch_start(nsurl *url, nsurl *referer,
 		void *p, bool only_2xx, const char *post_urlenc,
 		const struct fetch_multipart_data *post_multipart,
 		bool verifiable,
-		const char *headers[]);
+		const char *headers[], fetch_priority priority);
+void fetch_set_priority(struct fetch *fetch, fetch_priority priority);
+void fetch_preconnect(nsurl *url);
 void fetch_abort(struct fetch *f);
 void fetch_poll(void);
 void fetch_quit(void);
@@ -133,6 +144,7 @@ typedef bool (*fetcher_start_fetch)(void *);
 typedef void (*fetcher_abort_fetch)(void *);
 typedef void (*fetcher_free_fetch)(void *);
 typedef void (*fetcher_poll_fetcher)(lwc_string *);
+typedef bool (*fetcher_preconnect)(nsurl *);
 typedef void (*fetcher_finalise)(lwc_string *);
 
 /** Register a fetcher for a scheme
@@ -145,6 +157,8 @@ typedef void (*fetcher_finalise)(lwc_string *);
  * \param abort_fetch	fetcher fetch abort function
  * \param free_fetch	fetcher fetch free function
  * \param poll_fetcher	fetcher poll function
+ * \param preconnect	fetcher preconnect function, or NULL if the fetcher
+ *			has no use for advance notice of fetches
  * \param finaliser	fetcher finaliser
  * \return true iff success
  */
@@ -156,6 +170,7 @@ bool fetch_add_fetcher(lwc_string *scheme,
                        fetcher_abort_fetch abort_fetch,
                        fetcher_free_fetch free_fetch,
                        fetcher_poll_fetcher poll_fetcher,
+                       fetcher_preconnect preconnect,
                        fetcher_finalise finaliser);
 
 void fetch_send_callback(const fetch_msg *msg, struct fetch *fetch);
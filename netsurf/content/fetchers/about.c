@@ -45,6 +45,7 @@
 #include "content/dirlist.h"
 #include "content/fetch.h"
 #include "content/fetchers/about.h"
+#include "content/llcache.h"
 #include "content/urldb.h"
 #include "desktop/netsurf.h"
 #include "desktop/options.h"
@@ -298,6 +299,72 @@ fetch_about_imagecache_handler_aborted:
 	return false;
 }
 
+/** Handler to generate about:llcache page.
+ *
+ * Shows details of the low-level cache
+ *
+ */
+static bool fetch_about_llcache_handler(struct fetch_about_context *ctx)
+{
+	fetch_msg msg;
+	char buffer[2048]; /* output buffer */
+	int code = 200;
+	int slen;
+
+	/* content is going to return ok */
+	fetch_set_http_code(ctx->fetchh, code);
+
+	/* content type */
+	if (fetch_about_send_header(ctx, "Content-Type: text/html"))
+		goto fetch_about_llcache_handler_aborted;
+
+	msg.type = FETCH_DATA;
+	msg.data.header_or_data.buf = (const uint8_t *) buffer;
+
+	/* page head */
+	slen = snprintf(buffer, sizeof buffer, 
+			"<html>\n<head>\n"
+			"<title>NetSurf Browser Resource Cache Status</title>\n"
+			"<link rel=\"stylesheet\" type=\"text/css\" "
+			"href=\"resource:internal.css\">\n"
+			"</head>\n"
+			"<body id =\"cachelist\">\n"
+			"<p class=\"banner\">"
+			"<a href=\"http://www.netsurf-browser.org/\">"
+			"<img src=\"resource:netsurf.png\" alt=\"NetSurf\"></a>"
+			"</p>\n"
+			"<h1>NetSurf Browser Resource Cache Status</h1>\n");
+	msg.data.header_or_data.len = slen;
+	if (fetch_about_send_callback(&msg, ctx))
+		goto fetch_about_llcache_handler_aborted;
+
+	/* low-level cache summary */
+	slen = llcache_snsummaryf(buffer, sizeof(buffer), 
+		"<p>Configured limit of %a</p>\n"
+		"<p>Total size in use %b (%c cached objects)</p>\n"
+		"<p>Peak size %d</p>\n"
+		"<p>Retrievals total/hit/revalidated/miss %e/%f/%g/%h "
+				"(%pf%%/%pg%%/%ph%%)</p>\n"
+		"<p>Retrievals loaded from backing store %i (%pi%%)</p>\n"
+		"<p>Objects evicted %j (total size %k)</p>\n"
+		"<p>Objects revalidated in the background %l</p>\n"
+		"</body>\n</html>\n");
+	if (slen < 0 || slen >= (int) (sizeof(buffer))) 
+		goto fetch_about_llcache_handler_aborted; /* overflow */
+
+	msg.data.header_or_data.len = slen;
+	if (fetch_about_send_callback(&msg, ctx))
+		goto fetch_about_llcache_handler_aborted;
+
+	msg.type = FETCH_FINISHED;
+	fetch_about_send_callback(&msg, ctx);
+
+	return true;
+
+fetch_about_llcache_handler_aborted:
+	return false;
+}
+
 /** Handler to generate about:config page */
 static bool fetch_about_config_handler(struct fetch_about_context *ctx)
 {
@@ -575,6 +642,9 @@ struct about_handlers about_handler_list[] = {
 	/* details about the image cache */
 	{ "imagecache", SLEN("imagecache"), NULL,
 			fetch_about_imagecache_handler, true },
+	/* details about the low-level cache */
+	{ "llcache", SLEN("llcache"), NULL,
+			fetch_about_llcache_handler, true },
 	/* The default blank page */
 	{ "blank", SLEN("blank"), NULL,
 			fetch_about_blank_handler, true } 
@@ -827,5 +897,6 @@ void fetch_about_register(void)
 		fetch_about_abort,
 		fetch_about_free,
 		fetch_about_poll,
+		NULL,
 		fetch_about_finalise);
 }
@@ -26,6 +26,10 @@
  *
  * The CURL handles are cached in the curl_handle_ring. There are at most
  * ::max_cached_fetch_handles in this ring.
+ *
+ * Handles opening connections ahead of fetches are held in the
+ * curl_preconnect_ring until they complete.  There are at most
+ * ::max_preconnects in this ring.
  */
 
 #include <assert.h>
@@ -43,6 +47,7 @@
 #include <openssl/ssl.h>
 #include "content/fetch.h"
 #include "content/fetchers/curl.h"
+#include "content/fetchers/replay.h"
 #include "content/urldb.h"
 #include "desktop/netsurf.h"
 #include "desktop/options.h"
@@ -91,6 +96,7 @@ struct curl_fetch_info {
 #define MAX_CERTS 10
 	struct cert_info cert_data[MAX_CERTS];	/**< HTTPS certificate data */
 	unsigned int last_progress_update;	/**< Time of last progress update */
+	struct fetch_replay_record *record;	/**< Response recording, or 0 */
 };
 
 struct cache_handle {
@@ -105,6 +111,8 @@ CURLM *fetch_curl_multi;		/**< Global cURL multi handle. */
 /** Curl handle with default options set; not used for transfers. */
 static CURL *fetch_blank_curl;
 static struct cache_handle *curl_handle_ring = 0; /**< Ring of cached handles */
+/** Ring of handles opening connections ahead of fetches */
+static struct cache_handle *curl_preconnect_ring = 0;
 static int curl_fetchers_registered = 0;
 static bool curl_with_openssl;
 
@@ -119,6 +127,8 @@ static void * fetch_curl_setup(struct fetch *parent_fetch, nsurl *url,
 		 const struct fetch_multipart_data *post_multipart,
 		 const char **headers);
 static bool fetch_curl_start(void *vfetch);
+static bool fetch_curl_preconnect(nsurl *url);
+static bool fetch_curl_preconnect_done(CURL *handle);
 static bool fetch_curl_initiate_fetch(struct curl_fetch_info *fetch,
 		CURL *handle);
 static CURL *fetch_curl_get_handle(lwc_string *host);
@@ -129,7 +139,17 @@ static CURLcode fetch_curl_sslctxfun(CURL *curl_handle, void *_sslctx,
 static void fetch_curl_abort(void *vf);
 static void fetch_curl_stop(struct curl_fetch_info *f);
 static void fetch_curl_free(void *f);
+static void fetch_curl_process_messages(void);
+#ifndef WITH_SCHEDULE_FD
 static void fetch_curl_poll(lwc_string *scheme_ignored);
+static void fetch_curl_preconnect_poll(void *p);
+#else
+static int fetch_curl_socket(CURL *easy, curl_socket_t s, int what,
+		void *userp, void *socketp);
+static int fetch_curl_timer(CURLM *multi, long timeout_ms, void *userp);
+static void fetch_curl_socket_ready(int fd, int events, void *p);
+static void fetch_curl_timeout(void *p);
+#endif
 static void fetch_curl_done(CURL *curl_handle, CURLcode result);
 static int fetch_curl_progress(void *clientp, double dltotal, double dlnow,
 		double ultotal, double ulnow);
@@ -140,6 +160,8 @@ static int fetch_curl_ignore_debug(CURL *handle,
 				   void *userptr);
 static size_t fetch_curl_data(char *data, size_t size, size_t nmemb,
 			      void *_f);
+static size_t fetch_curl_discard(char *data, size_t size, size_t nmemb,
+				 void *p);
 static size_t fetch_curl_header(char *data, size_t size, size_t nmemb,
 				void *_f);
 static bool fetch_curl_process_headers(struct curl_fetch_info *f);
@@ -160,6 +182,9 @@ static int fetch_curl_cert_verify_callback(X509_STORE_CTX *x509_ctx,
 void fetch_curl_register(void)
 {
 	CURLcode code;
+#ifdef WITH_SCHEDULE_FD
+	CURLMcode codem;
+#endif
 	curl_version_info_data *data;
 	int i;
 	lwc_string *scheme;
@@ -176,6 +201,20 @@ void fetch_curl_register(void)
 		die("Failed to initialise the fetch module "
 				"(curl_multi_init failed).");
 
+#ifdef WITH_SCHEDULE_FD
+	/* Have cURL tell us which sockets to wait on and when it next needs
+	 * to run, so fetches progress as soon as data arrives, without
+	 * polling. */
+	codem = curl_multi_setopt(fetch_curl_multi, CURLMOPT_SOCKETFUNCTION,
+			fetch_curl_socket);
+	if (codem == CURLM_OK)
+		codem = curl_multi_setopt(fetch_curl_multi,
+				CURLMOPT_TIMERFUNCTION, fetch_curl_timer);
+	if (codem != CURLM_OK)
+		die("Failed to initialise the fetch module "
+				"(curl_multi_setopt failed).");
+#endif
+
 	/* Create a curl easy handle with the options that are common to all
 	   fetches. */
 	fetch_blank_curl = curl_easy_init();
@@ -259,11 +298,12 @@ void fetch_curl_register(void)
 				fetch_curl_start,
 				fetch_curl_abort,
 				fetch_curl_free,
-#ifdef FETCHER_CURLL_SCHEDULED
+#if defined(FETCHER_CURLL_SCHEDULED) || defined(WITH_SCHEDULE_FD)
 				       NULL,
 #else
 				fetch_curl_poll,
 #endif
+				fetch_curl_preconnect,
 				fetch_curl_finalise)) {
 			LOG(("Unable to register cURL fetcher for %s",
 					data->protocols[i]));
@@ -306,6 +346,18 @@ void fetch_curl_finalise(lwc_string *scheme)
 
 		curl_easy_cleanup(fetch_blank_curl);
 
+		/* Abandon any connections still being opened */
+		while (curl_preconnect_ring != NULL) {
+			h = curl_preconnect_ring;
+			fetch_curl_preconnect_done(h->handle);
+		}
+
+#ifdef WITH_SCHEDULE_FD
+		schedule_remove(fetch_curl_timeout, NULL);
+#else
+		schedule_remove(fetch_curl_preconnect_poll, NULL);
+#endif
+
 		codem = curl_multi_cleanup(fetch_curl_multi);
 		if (codem != CURLM_OK)
 			LOG(("curl_multi_cleanup failed: ignoring"));
@@ -387,6 +439,7 @@ void * fetch_curl_setup(struct fetch *parent_fetch, nsurl *url,
 		fetch->post_multipart = fetch_curl_post_convert(post_multipart);
 	memset(fetch->cert_data, 0, sizeof(fetch->cert_data));
 	fetch->last_progress_update = 0;
+	fetch->record = NULL;
 
 	if (fetch->host == NULL ||
 		(post_multipart != NULL && fetch->post_multipart == NULL) ||
@@ -483,16 +536,171 @@ bool fetch_curl_initiate_fetch(struct curl_fetch_info *fetch, CURL *handle)
 		return false;
 	}
 
+	/* Record the response, if wanted.  Only GET requests are replayed */
+	if (fetch->post_urlenc == NULL && fetch->post_multipart == NULL)
+		fetch->record = fetch_replay_record_start(fetch->url);
+
 	/* add to the global curl multi handle */
 	codem = curl_multi_add_handle(fetch_curl_multi, fetch->curl_handle);
 	assert(codem == CURLM_OK || codem == CURLM_CALL_MULTI_PERFORM);
-	
+
+#ifndef WITH_SCHEDULE_FD
+	/* In socket mode, adding the handle sets cURL's timer instead */
 	schedule(1, (schedule_callback_fn)fetch_curl_poll, NULL);
+#endif
 	
 	return true;
 }
 
 
+/**
+ * Open a connection to a URL's host, ahead of fetches from it.
+ *
+ * A HEAD request is made for the root of the host.  Once it completes, the
+ * connection is left in cURL's connection cache, where the fetches will
+ * find it.  (Connections opened with CURLOPT_CONNECT_ONLY aren't reused by
+ * cURL for later transfers, so that isn't any use.)
+ *
+ * This will return whether or not the connection is being opened.
+ */
+
+bool fetch_curl_preconnect(nsurl *url)
+{
+	struct cache_handle *h;
+	lwc_string *host;
+	CURLcode code;
+	CURLMcode codem;
+	char *origin;
+	size_t len;
+	int c;
+
+	/* Fetches share connections to the proxy anyway, and a request
+	 * through it would fetch from the host, not just connect to it */
+	if (nsoption_bool(http_proxy) &&
+	    (nsoption_charp(http_proxy_host) != NULL))
+		return false;
+
+	RING_GETSIZE(struct cache_handle, curl_preconnect_ring, c);
+	if (c >= nsoption_int(max_preconnects))
+		return false;
+
+	host = nsurl_get_component(url, NSURL_HOST);
+	if (host == NULL)
+		return false;
+
+	RING_FINDBYLWCHOST(curl_preconnect_ring, h, host);
+	if (h != NULL) {
+		/* Already connecting to this host */
+		lwc_string_unref(host);
+		return false;
+	}
+
+	h = malloc(sizeof(struct cache_handle));
+	if (h == NULL) {
+		lwc_string_unref(host);
+		return false;
+	}
+	h->host = host;
+
+	if (nsurl_get(url, NSURL_SCHEME | NSURL_HOST | NSURL_PORT,
+			&origin, &len) != NSERROR_OK) {
+		lwc_string_unref(h->host);
+		free(h);
+		return false;
+	}
+
+	h->handle = curl_easy_duphandle(fetch_blank_curl);
+	if (h->handle == NULL) {
+		free(origin);
+		lwc_string_unref(h->host);
+		free(h);
+		return false;
+	}
+
+#undef SETOPT
+#define SETOPT(option, value) { \
+	code = curl_easy_setopt(h->handle, option, value);	\
+	if (code != CURLE_OK)					\
+		goto failed;					\
+	}
+
+	/* cURL will only reuse the connection for fetches with matching
+	 * SSL verification settings, so these must be as
+	 * fetch_curl_set_options() will set them */
+	SETOPT(CURLOPT_URL, origin);
+	SETOPT(CURLOPT_NOBODY, 1L);
+	SETOPT(CURLOPT_WRITEFUNCTION, fetch_curl_discard);
+	SETOPT(CURLOPT_HEADERFUNCTION, fetch_curl_discard);
+	SETOPT(CURLOPT_NOPROGRESS, 1L);
+	SETOPT(CURLOPT_TIMEOUT, 30L);
+	if (urldb_nsurl_get_cert_permissions(url)) {
+		SETOPT(CURLOPT_SSL_VERIFYPEER, 0L);
+		SETOPT(CURLOPT_SSL_VERIFYHOST, 0L);
+	} else {
+		SETOPT(CURLOPT_SSL_VERIFYPEER, 1L);
+		SETOPT(CURLOPT_SSL_VERIFYHOST, 2L);
+	}
+
+	codem = curl_multi_add_handle(fetch_curl_multi, h->handle);
+	if (codem != CURLM_OK && codem != CURLM_CALL_MULTI_PERFORM)
+		goto failed;
+
+	free(origin);
+
+	LOG(("preconnecting to %s", lwc_string_data(h->host)));
+
+	RING_INSERT(curl_preconnect_ring, h);
+
+#ifndef WITH_SCHEDULE_FD
+	/* There may be no fetches to keep cURL polled, so do it ourselves
+	 * until the connection is made */
+	schedule_remove(fetch_curl_preconnect_poll, NULL);
+	schedule(1, fetch_curl_preconnect_poll, NULL);
+#endif
+
+	return true;
+
+failed:
+	curl_easy_cleanup(h->handle);
+	free(origin);
+	lwc_string_unref(h->host);
+	free(h);
+	return false;
+}
+
+
+/**
+ * Clean up after opening a connection ahead of fetches.
+ *
+ * \param handle  cURL handle which has finished
+ * \return true iff \a handle was opening a connection ahead of fetches
+ */
+
+bool fetch_curl_preconnect_done(CURL *handle)
+{
+	struct cache_handle *h = curl_preconnect_ring;
+
+	if (h == NULL)
+		return false;
+
+	while (h->handle != handle) {
+		h = h->r_next;
+		if (h == curl_preconnect_ring)
+			return false;
+	}
+
+	/* The connection stays in cURL's cache after the handle goes */
+	curl_multi_remove_handle(fetch_curl_multi, handle);
+	curl_easy_cleanup(handle);
+
+	RING_REMOVE(curl_preconnect_ring, h);
+	lwc_string_unref(h->host);
+	free(h);
+
+	return true;
+}
+
+
 /**
  * Find a CURL handle to use to dispatch a job
  */
@@ -598,14 +806,14 @@ fetch_curl_set_options(struct curl_fetch_info *f)
 		SETOPT(CURLOPT_HTTPGET, 1L);
 	}
 
-	f->cookie_string = urldb_get_cookie(nsurl_access(f->url));
+	f->cookie_string = urldb_nsurl_get_cookie(f->url);
 	if (f->cookie_string) {
 		SETOPT(CURLOPT_COOKIE, f->cookie_string);
 	} else {
 		SETOPT(CURLOPT_COOKIE, NULL);
 	}
 
-	if ((auth = urldb_get_auth_details(nsurl_access(f->url), NULL)) != NULL) {
+	if ((auth = urldb_nsurl_get_auth_details(f->url, NULL)) != NULL) {
 		SETOPT(CURLOPT_HTTPAUTH, CURLAUTH_ANY);
 		SETOPT(CURLOPT_USERPWD, auth);
 	} else {
@@ -634,7 +842,7 @@ fetch_curl_set_options(struct curl_fetch_info *f)
 		SETOPT(CURLOPT_PROXY, NULL);
 	}
 
-	if (urldb_get_cert_permissions(nsurl_access(f->url))) {
+	if (urldb_nsurl_get_cert_permissions(f->url)) {
 		/* Disable certificate verification */
 		SETOPT(CURLOPT_SSL_VERIFYPEER, 0L);
 		SETOPT(CURLOPT_SSL_VERIFYHOST, 0L);
@@ -727,6 +935,8 @@ void fetch_curl_free(void *vf)
 
 	if (f->curl_handle)
 		curl_easy_cleanup(f->curl_handle);
+	if (f->record)
+		fetch_replay_record_finish(f->record, f->http_code, false);
 	nsurl_unref(f->url);
 	lwc_string_unref(f->host);
 	free(f->location);
@@ -748,6 +958,7 @@ void fetch_curl_free(void *vf)
 }
 
 
+#ifndef WITH_SCHEDULE_FD
 /**
  * Do some work on current fetches.
  *
@@ -756,9 +967,8 @@ void fetch_curl_free(void *vf)
 
 void fetch_curl_poll(lwc_string *scheme_ignored)
 {
-	int running, queue;
+	int running;
 	CURLMcode codem;
-	CURLMsg *curl_msg;
 	
 	/* do any possible work on the current fetches */
 	do {
@@ -771,11 +981,46 @@ void fetch_curl_poll(lwc_string *scheme_ignored)
 		}
 	} while (codem == CURLM_CALL_MULTI_PERFORM);
 
-	/* process curl results */
+	fetch_curl_process_messages();
+
+#ifdef FETCHER_CURLL_SCHEDULED
+	if (running != 0) {
+		schedule(1, (schedule_callback_fn)fetch_curl_poll, fetch_curl_poll);
+	}
+#endif
+}
+
+
+/**
+ * Keep cURL polled while connections are being opened ahead of fetches.
+ */
+
+void fetch_curl_preconnect_poll(void *p)
+{
+	fetch_curl_poll(NULL);
+
+	if (curl_preconnect_ring != NULL)
+		schedule(5, fetch_curl_preconnect_poll, NULL);
+}
+#endif
+
+
+/**
+ * Process the results of completed fetches.
+ */
+
+void fetch_curl_process_messages(void)
+{
+	int queue;
+	CURLMsg *curl_msg;
+
 	curl_msg = curl_multi_info_read(fetch_curl_multi, &queue);
 	while (curl_msg) {
 		switch (curl_msg->msg) {
 			case CURLMSG_DONE:
+				if (fetch_curl_preconnect_done(
+						curl_msg->easy_handle))
+					break;
 				fetch_curl_done(curl_msg->easy_handle,
 						curl_msg->data.result);
 				break;
@@ -784,15 +1029,108 @@ void fetch_curl_poll(lwc_string *scheme_ignored)
 		}
 		curl_msg = curl_multi_info_read(fetch_curl_multi, &queue);
 	}
+}
 
-#ifdef FETCHER_CURLL_SCHEDULED
-	if (running != 0) {
-		schedule(1, (schedule_callback_fn)fetch_curl_poll, fetch_curl_poll);
+
+#ifdef WITH_SCHEDULE_FD
+/**
+ * Callback from cURL to change which conditions a socket is watched for.
+ */
+
+int fetch_curl_socket(CURL *easy, curl_socket_t s, int what,
+		void *userp, void *socketp)
+{
+	int events;
+
+	switch (what) {
+	case CURL_POLL_IN:
+		events = SCHEDULE_FD_READ;
+		break;
+	case CURL_POLL_OUT:
+		events = SCHEDULE_FD_WRITE;
+		break;
+	case CURL_POLL_INOUT:
+		events = SCHEDULE_FD_READ | SCHEDULE_FD_WRITE;
+		break;
+	case CURL_POLL_REMOVE:
+		schedule_fd_remove(s);
+		return 0;
+	default:
+		return 0;
 	}
-#endif
+
+	if (schedule_fd(s, events, fetch_curl_socket_ready, NULL) == false)
+		LOG(("Unable to watch socket %d", s));
+
+	return 0;
 }
 
 
+/**
+ * Callback from cURL to set when it next needs to run.
+ */
+
+int fetch_curl_timer(CURLM *multi, long timeout_ms, void *userp)
+{
+	schedule_remove(fetch_curl_timeout, NULL);
+
+	/* A negative timeout cancels the timer */
+	if (timeout_ms >= 0)
+		schedule((timeout_ms + 9) / 10, fetch_curl_timeout, NULL);
+
+	return 0;
+}
+
+
+/**
+ * Do work on the fetches using a socket which has become ready.
+ */
+
+void fetch_curl_socket_ready(int fd, int events, void *p)
+{
+	int action = 0;
+	int running;
+	CURLMcode codem;
+
+	if (events & SCHEDULE_FD_READ)
+		action |= CURL_CSELECT_IN;
+	if (events & SCHEDULE_FD_WRITE)
+		action |= CURL_CSELECT_OUT;
+	if (events & SCHEDULE_FD_ERROR)
+		action |= CURL_CSELECT_ERR;
+
+	codem = curl_multi_socket_action(fetch_curl_multi, fd, action,
+			&running);
+	if (codem != CURLM_OK) {
+		LOG(("curl_multi_socket_action: %i %s",
+				codem, curl_multi_strerror(codem)));
+	}
+
+	fetch_curl_process_messages();
+}
+
+
+/**
+ * Do work on the fetches whose cURL timeouts have expired.
+ */
+
+void fetch_curl_timeout(void *p)
+{
+	int running;
+	CURLMcode codem;
+
+	codem = curl_multi_socket_action(fetch_curl_multi,
+			CURL_SOCKET_TIMEOUT, 0, &running);
+	if (codem != CURLM_OK) {
+		LOG(("curl_multi_socket_action: %i %s",
+				codem, curl_multi_strerror(codem)));
+	}
+
+	fetch_curl_process_messages();
+}
+#endif
+
+
 /**
  * Handle a completed fetch (CURLMSG_DONE from curl_multi_info_read()).
  *
@@ -860,6 +1198,16 @@ void fetch_curl_done(CURL *curl_handle, CURLcode result)
 		error = true;
 	}
 
+	if (f->record) {
+		/* Keep complete responses, and redirects, whose bodies
+		 * aren't read */
+		bool keep = !abort_fetch && (finished ||
+				(300 <= f->http_code && f->http_code < 400 &&
+				f->http_code != 304 && f->location != NULL));
+		fetch_replay_record_finish(f->record, f->http_code, keep);
+		f->record = NULL;
+	}
+
 	fetch_curl_stop(f);
 
 	if (abort_fetch)
@@ -1054,6 +1402,10 @@ size_t fetch_curl_data(char *data, size_t size, size_t nmemb,
 		return 0;
 	}
 
+	if (f->record)
+		fetch_replay_record_data(f->record, (const uint8_t *) data,
+				size * nmemb);
+
 	/* send data to the caller */
 	msg.type = FETCH_DATA;
 	msg.data.header_or_data.buf = (const uint8_t *) data;
@@ -1069,6 +1421,16 @@ size_t fetch_curl_data(char *data, size_t size, size_t nmemb,
 }
 
 
+/**
+ * Callback function for cURL, for transfers whose data isn't wanted.
+ */
+
+size_t fetch_curl_discard(char *data, size_t size, size_t nmemb, void *p)
+{
+	return size * nmemb;
+}
+
+
 /**
  * Callback function for headers.
  *
@@ -1088,6 +1450,10 @@ size_t fetch_curl_header(char *data, size_t size, size_t nmemb,
 		return 0;
 	}
 
+	if (f->record)
+		fetch_replay_record_header(f->record, (const uint8_t *) data,
+				size);
+
 	msg.type = FETCH_HEADER;
 	msg.data.header_or_data.buf = (const uint8_t *) data;
 	msg.data.header_or_data.len = size;
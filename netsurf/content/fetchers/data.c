@@ -341,5 +341,6 @@ void fetch_data_register(void)
 		fetch_data_abort,
 		fetch_data_free,
 		fetch_data_poll,
+		NULL,
 		fetch_data_finalise);
 }
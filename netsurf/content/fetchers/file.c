@@ -49,9 +49,17 @@
 #include "utils/utils.h"
 #include "utils/ring.h"
 
+#ifdef WITH_MMAP
+#include <sys/mman.h>
+#endif
+
 /* Maximum size of read buffer */
 #define FETCH_FILE_MAX_BUF_SIZE (1024 * 1024)
 
+/* Minimum size of file to map rather than read.  Reading smaller files is
+ * cheaper than setting up and tearing down a mapping. */
+#define FETCH_FILE_MIN_MAP_SIZE (64 * 1024)
+
 /** Context for a fetch */
 struct fetch_file_context {
 	struct fetch_file_context *r_next, *r_prev;
@@ -245,6 +253,91 @@ fetch_file_process_error_aborted:
 }
 
 
+/** Send the headers for a file's contents */
+static bool fetch_file_send_plain_headers(struct fetch_file_context *ctx,
+					  struct stat *fdstat)
+{
+	/* content type */
+	if (fetch_file_send_header(ctx, "Content-Type: %s", 
+			fetch_filetype(ctx->path)))
+		return true;
+
+	/* content length */
+	if (fetch_file_send_header(ctx, "Content-Length: %zd", fdstat->st_size))
+		return true;
+
+	/* create etag */
+	if (fetch_file_send_header(ctx, "ETag: \"%10" PRId64 "\"", 
+			(int64_t) fdstat->st_mtime))
+		return true;
+
+	return false;
+}
+
+#ifdef WITH_MMAP
+/**
+ * Process object as a regular file, by mapping it
+ *
+ * The file is sent in FETCH_DATA messages straight from the mapping, so
+ * it is copied once rather than read through a buffer first.
+ * The mapping is removed before returning, so nothing refers to it once
+ * the fetch has finished.
+ *
+ * Touching a page beyond the end of a file which has been truncated since
+ * it was mapped raises SIGBUS.  Keeping the mapping any longer, such as
+ * handing it to the cache, would leave the browser open to that for as
+ * long as the object lived.  As it is, the file would have to be truncated
+ * while the fetch callback copies it.
+ *
+ * \return true if the fetch was processed, false if the file can't be
+ *         mapped and should be read instead
+ */
+static bool fetch_file_process_mapped(struct fetch_file_context *ctx,
+				      int fd, struct stat *fdstat)
+{
+	fetch_msg msg;
+	size_t offset, len;
+	void *map;
+
+	/* Devices, pipes and the like can't be relied upon to map */
+	if (S_ISREG(fdstat->st_mode) == 0 ||
+			fdstat->st_size < FETCH_FILE_MIN_MAP_SIZE ||
+			(uintmax_t) fdstat->st_size > SIZE_MAX)
+		return false;
+
+	map = mmap(NULL, fdstat->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED)
+		return false;
+
+	/* fetch is going to be successful */
+	fetch_set_http_code(ctx->fetchh, 200);
+
+	if (fetch_file_send_plain_headers(ctx, fdstat))
+		goto fetch_file_process_mapped_aborted;
+
+	/* Send the data in the same size pieces as reading would, so the
+	 * recipient needn't allocate room for the whole file at once */
+	msg.type = FETCH_DATA;
+	for (offset = 0; offset < (size_t) fdstat->st_size; offset += len) {
+		len = min(fdstat->st_size - offset, FETCH_FILE_MAX_BUF_SIZE);
+
+		msg.data.header_or_data.buf = (const uint8_t *) map + offset;
+		msg.data.header_or_data.len = len;
+		if (fetch_file_send_callback(&msg, ctx))
+			goto fetch_file_process_mapped_aborted;
+	}
+
+	msg.type = FETCH_FINISHED;
+	fetch_file_send_callback(&msg, ctx);
+
+fetch_file_process_mapped_aborted:
+
+	munmap(map, fdstat->st_size);
+
+	return true;
+}
+#endif
+
 /** Process object as a regular file */
 static void fetch_file_process_plain(struct fetch_file_context *ctx,
 				     struct stat *fdstat)
@@ -274,6 +367,13 @@ static void fetch_file_process_plain(struct fetch_file_context *ctx,
 		return;
 	}
 
+#ifdef WITH_MMAP
+	if (fetch_file_process_mapped(ctx, fd, fdstat)) {
+		close(fd);
+		return;
+	}
+#endif
+
 	/* set buffer size */
 	buf_size = fdstat->st_size;
 	if (buf_size > FETCH_FILE_MAX_BUF_SIZE)
@@ -298,18 +398,7 @@ static void fetch_file_process_plain(struct fetch_file_context *ctx,
 	 * fetch_file_send_callback().
 	 */
 
-	/* content type */
-	if (fetch_file_send_header(ctx, "Content-Type: %s", 
-			fetch_filetype(ctx->path)))
-		goto fetch_file_process_aborted;
-
-	/* content length */
-	if (fetch_file_send_header(ctx, "Content-Length: %zd", fdstat->st_size))
-		goto fetch_file_process_aborted;
-
-	/* create etag */
-	if (fetch_file_send_header(ctx, "ETag: \"%10" PRId64 "\"", 
-			(int64_t) fdstat->st_mtime))
+	if (fetch_file_send_plain_headers(ctx, fdstat))
 		goto fetch_file_process_aborted;
 
 	/* main data loop */
@@ -656,5 +745,6 @@ void fetch_file_register(void)
 		fetch_file_abort,
 		fetch_file_free,
 		fetch_file_poll,
+		NULL,
 		fetch_file_finalise);
 }
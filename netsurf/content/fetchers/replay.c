@@ -0,0 +1,667 @@
+/*
+ * Copyright 2012 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Recorded HTTP response fetcher (implementation).
+ *
+ * Each archive file is named by a hash of its URL and has the form:
+ *
+ *   URL <url>
+ *   STATUS <code>
+ *   HEADER <header line>	(repeated)
+ *   DATA <ms> <length>		(repeated)
+ *   <length bytes of body data>
+ *
+ * where every line ends with a newline, including the body data, and
+ * <ms> is the time in milliseconds from the start of the fetch at which
+ * the chunk of body data arrived.
+ */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/time.h>
+
+#include <libwapcaplet/libwapcaplet.h>
+
+#include "utils/config.h"
+#include "content/fetch.h"
+#include "content/fetchers/replay.h"
+#include "desktop/options.h"
+#include "utils/chunkbuf.h"
+#include "utils/log.h"
+#include "utils/messages.h"
+#include "utils/nsurl.h"
+#include "utils/ring.h"
+#include "utils/utils.h"
+
+/** Length of an archive file's name, excluding the terminator */
+#define REPLAY_NAME_LEN 16
+
+/** A response being recorded */
+struct fetch_replay_record {
+	char *url;			/**< URL being fetched */
+	unsigned int start;		/**< Time recording began / ms */
+	struct chunkbuf headers;	/**< Header lines, in archive form */
+	struct chunkbuf body;		/**< Body chunks, in archive form */
+	bool failed;			/**< Recording ran out of memory */
+};
+
+/** Context for a fetch being replayed */
+struct fetch_replay_context {
+	struct fetch *parent_fetch;	/**< Fetch we're providing data for */
+	nsurl *url;			/**< URL being fetched */
+	bool only_2xx;			/**< Only HTTP 2xx responses wanted */
+
+	uint8_t *archive;		/**< Archive file contents, or NULL */
+	size_t archive_len;		/**< Byte length of archive */
+	size_t pos;			/**< Offset of next item in archive */
+
+	bool active;			/**< Fetch has been started */
+	bool had_headers;		/**< Headers have been sent */
+	unsigned int start;		/**< Time fetch began / ms */
+
+	bool aborted;			/**< Fetch has been aborted */
+	bool locked;			/**< Context is in a callback */
+
+	struct fetch_replay_context *r_next, *r_prev;
+};
+
+static struct fetch_replay_context *ring = NULL;
+
+static unsigned int fetch_replay_time(void);
+static void fetch_replay_archive_name(const char *url, char *name);
+static char *fetch_replay_archive_path(const char *dir, const char *url,
+		const char *suffix);
+static bool fetch_replay_line(struct fetch_replay_context *c,
+		const char **line, size_t *len);
+static bool fetch_replay_load(struct fetch_replay_context *c, long *code);
+static bool fetch_replay_process(struct fetch_replay_context *c);
+
+
+/**
+ * Get the current time in milliseconds, modulo wrapping
+ */
+
+unsigned int fetch_replay_time(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+
+	return tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+/**
+ * Compute the name of the archive file for a URL
+ *
+ * \param url   URL to name file for
+ * \param name  Buffer of REPLAY_NAME_LEN + 1 bytes to receive name
+ *
+ * The name is a 64-bit FNV-1a hash of the URL, which is stable between
+ * runs, unlike nsurl_hash().
+ */
+
+void fetch_replay_archive_name(const char *url, char *name)
+{
+	uint64_t hash = UINT64_C(0xcbf29ce484222325);
+
+	for (; *url != '\0'; url++) {
+		hash ^= (uint8_t) *url;
+		hash *= UINT64_C(0x100000001b3);
+	}
+
+	snprintf(name, REPLAY_NAME_LEN + 1, "%016" PRIx64, hash);
+}
+
+
+/**
+ * Build the path of the archive file for a URL
+ *
+ * \param dir     Archive directory
+ * \param url     URL to find file for
+ * \param suffix  Suffix to append to the file name
+ * \return Path, which the caller must free, or NULL on memory exhaustion
+ */
+
+char *fetch_replay_archive_path(const char *dir, const char *url,
+		const char *suffix)
+{
+	char name[REPLAY_NAME_LEN + 1];
+	size_t len;
+	char *path;
+
+	fetch_replay_archive_name(url, name);
+
+	len = strlen(dir) + 1 + REPLAY_NAME_LEN + strlen(suffix) + 1;
+	path = malloc(len);
+	if (path == NULL)
+		return NULL;
+
+	snprintf(path, len, "%s/%s%s", dir, name, suffix);
+
+	return path;
+}
+
+
+/* Recording */
+
+struct fetch_replay_record *fetch_replay_record_start(nsurl *url)
+{
+	struct fetch_replay_record *record;
+
+	if (nsoption_charp(fetch_record_path) == NULL)
+		return NULL;
+
+	record = calloc(1, sizeof(*record));
+	if (record == NULL)
+		return NULL;
+
+	record->url = strdup(nsurl_access(url));
+	if (record->url == NULL) {
+		free(record);
+		return NULL;
+	}
+
+	record->start = fetch_replay_time();
+
+	return record;
+}
+
+void fetch_replay_record_header(struct fetch_replay_record *record,
+		const uint8_t *data, size_t len)
+{
+	/* Strip the line ending */
+	while (len > 0 && (data[len - 1] == '\r' || data[len - 1] == '\n'))
+		len--;
+
+	/* The blank line ending the headers is implicit in the archive */
+	if (len == 0 || record->failed)
+		return;
+
+	/* Headers of earlier responses (100 Continue, 401 before
+	 * authenticating) aren't part of the one we're recording */
+	if (len > SLEN("HTTP/") &&
+			strncasecmp((const char *) data, "HTTP/",
+				SLEN("HTTP/")) == 0)
+		chunkbuf_finalise(&record->headers);
+
+	if (chunkbuf_append(&record->headers, (const uint8_t *) "HEADER ",
+				SLEN("HEADER ")) != NSERROR_OK ||
+			chunkbuf_append(&record->headers, data, len) !=
+				NSERROR_OK ||
+			chunkbuf_append(&record->headers,
+				(const uint8_t *) "\n", 1) != NSERROR_OK)
+		record->failed = true;
+}
+
+void fetch_replay_record_data(struct fetch_replay_record *record,
+		const uint8_t *data, size_t len)
+{
+	char line[64];
+	int line_len;
+
+	if (record->failed)
+		return;
+
+	line_len = snprintf(line, sizeof line, "DATA %u %zu\n",
+			fetch_replay_time() - record->start, len);
+
+	if (chunkbuf_append(&record->body, (const uint8_t *) line,
+				line_len) != NSERROR_OK ||
+			chunkbuf_append(&record->body, data, len) !=
+				NSERROR_OK ||
+			chunkbuf_append(&record->body,
+				(const uint8_t *) "\n", 1) != NSERROR_OK)
+		record->failed = true;
+}
+
+void fetch_replay_record_finish(struct fetch_replay_record *record,
+		long http_code, bool keep)
+{
+	const char *dir = nsoption_charp(fetch_record_path);
+	struct chunkbuf *parts[2] = { &record->headers, &record->body };
+	char *path = NULL;
+	char *temp = NULL;
+	FILE *fp = NULL;
+	bool ok;
+	int i;
+
+	if (keep == false || record->failed || dir == NULL)
+		goto cleanup;
+
+	path = fetch_replay_archive_path(dir, record->url, "");
+	temp = fetch_replay_archive_path(dir, record->url, ".tmp");
+	if (path == NULL || temp == NULL)
+		goto cleanup;
+
+	/* Write to a temporary file and move it into place once complete,
+	 * so a replay never sees a partial response */
+	fp = fopen(temp, "wb");
+	if (fp == NULL) {
+		LOG(("Failed to create %s: %s", temp, strerror(errno)));
+		goto cleanup;
+	}
+
+	ok = fprintf(fp, "URL %s\nSTATUS %ld\n", record->url, http_code) > 0;
+
+	for (i = 0; ok && i < 2; i++) {
+		const uint8_t *span;
+		size_t offset = 0;
+		size_t len;
+
+		while (ok && (span = chunkbuf_span(parts[i], offset,
+				&len)) != NULL) {
+			ok = fwrite(span, 1, len, fp) == len;
+			offset += len;
+		}
+	}
+
+	if (fclose(fp) != 0)
+		ok = false;
+
+	if (ok == false || rename(temp, path) != 0) {
+		LOG(("Failed to record %s: %s", record->url, strerror(errno)));
+		remove(temp);
+	}
+
+cleanup:
+	free(temp);
+	free(path);
+	chunkbuf_finalise(&record->headers);
+	chunkbuf_finalise(&record->body);
+	free(record->url);
+	free(record);
+}
+
+
+/* Replay */
+
+static bool fetch_replay_initialise(lwc_string *scheme)
+{
+	LOG(("Replaying %s fetches from %s", lwc_string_data(scheme),
+			nsoption_charp(fetch_replay_path)));
+	return true;
+}
+
+static void fetch_replay_finalise(lwc_string *scheme)
+{
+}
+
+static bool fetch_replay_can_fetch(const nsurl *url)
+{
+	return true;
+}
+
+static void *fetch_replay_setup(struct fetch *parent_fetch, nsurl *url,
+		 bool only_2xx, const char *post_urlenc,
+		 const struct fetch_multipart_data *post_multipart,
+		 const char **headers)
+{
+	struct fetch_replay_context *ctx = calloc(1, sizeof(*ctx));
+
+	if (ctx == NULL)
+		return NULL;
+
+	ctx->parent_fetch = parent_fetch;
+	ctx->url = nsurl_ref(url);
+	ctx->only_2xx = only_2xx;
+
+	RING_INSERT(ring, ctx);
+
+	return ctx;
+}
+
+static bool fetch_replay_start(void *ctx)
+{
+	struct fetch_replay_context *c = ctx;
+
+	c->active = true;
+	c->start = fetch_replay_time();
+
+	return true;
+}
+
+static void fetch_replay_free(void *ctx)
+{
+	struct fetch_replay_context *c = ctx;
+
+	nsurl_unref(c->url);
+	free(c->archive);
+	RING_REMOVE(ring, c);
+	free(ctx);
+}
+
+static void fetch_replay_abort(void *ctx)
+{
+	struct fetch_replay_context *c = ctx;
+
+	/* To avoid the poll loop having to deal with the fetch context
+	 * disappearing from under it, we simply flag the abort here.
+	 * The poll loop itself will perform the appropriate cleanup.
+	 */
+	c->aborted = true;
+}
+
+static void fetch_replay_send_callback(const fetch_msg *msg,
+		struct fetch_replay_context *c)
+{
+	c->locked = true;
+	fetch_send_callback(msg, c->parent_fetch);
+	c->locked = false;
+}
+
+
+/**
+ * Get the next line from a fetch's archive
+ *
+ * \param c     Context of fetch
+ * \param line  Pointer to location to receive line
+ * \param len   Pointer to location to receive line length, excluding newline
+ * \return true on success, false at the end of the archive
+ */
+
+bool fetch_replay_line(struct fetch_replay_context *c,
+		const char **line, size_t *len)
+{
+	const char *start = (const char *) c->archive + c->pos;
+	const char *end;
+
+	if (c->pos >= c->archive_len)
+		return false;
+
+	end = memchr(start, '\n', c->archive_len - c->pos);
+	if (end == NULL)
+		return false;
+
+	*line = start;
+	*len = end - start;
+	c->pos += *len + 1;
+
+	return true;
+}
+
+
+/**
+ * Read the archive file for a fetch and check its preamble
+ *
+ * \param c     Context of fetch
+ * \param code  Pointer to location to receive HTTP status code
+ * \return true on success, false if there's no usable archive for the URL
+ *
+ * On success, the archive is positioned at the first header line.
+ */
+
+bool fetch_replay_load(struct fetch_replay_context *c, long *code)
+{
+	const char *url = nsurl_access(c->url);
+	const char *line;
+	size_t len;
+	char *path;
+	FILE *fp;
+	long size;
+
+	path = fetch_replay_archive_path(nsoption_charp(fetch_replay_path),
+			url, "");
+	if (path == NULL)
+		return false;
+
+	fp = fopen(path, "rb");
+	free(path);
+	if (fp == NULL)
+		return false;
+
+	if (fseek(fp, 0, SEEK_END) == 0 && (size = ftell(fp)) > 0 &&
+			fseek(fp, 0, SEEK_SET) == 0 &&
+			(c->archive = malloc(size)) != NULL &&
+			fread(c->archive, 1, size, fp) == (size_t) size)
+		c->archive_len = size;
+	fclose(fp);
+
+	/* The URL must match exactly, in case of a hash collision */
+	if (fetch_replay_line(c, &line, &len) == false ||
+			len != SLEN("URL ") + strlen(url) ||
+			strncmp(line, "URL ", SLEN("URL ")) != 0 ||
+			strncmp(line + SLEN("URL "), url, strlen(url)) != 0)
+		return false;
+
+	if (fetch_replay_line(c, &line, &len) == false ||
+			len <= SLEN("STATUS ") ||
+			strncmp(line, "STATUS ", SLEN("STATUS ")) != 0)
+		return false;
+
+	*code = strtol(line + SLEN("STATUS "), NULL, 10);
+
+	return true;
+}
+
+
+/**
+ * Make progress with a fetch
+ *
+ * \param c  Context of fetch
+ * \return true if the fetch is complete, false if it has more to send
+ *
+ * With the fetch_replay_timing option, body data is held back until the
+ * time it was originally received.  Otherwise it is all sent at once.
+ */
+
+bool fetch_replay_process(struct fetch_replay_context *c)
+{
+	fetch_msg msg;
+	const char *line;
+	size_t len;
+
+	if (c->had_headers == false) {
+		const char *location = NULL;
+		size_t location_len = 0;
+		size_t body;
+		long code;
+
+		if (fetch_replay_load(c, &code) == false) {
+			LOG(("No recording of %s", nsurl_access(c->url)));
+			msg.type = FETCH_ERROR;
+			msg.data.error = "Not found in replay archive";
+			fetch_replay_send_callback(&msg, c);
+			return true;
+		}
+
+		fetch_set_http_code(c->parent_fetch, code);
+
+		/* Any callback can result in the fetch being aborted.
+		 * Therefore, we _must_ check for this after _every_
+		 * call to fetch_replay_send_callback().
+		 */
+		body = c->pos;
+		while (c->aborted == false &&
+				fetch_replay_line(c, &line, &len) &&
+				len >= SLEN("HEADER ") &&
+				strncmp(line, "HEADER ",
+					SLEN("HEADER ")) == 0) {
+			line += SLEN("HEADER ");
+			len -= SLEN("HEADER ");
+
+			/* Header consumers expect a terminated string */
+			c->archive[c->pos - 1] = '\0';
+
+			if (len > SLEN("Location:") &&
+					strncasecmp(line, "Location:",
+						SLEN("Location:")) == 0) {
+				location = line + SLEN("Location:");
+				location_len = len - SLEN("Location:");
+			}
+
+			msg.type = FETCH_HEADER;
+			msg.data.header_or_data.buf = (const uint8_t *) line;
+			msg.data.header_or_data.len = len;
+			fetch_replay_send_callback(&msg, c);
+
+			body = c->pos;
+		}
+		c->pos = body;
+
+		if (c->aborted)
+			return true;
+
+		if (300 <= code && code < 400 && location != NULL) {
+			char *target;
+
+			while (location_len > 0 && (*location == ' ' ||
+					*location == '\t')) {
+				location++;
+				location_len--;
+			}
+
+			target = strndup(location, location_len);
+			if (target == NULL) {
+				msg.type = FETCH_ERROR;
+				msg.data.error = messages_get("NoMemory");
+			} else {
+				msg.type = FETCH_REDIRECT;
+				msg.data.redirect = target;
+			}
+			fetch_replay_send_callback(&msg, c);
+			free(target);
+			return true;
+		}
+
+		if (c->only_2xx && (code < 200 || 299 < code)) {
+			msg.type = FETCH_ERROR;
+			msg.data.error = messages_get("Not2xx");
+			fetch_replay_send_callback(&msg, c);
+			return true;
+		}
+
+		c->had_headers = true;
+	}
+
+	while (c->aborted == false) {
+		size_t chunk = c->pos;
+		unsigned int when;
+		size_t data_len;
+
+		if (fetch_replay_line(c, &line, &len) == false)
+			break;
+
+		if (sscanf(line, "DATA %u %zu", &when, &data_len) != 2 ||
+				data_len > c->archive_len - c->pos) {
+			LOG(("Malformed recording of %s",
+					nsurl_access(c->url)));
+			c->pos = c->archive_len;
+			break;
+		}
+
+		if (nsoption_bool(fetch_replay_timing) &&
+				fetch_replay_time() - c->start < when) {
+			/* Not due yet: come back to this chunk */
+			c->pos = chunk;
+			return false;
+		}
+
+		msg.type = FETCH_DATA;
+		msg.data.header_or_data.buf = c->archive + c->pos;
+		msg.data.header_or_data.len = data_len;
+		c->pos += data_len + 1;
+		fetch_replay_send_callback(&msg, c);
+	}
+
+	if (c->aborted == false) {
+		msg.type = FETCH_FINISHED;
+		fetch_replay_send_callback(&msg, c);
+	}
+
+	return true;
+}
+
+static void fetch_replay_poll(lwc_string *scheme)
+{
+	struct fetch_replay_context *c, *next;
+
+	if (ring == NULL) return;
+
+	/* Iterate over ring, processing each pending fetch */
+	c = ring;
+	do {
+		/* Ignore fetches that have been flagged as locked.
+		 * This allows safe re-entrant calls to this function.
+		 * Re-entrancy can occur if, as a result of a callback,
+		 * the interested party causes fetch_poll() to be called
+		 * again.
+		 */
+		if (c->locked == true) {
+			next = c->r_next;
+			continue;
+		}
+
+		/* Leave fetches which are still queued */
+		if (c->aborted == false && c->active == false) {
+			next = c->r_next;
+			continue;
+		}
+
+		/* Fetches waiting on recorded timing stay in the ring */
+		if (c->aborted == false && fetch_replay_process(c) == false) {
+			next = c->r_next;
+			continue;
+		}
+
+		/* Compute next fetch item at the last possible moment as
+		 * processing this item may have added to the ring.
+		 */
+		next = c->r_next;
+
+		fetch_remove_from_queues(c->parent_fetch);
+		fetch_free(c->parent_fetch);
+
+		/* Advance to next ring entry, exiting if we've reached
+		 * the start of the ring or the ring has become empty
+		 */
+	} while ( (c = next) != ring && ring != NULL);
+}
+
+void fetch_replay_register(void)
+{
+	const char *schemes[] = { "http", "https" };
+	lwc_string *scheme;
+	size_t i;
+
+	for (i = 0; i < sizeof schemes / sizeof schemes[0]; i++) {
+		if (lwc_intern_string(schemes[i], strlen(schemes[i]),
+				&scheme) != lwc_error_ok) {
+			die("Failed to initialise the fetch module "
+					"(couldn't intern scheme).");
+		}
+
+		fetch_add_fetcher(scheme,
+			fetch_replay_initialise,
+			fetch_replay_can_fetch,
+			fetch_replay_setup,
+			fetch_replay_start,
+			fetch_replay_abort,
+			fetch_replay_free,
+			fetch_replay_poll,
+			NULL,
+			fetch_replay_finalise);
+	}
+}
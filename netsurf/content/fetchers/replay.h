@@ -0,0 +1,88 @@
+/*
+ * Copyright 2012 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Recorded HTTP response fetcher (interface).
+ *
+ * The replay fetcher serves http and https URLs from an archive of
+ * responses recorded by the cURL fetcher, without touching the network.
+ * Page loads replayed from the same archive are repeatable, which makes
+ * them suitable for benchmarking.
+ *
+ * The archive is a directory holding a file per URL.  Each file contains
+ * the response status, its header lines, and the body data in the chunks
+ * it arrived in, with the time each chunk arrived.
+ */
+
+#ifndef NETSURF_CONTENT_FETCHERS_FETCH_REPLAY_H
+#define NETSURF_CONTENT_FETCHERS_FETCH_REPLAY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils/nsurl.h"
+
+struct fetch_replay_record;
+
+/**
+ * Register the replay fetcher for http and https, in place of cURL
+ */
+void fetch_replay_register(void);
+
+/**
+ * Begin recording a response into the archive
+ *
+ * \param url  URL being fetched
+ * \return Recording, or NULL if recording is disabled or on failure
+ */
+struct fetch_replay_record *fetch_replay_record_start(nsurl *url);
+
+/**
+ * Add a header line to a recording
+ *
+ * \param record  Recording to add to
+ * \param data    Header line, as received
+ * \param len     Byte length of \a data
+ *
+ * A status line starts a new response, discarding any earlier headers.
+ */
+void fetch_replay_record_header(struct fetch_replay_record *record,
+		const uint8_t *data, size_t len);
+
+/**
+ * Add a chunk of body data to a recording
+ *
+ * \param record  Recording to add to
+ * \param data    Body data
+ * \param len     Byte length of \a data
+ */
+void fetch_replay_record_data(struct fetch_replay_record *record,
+		const uint8_t *data, size_t len);
+
+/**
+ * Finish a recording, writing it to the archive if wanted
+ *
+ * \param record     Recording to finish, which is destroyed
+ * \param http_code  HTTP status code of the response
+ * \param keep       Whether the response was complete and worth keeping
+ */
+void fetch_replay_record_finish(struct fetch_replay_record *record,
+		long http_code, bool keep);
+
+#endif
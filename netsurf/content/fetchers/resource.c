@@ -362,5 +362,6 @@ void fetch_resource_register(void)
 		fetch_resource_abort,
 		fetch_resource_free,
 		fetch_resource_poll,
+		NULL,
 		fetch_resource_finalise);
 }
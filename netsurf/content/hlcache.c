@@ -70,6 +70,13 @@ struct hlcache_entry {
 
 	hlcache_entry *next;		/**< Next sibling */
 	hlcache_entry *prev;		/**< Previous sibling */
+
+	uint32_t hash;			/**< Low-level object hash when indexed */
+	hlcache_entry *hash_next;	/**< Next in index bucket */
+	hlcache_entry *hash_prev;	/**< Previous in index bucket */
+
+	hlcache_entry *clean_next;	/**< Next on list of unused entries */
+	bool clean_listed;		/**< Whether on list of unused entries */
 };
 
 /** Current state of the cache.
@@ -82,6 +89,19 @@ struct hlcache_s {
 	/** List of cached content objects */
 	hlcache_entry *content_list;
 
+	/** Index of cached content objects, hashed by low-level object */
+	hlcache_entry **index;
+
+	/** Number of buckets in the index (a power of 2) */
+	uint32_t index_size;
+
+	/** Number of entries in the index */
+	uint32_t index_count;
+
+	/** List of entries which may have become unused since the
+	 * cache was last cleaned */
+	hlcache_entry *clean_list;
+
 	/** Ring of retrieval contexts */
 	hlcache_retrieval_ctx *retrieval_ctx_ring;
 
@@ -90,12 +110,23 @@ struct hlcache_s {
 	unsigned int miss_count;
 };
 
+/** Initial number of buckets in the content index */
+#define HLCACHE_INDEX_INITIAL_SIZE 64
+
 /** high level cache state */
 static struct hlcache_s *hlcache = NULL;
 
 
+static void hlcache_index_grow(void);
+static void hlcache_entry_insert(hlcache_entry *entry);
+static void hlcache_entry_remove(hlcache_entry *entry);
+static void hlcache_entry_check_unused(hlcache_entry *entry);
 static void hlcache_clean(void *ignored);
+static fetch_priority hlcache_retrieve_priority(
+		const hlcache_child_context *child, content_type accepted_types);
 
+static const uint8_t *hlcache_sniff_data(const llcache_handle *handle,
+		uint8_t *buf, size_t *len);
 static nserror hlcache_llcache_callback(llcache_handle *handle,
 		const llcache_event *event, void *pw);
 static nserror hlcache_migrate_ctx(hlcache_retrieval_ctx *ctx,
@@ -121,10 +152,19 @@ hlcache_initialise(const struct hlcache_parameters *hlcache_parameters)
 		return NSERROR_NOMEM;
 	}
 
+	hlcache->index_size = HLCACHE_INDEX_INITIAL_SIZE;
+	hlcache->index = calloc(hlcache->index_size, sizeof(hlcache_entry *));
+	if (hlcache->index == NULL) {
+		free(hlcache);
+		hlcache = NULL;
+		return NSERROR_NOMEM;
+	}
+
 	ret = llcache_initialise(hlcache_parameters->cb,
 				 hlcache_parameters->cb_ctx,
 				 hlcache_parameters->limit);
 	if (ret != NSERROR_OK) {
+		free(hlcache->index);
 		free(hlcache);
 		hlcache = NULL;
 		return ret;
@@ -210,6 +250,7 @@ void hlcache_finalise(void)
 
 	LOG(("hit/miss %d/%d", hlcache->hit_count, hlcache->miss_count));
 
+	free(hlcache->index);
 	free(hlcache);
 	hlcache = NULL;
 
@@ -267,6 +308,7 @@ nserror hlcache_handle_retrieve(nsurl *url, uint32_t flags,
 	ctx->handle->pw = pw;
 
 	error = llcache_handle_retrieve(url, flags, referer, post,
+			hlcache_retrieve_priority(child, accepted_types),
 			hlcache_llcache_callback, ctx,
 			&ctx->llcache);
 	if (error != NSERROR_OK) {
@@ -289,6 +331,8 @@ nserror hlcache_handle_release(hlcache_handle *handle)
 	if (handle->entry != NULL) {
 		content_remove_user(handle->entry->content,
 				hlcache_content_callback, handle);
+
+		hlcache_entry_check_unused(handle->entry);
 	} else {
 		RING_ITERATE_START(struct hlcache_retrieval_ctx,
 				   hlcache->retrieval_ctx_ring,
@@ -392,11 +436,7 @@ nserror hlcache_handle_abort(hlcache_handle *handle)
 
 		entry->content = clone;
 		handle->entry = entry;
-		entry->prev = NULL;
-		entry->next = hlcache->content_list;
-		if (hlcache->content_list != NULL)
-			hlcache->content_list->prev = entry;
-		hlcache->content_list = entry;
+		hlcache_entry_insert(entry);
 
 		c = clone;
 	}
@@ -414,6 +454,35 @@ nserror hlcache_handle_replace_callback(hlcache_handle *handle,
 	return NSERROR_OK;
 }
 
+/* See hlcache.h for documentation */
+nserror hlcache_handle_set_priority(hlcache_handle *handle,
+		fetch_priority priority)
+{
+	nserror error = NSERROR_OK;
+
+	assert(handle != NULL);
+
+	if (handle->entry != NULL) {
+		error = content_set_priority(handle->entry->content, priority);
+	} else {
+		RING_ITERATE_START(struct hlcache_retrieval_ctx,
+				   hlcache->retrieval_ctx_ring,
+				   ictx) {
+			if (ictx->handle == handle) {
+				/* This is the nascent context for us */
+				error = llcache_handle_set_priority(
+						ictx->llcache, priority);
+
+				/* And stop */
+				RING_ITERATE_STOP(hlcache->retrieval_ctx_ring,
+						ictx);
+			}
+		} RING_ITERATE_END(hlcache->retrieval_ctx_ring, ictx);
+	}
+
+	return error;
+}
+
 nserror hlcache_handle_clone(hlcache_handle *handle, hlcache_handle **result)
 {
 	*result = NULL;
@@ -451,6 +520,164 @@ nsurl *hlcache_handle_get_url(const hlcache_handle *handle)
  * High-level cache internals						      *
  ******************************************************************************/
 
+/**
+ * Find the index bucket for a low-level object hash
+ *
+ * \param hash  Hash of low-level object
+ * \return Pointer to head of bucket
+ */
+static inline hlcache_entry **hlcache_index_bucket(uint32_t hash)
+{
+	return &hlcache->index[hash & (hlcache->index_size - 1)];
+}
+
+/**
+ * Double the number of buckets in the content index
+ *
+ * On failure, the existing index is retained.
+ */
+void hlcache_index_grow(void)
+{
+	uint32_t new_size = hlcache->index_size * 2;
+	hlcache_entry **new_index;
+	hlcache_entry *entry, *next, **bucket;
+	uint32_t i;
+
+	new_index = calloc(new_size, sizeof(hlcache_entry *));
+	if (new_index == NULL)
+		return;
+
+	for (i = 0; i < hlcache->index_size; i++) {
+		for (entry = hlcache->index[i]; entry != NULL; entry = next) {
+			next = entry->hash_next;
+
+			bucket = &new_index[entry->hash & (new_size - 1)];
+
+			entry->hash_prev = NULL;
+			entry->hash_next = *bucket;
+			if (*bucket != NULL)
+				(*bucket)->hash_prev = entry;
+			*bucket = entry;
+		}
+	}
+
+	free(hlcache->index);
+	hlcache->index = new_index;
+	hlcache->index_size = new_size;
+}
+
+/**
+ * Add an entry to the cache
+ *
+ * \param entry  Entry to add, with its content set
+ *
+ * The entry is indexed by the low-level object its content uses.  Should
+ * the content's low-level handle later move to another object, the entry
+ * stays where it is; lookups check the object, so it is never mistaken
+ * for one using the new object, as such entries can't be shared anyway.
+ */
+void hlcache_entry_insert(hlcache_entry *entry)
+{
+	hlcache_entry **bucket;
+
+	entry->prev = NULL;
+	entry->next = hlcache->content_list;
+	if (hlcache->content_list != NULL)
+		hlcache->content_list->prev = entry;
+	hlcache->content_list = entry;
+
+	/* Keep chains short. If growing fails, we simply carry on with
+	 * longer chains. */
+	if (hlcache->index_count >= hlcache->index_size)
+		hlcache_index_grow();
+
+	entry->hash = llcache_handle_object_hash(
+			content_get_llcache_handle(entry->content));
+	bucket = hlcache_index_bucket(entry->hash);
+
+	entry->hash_prev = NULL;
+	entry->hash_next = *bucket;
+	if (*bucket != NULL)
+		(*bucket)->hash_prev = entry;
+	*bucket = entry;
+
+	hlcache->index_count++;
+
+	entry->clean_next = NULL;
+	entry->clean_listed = false;
+}
+
+/**
+ * Remove an entry from the cache
+ *
+ * \param entry  Entry to remove, which must not be on the list of unused
+ *		 entries
+ */
+void hlcache_entry_remove(hlcache_entry *entry)
+{
+	hlcache_entry **bucket = hlcache_index_bucket(entry->hash);
+
+	assert(entry->clean_listed == false);
+
+	if (entry->prev == NULL)
+		hlcache->content_list = entry->next;
+	else
+		entry->prev->next = entry->next;
+
+	if (entry->next != NULL)
+		entry->next->prev = entry->prev;
+
+	if (entry == *bucket)
+		*bucket = entry->hash_next;
+	else
+		entry->hash_prev->hash_next = entry->hash_next;
+
+	if (entry->hash_next != NULL)
+		entry->hash_next->hash_prev = entry->hash_prev;
+
+	hlcache->index_count--;
+}
+
+/**
+ * Note that an entry may have become unused
+ *
+ * \param entry  Entry to consider
+ *
+ * Unused entries are listed for the next cache clean to consider, so it
+ * need not examine every entry.
+ */
+void hlcache_entry_check_unused(hlcache_entry *entry)
+{
+	if (entry->clean_listed || content_count_users(entry->content) != 0)
+		return;
+
+	entry->clean_next = hlcache->clean_list;
+	entry->clean_listed = true;
+	hlcache->clean_list = entry;
+}
+
+/**
+ * Determine the fetch priority for a retrieval
+ *
+ * \param child           Child retrieval context, or NULL for top-level
+ * \param accepted_types  Bitmap of acceptable content types
+ * \return Priority for retrieval
+ *
+ * Top-level documents come first, as nothing else can start until they
+ * arrive.  Stylesheets come next, as layout waits for them.
+ */
+fetch_priority hlcache_retrieve_priority(
+		const hlcache_child_context *child, content_type accepted_types)
+{
+	if (child == NULL && (accepted_types & CONTENT_HTML))
+		return FETCH_PRIORITY_DOCUMENT;
+
+	if (accepted_types == CONTENT_CSS)
+		return FETCH_PRIORITY_STYLESHEET;
+
+	return FETCH_PRIORITY_NORMAL;
+}
+
 /**
  * Attempt to clean the cache
  */
@@ -458,19 +685,29 @@ void hlcache_clean(void *ignored)
 {
 	hlcache_entry *entry, *next;
 
-	for (entry = hlcache->content_list; entry != NULL; entry = next) {
-		next = entry->next;
+	/* Only entries which have lost their last user since the last clean,
+	 * or were still loading then, can need removing.  Take the list, as
+	 * destroying contents may add entries to it. */
+	next = hlcache->clean_list;
+	hlcache->clean_list = NULL;
 
-		if (entry->content == NULL)
-			continue;
+	while ((entry = next) != NULL) {
+		next = entry->clean_next;
 
-		if (content__get_status(entry->content) ==
-				CONTENT_STATUS_LOADING)
-			continue;
+		entry->clean_next = NULL;
+		entry->clean_listed = false;
 
+		/* Entry is in use again: it'll be listed when it isn't */
 		if (content_count_users(entry->content) != 0)
 			continue;
 
+		/* Look at it again next time */
+		if (content__get_status(entry->content) ==
+				CONTENT_STATUS_LOADING) {
+			hlcache_entry_check_unused(entry);
+			continue;
+		}
+
 		/** \todo This is over-zealous: all unused contents
 		 * will be immediately destroyed. Ideally, we want to
 		 * purge all unused contents that are using stale
@@ -479,13 +716,7 @@ void hlcache_clean(void *ignored)
 		 */
 
 		/* Remove entry from cache */
-		if (entry->prev == NULL)
-			hlcache->content_list = entry->next;
-		else
-			entry->prev->next = entry->next;
-
-		if (entry->next != NULL)
-			entry->next->prev = entry->prev;
+		hlcache_entry_remove(entry);
 
 		/* Destroy content */
 		content_destroy(entry->content);
@@ -501,6 +732,49 @@ void hlcache_clean(void *ignored)
 	schedule(hlcache->params.bg_clean_time / 10, hlcache_clean, NULL);
 }
 
+/**
+ * Get the start of an object's source data, for the MIME sniffer
+ *
+ * \param handle  Handle to get source data from
+ * \param buf     Buffer of ::MIMESNIFF_HEADER_SIZE bytes
+ * \param len     Pointer to location to receive byte length of data
+ * \return Pointer to data, or NULL if there is none
+ *
+ * The sniffer looks no further than ::MIMESNIFF_HEADER_SIZE bytes, so the
+ * source data needn't all be coalesced to sniff it.  If that much isn't
+ * held contiguously, it is copied into \a buf.
+ */
+static const uint8_t *hlcache_sniff_data(const llcache_handle *handle,
+		uint8_t *buf, size_t *len)
+{
+	const uint8_t *span;
+	size_t offset = 0, slen;
+
+	span = llcache_handle_get_source_span(handle, 0, &slen);
+	if (span == NULL) {
+		*len = 0;
+		return NULL;
+	}
+
+	if (slen >= MIMESNIFF_HEADER_SIZE ||
+			slen == llcache_handle_get_source_size(handle)) {
+		*len = slen;
+		return span;
+	}
+
+	while (span != NULL && offset < MIMESNIFF_HEADER_SIZE) {
+		slen = min(slen, MIMESNIFF_HEADER_SIZE - offset);
+		memcpy(buf + offset, span, slen);
+		offset += slen;
+
+		span = llcache_handle_get_source_span(handle, offset, &slen);
+	}
+
+	*len = offset;
+
+	return buf;
+}
+
 /**
  * Handler for low-level cache events
  *
@@ -514,6 +788,9 @@ nserror hlcache_llcache_callback(llcache_handle *handle,
 {
 	hlcache_retrieval_ctx *ctx = pw;
 	lwc_string *effective_type = NULL;
+	uint8_t buf[MIMESNIFF_HEADER_SIZE];
+	const uint8_t *data;
+	size_t len, wanted;
 	nserror error;
 
 	assert(ctx->llcache == handle);
@@ -521,9 +798,9 @@ nserror hlcache_llcache_callback(llcache_handle *handle,
 	switch (event->type) {
 	case LLCACHE_EVENT_HAD_HEADERS:
 		error = mimesniff_compute_effective_type(handle, NULL, 0,
-				ctx->flags & HLCACHE_RETRIEVE_SNIFF_TYPE,
+				false, ctx->flags & HLCACHE_RETRIEVE_SNIFF_TYPE,
 				ctx->accepted_types == CONTENT_IMAGE,
-				&effective_type);
+				&effective_type, &wanted);
 		if (error == NSERROR_OK || error == NSERROR_NOT_FOUND) {
 			/* If the sniffer was successful or failed to find
 			 * a Content-Type header when sniffing was
@@ -545,10 +822,30 @@ nserror hlcache_llcache_callback(llcache_handle *handle,
 	case LLCACHE_EVENT_HAD_DATA:
 		error = mimesniff_compute_effective_type(handle,
 				event->data.data.buf, event->data.data.len,
-				ctx->flags & HLCACHE_RETRIEVE_SNIFF_TYPE,
+				false, ctx->flags & HLCACHE_RETRIEVE_SNIFF_TYPE,
 				ctx->accepted_types == CONTENT_IMAGE,
-				&effective_type);
-		if (error != NSERROR_OK) {
+				&effective_type, &wanted);
+		if (error == NSERROR_NEED_DATA && 
+				llcache_handle_get_source_size(handle) > 
+				event->data.data.len) {
+			/* Event only carries the first chunk of source 
+			 * data, so try again with all there is */
+			data = hlcache_sniff_data(handle, buf, &len);
+
+			error = mimesniff_compute_effective_type(handle,
+					data, len, false, 
+					ctx->flags & HLCACHE_RETRIEVE_SNIFF_TYPE,
+					ctx->accepted_types == CONTENT_IMAGE,
+					&effective_type, &wanted);
+		}
+
+		if (error == NSERROR_NEED_DATA) {
+			/* Can't decide yet: ask for a replay once 
+			 * the sniffer has enough data to make progress */
+			llcache_handle_need_data(handle, wanted);
+
+			return NSERROR_NEED_DATA;
+		} else if (error != NSERROR_OK) {
 			assert(0 && "MIME sniff failed with data");
 		}
 
@@ -561,9 +858,15 @@ nserror hlcache_llcache_callback(llcache_handle *handle,
 		break;
 	case LLCACHE_EVENT_DONE:
 		/* DONE event before we could determine the effective MIME type.
+		 * All the data there will be is now available, so sniff it.
 		 */
+		data = hlcache_sniff_data(handle, buf, &len);
+
 		error = mimesniff_compute_effective_type(handle,
-				NULL, 0, false, false, &effective_type);
+				data, len, true, 
+				ctx->flags & HLCACHE_RETRIEVE_SNIFF_TYPE,
+				ctx->accepted_types == CONTENT_IMAGE,
+				&effective_type, &wanted);
 		if (error == NSERROR_OK) {
 			error = hlcache_migrate_ctx(ctx, effective_type);
 
@@ -716,13 +1019,16 @@ nserror hlcache_find_content(hlcache_retrieval_ctx *ctx,
 	hlcache_entry *entry;
 	hlcache_event event;
 	nserror error = NSERROR_OK;
+	uint32_t hash = llcache_handle_object_hash(ctx->llcache);
 
-	/* Search list of cached contents for a suitable one */
-	for (entry = hlcache->content_list; entry != NULL; entry = entry->next) {
+	/* Search cached contents using the same low-level object for a
+	 * suitable one */
+	for (entry = *hlcache_index_bucket(hash); entry != NULL;
+			entry = entry->hash_next) {
 		hlcache_handle entry_handle = { entry, NULL, NULL };
 		const llcache_handle *entry_llcache;
 
-		if (entry->content == NULL)
+		if (entry->hash != hash)
 			continue;
 
 		/* Ignore contents in the error state */
@@ -763,11 +1069,7 @@ nserror hlcache_find_content(hlcache_retrieval_ctx *ctx,
 		}
 
 		/* Insert into cache */
-		entry->prev = NULL;
-		entry->next = hlcache->content_list;
-		if (hlcache->content_list != NULL)
-			hlcache->content_list->prev = entry;
-		hlcache->content_list = entry;
+		hlcache_entry_insert(entry);
 
 		/* Signal to caller that we created a content */
 		error = NSERROR_NEED_DATA;
@@ -781,8 +1083,11 @@ nserror hlcache_find_content(hlcache_retrieval_ctx *ctx,
 
 	/* Associate handle with content */
 	if (content_add_user(entry->content,
-			hlcache_content_callback, ctx->handle) == false)
+			hlcache_content_callback, ctx->handle) == false) {
+		/* A new entry may be left without users */
+		hlcache_entry_check_unused(entry);
 		return NSERROR_NOMEM;
+	}
 
 	/* Associate cache entry with handle */
 	ctx->handle->entry = entry;
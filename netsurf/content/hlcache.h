@@ -122,6 +122,8 @@ nserror hlcache_poll(void);
  * \param result          Pointer to location to recieve cache handle
  * \return NSERROR_OK on success, appropriate error otherwise
  *
+ * Top-level documents and stylesheets are fetched ahead of other objects.
+ *
  * Child contents are keyed on the tuple < URL, quirks >.
  * The quirks field is ignored for child contents whose behaviour is not
  * affected by quirks mode.
@@ -163,6 +165,21 @@ nserror hlcache_handle_abort(hlcache_handle *handle);
 nserror hlcache_handle_replace_callback(hlcache_handle *handle,
 		hlcache_handle_callback cb, void *pw);
 
+/**
+ * Change the fetch priority of a high-level cache object
+ *
+ * \param handle    Cache handle of object
+ * \param priority  New priority
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * This is used to re-rank fetches as their importance becomes known,
+ * e.g. when an object is found to be visible.  As the object may have
+ * other users, its priority is only ever raised.  It has no effect on
+ * objects whose fetch has already started.
+ */
+nserror hlcache_handle_set_priority(hlcache_handle *handle,
+		fetch_priority priority);
+
 /**
  * Retrieve a content object from a cache handle
  *
@@ -20,15 +20,19 @@
  * Low-level resource cache (implementation)
  */
 
+#include <inttypes.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
 #include <curl/curl.h>
 
+#include "content/backing_store.h"
 #include "content/fetch.h"
 #include "content/llcache.h"
 #include "content/urldb.h"
+#include "desktop/options.h"
+#include "utils/chunkbuf.h"
 #include "utils/log.h"
 #include "utils/messages.h"
 #include "utils/nsurl.h"
@@ -57,6 +61,7 @@ struct llcache_handle {
 
 	llcache_fetch_state state;	/**< Last known state of object fetch */
 	size_t bytes;			/**< Last reported byte count */
+	size_t wanted;			/**< Source length client needs */
 };
 
 /** Low-level cache object user record */
@@ -73,6 +78,7 @@ typedef struct llcache_object_user {
 /** Low-level cache object fetch context */
 typedef struct {
 	uint32_t flags;			/**< Fetch flags */
+	fetch_priority priority;	/**< Fetch priority */
 	nsurl *referer;			/**< Referring URL, or NULL if none */
 	llcache_post_data *post;	/**< POST data, or NULL for GET */	
 
@@ -103,6 +109,7 @@ typedef struct {
 	int age;		/**< Age: response header */
 	int max_age;		/**< Max-Age Cache-control parameter */
 	llcache_validate no_cache;	/**< No-Cache Cache-control parameter */
+	bool no_store;		/**< No-Store Cache-control parameter */
 	char *etag;		/**< Etag: response header */
 	time_t last_modified;	/**< Last-Modified: response header */
 } llcache_cache_control;
@@ -114,18 +121,17 @@ typedef struct {
 } llcache_header;
 
 /** Low-level cache object */
-/** \todo Consider whether a list is a sane container */
 struct llcache_object {
 	llcache_object *prev;		/**< Previous in list */
 	llcache_object *next;		/**< Next in list */
 
+	llcache_object *hash_prev;	/**< Previous in index bucket */
+	llcache_object *hash_next;	/**< Next in index bucket */
+
 	nsurl *url;			/**< Post-redirect URL for object */
 	bool has_query;			/**< URL has a query segment */
   
-	/** \todo We need a generic dynamic buffer object */
-	uint8_t *source_data;		/**< Source data for object */
-	size_t source_len;		/**< Byte length of source data */
-	size_t source_alloc;		/**< Allocated size of source buffer */
+	struct chunkbuf source;		/**< Source data for object */
 
 	llcache_object_user *users;	/**< List of users */
 
@@ -139,6 +145,13 @@ struct llcache_object {
 
 	llcache_header *headers;	/**< Fetch headers */
 	size_t num_headers;		/**< Number of fetch headers */
+
+	bool persisted;			/**< Object is in the backing store */
+
+	bool background;		/**< Fetched to revalidate candidate
+					 * without blocking its users */
+	uint32_t hits;			/**< Count of fresh retrievals since
+					 * last validated */
 };
 
 struct llcache_s {
@@ -148,15 +161,56 @@ struct llcache_s {
 	/** Data for fetch-related query handler */
 	void *query_cb_pw;
 
-	/** Head of the low-level cached object list */
+	/** Head of the low-level cached object list
+	 *
+	 * The list is kept in order of use, most recently used first. */
 	llcache_object *cached_objects;
 
+	/** Tail of the low-level cached object list (least recently used) */
+	llcache_object *cached_objects_tail;
+
 	/** Head of the low-level uncached object list */
 	llcache_object *uncached_objects;
 
+	/** Index of cached objects, hashed by URL */
+	llcache_object **cached_index;
+
+	/** Number of buckets in the cached object index (a power of 2) */
+	uint32_t cached_index_size;
+
+	/** Number of objects in the cached object index */
+	uint32_t cached_index_count;
+
 	uint32_t limit;
+
+	/** Total size of all objects in both lists */
+	size_t total_size;
+
+	/** The largest total size seen since initialisation */
+	size_t peak_size;
+
+	/* Statistics */
+	unsigned int hit_count;		/**< Fresh objects found in memory */
+	unsigned int store_hit_count;	/**< Objects found in backing store */
+	unsigned int revalidate_count;	/**< Stale objects revalidated */
+	unsigned int background_count;	/**< Objects revalidated while
+					 * the cached copy was used */
+	unsigned int miss_count;	/**< Objects not in cache at all */
+	unsigned int evict_count;	/**< Objects evicted by cleaning */
+	uint64_t evict_size;		/**< Total size of evicted objects */
 };
 
+/** Initial number of buckets in the cached object index */
+#define LLCACHE_INDEX_INITIAL_SIZE 256
+
+/** Number of fresh retrievals after which an object is revalidated
+ * ahead of becoming stale */
+#define LLCACHE_REFRESH_AHEAD_HITS 3
+
+/** Reciprocal of the fraction of its freshness lifetime an object
+ * must have left before it is revalidated ahead of becoming stale */
+#define LLCACHE_REFRESH_AHEAD_FRACTION 8
+
 /** low level cache state */
 static struct llcache_s *llcache = NULL;
 
@@ -164,6 +218,8 @@ static struct llcache_s *llcache = NULL;
 static lwc_string *llcache_file_lwc;
 static lwc_string *llcache_about_lwc;
 static lwc_string *llcache_resource_lwc;
+static lwc_string *llcache_http_lwc;
+static lwc_string *llcache_https_lwc;
 
 /* forward referenced callback function */
 static void llcache_fetch_callback(const fetch_msg *msg, void *p);
@@ -501,13 +557,15 @@ static nserror llcache_fetch_parse_header(llcache_object *object,
 			while (*comma != '\0' && *comma != ',')
 				comma++;
 
-			if (8 < comma - start && (strncasecmp(start, 
-					"no-cache", 8) == 0 || 
-					strncasecmp(start, "no-store", 8) == 0))
-				/* When we get a disk cache we should
-				 * distinguish between these two */
+			if (8 <= comma - start && strncasecmp(start, 
+					"no-cache", 8) == 0) {
 				object->cache.no_cache = LLCACHE_VALIDATE_ALWAYS;
-			else if (7 < comma - start && 
+			} else if (8 <= comma - start && strncasecmp(start,
+					"no-store", 8) == 0) {
+				/* Must also never reach the backing store */
+				object->cache.no_cache = LLCACHE_VALIDATE_ALWAYS;
+				object->cache.no_store = true;
+			} else if (7 < comma - start && 
 					strncasecmp(start, "max-age", 7) == 0) {
 				/* Find '=' */
 				while (start < comma && *start != '=')
@@ -711,7 +769,7 @@ static nserror llcache_object_refetch(llcache_object *object)
 			object->fetch.flags & LLCACHE_RETRIEVE_NO_ERROR_PAGES,
 			urlenc, multipart,
 			object->fetch.flags & LLCACHE_RETRIEVE_VERIFIABLE,
-			(const char **) headers);
+			(const char **) headers, object->fetch.priority);
 
 	/* Clean up cache-control headers */
 	while (--header_idx >= 0)
@@ -733,6 +791,7 @@ static nserror llcache_object_refetch(llcache_object *object)
  * \param referer	  Referring URL, or NULL for none
  * \param post		  POST data, or NULL for GET
  * \param redirect_count  Number of redirects followed so far
+ * \param priority	       Fetch priority
  * \return NSERROR_OK on success, appropriate error otherwise
  *
  * \pre object::url must contain the URL to fetch
@@ -742,7 +801,7 @@ static nserror llcache_object_refetch(llcache_object *object)
  */
 static nserror llcache_object_fetch(llcache_object *object, uint32_t flags,
 		nsurl *referer, const llcache_post_data *post,
-		uint32_t redirect_count)
+		uint32_t redirect_count, fetch_priority priority)
 {
 	nserror error;
 	nsurl *referer_clone = NULL;
@@ -762,6 +821,7 @@ static nserror llcache_object_fetch(llcache_object *object, uint32_t flags,
 		referer_clone = nsurl_ref(referer);
 
 	object->fetch.flags = flags;
+	object->fetch.priority = priority;
 	object->fetch.referer = referer_clone;
 	object->fetch.post = post_clone;
 	object->fetch.redirect_count = redirect_count;
@@ -788,7 +848,7 @@ static nserror llcache_object_destroy(llcache_object *object)
 #endif
 
 	nsurl_unref(object->url);
-	free(object->source_data);
+	chunkbuf_finalise(&object->source);
 
 	if (object->fetch.fetch != NULL) {
 		fetch_abort(object->fetch.fetch);
@@ -822,9 +882,124 @@ static nserror llcache_object_destroy(llcache_object *object)
 	return NSERROR_OK;
 }
 
+/**
+ * Find the cached object index bucket for a URL
+ *
+ * \param url	URL to find bucket for
+ * \return Pointer to head of bucket
+ */
+static inline llcache_object **llcache_index_bucket(const nsurl *url)
+{
+	return &llcache->cached_index[nsurl_hash(url) &
+			(llcache->cached_index_size - 1)];
+}
+
+/**
+ * Double the number of buckets in the cached object index
+ *
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * On failure, the existing index is retained.
+ */
+static nserror llcache_index_grow(void)
+{
+	uint32_t new_size = llcache->cached_index_size * 2;
+	llcache_object **new_index;
+	llcache_object *object, *next, **bucket;
+	uint32_t i;
+
+	new_index = calloc(new_size, sizeof(llcache_object *));
+	if (new_index == NULL)
+		return NSERROR_NOMEM;
+
+	for (i = 0; i < llcache->cached_index_size; i++) {
+		for (object = llcache->cached_index[i]; object != NULL;
+				object = next) {
+			next = object->hash_next;
+
+			bucket = &new_index[nsurl_hash(object->url) &
+					(new_size - 1)];
+
+			object->hash_prev = NULL;
+			object->hash_next = *bucket;
+			if (*bucket != NULL)
+				(*bucket)->hash_prev = object;
+			*bucket = object;
+		}
+	}
+
+	free(llcache->cached_index);
+	llcache->cached_index = new_index;
+	llcache->cached_index_size = new_size;
+
+	return NSERROR_OK;
+}
+
+/**
+ * Add a low-level cache object to the cached object index
+ *
+ * \param object  Object to add
+ */
+static void llcache_index_add(llcache_object *object)
+{
+	llcache_object **bucket;
+
+	/* Keep chains short. If growing fails, we simply carry on with
+	 * longer chains. */
+	if (llcache->cached_index_count >= llcache->cached_index_size)
+		llcache_index_grow();
+
+	bucket = llcache_index_bucket(object->url);
+
+	object->hash_prev = NULL;
+	object->hash_next = *bucket;
+	if (*bucket != NULL)
+		(*bucket)->hash_prev = object;
+	*bucket = object;
+
+	llcache->cached_index_count++;
+}
+
+/**
+ * Remove a low-level cache object from the cached object index
+ *
+ * \param object  Object to remove
+ */
+static void llcache_index_remove(llcache_object *object)
+{
+	llcache_object **bucket = llcache_index_bucket(object->url);
+
+	if (object == *bucket)
+		*bucket = object->hash_next;
+	else
+		object->hash_prev->hash_next = object->hash_next;
+
+	if (object->hash_next != NULL)
+		object->hash_next->hash_prev = object->hash_prev;
+
+	object->hash_prev = object->hash_next = NULL;
+
+	llcache->cached_index_count--;
+}
+
+/**
+ * Determine the amount of memory accounted to a low-level cache object
+ *
+ * \param object  Object to consider
+ * \return Size of object, in bytes
+ */
+static inline size_t llcache_object_size(const llcache_object *object)
+{
+	return object->source.len + sizeof(*object);
+}
+
 /**
  * Add a low-level cache object to a cache list
  *
+ * Objects added to the cached object list are also indexed by URL.
+ * Objects are added at the head of a list, so they count as the most
+ * recently used.
+ *
  * \param object  Object to add
  * \param list	  List to add to
  * \return NSERROR_OK
@@ -839,35 +1014,109 @@ static nserror llcache_object_add_to_list(llcache_object *object,
 		(*list)->prev = object;
 	*list = object;
 
+	if (list == &llcache->cached_objects) {
+		if (object->next == NULL)
+			llcache->cached_objects_tail = object;
+
+		llcache_index_add(object);
+	}
+
+	llcache->total_size += llcache_object_size(object);
+	if (llcache->total_size > llcache->peak_size)
+		llcache->peak_size = llcache->total_size;
+
 	return NSERROR_OK;
 }
 
 /**
- * Determine if an object is still fresh
+ * Mark a cached low-level cache object as the most recently used
  *
- * \param object  Object to consider
- * \return True if object is still fresh, false otherwise
+ * \param object  Object to mark, which must be in the cached object list
  */
-static bool llcache_object_is_fresh(const llcache_object *object)
+static void llcache_object_touch(llcache_object *object)
+{
+	if (object == llcache->cached_objects)
+		return;
+
+	/* Unlink from current position; object isn't the head */
+	object->prev->next = object->next;
+	if (object->next != NULL)
+		object->next->prev = object->prev;
+	else
+		llcache->cached_objects_tail = object->prev;
+
+	/* And relink at the head */
+	object->prev = NULL;
+	object->next = llcache->cached_objects;
+	llcache->cached_objects->prev = object;
+	llcache->cached_objects = object;
+}
+
+/**
+ * Raise the priority of a low-level cache object's fetch
+ *
+ * \param object    Object to change priority of
+ * \param priority  New priority
+ *
+ * The priority is only ever raised, as the object's other users may need
+ * it more urgently.  It is also used for any later refetch or redirect of
+ * the object.
+ */
+static void llcache_object_set_priority(llcache_object *object,
+		fetch_priority priority)
+{
+	if (priority >= object->fetch.priority)
+		return;
+
+	object->fetch.priority = priority;
+
+	if (object->fetch.fetch != NULL)
+		fetch_set_priority(object->fetch.fetch, priority);
+}
+
+/**
+ * Compute the age of an object, as per RFC 2616 13.2.3/13.2.4
+ *
+ * \param object              Object to consider
+ * \param current_age         Pointer to location to receive current age
+ * \param freshness_lifetime  Pointer to location to receive lifetime
+ */
+static void llcache_object_age(const llcache_object *object,
+		int *current_age, int *freshness_lifetime)
 {
 	const llcache_cache_control *cd = &object->cache;
-	int current_age, freshness_lifetime;
 	time_t now = time(NULL);
+	int age;
 
-	/* Calculate staleness of cached object as per RFC 2616 13.2.3/13.2.4 */
-	current_age = max(0, (cd->res_time - cd->date));
-	current_age = max(current_age, (cd->age == INVALID_AGE) ? 0 : cd->age);
-	current_age += cd->res_time - cd->req_time + now - cd->res_time;
+	/* Calculate staleness of cached object */
+	age = max(0, (cd->res_time - cd->date));
+	age = max(age, (cd->age == INVALID_AGE) ? 0 : cd->age);
+	age += cd->res_time - cd->req_time + now - cd->res_time;
+	*current_age = age;
 
 	/* Determine freshness lifetime of this object */
 	if (cd->max_age != INVALID_AGE)
-		freshness_lifetime = cd->max_age;
+		*freshness_lifetime = cd->max_age;
 	else if (cd->expires != 0)
-		freshness_lifetime = cd->expires - cd->date;
+		*freshness_lifetime = cd->expires - cd->date;
 	else if (cd->last_modified != 0)
-		freshness_lifetime = (now - cd->last_modified) / 10;
+		*freshness_lifetime = (now - cd->last_modified) / 10;
 	else
-		freshness_lifetime = 0;
+		*freshness_lifetime = 0;
+}
+
+/**
+ * Determine if an object is still fresh
+ *
+ * \param object  Object to consider
+ * \return True if object is still fresh, false otherwise
+ */
+static bool llcache_object_is_fresh(const llcache_object *object)
+{
+	const llcache_cache_control *cd = &object->cache;
+	int current_age, freshness_lifetime;
+
+	llcache_object_age(object, &current_age, &freshness_lifetime);
 
 #ifdef LLCACHE_TRACE
 	LOG(("%p: (%d > %d || %d != %d)", object, 
@@ -890,6 +1139,60 @@ static bool llcache_object_is_fresh(const llcache_object *object)
 			object->fetch.state != LLCACHE_FETCH_COMPLETE));
 }
 
+/**
+ * Determine if a stale object may be used while it is revalidated
+ *
+ * \param object  Object to consider, which is not fresh
+ * \return True if object may be used, false otherwise
+ */
+static bool llcache_object_may_use_stale(const llcache_object *object)
+{
+	const llcache_cache_control *cd = &object->cache;
+	int limit = nsoption_int(stale_while_revalidate);
+	int current_age, freshness_lifetime;
+
+	/* The object must be complete and not have been forbidden from 
+	 * being returned from the cache unvalidated */
+	if (limit <= 0 || cd->no_cache != LLCACHE_VALIDATE_FRESH ||
+			cd->no_store ||
+			object->fetch.state != LLCACHE_FETCH_COMPLETE)
+		return false;
+
+	/* The response must have said something about its cacheability */
+	if (cd->etag == NULL && cd->last_modified == 0 &&
+			cd->max_age <= 0 && cd->expires == 0)
+		return false;
+
+	llcache_object_age(object, &current_age, &freshness_lifetime);
+
+	return current_age - freshness_lifetime <= limit;
+}
+
+/**
+ * Determine if a fresh object is worth revalidating before it is stale
+ *
+ * \param object  Object to consider, which is fresh
+ * \return True if object should be revalidated, false otherwise
+ *
+ * Objects which are retrieved often and are near the end of their 
+ * freshness lifetime are revalidated, so that later retrievals don't 
+ * find them stale.
+ */
+static bool llcache_object_is_expiring(const llcache_object *object)
+{
+	int current_age, freshness_lifetime;
+
+	if (nsoption_int(stale_while_revalidate) <= 0 ||
+			object->hits < LLCACHE_REFRESH_AHEAD_HITS ||
+			object->fetch.state != LLCACHE_FETCH_COMPLETE)
+		return false;
+
+	llcache_object_age(object, &current_age, &freshness_lifetime);
+
+	return (freshness_lifetime - current_age) * 
+			LLCACHE_REFRESH_AHEAD_FRACTION < freshness_lifetime;
+}
+
 /**
  * Clone an object's cache data
  *
@@ -940,6 +1243,9 @@ static nserror llcache_object_clone_cache_data(llcache_object *source,
 
 	if (source->cache.no_cache != LLCACHE_VALIDATE_FRESH)
 		destination->cache.no_cache = source->cache.no_cache;
+
+	if (source->cache.no_store)
+		destination->cache.no_store = true;
 	
 	if (source->cache.last_modified != 0)
 		destination->cache.last_modified = source->cache.last_modified;
@@ -947,6 +1253,433 @@ static nserror llcache_object_clone_cache_data(llcache_object *source,
 	return NSERROR_OK;
 }
 
+/**
+ * Append a field to serialised metadata
+ *
+ * \param op	  Output position
+ * \param field  Field to append
+ * \return Output position following the field
+ */
+static inline char *llcache_metadata_append(char *op, const char *field)
+{
+	size_t len = strlen(field) + 1;
+
+	memcpy(op, field, len);
+
+	return op + len;
+}
+
+/**
+ * Append a numeric field to serialised metadata
+ *
+ * \param op	  Output position
+ * \param value  Value to append
+ * \return Output position following the field
+ */
+static inline char *llcache_metadata_append_num(char *op, long long value)
+{
+	char buf[24];
+
+	snprintf(buf, sizeof(buf), "%lld", value);
+
+	return llcache_metadata_append(op, buf);
+}
+
+/**
+ * Serialise an object's metadata for the backing store
+ *
+ * \param object  Object to serialise metadata of
+ * \param data	  Pointer to location to receive data, which the caller
+ *		  must free
+ * \param len	  Pointer to location to receive byte length of data
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * The metadata is a sequence of NUL-terminated fields: the URL, the cache
+ * control data, the source length, the header count and then the name and
+ * value of each header.
+ */
+static nserror llcache_serialise_metadata(llcache_object *object,
+		uint8_t **data, size_t *len)
+{
+	const llcache_cache_control *cd = &object->cache;
+	size_t alloc;
+	char *buf, *op;
+	size_t i;
+
+	/* Numeric fields need at most 21 bytes each, including the NUL */
+	alloc = nsurl_length(object->url) + 1 + 11 * 21;
+	if (cd->etag != NULL)
+		alloc += strlen(cd->etag);
+	for (i = 0; i < object->num_headers; i++) {
+		alloc += strlen(object->headers[i].name) + 1 +
+				strlen(object->headers[i].value) + 1;
+	}
+
+	buf = malloc(alloc);
+	if (buf == NULL)
+		return NSERROR_NOMEM;
+
+	op = llcache_metadata_append(buf, nsurl_access(object->url));
+	op = llcache_metadata_append_num(op, cd->req_time);
+	op = llcache_metadata_append_num(op, cd->res_time);
+	op = llcache_metadata_append_num(op, cd->date);
+	op = llcache_metadata_append_num(op, cd->expires);
+	op = llcache_metadata_append_num(op, cd->age);
+	op = llcache_metadata_append_num(op, cd->max_age);
+	op = llcache_metadata_append_num(op, cd->no_cache);
+	op = llcache_metadata_append(op, cd->etag != NULL ? cd->etag : "");
+	op = llcache_metadata_append_num(op, cd->last_modified);
+	op = llcache_metadata_append_num(op, object->source.len);
+	op = llcache_metadata_append_num(op, object->num_headers);
+
+	for (i = 0; i < object->num_headers; i++) {
+		op = llcache_metadata_append(op, object->headers[i].name);
+		op = llcache_metadata_append(op, object->headers[i].value);
+	}
+
+	assert((size_t) (op - buf) <= alloc);
+
+	*data = (uint8_t *) buf;
+	*len = op - buf;
+
+	return NSERROR_OK;
+}
+
+/**
+ * Extract the next field from serialised metadata
+ *
+ * \param pos  Pointer to current position, updated on exit
+ * \param end  End of metadata
+ * \return Pointer to field, or NULL if the metadata is truncated
+ */
+static const char *llcache_metadata_field(const uint8_t **pos,
+		const uint8_t *end)
+{
+	const char *field = (const char *) *pos;
+	const uint8_t *nul = memchr(*pos, '\0', end - *pos);
+
+	if (nul == NULL)
+		return NULL;
+
+	*pos = nul + 1;
+
+	return field;
+}
+
+/**
+ * Populate an object from serialised metadata
+ *
+ * \param object      Object to populate
+ * \param data	      Serialised metadata
+ * \param len	      Byte length of \a data
+ * \param source_len  Pointer to location to receive source data length
+ * \return NSERROR_OK on success,
+ *	   NSERROR_NOT_FOUND if the metadata is invalid or for another URL,
+ *	   appropriate error otherwise
+ */
+static nserror llcache_process_metadata(llcache_object *object,
+		const uint8_t *data, size_t len, size_t *source_len)
+{
+	llcache_cache_control *cd = &object->cache;
+	const uint8_t *pos = data, *end = data + len;
+	const char *field[11], *count;
+	size_t num_headers, i;
+
+	for (i = 0; i < NOF_ELEMENTS(field); i++) {
+		field[i] = llcache_metadata_field(&pos, end);
+		if (field[i] == NULL)
+			return NSERROR_NOT_FOUND;
+	}
+
+	/* Distinct URLs may share a backing store entry */
+	if (strcmp(field[0], nsurl_access(object->url)) != 0)
+		return NSERROR_NOT_FOUND;
+
+	cd->req_time = strtoll(field[1], NULL, 10);
+	cd->res_time = strtoll(field[2], NULL, 10);
+	cd->date = strtoll(field[3], NULL, 10);
+	cd->expires = strtoll(field[4], NULL, 10);
+	cd->age = atoi(field[5]);
+	cd->max_age = atoi(field[6]);
+	cd->no_cache = atoi(field[7]);
+	if (field[8][0] != '\0') {
+		cd->etag = strdup(field[8]);
+		if (cd->etag == NULL)
+			return NSERROR_NOMEM;
+	}
+	cd->last_modified = strtoll(field[9], NULL, 10);
+	*source_len = strtoul(field[10], NULL, 10);
+
+	count = llcache_metadata_field(&pos, end);
+	if (count == NULL)
+		return NSERROR_NOT_FOUND;
+	num_headers = strtoul(count, NULL, 10);
+
+	if (num_headers > 0) {
+		object->headers = calloc(num_headers, sizeof(llcache_header));
+		if (object->headers == NULL)
+			return NSERROR_NOMEM;
+	}
+
+	for (i = 0; i < num_headers; i++) {
+		const char *name = llcache_metadata_field(&pos, end);
+		const char *value = llcache_metadata_field(&pos, end);
+
+		if (name == NULL || value == NULL)
+			return NSERROR_NOT_FOUND;
+
+		object->headers[i].name = strdup(name);
+		object->headers[i].value = strdup(value);
+		object->num_headers++;
+
+		if (object->headers[i].name == NULL ||
+				object->headers[i].value == NULL)
+			return NSERROR_NOMEM;
+	}
+
+	return NSERROR_OK;
+}
+
+/**
+ * Retrieve an object from the backing store
+ *
+ * \param url	  URL of object to retrieve
+ * \param result  Pointer to location to receive retrieved object
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * On success, the object is complete and has been added to the cached
+ * object list. It may not be fresh.
+ */
+static nserror llcache_object_retrieve_from_store(nsurl *url,
+		llcache_object **result)
+{
+	nserror error;
+	llcache_object *obj;
+	uint8_t *meta, *data;
+	size_t meta_len, data_len, source_len;
+
+	error = backing_store_fetch(url, BACKING_STORE_META, &meta, &meta_len);
+	if (error != NSERROR_OK)
+		return error;
+
+	error = llcache_object_new(url, &obj);
+	if (error != NSERROR_OK) {
+		free(meta);
+		return error;
+	}
+
+	error = llcache_process_metadata(obj, meta, meta_len, &source_len);
+	free(meta);
+	if (error != NSERROR_OK) {
+		llcache_object_destroy(obj);
+		return error;
+	}
+
+	error = backing_store_fetch(url, BACKING_STORE_NONE, &data, &data_len);
+	if (error == NSERROR_OK && data_len != source_len) {
+		/* Data doesn't match metadata; discard both */
+		free(data);
+		backing_store_invalidate(url);
+		error = NSERROR_NOT_FOUND;
+	}
+	if (error == NSERROR_OK) {
+		error = chunkbuf_adopt(&obj->source, data, data_len);
+		if (error != NSERROR_OK)
+			free(data);
+	}
+	if (error != NSERROR_OK) {
+		llcache_object_destroy(obj);
+		return error;
+	}
+
+	obj->fetch.state = LLCACHE_FETCH_COMPLETE;
+	obj->persisted = true;
+
+#ifdef LLCACHE_TRACE
+	LOG(("Retrieved %p from backing store", obj));
+#endif
+
+	llcache_object_add_to_list(obj, &llcache->cached_objects);
+
+	*result = obj;
+
+	return NSERROR_OK;
+}
+
+/**
+ * Determine if an object is worth placing in the backing store
+ *
+ * \param object  Object to consider
+ * \return True if the object should be persisted, false otherwise
+ */
+static bool llcache_object_is_persistable(const llcache_object *object)
+{
+	const llcache_cache_control *cd = &object->cache;
+	const llcache_object *other;
+	lwc_string *scheme;
+	bool http = false, https = false;
+
+	if (object->persisted || cd->no_store ||
+			object->fetch.state != LLCACHE_FETCH_COMPLETE ||
+			object->fetch.fetch != NULL ||
+			object->fetch.outstanding_query ||
+			(object->fetch.flags & LLCACHE_RETRIEVE_STREAM_DATA))
+		return false;
+
+	/* The object must be usable without refetching, or at least 
+	 * revalidatable */
+	if (cd->etag == NULL && cd->last_modified == 0 &&
+			cd->max_age <= 0 && cd->expires == 0)
+		return false;
+
+	/* Only objects fetched over HTTP carry cache control data */
+	scheme = nsurl_get_component(object->url, NSURL_SCHEME);
+	if (scheme == NULL)
+		return false;
+	lwc_string_isequal(scheme, llcache_http_lwc, &http);
+	lwc_string_isequal(scheme, llcache_https_lwc, &https);
+	lwc_string_unref(scheme);
+	if (http == false && https == false)
+		return false;
+
+	/* Don't let an older copy of the object replace a newer one */
+	for (other = *llcache_index_bucket(object->url); other != NULL;
+			other = other->hash_next) {
+		if (other != object && 
+				other->cache.req_time > cd->req_time &&
+				nsurl_compare(other->url, object->url,
+						NSURL_COMPLETE) == true)
+			return false;
+	}
+
+	return true;
+}
+
+/**
+ * Place an object in the backing store, if it is worth keeping
+ *
+ * \param object  Object to persist
+ */
+static void llcache_object_persist(llcache_object *object)
+{
+	const uint8_t *data;
+	uint8_t *meta;
+	size_t meta_len;
+
+	if (llcache_object_is_persistable(object) == false)
+		return;
+
+	data = chunkbuf_flatten(&object->source);
+	if (data == NULL && object->source.len > 0)
+		return;
+
+	if (llcache_serialise_metadata(object, &meta, &meta_len) != NSERROR_OK)
+		return;
+
+	/* Metadata goes last, so it is only present with valid data */
+	if (backing_store_store(object->url, BACKING_STORE_NONE,
+			data, object->source.len) == NSERROR_OK &&
+			backing_store_store(object->url, BACKING_STORE_META,
+			meta, meta_len) == NSERROR_OK) {
+#ifdef LLCACHE_TRACE
+		LOG(("Persisted %p", object));
+#endif
+		object->persisted = true;
+	}
+
+	free(meta);
+}
+
+/**
+ * Start revalidating a cached object
+ *
+ * \param candidate	  Object to revalidate
+ * \param flags		  Fetch flags
+ * \param referer	  Referring URL, or NULL if none
+ * \param post		  POST data, or NULL for a GET request
+ * \param redirect_count  Number of redirects followed so far
+ * \param priority	  Fetch priority
+ * \param result	  Pointer to location to recieve revalidating object
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * The revalidating object is added to the cache. If its fetch finds that
+ * \a candidate is unmodified, its users are moved to \a candidate.
+ */
+static nserror llcache_object_revalidate(llcache_object *candidate,
+		uint32_t flags, nsurl *referer, const llcache_post_data *post,
+		uint32_t redirect_count, fetch_priority priority,
+		llcache_object **result)
+{
+	nserror error;
+	llcache_object *obj;
+
+	/* Create a new object */
+	error = llcache_object_new(candidate->url, &obj);
+	if (error != NSERROR_OK)
+		return error;
+
+#ifdef LLCACHE_TRACE
+	LOG(("Found candidate %p (%p)", obj, candidate));
+#endif
+
+	/* Clone candidate's cache data */
+	error = llcache_object_clone_cache_data(candidate, obj, true);
+	if (error != NSERROR_OK) {
+		llcache_object_destroy(obj);
+		return error;
+	}			
+
+	obj->has_query = candidate->has_query;
+
+	/* Record candidate, so we can fall back if it is still fresh */
+	candidate->candidate_count++;
+	obj->candidate = candidate;
+
+	/* Attempt to kick-off fetch */
+	error = llcache_object_fetch(obj, flags, referer, post,
+			redirect_count, priority);
+	if (error != NSERROR_OK) {
+		candidate->candidate_count--;
+		llcache_object_destroy(obj);
+		return error;
+	}
+
+	/* Add new object to cache */
+	llcache_object_add_to_list(obj, &llcache->cached_objects);
+
+	*result = obj;
+
+	return NSERROR_OK;
+}
+
+/**
+ * Revalidate a cached object while its users carry on using it
+ *
+ * \param candidate  Object to revalidate
+ * \param flags      Fetch flags
+ * \param referer    Referring URL, or NULL if none
+ *
+ * Nothing is done if \a candidate is already being revalidated. Failure
+ * is not reported, as the cached object remains usable meanwhile.
+ */
+static void llcache_object_revalidate_background(llcache_object *candidate,
+		uint32_t flags, nsurl *referer)
+{
+	llcache_object *obj;
+
+	if (candidate->candidate_count != 0)
+		return;
+
+	if (llcache_object_revalidate(candidate, flags, referer, NULL, 0,
+			FETCH_PRIORITY_NORMAL, &obj) != NSERROR_OK) {
+		LOG(("Failed to revalidate %p", candidate));
+		return;
+	}
+
+	obj->background = true;
+	llcache->background_count++;
+}
+
 /**
  * Retrieve a potentially cached object
  *
@@ -955,12 +1688,14 @@ static nserror llcache_object_clone_cache_data(llcache_object *source,
  * \param referer	  Referring URL, or NULL if none
  * \param post		  POST data, or NULL for a GET request
  * \param redirect_count  Number of redirects followed so far
+ * \param priority	  Fetch priority
  * \param result	  Pointer to location to recieve retrieved object
  * \return NSERROR_OK on success, appropriate error otherwise
  */
 static nserror llcache_object_retrieve_from_cache(nsurl *url, uint32_t flags,
 		nsurl *referer, const llcache_post_data *post,
-		uint32_t redirect_count, llcache_object **result)
+		uint32_t redirect_count, fetch_priority priority,
+		llcache_object **result)
 {
 	nserror error;
 	llcache_object *obj, *newest = NULL;
@@ -969,62 +1704,72 @@ static nserror llcache_object_retrieve_from_cache(nsurl *url, uint32_t flags,
 	LOG(("Searching cache for %s (%x %s %p)", url, flags, referer, post));
 #endif
 
-	/* Search for the most recently fetched matching object */
-	for (obj = llcache->cached_objects; obj != NULL; obj = obj->next) {
+	/* Search for the most recently fetched matching object, ignoring
+	 * background revalidations until they're done */
+	for (obj = *llcache_index_bucket(url); obj != NULL;
+			obj = obj->hash_next) {
 
 		if ((newest == NULL || 
 				obj->cache.req_time > newest->cache.req_time) &&
+				(obj->background == false || 
+				obj->fetch.state == LLCACHE_FETCH_COMPLETE) &&
 				nsurl_compare(obj->url, url,
 						NSURL_COMPLETE) == true) {
 			newest = obj;
 		}
 	}
 
+	/* Not in memory, so try the backing store */
+	if (newest == NULL && llcache_object_retrieve_from_store(url,
+			&obj) == NSERROR_OK) {
+		llcache->store_hit_count++;
+		newest = obj;
+	}
+
+	/* Whatever we found is in use, so shouldn't be evicted soon */
+	if (newest != NULL)
+		llcache_object_touch(newest);
+
 	if (newest != NULL && llcache_object_is_fresh(newest)) {
 		/* Found a suitable object, and it's still fresh, so use it */
 		obj = newest;
+		llcache->hit_count++;
+
+		/* It may still be being fetched, for a less urgent user */
+		llcache_object_set_priority(obj, priority);
 
 #ifdef LLCACHE_TRACE
 		LOG(("Found fresh %p", obj));
 #endif
 
+		/* Refresh it ahead of time if it is popular */
+		obj->hits++;
+		if (llcache_object_is_expiring(obj))
+			llcache_object_revalidate_background(obj, flags,
+					referer);
+
 		/* The client needs to catch up with the object's state.
 		 * This will occur the next time that llcache_poll is called.
 		 */
-	} else if (newest != NULL) {
-		/* Found a candidate object but it needs freshness validation */
-
-		/* Create a new object */
-		error = llcache_object_new(url, &obj);
-		if (error != NSERROR_OK)
-			return error;
+	} else if (newest != NULL && llcache_object_may_use_stale(newest)) {
+		/* Found a stale object, which may be used as-is while it
+		 * is revalidated */
+		obj = newest;
+		llcache->hit_count++;
 
 #ifdef LLCACHE_TRACE
-		LOG(("Found candidate %p (%p)", obj, newest));
+		LOG(("Found stale %p", obj));
 #endif
 
-		/* Clone candidate's cache data */
-		error = llcache_object_clone_cache_data(newest, obj, true);
-		if (error != NSERROR_OK) {
-			llcache_object_destroy(obj);
-			return error;
-		}			
-
-		/* Record candidate, so we can fall back if it is still fresh */
-		newest->candidate_count++;
-		obj->candidate = newest;
-
-		/* Attempt to kick-off fetch */
-		error = llcache_object_fetch(obj, flags, referer, post,
-				redirect_count);
-		if (error != NSERROR_OK) {
-			newest->candidate_count--;
-			llcache_object_destroy(obj);
+		llcache_object_revalidate_background(obj, flags, referer);
+	} else if (newest != NULL) {
+		/* Found a candidate object but it needs freshness validation */
+		error = llcache_object_revalidate(newest, flags, referer, post,
+				redirect_count, priority, &obj);
+		if (error != NSERROR_OK)
 			return error;
-		}
 
-		/* Add new object to cache */
-		llcache_object_add_to_list(obj, &llcache->cached_objects);
+		llcache->revalidate_count++;
 	} else {
 		/* No object found; create a new one */
 		/* Create new object */
@@ -1036,9 +1781,11 @@ static nserror llcache_object_retrieve_from_cache(nsurl *url, uint32_t flags,
 		LOG(("Not found %p", obj));
 #endif
 
+		llcache->miss_count++;
+
 		/* Attempt to kick-off fetch */
 		error = llcache_object_fetch(obj, flags, referer, post,
-				redirect_count);
+				redirect_count, priority);
 		if (error != NSERROR_OK) {
 			llcache_object_destroy(obj);
 			return error;
@@ -1061,12 +1808,14 @@ static nserror llcache_object_retrieve_from_cache(nsurl *url, uint32_t flags,
  * \param referer	  Referring URL, or NULL if none
  * \param post		  POST data, or NULL for a GET request
  * \param redirect_count  Number of redirects followed so far
+ * \param priority	  Fetch priority
  * \param result	  Pointer to location to recieve retrieved object
  * \return NSERROR_OK on success, appropriate error otherwise
  */
 static nserror llcache_object_retrieve(nsurl *url, uint32_t flags,
 		nsurl *referer, const llcache_post_data *post,
-		uint32_t redirect_count, llcache_object **result)
+		uint32_t redirect_count, fetch_priority priority,
+		llcache_object **result)
 {
 	nserror error;
 	llcache_object *obj;
@@ -1106,7 +1855,7 @@ static nserror llcache_object_retrieve(nsurl *url, uint32_t flags,
 
 		/* Attempt to kick-off fetch */
 		error = llcache_object_fetch(obj, flags, referer, post, 
-				redirect_count);
+				redirect_count, priority);
 		if (error != NSERROR_OK) {
 			llcache_object_destroy(obj);
 			nsurl_unref(defragmented_url);
@@ -1117,7 +1866,8 @@ static nserror llcache_object_retrieve(nsurl *url, uint32_t flags,
 		llcache_object_add_to_list(obj, &llcache->uncached_objects);
 	} else {
 		error = llcache_object_retrieve_from_cache(defragmented_url,
-				flags, referer, post, redirect_count, &obj);
+				flags, referer, post, redirect_count, priority,
+				&obj);
 		if (error != NSERROR_OK) {
 			nsurl_unref(defragmented_url);
 			return error;
@@ -1265,7 +2015,8 @@ static nserror llcache_fetch_redirect(llcache_object *object, const char *target
 	/* Attempt to fetch target URL */
 	error = llcache_object_retrieve(url, object->fetch.flags,
 			object->fetch.referer, post, 
-			object->fetch.redirect_count + 1, &dest);
+			object->fetch.redirect_count + 1, object->fetch.priority,
+			&dest);
 
 	/* No longer require url */
 	nsurl_unref(url);
@@ -1335,6 +2086,10 @@ static nserror llcache_fetch_notmodified(llcache_object *object,
 				false);
 		/* Bring candidate's cache data up to date */
 		llcache_object_cache_update(object->candidate);
+		/* Backing store copy of candidate's metadata is now stale */
+		object->candidate->persisted = false;
+		/* Candidate has to earn another early revalidation */
+		object->candidate->hits = 0;
 		/* Revert no-cache to normal, if required */
 		if (object->candidate->cache.no_cache == 
 				LLCACHE_VALIDATE_ONCE) {
@@ -1376,20 +2131,16 @@ static nserror llcache_fetch_notmodified(llcache_object *object,
 static nserror llcache_fetch_process_data(llcache_object *object, const uint8_t *data, 
 		size_t len)
 {
-	/* Resize source buffer if it's too small */
-	if (object->source_len + len >= object->source_alloc) {
-		const size_t new_len = object->source_len + len + 64 * 1024;
-		uint8_t *temp = realloc(object->source_data, new_len);
-		if (temp == NULL)
-			return NSERROR_NOMEM;
-
-		object->source_data = temp;
-		object->source_alloc = new_len;
-	}
+	nserror error;
 
 	/* Append this data chunk to source buffer */
-	memcpy(object->source_data + object->source_len, data, len);
-	object->source_len += len;
+	error = chunkbuf_append(&object->source, data, len);
+	if (error != NSERROR_OK)
+		return error;
+
+	llcache->total_size += len;
+	if (llcache->total_size > llcache->peak_size)
+		llcache->peak_size = llcache->total_size;
 
 	return NSERROR_OK;
 }
@@ -1453,7 +2204,7 @@ static nserror llcache_fetch_auth(llcache_object *object, const char *realm)
 	if (realm == NULL)
 		realm = nsurl_access(object->url);
 
-	auth = urldb_get_auth_details(nsurl_access(object->url), realm);
+	auth = urldb_nsurl_get_auth_details(object->url, realm);
 
 	if (auth == NULL || object->fetch.tried_with_auth == true) {
 		/* No authentication details, or tried what we had, so ask */
@@ -1559,6 +2310,27 @@ static void llcache_fetch_callback(const fetch_msg *msg, void *p)
 	LOG(("Fetch event %d for %p", msg->type, object));
 #endif
 
+	/* Nobody is waiting on a background revalidation to ask about
+	 * redirects, authentication or certificates, so abandon it and
+	 * leave those to the next foreground fetch */
+	if (object->background && (msg->type == FETCH_REDIRECT ||
+			msg->type == FETCH_AUTH ||
+			msg->type == FETCH_CERT_ERR)) {
+		if (object->candidate != NULL) {
+			object->candidate->candidate_count--;
+			object->candidate = NULL;
+		}
+
+		fetch_abort(object->fetch.fetch);
+		object->fetch.fetch = NULL;
+
+		llcache_invalidate_cache_control_data(object);
+
+		object->fetch.state = LLCACHE_FETCH_COMPLETE;
+
+		return;
+	}
+
 	switch (msg->type) {
 	case FETCH_HEADER:
 		/* Received a fetch header */
@@ -1628,23 +2400,13 @@ static void llcache_fetch_callback(const fetch_msg *msg, void *p)
 		break;
 	case FETCH_FINISHED:
 		/* Finished fetching */
-	{
-		uint8_t *temp;
-
 		object->fetch.state = LLCACHE_FETCH_COMPLETE;
 		object->fetch.fetch = NULL;
 
 		/* Shrink source buffer to required size */
-		temp = realloc(object->source_data, 
-				object->source_len);
-		/* If source_len is 0, then temp may be NULL */
-		if (temp != NULL || object->source_len == 0) {
-			object->source_data = temp;
-			object->source_alloc = object->source_len;
-		}
+		chunkbuf_trim(&object->source);
 
 		llcache_object_cache_update(object);
-	}
 		break;
 
 	/* Out-of-band information */
@@ -1745,6 +2507,9 @@ static llcache_object_user *llcache_object_find_user(const llcache_handle *handl
 /**
  * Remove a low-level cache object from a cache list
  *
+ * Objects removed from the cached object list are also removed from the
+ * URL index.
+ *
  * \param object  Object to remove
  * \param list	  List to remove from
  * \return NSERROR_OK
@@ -1752,6 +2517,13 @@ static llcache_object_user *llcache_object_find_user(const llcache_handle *handl
 static nserror llcache_object_remove_from_list(llcache_object *object,
 		llcache_object **list)
 {
+	if (list == &llcache->cached_objects) {
+		if (object == llcache->cached_objects_tail)
+			llcache->cached_objects_tail = object->prev;
+
+		llcache_index_remove(object);
+	}
+
 	if (object == *list)
 		*list = object->next;
 	else
@@ -1760,6 +2532,8 @@ static nserror llcache_object_remove_from_list(llcache_object *object,
 	if (object->next != NULL)
 		object->next->prev = object->prev;
 
+	llcache->total_size -= llcache_object_size(object);
+
 	return NSERROR_OK;
 }
 
@@ -1910,35 +2684,45 @@ static nserror llcache_object_notify_users(llcache_object *object)
 			}
 		}
 
-		/* User: DATA, Obj: DATA, COMPLETE, more source available */
+		/* User: DATA, Obj: DATA, COMPLETE, more source available
+		 * and at least as much as the client asked for */
 		if (handle->state == LLCACHE_FETCH_DATA &&
 				objstate >= LLCACHE_FETCH_DATA &&
-				object->source_len > handle->bytes) {
+				object->source.len > handle->bytes &&
+				object->source.len >= handle->wanted) {
+			const bool streaming = (object->fetch.flags & 
+					LLCACHE_RETRIEVE_STREAM_DATA) != 0;
 			size_t orig_handle_read;
 
-			/* Construct HAD_DATA event */
+			/* Construct HAD_DATA event. The data is passed
+			 * straight from the source buffer, a chunk at a 
+			 * time. */
 			event.type = LLCACHE_EVENT_HAD_DATA;
-			event.data.data.buf = 
-					object->source_data + handle->bytes;
-			event.data.data.len = 
-					object->source_len - handle->bytes;
+			event.data.data.buf = chunkbuf_span(&object->source,
+					handle->bytes, &event.data.data.len);
 
 			/* Update record of last byte emitted */
-			if (object->fetch.flags & 
-					LLCACHE_RETRIEVE_STREAM_DATA) {
-				/* Streaming, so reset to zero to 
-				 * minimise amount of cached source data.
-				 * Additionally, we don't support replay
+			if (streaming) {
+				/* Streaming, so the data is discarded once
+				 * emitted to minimise amount of cached source
+				 * data. Additionally, we don't support replay
 				 * when streaming. */
 				orig_handle_read = 0;
-				handle->bytes = object->source_len = 0;
 			} else {
 				orig_handle_read = handle->bytes;
-				handle->bytes = object->source_len;
+				handle->bytes += event.data.data.len;
 			}
 
 			/* Emit event */
+			handle->wanted = 0;
 			error = handle->cb(handle, &event, handle->pw);
+
+			if (streaming) {
+				llcache->total_size -= event.data.data.len;
+				chunkbuf_discard(&object->source, 
+						event.data.data.len);
+			}
+
 			if (user->queued_for_delete) {
 				next_user = user->next;
 				llcache_object_remove_user(object, user);
@@ -1961,6 +2745,14 @@ static nserror llcache_object_notify_users(llcache_object *object)
 				user->iterator_target = false;
 				return error;
 			}
+
+			/* Source is in further chunks: revisit this user
+			 * to emit the rest before going any further */
+			if (object->source.len > handle->bytes) {
+				user->iterator_target = false;
+				next_user = user;
+				continue;
+			}
 		}
 
 		/* User: DATA, Obj: COMPLETE => User->COMPLETE */
@@ -1971,6 +2763,7 @@ static nserror llcache_object_notify_users(llcache_object *object)
 			/* Emit DONE event */
 			event.type = LLCACHE_EVENT_DONE;
 
+			handle->wanted = 0;
 			error = handle->cb(handle, &event, handle->pw);
 			if (user->queued_for_delete) {
 				next_user = user->next;
@@ -2032,16 +2825,11 @@ static nserror llcache_object_snapshot(llcache_object *object,
 	
 	newobj->has_query = object->has_query;
 
-	newobj->source_alloc = newobj->source_len = object->source_len;
-	
-	if (object->source_len > 0) {
-		newobj->source_data = malloc(newobj->source_alloc);
-		if (newobj->source_data == NULL) {
-			llcache_object_destroy(newobj);
-			return NSERROR_NOMEM;
-		}
-		memcpy(newobj->source_data, object->source_data, 
-				newobj->source_len);
+	/* The snapshot shares the source data, rather than copying it */
+	error = chunkbuf_share(&object->source, &newobj->source);
+	if (error != NSERROR_OK) {
+		llcache_object_destroy(newobj);
+		return error;
 	}
 	
 	if (object->num_headers > 0) {
@@ -2084,8 +2872,7 @@ static nserror llcache_object_snapshot(llcache_object *object,
 /* Exported interface documented in llcache.h */
 void llcache_clean(void)
 {
-	llcache_object *object, *next;
-	uint32_t llcache_size = 0;
+	llcache_object *object, *next, *prev;
 
 #ifdef LLCACHE_TRACE
 	LOG(("Attempting cache clean"));
@@ -2095,7 +2882,8 @@ void llcache_clean(void)
 	 * 
 	 * 1) Uncacheable objects with no users
 	 * 2) Stale cacheable objects with no users or pending fetches
-	 * 3) Fresh cacheable objects with no users or pending fetches
+	 * 3) Fresh cacheable objects with no users or pending fetches,
+	 *    least recently used first
 	 */
 
 	/* 1) Uncacheable objects with no users or fetches */
@@ -2113,61 +2901,131 @@ void llcache_clean(void)
 			llcache_object_remove_from_list(object, 
 					&llcache->uncached_objects);
 			llcache_object_destroy(object);
-		} else {
-			llcache_size += object->source_len + sizeof(*object);
 		}
 	}
 
-	/* 2) Stale cacheable objects with no users or pending fetches */
-	for (object = llcache->cached_objects; object != NULL; object = next) {
-		next = object->next;
+	/* 2) and 3) Cacheable objects with no users or pending fetches.
+	 * 
+	 * The cached object list is in order of use, so walking it from
+	 * the tail visits the least recently used objects first. Stale
+	 * objects are always removed, unless they may be used while they
+	 * are revalidated. Fresh objects are removed only while the cache
+	 * exceeds the configured size.
+	 */
+	for (object = llcache->cached_objects_tail; object != NULL; 
+			object = prev) {
+		prev = object->prev;
+
+		if ((object->users != NULL) ||
+		    (object->candidate_count != 0) ||
+		    (object->fetch.fetch != NULL) ||
+		    (object->fetch.outstanding_query != false))
+			continue;
+
+		if (llcache->total_size <= llcache->limit &&
+				(llcache_object_is_fresh(object) ||
+				llcache_object_may_use_stale(object)))
+			continue;
 
-		if ((object->users == NULL) && 
-		    (object->candidate_count == 0) &&
-		    (llcache_object_is_fresh(object) == false) &&
-		    (object->fetch.fetch == NULL) &&
-		    (object->fetch.outstanding_query == false)) {
 #ifdef LLCACHE_TRACE
-			LOG(("Found victim %p", object));
+		LOG(("Found victim %p", object));
 #endif
-			llcache_object_remove_from_list(object,
-					&llcache->cached_objects);
-			llcache_object_destroy(object);
-		} else {
-			llcache_size += object->source_len + sizeof(*object);
-		}
-	}
+		llcache->evict_count++;
+		llcache->evict_size += llcache_object_size(object);
 
-	/* 3) Fresh cacheable objects with no users or pending
-	 * fetches, only if the cache exceeds the configured size.
-	 */
-	if (llcache->limit < llcache_size) {
-		for (object = llcache->cached_objects; object != NULL; 
-				object = next) {
-			next = object->next;
+		llcache_object_persist(object);
+		llcache_object_remove_from_list(object,
+				&llcache->cached_objects);
+		llcache_object_destroy(object);
+	}
 
-			if (object->users == NULL && 
-					object->candidate_count == 0 &&
-					object->fetch.fetch == NULL &&
-					object->fetch.outstanding_query == 
-							false) {
 #ifdef LLCACHE_TRACE
-				LOG(("Found victim %p", object));
+	LOG(("Size: %zu", llcache->total_size));
 #endif
-				llcache_size -= 
-					object->source_len + sizeof(*object);
 
-				llcache_object_remove_from_list(object,
-						&llcache->cached_objects);
-				llcache_object_destroy(object);
+}
+
+/* See llcache.h for documentation */
+int llcache_snsummaryf(char *string, size_t size, const char *fmt)
+{
+	size_t slen = 0; /* current output string length */
+	int fmtc = 0; /* current index into format string */
+	bool pct;
+	unsigned int op_count;
+
+	if (llcache == NULL || size == 0)
+		return -1;
+
+	op_count = llcache->hit_count +
+		llcache->revalidate_count +
+		llcache->miss_count;
+
+	while ((slen < size) && (fmt[fmtc] != 0)) {
+		if (fmt[fmtc] == '%') {
+			fmtc++;
+
+			/* check for percentage modifier */
+			if (fmt[fmtc] == 'p') {
+				fmtc++;
+				pct = true;
+			} else {
+				pct = false;
+			}
+
+#define FMTCHR(chr,fmt,var) case chr : \
+slen += snprintf(string + slen, size - slen, "%"fmt, llcache->var); break
+
+#define FMTPCHR(chr,fmt,var) \
+case chr :							\
+	if (pct) {						\
+		slen += snprintf(string + slen, size - slen, "%u", \
+				op_count > 0 ? (unsigned int) \
+				(((uint64_t) llcache->var * 100) / \
+				op_count) : 100);		\
+	} else {						\
+		slen += snprintf(string + slen, size - slen, "%"fmt, \
+				llcache->var);			\
+	} break
+
+			switch (fmt[fmtc]) {
+			case '%':
+				string[slen] = '%';
+				slen++;
+				break;
+
+			FMTCHR('a', "u", limit);
+			FMTCHR('b', "zu", total_size);
+			FMTCHR('c', "u", cached_index_count);
+			FMTCHR('d', "zu", peak_size);
+
+			case 'e':
+				slen += snprintf(string + slen, size - slen,
+						"%u", op_count);
+				break;
+
+			FMTPCHR('f', "u", hit_count);
+			FMTPCHR('g', "u", revalidate_count);
+			FMTPCHR('h', "u", miss_count);
+			FMTPCHR('i', "u", store_hit_count);
+			FMTCHR('j', "u", evict_count);
+			FMTCHR('k', PRIu64, evict_size);
+			FMTCHR('l', "u", background_count);
 			}
+#undef FMTCHR
+#undef FMTPCHR
+
+			fmtc++;
+		} else {
+			string[slen] = fmt[fmtc];
+			slen++;
+			fmtc++;
 		}
 	}
 
-#ifdef LLCACHE_TRACE
-	LOG(("Size: %u", llcache_size));
-#endif
+	/* Ensure that we NUL-terminate the output */
+	string[min(slen, size - 1)] = '\0';
 
+	return slen;
 }
 
 /* See llcache.h for documentation */
@@ -2183,6 +3041,15 @@ llcache_initialise(llcache_query_callback cb, void *pw, uint32_t llcache_limit)
 	llcache->query_cb_pw = pw;
 	llcache->limit = llcache_limit;
 
+	llcache->cached_index = calloc(LLCACHE_INDEX_INITIAL_SIZE,
+			sizeof(llcache_object *));
+	if (llcache->cached_index == NULL) {
+		free(llcache);
+		llcache = NULL;
+		return NSERROR_NOMEM;
+	}
+	llcache->cached_index_size = LLCACHE_INDEX_INITIAL_SIZE;
+
 	/* Create static scheme strings */
 	if (lwc_intern_string("file", SLEN("file"),
 			&llcache_file_lwc) != lwc_error_ok)
@@ -2196,6 +3063,14 @@ llcache_initialise(llcache_query_callback cb, void *pw, uint32_t llcache_limit)
 			&llcache_resource_lwc) != lwc_error_ok)
 		return NSERROR_NOMEM;
 
+	if (lwc_intern_string("http", SLEN("http"),
+			&llcache_http_lwc) != lwc_error_ok)
+		return NSERROR_NOMEM;
+
+	if (lwc_intern_string("https", SLEN("https"),
+			&llcache_https_lwc) != lwc_error_ok)
+		return NSERROR_NOMEM;
+
 	LOG(("llcache initialised with a limit of %d bytes", llcache_limit));
 
 	return NSERROR_OK;
@@ -2245,6 +3120,12 @@ void llcache_finalise(void)
 		/* Fetch system has already been destroyed */
 		object->fetch.fetch = NULL;		
 
+		/* Keep what we can for next time */
+		llcache_object_persist(object);
+
+		/* Later objects look in the index when being persisted */
+		llcache_index_remove(object);
+
 		llcache_object_destroy(object);
 	}
 
@@ -2252,7 +3133,10 @@ void llcache_finalise(void)
 	lwc_string_unref(llcache_file_lwc);
 	lwc_string_unref(llcache_about_lwc);
 	lwc_string_unref(llcache_resource_lwc);
+	lwc_string_unref(llcache_http_lwc);
+	lwc_string_unref(llcache_https_lwc);
 
+	free(llcache->cached_index);
 	free(llcache);
 	llcache = NULL;
 }
@@ -2281,7 +3165,7 @@ nserror llcache_poll(void)
 /* See llcache.h for documentation */
 nserror llcache_handle_retrieve(nsurl *url, uint32_t flags,
 		nsurl *referer, const llcache_post_data *post,
-		llcache_handle_callback cb, void *pw,
+		fetch_priority priority, llcache_handle_callback cb, void *pw,
 		llcache_handle **result)
 {
 	nserror error;
@@ -2299,7 +3183,8 @@ nserror llcache_handle_retrieve(nsurl *url, uint32_t flags,
 
 	/* Retrieve a suitable object from the cache,
 	 * creating a new one if needed. */
-	error = llcache_object_retrieve(url, flags, referer, post, 0, &object);
+	error = llcache_object_retrieve(url, flags, referer, post, 0, priority,
+			&object);
 	if (error != NSERROR_OK) {
 		llcache_object_user_destroy(user);
 		return error;
@@ -2313,6 +3198,15 @@ nserror llcache_handle_retrieve(nsurl *url, uint32_t flags,
 	return NSERROR_OK;
 }
 
+/* See llcache.h for documentation */
+nserror llcache_handle_set_priority(llcache_handle *handle,
+		fetch_priority priority)
+{
+	llcache_object_set_priority(handle->object, priority);
+
+	return NSERROR_OK;
+}
+
 /* See llcache.h for documentation */
 nserror llcache_handle_change_callback(llcache_handle *handle,
 		llcache_handle_callback cb, void *pw)
@@ -2320,6 +3214,9 @@ nserror llcache_handle_change_callback(llcache_handle *handle,
 	handle->cb = cb;
 	handle->pw = pw;
 
+	/* The new client hasn't asked for anything yet */
+	handle->wanted = 0;
+
 	return NSERROR_OK;
 }
 
@@ -2447,6 +3344,14 @@ nserror llcache_handle_force_stream(llcache_handle *handle)
 	return NSERROR_OK;
 }
 
+/* See llcache.h for documentation */
+nserror llcache_handle_need_data(llcache_handle *handle, size_t len)
+{
+	handle->wanted = len;
+
+	return NSERROR_OK;
+}
+
 /* See llcache.h for documentation */
 nserror llcache_handle_invalidate_cache_data(llcache_handle *handle)
 {
@@ -2469,9 +3374,33 @@ nsurl *llcache_handle_get_url(const llcache_handle *handle)
 const uint8_t *llcache_handle_get_source_data(const llcache_handle *handle,
 		size_t *size)
 {
-	*size = handle->object != NULL ? handle->object->source_len : 0;
+	if (handle->object == NULL) {
+		*size = 0;
+		return NULL;
+	}
+
+	/* Clients want the data in one piece */
+	*size = handle->object->source.len;
 
-	return handle->object != NULL ? handle->object->source_data : NULL;
+	return chunkbuf_flatten(&handle->object->source);
+}
+
+/* See llcache.h for documentation */
+const uint8_t *llcache_handle_get_source_span(const llcache_handle *handle,
+		size_t offset, size_t *size)
+{
+	if (handle->object == NULL) {
+		*size = 0;
+		return NULL;
+	}
+
+	return chunkbuf_span(&handle->object->source, offset, size);
+}
+
+/* See llcache.h for documentation */
+size_t llcache_handle_get_source_size(const llcache_handle *handle)
+{
+	return handle->object != NULL ? handle->object->source.len : 0;
 }
 
 /* See llcache.h for documentation */
@@ -2500,3 +3429,15 @@ bool llcache_handle_references_same_object(const llcache_handle *a,
 	return a->object == b->object;
 }
 
+/* See llcache.h for documentation */
+uint32_t llcache_handle_object_hash(const llcache_handle *handle)
+{
+	uint32_t hash = (uint32_t) ((uintptr_t) handle->object >> 4);
+
+	/* Spread the bits of the address into the low bits, which are
+	 * what hash tables index on */
+	hash *= 0x9e3779b1;
+
+	return hash ^ (hash >> 16);
+}
+
@@ -27,6 +27,7 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "content/fetch.h"
 #include "utils/errors.h"
 #include "utils/nsurl.h"
 
@@ -178,6 +179,38 @@ nserror llcache_poll(void);
  */
 void llcache_clean(void);
 
+/**
+ * Fill a buffer with information about the low-level cache using a format.
+ *
+ * The format string is copied into the output buffer with the
+ * following replaced:
+ *
+ * a Configured cache limit size
+ * b Current total size of objects in the cache
+ * c Number of cacheable objects currently in the cache
+ * d The largest total size the cache has reached since initialisation
+ * e The total number of cacheable retrievals
+ * f The number of retrievals satisfied by a fresh cached object
+ * g The number of retrievals which required a stale object to be
+ *     revalidated
+ * h The number of retrievals which were not in the cache at all
+ * i The number of objects satisfying retrievals which were loaded from
+ *     the backing store
+ * j The number of objects evicted by cleaning
+ * k The total size of objects evicted by cleaning
+ * l The number of objects revalidated while a cached copy was used
+ *
+ * format modifiers:
+ * A p before the value modifies the replacement to be a percentage of
+ * the total number of retrievals.  This is valid for f, g, h and i.
+ *
+ * \param string  The buffer in which to place the results.
+ * \param size    The size of the string buffer.
+ * \param fmt     The format string.
+ * \return The number of bytes written to \a string or -1 on error
+ */
+int llcache_snsummaryf(char *string, size_t size, const char *fmt);
+
 /**
  * Retrieve a handle for a low-level cache object
  *
@@ -185,16 +218,33 @@ void llcache_clean(void);
  * \param flags    Object retrieval flags
  * \param referer  Referring URL, or NULL if none
  * \param post     POST data, or NULL for a GET request
+ * \param priority Fetch priority
  * \param cb       Client callback for events
  * \param pw       Pointer to client-specific data
  * \param result   Pointer to location to recieve cache handle
  * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * If the object is already being fetched less urgently, its fetch is
+ * given \a priority.
  */
 nserror llcache_handle_retrieve(nsurl *url, uint32_t flags,
 		nsurl *referer, const llcache_post_data *post,
-		llcache_handle_callback cb, void *pw,
+		fetch_priority priority, llcache_handle_callback cb, void *pw,
 		llcache_handle **result);
 
+/**
+ * Raise the fetch priority of a low-level cache object
+ *
+ * \param handle    Handle of object to change priority of
+ * \param priority  New priority
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * This affects all users of the object, so the priority is only ever
+ * raised.  It has no effect on fetches which have already started.
+ */
+nserror llcache_handle_set_priority(llcache_handle *handle,
+		fetch_priority priority);
+
 /**
  * Change the callback associated with a low-level cache handle
  *
@@ -240,6 +290,20 @@ nserror llcache_handle_abort(llcache_handle *handle);
  */
 nserror llcache_handle_force_stream(llcache_handle *handle);
 
+/**
+ * Withhold further data events from a low-level cache handle until
+ * its object has at least the given amount of source data
+ *
+ * If the fetch completes first, the DONE event is emitted as usual.
+ * Only the next event is affected: it is intended to be used from
+ * a client callback returning NSERROR_NEED_DATA.
+ *
+ * \param handle  Handle to withhold events from
+ * \param len     Total length of source data required, in bytes
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+nserror llcache_handle_need_data(llcache_handle *handle, size_t len);
+
 /**
  * Invalidate cache data for a low-level cache object
  *
@@ -262,10 +326,38 @@ nsurl *llcache_handle_get_url(const llcache_handle *handle);
  * \param handle  Handle to retrieve source data from
  * \param size    Pointer to location to receive byte length of data
  * \return Pointer to source data
+ *
+ * The object's source data is coalesced into a single block, if it is not
+ * already, so this should only be called by clients which need all the
+ * data at once.  The pointer remains valid until more data arrives.
  */
 const uint8_t *llcache_handle_get_source_data(const llcache_handle *handle,
 		size_t *size);
 
+/**
+ * Retrieve a contiguous span of a low-level cache object's source data
+ *
+ * \param handle  Handle to retrieve source data from
+ * \param offset  Offset into source data of start of span
+ * \param size    Pointer to location to receive byte length of span
+ * \return Pointer to span data, or NULL if \a offset is beyond the data
+ *
+ * The source data is not coalesced, so the span may end before the end of
+ * the data.  Clients which read the data piecemeal should use this in
+ * preference to llcache_handle_get_source_data().  The pointer remains
+ * valid until the source data is next modified or coalesced.
+ */
+const uint8_t *llcache_handle_get_source_span(const llcache_handle *handle,
+		size_t offset, size_t *size);
+
+/**
+ * Retrieve the byte length of a low-level cache object's source data
+ *
+ * \param handle  Handle to retrieve source data length from
+ * \return Byte length of source data
+ */
+size_t llcache_handle_get_source_size(const llcache_handle *handle);
+
 /**
  * Retrieve a header value associated with a low-level cache object
  *
@@ -292,4 +384,16 @@ const char *llcache_handle_get_header(const llcache_handle *handle,
 bool llcache_handle_references_same_object(const llcache_handle *a, 
 		const llcache_handle *b);
 
+/**
+ * Get a hash value for the object referenced by a handle
+ *
+ * \param handle  Handle to consider
+ * \return Hash value
+ *
+ * Handles which reference the same object have the same hash value.
+ * The value changes if the handle is moved to another object, as happens
+ * when it is aborted.
+ */
+uint32_t llcache_handle_object_hash(const llcache_handle *handle);
+
 #endif
@@ -134,9 +134,66 @@ void mimesniff_fini(void)
 	lwc_string_unref(unknown_unknown);
 }
 
-static bool mimesniff__has_binary_octets(const uint8_t *data, size_t len)
+/** Resource header being sniffed */
+struct mimesniff_header {
+	const uint8_t *data;	/**< Octets received so far, or NULL */
+	size_t len;		/**< Length of data, at most 512 */
+	bool complete;		/**< No further octets will be received */
+	size_t wanted;		/**< Length needed to make progress */
+};
+
+/**
+ * Match a signature against the resource header
+ *
+ * \param h         Resource header to match against
+ * \param offset    Offset of signature in header
+ * \param sig       Signature to match
+ * \param len       Length of \a sig
+ * \param caseless  Whether to match ASCII case insensitively
+ * \return NSERROR_OK if the signature matches,
+ *         NSERROR_NEED_DATA if the header received so far is consistent
+ *                           with the signature but too short to tell,
+ *         NSERROR_NOT_FOUND otherwise
+ */
+static nserror mimesniff__match_sig(struct mimesniff_header *h, size_t offset,
+		const uint8_t *sig, size_t len, bool caseless)
+{
+	size_t avail = h->len > offset ? h->len - offset : 0;
+	size_t cmp = min(avail, len);
+
+	if (cmp > 0) {
+		const uint8_t *data = h->data + offset;
+
+		if (caseless && strncasecmp((const char *) data, 
+				(const char *) sig, cmp) != 0)
+			return NSERROR_NOT_FOUND;
+		else if (caseless == false && memcmp(data, sig, cmp) != 0)
+			return NSERROR_NOT_FOUND;
+	}
+
+	if (avail >= len)
+		return NSERROR_OK;
+
+	if (h->complete)
+		return NSERROR_NOT_FOUND;
+
+	h->wanted = offset + len;
+
+	return NSERROR_NEED_DATA;
+}
+
+/**
+ * Search the resource header for binary octets
+ *
+ * \param h  Resource header to search
+ * \return NSERROR_OK if a binary octet was found,
+ *         NSERROR_NEED_DATA if none was found but the header is incomplete,
+ *         NSERROR_NOT_FOUND otherwise
+ */
+static nserror mimesniff__has_binary_octets(struct mimesniff_header *h)
 {
-	const uint8_t *end = data + len;
+	const uint8_t *data = h->data;
+	const uint8_t *end = data + h->len;
 
 	while (data != end) {
 		const uint8_t c = *data;
@@ -144,18 +201,26 @@ static bool mimesniff__has_binary_octets(const uint8_t *data, size_t len)
 		/* Binary iff in C0 and not ESC, CR, FF, LF, HT */
 		if (c <= 0x1f && c != 0x1b && c != '\r' && c != '\f' && 
 				c != '\n' && c != '\t')
-			break;
+			return NSERROR_OK;
 
 		data++;
 	}
 
-	return data != end;
+	if (h->complete)
+		return NSERROR_NOT_FOUND;
+
+	/* Only the whole header can prove the absence of binary octets */
+	h->wanted = 512;
+
+	return NSERROR_NEED_DATA;
 }
 
-static nserror mimesniff__match_mp4(const uint8_t *data, size_t len,
+static nserror mimesniff__match_mp4(struct mimesniff_header *h,
 		lwc_string **effective_type)
 {
+	const uint8_t *data = h->data;
 	size_t box_size, i;
+	nserror error;
 
 	/* ISO/IEC 14496-12:2008 $4.3 says (effectively):
 	 *
@@ -178,23 +243,38 @@ static nserror mimesniff__match_mp4(const uint8_t *data, size_t len,
 	 * which is decidely unlikely.
 	 */
 
+	/* Ensure this is an 'ftyp' box */
+	error = mimesniff__match_sig(h, 4, (const uint8_t *) "ftyp", 
+			SLEN("ftyp"), false);
+	if (error != NSERROR_OK)
+		return error;
+
 	/* 12 reflects the minimum number of octets needed to sniff useful 
 	 * information out of an 'ftyp' box (i.e. the size, type, 
 	 * and major_brand words). */
-	if (len < 12)
-		return NSERROR_NOT_FOUND;
+	if (h->len < 12) {
+		if (h->complete)
+			return NSERROR_NOT_FOUND;
+
+		h->wanted = 12;
+		return NSERROR_NEED_DATA;
+	}
 
 	/* Box size is big-endian */
 	box_size = (data[0] << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
 
-	/* Require that we can read the entire box, and reject bad box sizes */
-	if (len < box_size || box_size % 4 != 0)
+	/* Reject bad box sizes, and those we'll never be able to read */
+	if (box_size < 12 || box_size % 4 != 0 || box_size > 512)
 		return NSERROR_NOT_FOUND;
 
-	/* Ensure this is an 'ftyp' box */
-	if (data[4] != 'f' || data[5] != 't' || 
-			data[6] != 'y' || data[7] != 'p')
-		return NSERROR_NOT_FOUND;
+	/* Require that we can read the entire box */
+	if (h->len < box_size) {
+		if (h->complete)
+			return NSERROR_NOT_FOUND;
+
+		h->wanted = box_size;
+		return NSERROR_NEED_DATA;
+	}
 
 	/* Check if major brand begins with 'mp4' */
 	if (data[8] == 'm' && data[9] == 'p' && data[10] == '4') {
@@ -213,7 +293,7 @@ static nserror mimesniff__match_mp4(const uint8_t *data, size_t len,
 	return NSERROR_NOT_FOUND;
 }
 
-static nserror mimesniff__match_unknown_ws(const uint8_t *data, size_t len,
+static nserror mimesniff__match_unknown_ws(struct mimesniff_header *h,
 		lwc_string **effective_type)
 {
 #define SIG(t, s, x) { (const uint8_t *) s, SLEN(s), x, t }
@@ -243,41 +323,58 @@ static nserror mimesniff__match_unknown_ws(const uint8_t *data, size_t len,
 		{ NULL, 0, false, NULL }
 	};
 #undef SIG
-	const uint8_t *end = data + len;
 	const struct map_s *it;
+	size_t offset = 0;
+	nserror error;
 
 	/* Skip leading whitespace */
-	while (data != end) {
-		const uint8_t c = *data;
+	while (offset != h->len) {
+		const uint8_t c = h->data[offset];
 
 		if (c != '\t' && c != '\n' && c != '\f' && 
 				c != '\r' && c != ' ')
 			break;
 
-		data++;
+		offset++;
 	}
 
-	if (data == end)
-		return NSERROR_NOT_FOUND;
+	if (offset == h->len) {
+		if (h->complete)
+			return NSERROR_NOT_FOUND;
 
-	len = end - data;
+		h->wanted = offset + 1;
+		return NSERROR_NEED_DATA;
+	}
 
 	for (it = ws_exact_match_types; it->sig != NULL; it++) {
-		if (it->len <= len && memcmp(data, it->sig, it->len) == 0) {
+		error = mimesniff__match_sig(h, offset, it->sig, it->len, 
+				false);
+		if (error == NSERROR_OK)
 			*effective_type = lwc_string_ref(*it->type);
-			return NSERROR_OK;
-		}
+		if (error != NSERROR_NOT_FOUND)
+			return error;
 	}
 
 	for (it = ws_inexact_match_types; it->sig != NULL; it++) {
-		/* +1 for trailing space or > */
-		if (len < it->len + 1)
+		size_t trailer = offset + it->len;
+
+		error = mimesniff__match_sig(h, offset, it->sig, it->len, 
+				true);
+		if (error == NSERROR_NOT_FOUND)
 			continue;
+		else if (error != NSERROR_OK)
+			return error;
+
+		/* Require a trailing space or > */
+		if (trailer == h->len) {
+			if (h->complete)
+				continue;
+
+			h->wanted = trailer + 1;
+			return NSERROR_NEED_DATA;
+		}
 
-		if (strncasecmp((const char *) data, 
-				(const char *) it->sig, it->len) == 0 && 
-				(data[it->len] == ' ' || 
-				data[it->len] == '>')) {
+		if (h->data[trailer] == ' ' || h->data[trailer] == '>') {
 			*effective_type = lwc_string_ref(*it->type);
 			return NSERROR_OK;
 		}
@@ -286,7 +383,7 @@ static nserror mimesniff__match_unknown_ws(const uint8_t *data, size_t len,
 	return NSERROR_NOT_FOUND;
 }
 
-static nserror mimesniff__match_unknown_bom(const uint8_t *data, size_t len,
+static nserror mimesniff__match_unknown_bom(struct mimesniff_header *h,
 		lwc_string **effective_type)
 {
 #define SIG(t, s, x) { (const uint8_t *) s, SLEN(s), x, t }
@@ -298,18 +395,20 @@ static nserror mimesniff__match_unknown_bom(const uint8_t *data, size_t len,
 	};
 #undef SIG
 	const struct map_s *it;
+	nserror error;
 
 	for (it = bom_match_types; it->sig != NULL; it++) {
-		if (it->len <= len && memcmp(data, it->sig, it->len) == 0) {
+		error = mimesniff__match_sig(h, 0, it->sig, it->len, false);
+		if (error == NSERROR_OK)
 			*effective_type = lwc_string_ref(*it->type);
-			return NSERROR_OK;
-		}
+		if (error != NSERROR_NOT_FOUND)
+			return error;
 	}
 
 	return NSERROR_NOT_FOUND;
 }
 
-static nserror mimesniff__match_unknown_riff(const uint8_t *data, size_t len,
+static nserror mimesniff__match_unknown_riff(struct mimesniff_header *h,
 		lwc_string **effective_type)
 {
 #define SIG(t, s, x) { (const uint8_t *) s, SLEN(s), x, t }
@@ -320,21 +419,26 @@ static nserror mimesniff__match_unknown_riff(const uint8_t *data, size_t len,
 	};
 #undef SIG
 	const struct map_s *it;
+	nserror error;
+
+	error = mimesniff__match_sig(h, 0, (const uint8_t *) "RIFF", 
+			SLEN("RIFF"), false);
+	if (error != NSERROR_OK)
+		return error;
 
 	for (it = riff_match_types; it->sig != NULL; it++) {
-		if (it->len + SLEN("RIFF????") <= len && 
-				memcmp(data, "RIFF", SLEN("RIFF")) == 0 &&
-				memcmp(data + SLEN("RIFF????"), 
-						it->sig, it->len) == 0) {
+		error = mimesniff__match_sig(h, SLEN("RIFF????"), 
+				it->sig, it->len, false);
+		if (error == NSERROR_OK)
 			*effective_type = lwc_string_ref(*it->type);
-			return NSERROR_OK;
-		}
+		if (error != NSERROR_NOT_FOUND)
+			return error;
 	}
 
 	return NSERROR_NOT_FOUND;
 }
 
-static nserror mimesniff__match_unknown_exact(const uint8_t *data, size_t len,
+static nserror mimesniff__match_unknown_exact(struct mimesniff_header *h,
 		bool allow_unsafe, lwc_string **effective_type)
 {
 #define SIG(t, s, x) { (const uint8_t *) s, SLEN(s), x, t }
@@ -356,59 +460,66 @@ static nserror mimesniff__match_unknown_exact(const uint8_t *data, size_t len,
 	};
 #undef SIG
 	const struct map_s *it;
+	nserror error;
 
 	for (it = exact_match_types; it->sig != NULL; it++) {
-		if (it->len <= len && memcmp(data, it->sig, it->len) == 0 &&
-				(allow_unsafe || it->safe)) {
+		if (allow_unsafe == false && it->safe == false)
+			continue;
+
+		/* Signatures are matched in order, so an earlier one 
+		 * we can't yet rule out takes precedence over later ones */
+		error = mimesniff__match_sig(h, 0, it->sig, it->len, false);
+		if (error == NSERROR_OK)
 			*effective_type = lwc_string_ref(*it->type);
-			return NSERROR_OK;
-		}
+		if (error != NSERROR_NOT_FOUND)
+			return error;
 	}
 
 	return NSERROR_NOT_FOUND;
 }
 
-static nserror mimesniff__match_unknown(const uint8_t *data, size_t len,
+static nserror mimesniff__match_unknown(struct mimesniff_header *h,
 		bool allow_unsafe, lwc_string **effective_type)
 {
-	if (mimesniff__match_unknown_exact(data, len, allow_unsafe, 
-			effective_type) == NSERROR_OK)
-		return NSERROR_OK;
+	nserror error;
 
-	if (mimesniff__match_unknown_riff(data, len, 
-			effective_type) == NSERROR_OK)
-		return NSERROR_OK;
+	error = mimesniff__match_unknown_exact(h, allow_unsafe, 
+			effective_type);
+	if (error != NSERROR_NOT_FOUND)
+		return error;
+
+	error = mimesniff__match_unknown_riff(h, effective_type);
+	if (error != NSERROR_NOT_FOUND)
+		return error;
 
 	if (allow_unsafe == false)
 		return NSERROR_NOT_FOUND;
 
-	if (mimesniff__match_unknown_bom(data, len,
-			effective_type) == NSERROR_OK)
-		return NSERROR_OK;
+	error = mimesniff__match_unknown_bom(h, effective_type);
+	if (error != NSERROR_NOT_FOUND)
+		return error;
 
-	if (mimesniff__match_unknown_ws(data, len,
-			effective_type) == NSERROR_OK)
-		return NSERROR_OK;
+	error = mimesniff__match_unknown_ws(h, effective_type);
+	if (error != NSERROR_NOT_FOUND)
+		return error;
 
-	if (mimesniff__match_mp4(data, len, effective_type) == NSERROR_OK)
-		return NSERROR_OK;
-
-	return NSERROR_NOT_FOUND;
+	return mimesniff__match_mp4(h, effective_type);
 }
 
-static nserror mimesniff__compute_unknown(const uint8_t *data, size_t len,
+static nserror mimesniff__compute_unknown(struct mimesniff_header *h,
 		lwc_string **effective_type)
 {
-	if (data == NULL)
-		return NSERROR_NEED_DATA;
+	nserror error;
 
-	len = min(len, 512);
+	error = mimesniff__match_unknown(h, true, effective_type);
+	if (error != NSERROR_NOT_FOUND)
+		return error;
 
-	if (mimesniff__match_unknown(data, len, true, 
-			effective_type) == NSERROR_OK)
-		return NSERROR_OK;
+	error = mimesniff__has_binary_octets(h);
+	if (error == NSERROR_NEED_DATA)
+		return error;
 
-	if (mimesniff__has_binary_octets(data, len) == false) {
+	if (error == NSERROR_NOT_FOUND) {
 		/* No binary octets => text/plain */
 		*effective_type = lwc_string_ref(text_plain);
 		return NSERROR_OK;
@@ -419,32 +530,29 @@ static nserror mimesniff__compute_unknown(const uint8_t *data, size_t len,
 	return NSERROR_OK;
 }
 
-static nserror mimesniff__compute_text_or_binary(const uint8_t *data, 
-		size_t len, lwc_string **effective_type)
+static nserror mimesniff__compute_text_or_binary(struct mimesniff_header *h,
+		lwc_string **effective_type)
 {
-	if (data == NULL)
-		return NSERROR_NEED_DATA;
+	nserror error;
 
-	len = min(len, 512);
+	/* Found a BOM => text/plain */
+	error = mimesniff__match_unknown_bom(h, effective_type);
+	if (error != NSERROR_NOT_FOUND)
+		return error;
 
-	if (len >= 3 && ((data[0] == 0xfe && data[1] == 0xff) ||
-			(data[0] == 0xff && data[1] == 0xfe) ||
-			(data[0] == 0xef && data[1] == 0xbb && 
-				data[2] == 0xbf))) {
-		/* Found a BOM => text/plain */
-		*effective_type = lwc_string_ref(text_plain);
-		return NSERROR_OK;
-	}
+	error = mimesniff__has_binary_octets(h);
+	if (error == NSERROR_NEED_DATA)
+		return error;
 
-	if (mimesniff__has_binary_octets(data, len) == false) {
+	if (error == NSERROR_NOT_FOUND) {
 		/* No binary octets => text/plain */
 		*effective_type = lwc_string_ref(text_plain);
 		return NSERROR_OK;
 	}
 
-	if (mimesniff__match_unknown(data, len, false, 
-			effective_type) == NSERROR_OK)
-		return NSERROR_OK;
+	error = mimesniff__match_unknown(h, false, effective_type);
+	if (error != NSERROR_NOT_FOUND)
+		return error;
 
 	*effective_type = lwc_string_ref(application_octet_stream);
 
@@ -452,7 +560,7 @@ static nserror mimesniff__compute_text_or_binary(const uint8_t *data,
 }
 
 static nserror mimesniff__compute_image(lwc_string *official_type,
-		const uint8_t *data, size_t len, lwc_string **effective_type)
+		struct mimesniff_header *h, lwc_string **effective_type)
 {
 #define SIG(t, s) { (const uint8_t *) s, SLEN(s), t }
 	static const struct it_s {
@@ -471,28 +579,36 @@ static nserror mimesniff__compute_image(lwc_string *official_type,
 #undef SIG
 
 	const struct it_s *it;
-
-	if (data == NULL) {
-		lwc_string_unref(official_type);
-		return NSERROR_NEED_DATA;
-	}
+	nserror error;
 
 	for (it = image_types; it->sig != NULL; it++) {
-		if (it->len <= len && memcmp(data, it->sig, it->len) == 0) {
+		error = mimesniff__match_sig(h, 0, it->sig, it->len, false);
+		if (error == NSERROR_OK) {
 			lwc_string_unref(official_type);
 			*effective_type = lwc_string_ref(*it->type);
 			return NSERROR_OK;
+		} else if (error == NSERROR_NEED_DATA) {
+			lwc_string_unref(official_type);
+			return NSERROR_NEED_DATA;
 		}
 	}
 
 	/* WebP has a signature that doesn't fit into the above table */
-	if (SLEN("RIFF????WEBPVP") <= len && 
-			memcmp(data, "RIFF", SLEN("RIFF")) == 0 && 
-			memcmp(data + SLEN("RIFF????"), 
-					"WEBPVP", SLEN("WEBPVP")) == 0 ) {
+	error = mimesniff__match_sig(h, 0, (const uint8_t *) "RIFF", 
+			SLEN("RIFF"), false);
+	if (error == NSERROR_OK) {
+		error = mimesniff__match_sig(h, SLEN("RIFF????"), 
+				(const uint8_t *) "WEBPVP", SLEN("WEBPVP"), 
+				false);
+	}
+
+	if (error == NSERROR_OK) {
 		lwc_string_unref(official_type);
 		*effective_type = lwc_string_ref(image_webp);
 		return NSERROR_OK;
+	} else if (error == NSERROR_NEED_DATA) {
+		lwc_string_unref(official_type);
+		return NSERROR_NEED_DATA;
 	}
 
 	*effective_type = official_type;
@@ -500,8 +616,8 @@ static nserror mimesniff__compute_image(lwc_string *official_type,
 	return NSERROR_OK;
 }
 
-static nserror mimesniff__compute_feed_or_html(const uint8_t *data,
-		size_t len, lwc_string **effective_type)
+static nserror mimesniff__compute_feed_or_html(struct mimesniff_header *h,
+		lwc_string **effective_type)
 {
 #define RDF_NS "http://www.w3.org/1999/02/22-rdf-syntax-ns#"
 #define RSS_NS "http://purl.org/rss/1.0"
@@ -519,24 +635,27 @@ static nserror mimesniff__compute_feed_or_html(const uint8_t *data,
 	} state = BEFORE_BOM;
 
 	bool rdf = false, rss = false;
-	const uint8_t *end;
-
-	if (data == NULL)
-		return NSERROR_NEED_DATA;
-
-	end = data + min(len, 512);
+	const uint8_t *data = h->data;
+	const uint8_t *end = data + h->len;
 
 	while (data < end) {
 		const uint8_t c = *data;
 
 #define MATCH(s) SLEN(s) <= (size_t) (end - data) && \
 			memcmp(data, s, SLEN(s)) == 0
+/* Remaining input is a proper prefix of s, which more input may complete */
+#define PARTIAL(s) h->complete == false && \
+			(size_t) (end - data) < SLEN(s) && \
+			memcmp(data, s, end - data) == 0
+#define NEED(s) h->wanted = (data - h->data) + SLEN(s); \
+			return NSERROR_NEED_DATA
 
 		switch (state) {
 		case BEFORE_BOM:
-			if (3 <= end - data && c == 0xef && data[1] == 0xbb && 
-					data[2] == 0xbf) {
+			if (MATCH("\xef\xbb\xbf")) {
 				data += 3;
+			} else if (PARTIAL("\xef\xbb\xbf")) {
+				NEED("\xef\xbb\xbf");
 			}
 
 			state = BEFORE_MARKUP;
@@ -544,9 +663,10 @@ static nserror mimesniff__compute_feed_or_html(const uint8_t *data,
 		case BEFORE_MARKUP:
 			if (c == '\t' || c == '\n' || c	== '\r' || c == ' ')
 				data++;
-			else if (c != '<')
-				data = end;
-			else {
+			else if (c != '<') {
+				*effective_type = lwc_string_ref(text_html);
+				return NSERROR_OK;
+			} else {
 				state = MARKUP_START;
 				data++;
 			}
@@ -564,19 +684,22 @@ static nserror mimesniff__compute_feed_or_html(const uint8_t *data,
 			}
 			break;
 		case COMMENT_OR_DOCTYPE:
-			if (2 <= end - data && c == '-' && data[1] == '-') {
+			if (MATCH("--")) {
 				state = IN_COMMENT;
 				data += 2;
+			} else if (PARTIAL("--")) {
+				NEED("--");
 			} else {
 				/* Reconsume input */
 				state = IN_DOCTYPE;
 			}
 			break;
 		case IN_COMMENT:
-			if (3 <= end - data && c == '-' && data[1] == '-' &&
-					data[2] == '>') {
+			if (MATCH("-->")) {
 				state = BEFORE_MARKUP;
 				data += 3;
+			} else if (PARTIAL("-->")) {
+				NEED("-->");
 			} else
 				data++;
 			break;
@@ -586,9 +709,11 @@ static nserror mimesniff__compute_feed_or_html(const uint8_t *data,
 			data++;
 			break;
 		case IN_PI:
-			if (2 <= end - data && c == '?' && data[1] == '>') {
+			if (MATCH("?>")) {
 				state = BEFORE_MARKUP;
 				data += 2;
+			} else if (PARTIAL("?>")) {
+				NEED("?>");
 			} else
 				data++;
 			break;
@@ -604,8 +729,16 @@ static nserror mimesniff__compute_feed_or_html(const uint8_t *data,
 			} else if (MATCH("rdf:RDF")) {
 				state = IN_RDF;
 				data += SLEN("rdf:RDF");
-			} else
-				data = end;
+			} else if (PARTIAL("rss")) {
+				NEED("rss");
+			} else if (PARTIAL("feed")) {
+				NEED("feed");
+			} else if (PARTIAL("rdf:RDF")) {
+				NEED("rdf:RDF");
+			} else {
+				*effective_type = lwc_string_ref(text_html);
+				return NSERROR_OK;
+			}
 			break;
 		case IN_RDF:
 			if (MATCH(RSS_NS)) {
@@ -614,6 +747,10 @@ static nserror mimesniff__compute_feed_or_html(const uint8_t *data,
 			} else if (MATCH(RDF_NS)) {
 				rdf = true;
 				data += SLEN(RDF_NS);
+			} else if (PARTIAL(RSS_NS)) {
+				NEED(RSS_NS);
+			} else if (PARTIAL(RDF_NS)) {
+				NEED(RDF_NS);
 			} else
 				data++;
 
@@ -625,9 +762,16 @@ static nserror mimesniff__compute_feed_or_html(const uint8_t *data,
 
 			break;
 		}
+#undef NEED
+#undef PARTIAL
 #undef MATCH
 	}
 
+	if (h->complete == false) {
+		h->wanted = h->len + 1;
+		return NSERROR_NEED_DATA;
+	}
+
 	*effective_type = lwc_string_ref(text_html);
 
 	return NSERROR_OK;
@@ -636,9 +780,8 @@ static nserror mimesniff__compute_feed_or_html(const uint8_t *data,
 #undef RDF_NS
 }
 
-/* See mimesniff.h for documentation */
-nserror mimesniff_compute_effective_type(llcache_handle *handle,
-		const uint8_t *data, size_t len, bool sniff_allowed,
+static nserror mimesniff__compute(llcache_handle *handle,
+		struct mimesniff_header *h, bool sniff_allowed,
 		bool image_only, lwc_string **effective_type)
 {
 #define S(s) { s, SLEN(s) }
@@ -668,7 +811,7 @@ nserror mimesniff_compute_effective_type(llcache_handle *handle,
 			return NSERROR_NOT_FOUND;
 
 		/* No official type => unknown */
-		return mimesniff__compute_unknown(data, len, effective_type);
+		return mimesniff__compute_unknown(h, effective_type);
 	}
 
 	error = http_parse_content_type(content_type_header, &ct);
@@ -677,7 +820,7 @@ nserror mimesniff_compute_effective_type(llcache_handle *handle,
 			return NSERROR_NOT_FOUND;
 
 		/* Unparseable => unknown */
-		return mimesniff__compute_unknown(data, len, effective_type);
+		return mimesniff__compute_unknown(h, effective_type);
 	}
 
 	if (sniff_allowed == false) {
@@ -699,7 +842,7 @@ nserror mimesniff_compute_effective_type(llcache_handle *handle,
 		official_type = lwc_string_ref(ct->media_type);
 		http_content_type_destroy(ct);
 		return mimesniff__compute_image(official_type,
-				data, len, effective_type);
+				h, effective_type);
 	}
 
 	content_type_header_len = strlen(content_type_header);
@@ -710,7 +853,7 @@ nserror mimesniff_compute_effective_type(llcache_handle *handle,
 				memcmp(tt->data, content_type_header, 
 					content_type_header_len) == 0) {
 			http_content_type_destroy(ct);
-			return mimesniff__compute_text_or_binary(data, len,
+			return mimesniff__compute_text_or_binary(h,
 					effective_type);
 		}
 	}
@@ -724,7 +867,7 @@ nserror mimesniff_compute_effective_type(llcache_handle *handle,
 			(lwc_string_caseless_isequal(ct->media_type, any, 
 				&match) == lwc_error_ok && match)) {
 		http_content_type_destroy(ct);
-		return mimesniff__compute_unknown(data, len, effective_type);
+		return mimesniff__compute_unknown(h, effective_type);
 	}
 
 	/* +xml */
@@ -757,15 +900,14 @@ nserror mimesniff_compute_effective_type(llcache_handle *handle,
 		lwc_string *official_type = lwc_string_ref(ct->media_type);
 		http_content_type_destroy(ct);
 		return mimesniff__compute_image(official_type,
-				data, len, effective_type);
+				h, effective_type);
 	}
 
 	/* text/html */
 	if ((lwc_string_caseless_isequal(ct->media_type, text_html, 
 			&match) == lwc_error_ok && match)) {
 		http_content_type_destroy(ct);
-		return mimesniff__compute_feed_or_html(data, len,
-				effective_type);
+		return mimesniff__compute_feed_or_html(h, effective_type);
 	}
 
 	/* Use official type */
@@ -776,3 +918,27 @@ nserror mimesniff_compute_effective_type(llcache_handle *handle,
 	return NSERROR_OK;
 }
 
+/* See mimesniff.h for documentation */
+nserror mimesniff_compute_effective_type(llcache_handle *handle,
+		const uint8_t *data, size_t len, bool complete,
+		bool sniff_allowed, bool image_only,
+		lwc_string **effective_type, size_t *wanted)
+{
+	struct mimesniff_header h;
+	nserror error;
+
+	/* Only the first 512 octets (the resource header) are examined, 
+	 * so once that many have arrived there's nothing more to wait for */
+	h.data = data;
+	h.len = data != NULL ? min(len, MIMESNIFF_HEADER_SIZE) : 0;
+	h.complete = complete || h.len == MIMESNIFF_HEADER_SIZE;
+	h.wanted = 0;
+
+	error = mimesniff__compute(handle, &h, sniff_allowed, image_only,
+			effective_type);
+	if (error == NSERROR_NEED_DATA)
+		*wanted = min(h.wanted, MIMESNIFF_HEADER_SIZE);
+
+	return error;
+}
+
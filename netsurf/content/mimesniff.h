@@ -30,24 +30,36 @@
 
 struct llcache_handle;
 
+/** Most source data examined by the sniffer (the resource header), in bytes */
+#define MIMESNIFF_HEADER_SIZE 512
+
 /**
  * Compute the effective MIME type for an object using the sniffing
  * algorithm described in http://mimesniff.spec.whatwg.org/
  *
+ * The type is decided as soon as the data received so far allows.
+ * Otherwise, the number of octets required to make progress is reported
+ * and the caller should try again once that many are available, or once
+ * the fetch has completed.
+ *
  * \param handle          Source data handle to sniff
- * \param data            First data chunk, or NULL
+ * \param data            Source data received so far, or NULL
  * \param len             Length of \a data, in bytes
+ * \param complete        Whether \a data is all the source data
  * \param sniff_allowed   Whether MIME type sniffing is allowed
  * \param image_only      Sniff image types only
  * \param effective_type  Location to receive computed type
+ * \param wanted          Location to receive length of data needed
  * \return NSERROR_OK on success,
- *         NSERROR_NEED_DATA iff \a data is NULL and data is needed
+ *         NSERROR_NEED_DATA if \a data is insufficient to decide and
+ *                           \a complete is false; \a wanted is updated
  *         NSERROR_NOT_FOUND if sniffing is prohibited and no 
  *                           Content-Type header was found
  */
 nserror mimesniff_compute_effective_type(struct llcache_handle *handle,
-		const uint8_t *data, size_t len, bool sniff_allowed,
-		bool image_only, lwc_string **effective_type);
+		const uint8_t *data, size_t len, bool complete,
+		bool sniff_allowed, bool image_only,
+		lwc_string **effective_type, size_t *wanted);
 
 nserror mimesniff_init(void);
 void mimesniff_fini(void);
@@ -81,6 +81,21 @@
  * simpler implementation. Entries in this tree comprise pointers to the
  * leaf nodes of the host tree described above.
  *
+ * The database is saved in a binary file, holding the entries for each host
+ * together, with a table of hosts sorted by name. On loading, the file is
+ * mapped into memory, and a host's entries are only inserted into the trees
+ * above when that host is first looked up. Saves append changed entries to
+ * a journal alongside the file; the file is only rewritten once its journal
+ * has grown large. The older line-based text format may still be imported
+ * and exported.
+ *
+ * Cookies hang off the path node matching their path, or the host_part node
+ * of their domain for domain cookies. For fast lookup, each host_part also
+ * indexes its cookies in the order they are to be sent, so finding the
+ * cookies for an URL needs only a walk up the FQDN tree. Cookies which
+ * expire are also kept in a heap, ordered by expiry time, from which they
+ * are removed once expired.
+ *
  * REALLY IMPORTANT NOTE: urldb expects all URLs to be normalised. Use of 
  * non-normalised URLs with urldb will result in undefined behaviour and 
  * potential crashes.
@@ -89,6 +104,7 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -97,6 +113,10 @@
 
 #include <curl/curl.h>
 
+#include "utils/config.h"
+#ifdef WITH_MMAP
+#include <sys/mman.h>
+#endif
 #include "image/bitmap.h"
 #include "content/content.h"
 #include "content/urldb.h"
@@ -108,6 +128,8 @@
 #endif
 #include "utils/log.h"
 #include "utils/filename.h"
+#include "utils/nsurl.h"
+#include "utils/schedule.h"
 #include "utils/url.h"
 #include "utils/utils.h"
 
@@ -129,6 +151,23 @@ struct cookie_internal_data {
 
 	struct cookie_internal_data *prev;	/**< Previous in list */
 	struct cookie_internal_data *next;	/**< Next in list */
+
+	struct path_data *owner;	/**< Path entry holding cookie */
+	unsigned int expiry_index;	/**< Position in expiry heap, if
+					 * the cookie isn't a session one */
+};
+
+/** Cookies set for a host, in the order they are sent
+ *
+ * Cookies for the host alone come first, then domain cookies set for the
+ * host and its subdomains.  Each group is ordered longest path first, then
+ * oldest first.
+ */
+struct cookie_index {
+	struct cookie_internal_data **cookies;	/**< Indexed cookies */
+	unsigned int count;		/**< Number of cookies */
+	unsigned int host_count;	/**< Number of which are host cookies */
+	unsigned int alloc;		/**< Number of entries allocated */
 };
 
 /* A protection space is defined as a tuple canonical_root_url and realm.
@@ -170,6 +209,8 @@ struct path_data {
 	unsigned int frag_cnt;	/**< Number of entries in ::fragment */
 	char **fragment;	/**< Array of fragments */
 	bool persistent;	/**< This entry should persist */
+	bool dirty;		/**< URL data changed since last saved */
+	bool stored;		/**< URL data is in the saved database */
 
 	struct bitmap *thumb;	/**< Thumbnail image of resource */
 	struct url_internal_data urld;	/**< URL data for resource */
@@ -204,6 +245,8 @@ struct host_part {
 				 * proctection spaces known for his host and
 				 * all its schems and ports. */
 
+	struct cookie_index cookie_index;	/**< Cookies for this host */
+
 	struct host_part *next;	/**< Next sibling */
 	struct host_part *prev;	/**< Previous sibling */
 	struct host_part *parent;	/**< Parent host part */
@@ -219,6 +262,28 @@ struct search_node {
 	struct search_node *right;	/**< Right subtree */
 };
 
+/** Entry read from a binary URL file or its journal */
+struct url_store_record {
+	unsigned int visits;		/**< Visit count */
+	time_t last_visit;		/**< Last visit time */
+	content_type type;		/**< Type of resource */
+	unsigned int port;		/**< Port number, or 0 for default */
+	const char *scheme;		/**< URL scheme */
+	const char *path;		/**< Path and query */
+	const char *title;		/**< Resource title, or empty */
+	const char *thumbnail;		/**< Thumbnail filename, or empty */
+};
+
+/** Host being written to a binary URL file */
+struct url_store_host {
+	char *name;			/**< Host name */
+	const struct host_part *h;	/**< Host tree entry */
+	uint32_t name_offset;		/**< Offset of name in file */
+	uint32_t offset;		/**< Offset of entries in file */
+	uint32_t count;			/**< Number of entries written */
+	time_t newest;			/**< Latest visit time of entries */
+};
+
 /* Destruction */
 static void urldb_destroy_host_tree(struct host_part *root);
 static void urldb_destroy_path_tree(struct path_data *root);
@@ -234,6 +299,45 @@ static void urldb_count_urls(const struct path_data *root, time_t expiry,
 static void urldb_write_paths(const struct path_data *parent,
 		const char *host, FILE *fp, char **path, int *path_alloc,
 		int *path_used, time_t expiry);
+static struct path_data *urldb_add_saved_path(struct host_part *h,
+		const char *host, const char *scheme, unsigned int port,
+		const char *path);
+static bool urldb_host_name(const struct host_part *h, char *buf,
+		size_t size);
+static bool urldb_path_name(const struct path_data *p, char *buf,
+		size_t size);
+
+/* Binary URL file */
+static bool urldb_store_open(const char *filename, FILE *fp);
+static void urldb_store_replay_journal(const char *filename);
+static void urldb_store_release(void);
+static char *urldb_store_journal_name(const char *filename);
+static const char *urldb_store_read_string(const uint8_t *data, size_t len,
+		size_t *pos);
+static bool urldb_store_read_record(const uint8_t *data, size_t len,
+		size_t *pos, struct url_store_record *r);
+static void urldb_store_apply_record(struct host_part *h, const char *host,
+		const struct url_store_record *r);
+static const char *urldb_store_host(uint32_t index);
+static uint32_t urldb_store_search(const char *key, size_t len);
+static void urldb_store_materialise(const char *host);
+static void urldb_store_materialise_prefix(const char *prefix);
+static void urldb_store_materialise_since(time_t since);
+static void urldb_store_materialise_all(void);
+static void urldb_store_materialise_host(uint32_t index);
+static bool urldb_store_write_record(FILE *fp, const struct path_data *p,
+		const char *path);
+static bool urldb_store_write_host(FILE *fp, const struct host_part *h,
+		const char *journal_host, time_t expiry, uint32_t *count,
+		time_t *newest);
+static bool urldb_store_write_journal(struct search_node *root, FILE *fp,
+		time_t expiry);
+static bool urldb_store_collect_hosts(struct search_node *root,
+		struct url_store_host **hosts, uint32_t *count,
+		uint32_t *alloc);
+static int urldb_store_host_cmp(const void *a, const void *b);
+static void urldb_store_compact(const char *filename);
+static void urldb_store_append(const char *filename);
 
 /* Iteration */
 static bool urldb_iterate_partial_host(struct search_node *root,
@@ -260,13 +364,18 @@ static struct path_data *urldb_add_path_node(const char *scheme,
 static int urldb_add_path_fragment_cmp(const void *a, const void *b);
 static struct path_data *urldb_add_path_fragment(struct path_data *segment,
 		const char *fragment);
+static struct path_data *urldb_add_nsurl(const nsurl *url);
 
 /* Lookup */
 static struct path_data *urldb_find_url(const char *url);
+static struct path_data *urldb_find_nsurl(const nsurl *url);
 static struct path_data *urldb_match_path(const struct path_data *parent,
 		const char *path, const char *scheme, unsigned short port);
 static struct search_node **urldb_get_search_tree_direct(const char *host);
 static struct search_node *urldb_get_search_tree(const char *host);
+static const char *urldb_lookup_auth_details(struct path_data *p,
+		const char *realm);
+static bool urldb_lookup_cert_permissions(const struct path_data *p);
 
 /* Dump */
 static void urldb_dump_hosts(struct host_part *parent);
@@ -291,6 +400,7 @@ static int urldb_search_match_prefix(const struct host_part *a,
 		const char *b);
 
 /* Cookies */
+static char *urldb_lookup_cookie(const struct path_data *p, const char *path);
 static struct cookie_internal_data *urldb_parse_cookie(const char *url,
 		const char **cookie);
 static bool urldb_parse_avpair(struct cookie_internal_data *c, char *n, 
@@ -300,6 +410,20 @@ static bool urldb_insert_cookie(struct cookie_internal_data *c,
 static void urldb_free_cookie(struct cookie_internal_data *c);
 static bool urldb_concat_cookie(struct cookie_internal_data *c, int version,
 		int *used, int *alloc, char **buf);
+static bool urldb_cookie_path_match(const char *cookie_path,
+		const char *path);
+static struct host_part *urldb_cookie_host(
+		const struct cookie_internal_data *c);
+static bool urldb_index_cookie(struct host_part *h,
+		struct cookie_internal_data *c);
+static void urldb_unindex_cookie(struct host_part *h,
+		struct cookie_internal_data *c);
+static void urldb_unlink_cookie(struct cookie_internal_data *c);
+static bool urldb_expiry_insert(struct cookie_internal_data *c);
+static void urldb_expiry_remove(struct cookie_internal_data *c);
+static void urldb_expiry_sift(unsigned int i);
+static void urldb_expiry_schedule(void);
+static void urldb_reap_cookies(void *p);
 static void urldb_delete_cookie_hosts(const char *domain, const char *path, 
 		const char *name, struct host_part *parent);
 static void urldb_delete_cookie_paths(const char *domain, const char *path, 
@@ -326,15 +450,104 @@ static struct search_node *search_trees[NUM_SEARCH_TREES] = {
 #define MIN_COOKIE_FILE_VERSION 100
 #define COOKIE_FILE_VERSION 101
 static int loaded_cookie_file_version;
+
+/** Longest interval between checks for expired cookies, in seconds */
+#define COOKIE_REAP_INTERVAL 3600
+
+/** Cookies which expire, as a heap ordered by expiry time */
+static struct {
+	struct cookie_internal_data **heap;	/**< Heap of cookies */
+	unsigned int count;		/**< Number of cookies in heap */
+	unsigned int alloc;		/**< Number of entries allocated */
+} cookie_expiry;
+
+/** Cookies matched by a lookup, reused between lookups */
+static struct cookie_internal_data **matched_cookies;
+static unsigned int matched_cookies_alloc;
+/** Cookie header being built, reused between lookups */
+static char *cookie_header;
+static int cookie_header_alloc;
 #define MIN_URL_FILE_VERSION 106
 #define URL_FILE_VERSION 106
 
+/** Binary URL file identifier */
+#define URL_STORE_MAGIC "NSUD"
+/** Binary URL file journal identifier */
+#define URL_JOURNAL_MAGIC "NSUJ"
+#define URL_STORE_VERSION 1
+/** Size of file header: identifier, version, generation, host count and
+ * host table offset */
+#define URL_STORE_HEADER_SIZE 20
+/** Size of journal header: identifier, version and file generation */
+#define URL_JOURNAL_HEADER_SIZE 12
+/** Size of host table entry: name offset, entries offset, entry count and
+ * latest visit time */
+#define URL_STORE_HOST_SIZE 20
+/** Size of fixed part of entry: visits, last visit time, type and port.
+ * The scheme, path, title and thumbnail strings follow. */
+#define URL_STORE_RECORD_SIZE 20
+/** Longest path and query stored */
+#define URL_STORE_MAX_PATH 4096
+
+/** Binary URL file last loaded or saved */
+static struct {
+	char *filename;		/**< Name of file, or NULL if none */
+	uint32_t generation;	/**< Generation of file, matched by journal */
+	size_t length;		/**< Byte length of file */
+	size_t journal_length;	/**< Byte length of journal, or 0 if none */
+	bool compact;		/**< Journal is damaged, so rewrite file */
+
+	const uint8_t *data;	/**< Contents of file, or NULL if released */
+	const uint8_t *hosts;	/**< Host table, sorted by name */
+	uint32_t host_count;	/**< Number of hosts in table */
+	bool *materialised;	/**< Hosts whose entries are in the database */
+	uint32_t unmaterialised;	/**< Number of hosts not inserted */
+} url_store;
+
 /**
- * Import an URL database from file, replacing any existing database
+ * Load an URL database from file
  *
  * \param filename Name of file containing data
+ *
+ * The file may be in either the binary or the text format.
  */
 void urldb_load(const char *filename)
+{
+	char magic[SLEN(URL_STORE_MAGIC)];
+	FILE *fp;
+
+	assert(filename);
+
+	fp = fopen(filename, "rb");
+	if (!fp) {
+		LOG(("Failed to open file '%s' for reading", filename));
+		return;
+	}
+
+	if (fread(magic, 1, sizeof magic, fp) == sizeof magic &&
+			memcmp(magic, URL_STORE_MAGIC, sizeof magic) == 0) {
+		LOG(("Loading URL file"));
+
+		if (urldb_store_open(filename, fp)) {
+			urldb_store_replay_journal(filename);
+			LOG(("Successfully loaded URL file"));
+		}
+
+		fclose(fp);
+		return;
+	}
+
+	fclose(fp);
+
+	urldb_import(filename);
+}
+
+/**
+ * Import an URL database from a file in the text format
+ *
+ * \param filename Name of file containing data
+ */
+void urldb_import(const char *filename)
 {
 #define MAXIMUM_URL_LENGTH 4096
 	char s[MAXIMUM_URL_LENGTH];
@@ -412,9 +625,7 @@ void urldb_load(const char *filename)
 		for (i = 0; i < urls; i++) {
 			struct path_data *p = NULL;
 			char scheme[64], ports[10];
-			char url[64 + 3 + 256 + 6 + 4096 + 1];
 			unsigned int port;
-			bool is_file = false;
 
 			if (!fgets(scheme, sizeof scheme, fp))
 				break;
@@ -432,22 +643,9 @@ void urldb_load(const char *filename)
 			length = strlen(s) - 1;
 			s[length] = '\0';
 
-			if (!strcasecmp(host, "localhost") &&
-					!strcasecmp(scheme, "file"))
-				is_file = true;
-
-			snprintf(url, sizeof url, "%s://%s%s%s%s",
-					scheme,
-					/* file URLs have no host */
-					(is_file ? "" : host),
-					(port ? ":" : ""),
-					(port ? ports : ""),
-					s);
-
-			p = urldb_add_path(scheme, port, h, s, NULL, NULL,
-					url);
+			p = urldb_add_saved_path(h, host, scheme, port, s);
 			if (!p) {
-				LOG(("Failed inserting '%s'", url));
+				LOG(("Failed inserting '%s'", s));
 				die("Memory exhausted whilst loading "
 						"URL file");
 			}
@@ -505,17 +703,41 @@ void urldb_load(const char *filename)
 }
 
 /**
- * Export the current database to file
+ * Save the current database to file, in the binary format
  *
- * \param filename Name of file to export to
+ * \param filename Name of file to save to
+ *
+ * If the database was loaded from or last saved to the same file, the
+ * changes since are appended to its journal. Otherwise, or if the journal
+ * is large, the whole file is rewritten.
  */
 void urldb_save(const char *filename)
+{
+	assert(filename);
+
+	if (url_store.filename == NULL ||
+			strcmp(url_store.filename, filename) != 0 ||
+			url_store.compact ||
+			url_store.journal_length > url_store.length / 2)
+		urldb_store_compact(filename);
+	else
+		urldb_store_append(filename);
+}
+
+/**
+ * Export the current database to file, in the text format
+ *
+ * \param filename Name of file to export to
+ */
+void urldb_export(const char *filename)
 {
 	FILE *fp;
 	int i;
 
 	assert(filename);
 
+	urldb_store_materialise_all();
+
 	fp = fopen(filename, "w");
 	if (!fp) {
 		LOG(("Failed to open file '%s' for writing", filename));
@@ -726,15 +948,976 @@ void urldb_write_paths(const struct path_data *parent, const char *host,
 					break;
 				}
 
-				/* Going up, so remove '/' */
-				*path_used -= 1;
-				(*path)[*path_used - 1] = '\0';
+				/* Going up, so remove '/' */
+				*path_used -= 1;
+				(*path)[*path_used - 1] = '\0';
+
+				/* Ascend tree */
+				p = p->parent;
+			}
+		}
+	} while (p != parent);
+}
+
+/**
+ * Insert a saved URL into the database
+ *
+ * \param h Host tree entry of URL
+ * \param host Name of host
+ * \param scheme URL scheme
+ * \param port Port number, or 0 for the default
+ * \param path Path and query
+ * \return Pointer to path data, or NULL on memory exhaustion
+ */
+struct path_data *urldb_add_saved_path(struct host_part *h, const char *host,
+		const char *scheme, unsigned int port, const char *path)
+{
+	char url[64 + 3 + 256 + 6 + 4096 + 1];
+
+	/* file URLs have no host */
+	if (!strcasecmp(host, "localhost") && !strcasecmp(scheme, "file"))
+		host = "";
+
+	if (port)
+		snprintf(url, sizeof url, "%s://%s:%u%s", scheme, host,
+				port, path);
+	else
+		snprintf(url, sizeof url, "%s://%s%s", scheme, host, path);
+
+	return urldb_add_path(scheme, port, h, path, NULL, NULL, url);
+}
+
+/**
+ * Construct the name of a host
+ *
+ * \param h Host tree entry
+ * \param buf Buffer to receive name
+ * \param size Size of buffer
+ * \return true on success, false if the name doesn't fit
+ */
+bool urldb_host_name(const struct host_part *h, char *buf, size_t size)
+{
+	char *p = buf, *end = buf + size;
+
+	for (; h && h != &db_root; h = h->parent) {
+		int written = snprintf(p, end - p, "%s%s", h->part,
+				(h->parent && h->parent->parent) ? "." : "");
+		if (written < 0 || written >= end - p)
+			return false;
+		p += written;
+	}
+
+	return true;
+}
+
+/**
+ * Construct the path of an entry, as it was inserted
+ *
+ * \param p Path data of entry
+ * \param buf Buffer to receive path
+ * \param size Size of buffer
+ * \return true on success, false if the path doesn't fit
+ */
+bool urldb_path_name(const struct path_data *p, char *buf, size_t size)
+{
+	const struct path_data *q;
+	size_t len = 0, seglen;
+
+	/* Each segment is preceded by a '/' */
+	for (q = p; q->parent != NULL; q = q->parent)
+		len += strlen(q->segment) + 1;
+
+	if (len == 0 || len >= size)
+		return false;
+
+	buf[len] = '\0';
+
+	for (q = p; q->parent != NULL; q = q->parent) {
+		seglen = strlen(q->segment);
+		len -= seglen;
+		memcpy(buf + len, q->segment, seglen);
+		buf[--len] = '/';
+	}
+
+	return true;
+}
+
+/**
+ * Read a 32 bit value from a binary URL file
+ */
+static inline uint32_t urldb_store_get_u32(const uint8_t *b)
+{
+	return b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+}
+
+/**
+ * Read a time from a binary URL file
+ */
+static inline time_t urldb_store_get_time(const uint8_t *b)
+{
+	return (time_t) (int64_t) (urldb_store_get_u32(b) |
+			((uint64_t) urldb_store_get_u32(b + 4) << 32));
+}
+
+/**
+ * Write a 32 bit value to a binary URL file
+ */
+static inline bool urldb_store_put_u32(FILE *fp, uint32_t v)
+{
+	uint8_t b[4] = { v, v >> 8, v >> 16, v >> 24 };
+
+	return fwrite(b, 1, sizeof b, fp) == sizeof b;
+}
+
+/**
+ * Write a time to a binary URL file
+ */
+static inline bool urldb_store_put_time(FILE *fp, time_t t)
+{
+	uint64_t v = (uint64_t) (int64_t) t;
+
+	return urldb_store_put_u32(fp, v) && urldb_store_put_u32(fp, v >> 32);
+}
+
+/**
+ * Map a binary URL file, ready for its hosts to be materialised
+ *
+ * \param filename Name of file
+ * \param fp File, open for reading
+ * \return true on success, false otherwise
+ */
+bool urldb_store_open(const char *filename, FILE *fp)
+{
+	uint8_t header[URL_STORE_HEADER_SIZE];
+	const uint8_t *data, *entry;
+	uint32_t host_count, table, i;
+	bool *materialised;
+	char *name;
+	long length;
+
+	if (fseek(fp, 0, SEEK_END) != 0 || (length = ftell(fp)) < 0 ||
+			fseek(fp, 0, SEEK_SET) != 0 ||
+			fread(header, 1, sizeof header, fp) != sizeof header) {
+		LOG(("Failed reading URL file header"));
+		return false;
+	}
+
+	if (urldb_store_get_u32(header + 4) != URL_STORE_VERSION) {
+		LOG(("Unknown URL file version."));
+		return false;
+	}
+
+	host_count = urldb_store_get_u32(header + 12);
+	table = urldb_store_get_u32(header + 16);
+	if (table > (size_t) length || host_count >
+			((size_t) length - table) / URL_STORE_HOST_SIZE) {
+		LOG(("Corrupt URL file"));
+		return false;
+	}
+
+	name = strdup(filename);
+	if (!name)
+		return false;
+
+#ifdef WITH_MMAP
+	data = mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if (data == MAP_FAILED) {
+		LOG(("Failed mapping URL file"));
+		free(name);
+		return false;
+	}
+#else
+	data = malloc(length);
+	if (!data || fseek(fp, 0, SEEK_SET) != 0 ||
+			fread((void *) data, 1, length, fp) != (size_t) length) {
+		LOG(("Failed reading URL file"));
+		free((void *) data);
+		free(name);
+		return false;
+	}
+#endif
+
+	/* Check host names are intact, so lookups needn't */
+	for (i = 0; i < host_count; i++) {
+		size_t offset;
+
+		entry = data + table + i * URL_STORE_HOST_SIZE;
+		offset = urldb_store_get_u32(entry);
+		if (offset >= (size_t) length || memchr(data + offset, '\0',
+				length - offset) == NULL ||
+				urldb_store_get_u32(entry + 4) >
+				(size_t) length)
+			break;
+	}
+
+	materialised = calloc(host_count + 1, sizeof(bool));
+
+	if (i != host_count || !materialised) {
+		LOG(("Corrupt URL file, or out of memory"));
+#ifdef WITH_MMAP
+		munmap((void *) data, length);
+#else
+		free((void *) data);
+#endif
+		free(materialised);
+		free(name);
+		return false;
+	}
+
+	/* Replace any file loaded earlier, keeping its entries */
+	urldb_store_materialise_all();
+	urldb_store_release();
+	free(url_store.filename);
+
+	url_store.filename = name;
+	url_store.generation = urldb_store_get_u32(header + 8);
+	url_store.length = length;
+	url_store.journal_length = 0;
+	url_store.compact = false;
+	url_store.data = data;
+	url_store.hosts = data + table;
+	url_store.host_count = host_count;
+	url_store.materialised = materialised;
+	url_store.unmaterialised = host_count;
+
+	return true;
+}
+
+/**
+ * Apply the journal of a binary URL file to the database
+ *
+ * \param filename Name of file
+ */
+void urldb_store_replay_journal(const char *filename)
+{
+	struct url_store_record r;
+	struct host_part *h;
+	const char *host;
+	char *journal;
+	uint8_t *data = NULL;
+	size_t pos = URL_JOURNAL_HEADER_SIZE;
+	long length;
+	FILE *fp;
+
+	journal = urldb_store_journal_name(filename);
+	if (!journal)
+		return;
+
+	fp = fopen(journal, "rb");
+	free(journal);
+	if (!fp)
+		return;
+
+	if (fseek(fp, 0, SEEK_END) != 0 || (length = ftell(fp)) < 0 ||
+			(size_t) length < URL_JOURNAL_HEADER_SIZE ||
+			fseek(fp, 0, SEEK_SET) != 0 ||
+			(data = malloc(length)) == NULL ||
+			fread(data, 1, length, fp) != (size_t) length) {
+		LOG(("Failed reading URL file journal"));
+		url_store.compact = true;
+		goto out;
+	}
+
+	/* A journal left behind by an older file is ignored, and replaced
+	 * on the next save */
+	if (memcmp(data, URL_JOURNAL_MAGIC, SLEN(URL_JOURNAL_MAGIC)) != 0 ||
+			urldb_store_get_u32(data + 4) != URL_STORE_VERSION ||
+			urldb_store_get_u32(data + 8) !=
+			url_store.generation) {
+		LOG(("Ignoring stale URL file journal"));
+		goto out;
+	}
+
+	while (pos < (size_t) length) {
+		host = urldb_store_read_string(data, length, &pos);
+		if (!host || !urldb_store_read_record(data, length,
+				&pos, &r))
+			break;
+
+		h = urldb_add_host(host);
+		if (!h) {
+			LOG(("Failed adding host: '%s'", host));
+			die("Memory exhausted whilst loading URL file");
+		}
+
+		urldb_store_apply_record(h, host, &r);
+	}
+
+	if (pos == (size_t) length) {
+		url_store.journal_length = length;
+	} else {
+		/* Damaged, perhaps by a crash while saving. Entries read
+		 * from it must be saved again, so rewrite the file. */
+		LOG(("Corrupt URL file journal"));
+		url_store.compact = true;
+	}
+
+out:
+	free(data);
+	fclose(fp);
+}
+
+/**
+ * Release a mapped binary URL file
+ *
+ * Any hosts not yet materialised are lost from the database.
+ */
+void urldb_store_release(void)
+{
+	if (url_store.data != NULL) {
+#ifdef WITH_MMAP
+		munmap((void *) url_store.data, url_store.length);
+#else
+		free((void *) url_store.data);
+#endif
+	}
+
+	free(url_store.materialised);
+
+	url_store.data = NULL;
+	url_store.hosts = NULL;
+	url_store.host_count = 0;
+	url_store.materialised = NULL;
+	url_store.unmaterialised = 0;
+}
+
+/**
+ * Get the name of the journal of a binary URL file
+ *
+ * \param filename Name of file
+ * \return Name of journal (on heap), or NULL on memory exhaustion
+ */
+char *urldb_store_journal_name(const char *filename)
+{
+	char *journal = malloc(strlen(filename) + SLEN("-journal") + 1);
+
+	if (journal)
+		sprintf(journal, "%s-journal", filename);
+
+	return journal;
+}
+
+/**
+ * Read a string from a binary URL file
+ *
+ * \param data Contents of file
+ * \param len Byte length of file
+ * \param pos Offset of string, updated to offset following it
+ * \return Pointer to string, or NULL if it's unterminated
+ */
+const char *urldb_store_read_string(const uint8_t *data, size_t len,
+		size_t *pos)
+{
+	const uint8_t *end;
+	const char *s;
+
+	if (*pos >= len)
+		return NULL;
+
+	end = memchr(data + *pos, '\0', len - *pos);
+	if (!end)
+		return NULL;
+
+	s = (const char *) data + *pos;
+	*pos = end - data + 1;
+
+	return s;
+}
+
+/**
+ * Read an entry from a binary URL file
+ *
+ * \param data Contents of file
+ * \param len Byte length of file
+ * \param pos Offset of entry, updated to offset following it
+ * \param r Record to fill in, pointing into \a data
+ * \return true on success, false if the entry is incomplete
+ */
+bool urldb_store_read_record(const uint8_t *data, size_t len, size_t *pos,
+		struct url_store_record *r)
+{
+	const uint8_t *b = data + *pos;
+
+	if (*pos > len || len - *pos < URL_STORE_RECORD_SIZE)
+		return false;
+
+	r->visits = urldb_store_get_u32(b);
+	r->last_visit = urldb_store_get_time(b + 4);
+	r->type = (content_type) urldb_store_get_u32(b + 12);
+	r->port = urldb_store_get_u32(b + 16);
+	*pos += URL_STORE_RECORD_SIZE;
+
+	r->scheme = urldb_store_read_string(data, len, pos);
+	r->path = urldb_store_read_string(data, len, pos);
+	r->title = urldb_store_read_string(data, len, pos);
+	r->thumbnail = urldb_store_read_string(data, len, pos);
+
+	return r->scheme && r->path && r->path[0] == '/' &&
+			r->title && r->thumbnail;
+}
+
+/**
+ * Insert an entry read from a binary URL file into the database
+ *
+ * \param h Host tree entry of URL
+ * \param host Name of host
+ * \param r Entry to insert, replacing any existing data for its URL
+ */
+void urldb_store_apply_record(struct host_part *h, const char *host,
+		const struct url_store_record *r)
+{
+	struct path_data *p;
+	char *title;
+
+	p = urldb_add_saved_path(h, host, r->scheme, r->port, r->path);
+	if (!p) {
+		LOG(("Failed inserting '%s'", r->path));
+		die("Memory exhausted whilst loading URL file");
+	}
+
+	p->urld.visits = r->visits;
+	p->urld.last_visit = r->last_visit;
+	p->urld.type = r->type;
+
+	if (r->title[0] != '\0') {
+		title = strdup(r->title);
+		if (title) {
+			free(p->urld.title);
+			p->urld.title = title;
+		}
+	}
+
+#ifdef riscos
+	/* ensure filename is 'XX/XX/XX/XX' */
+	if (!p->thumb && strlen(r->thumbnail) == 11) {
+		char s[12];
+
+		memcpy(s, r->thumbnail, sizeof s);
+		s[2] = s[5] = s[8] = '/';
+		p->thumb = bitmap_create_file(s);
+	}
+#endif
+
+	p->dirty = false;
+	p->stored = true;
+}
+
+/**
+ * Get the name of a host in a binary URL file
+ *
+ * \param index Index of host in host table
+ * \return Host name
+ */
+const char *urldb_store_host(uint32_t index)
+{
+	return (const char *) url_store.data + urldb_store_get_u32(
+			url_store.hosts + index * URL_STORE_HOST_SIZE);
+}
+
+/**
+ * Find the first host in a binary URL file not preceding a key
+ *
+ * \param key Host name or prefix to look for
+ * \param len Number of characters of host names to compare with \a key
+ * \return Index of host, or number of hosts if none
+ */
+uint32_t urldb_store_search(const char *key, size_t len)
+{
+	uint32_t lo = 0, hi = url_store.host_count, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+
+		if (strncasecmp(urldb_store_host(mid), key, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/**
+ * Insert a host's entries from the binary URL file, if not done already
+ *
+ * \param host Name of host
+ */
+void urldb_store_materialise(const char *host)
+{
+	uint32_t i;
+
+	if (url_store.unmaterialised == 0)
+		return;
+
+	/* Including the terminator in the comparison matches whole names */
+	i = urldb_store_search(host, strlen(host) + 1);
+
+	if (i < url_store.host_count && !url_store.materialised[i] &&
+			strcasecmp(urldb_store_host(i), host) == 0)
+		urldb_store_materialise_host(i);
+}
+
+/**
+ * Insert entries from the binary URL file for hosts beginning with a prefix
+ *
+ * \param prefix Prefix of host names
+ */
+void urldb_store_materialise_prefix(const char *prefix)
+{
+	size_t len = strlen(prefix);
+	uint32_t i;
+
+	if (url_store.unmaterialised == 0)
+		return;
+
+	for (i = urldb_store_search(prefix, len); i < url_store.host_count &&
+			strncasecmp(urldb_store_host(i), prefix, len) == 0;
+			i++) {
+		if (!url_store.materialised[i])
+			urldb_store_materialise_host(i);
+	}
+}
+
+/**
+ * Insert entries from the binary URL file for hosts visited recently
+ *
+ * \param since Time of earliest visit of interest
+ */
+void urldb_store_materialise_since(time_t since)
+{
+	uint32_t i;
+
+	for (i = 0; i < url_store.host_count &&
+			url_store.unmaterialised > 0; i++) {
+		if (!url_store.materialised[i] && urldb_store_get_time(
+				url_store.hosts + i * URL_STORE_HOST_SIZE +
+				12) >= since)
+			urldb_store_materialise_host(i);
+	}
+}
+
+/**
+ * Insert all remaining entries from the binary URL file
+ */
+void urldb_store_materialise_all(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < url_store.host_count &&
+			url_store.unmaterialised > 0; i++) {
+		if (!url_store.materialised[i])
+			urldb_store_materialise_host(i);
+	}
+}
+
+/**
+ * Insert a host's entries from the binary URL file
+ *
+ * \param index Index of host in host table
+ */
+void urldb_store_materialise_host(uint32_t index)
+{
+	const uint8_t *entry = url_store.hosts + index * URL_STORE_HOST_SIZE;
+	const char *host = urldb_store_host(index);
+	size_t pos = urldb_store_get_u32(entry + 4);
+	uint32_t count = urldb_store_get_u32(entry + 8);
+	struct url_store_record r;
+	struct host_part *h;
+
+	/* Mark the host first, as inserting it looks it up again */
+	url_store.materialised[index] = true;
+	url_store.unmaterialised--;
+
+	h = urldb_add_host(host);
+	if (!h) {
+		LOG(("Failed adding host: '%s'", host));
+		die("Memory exhausted whilst loading URL file");
+	}
+
+	while (count-- > 0) {
+		if (!urldb_store_read_record(url_store.data, url_store.length,
+				&pos, &r)) {
+			LOG(("Corrupt URL file entry for '%s'", host));
+			break;
+		}
+
+		urldb_store_apply_record(h, host, &r);
+	}
+}
+
+/**
+ * Write an entry to a binary URL file or its journal
+ *
+ * \param fp File to write to
+ * \param p Path data of entry
+ * \param path Path and query of entry
+ * \return true on success, false on error
+ */
+bool urldb_store_write_record(FILE *fp, const struct path_data *p,
+		const char *path)
+{
+	const char *title = p->urld.title ? p->urld.title : "";
+	const char *thumbnail = "";
+
+#ifdef riscos
+	if (p->thumb)
+		thumbnail = p->thumb->filename;
+#endif
+
+	return urldb_store_put_u32(fp, p->urld.visits) &&
+			urldb_store_put_time(fp, p->urld.last_visit) &&
+			urldb_store_put_u32(fp, p->urld.type) &&
+			urldb_store_put_u32(fp, p->port) &&
+			fwrite(p->scheme, 1, strlen(p->scheme) + 1, fp) ==
+				strlen(p->scheme) + 1 &&
+			fwrite(path, 1, strlen(path) + 1, fp) ==
+				strlen(path) + 1 &&
+			fwrite(title, 1, strlen(title) + 1, fp) ==
+				strlen(title) + 1 &&
+			fwrite(thumbnail, 1, strlen(thumbnail) + 1, fp) ==
+				strlen(thumbnail) + 1;
+}
+
+/**
+ * Write a host's entries to a binary URL file or its journal
+ *
+ * \param fp File to write to
+ * \param h Host tree entry
+ * \param journal_host Name of host, to write changed entries to a journal,
+ *		       or NULL to write all entries to a file
+ * \param expiry Expiry time of URLs
+ * \param count Pointer to count, updated with entries written
+ * \param newest Pointer to latest visit time, updated with entries written
+ * \return true on success, false on error
+ */
+bool urldb_store_write_host(FILE *fp, const struct host_part *h,
+		const char *journal_host, time_t expiry, uint32_t *count,
+		time_t *newest)
+{
+	struct path_data *root = (struct path_data *) &h->paths;
+	struct path_data *p = root;
+	char path[URL_STORE_MAX_PATH];
+	bool keep, write;
+
+	if (p->children == NULL)
+		return true;
+
+	do {
+		if (p->children != NULL) {
+			/* Drill down into children */
+			p = p->children;
+			continue;
+		}
+
+		/* Only leaf nodes are entries, as for the text format */
+		keep = p->persistent || ((p->urld.last_visit > expiry) &&
+				(p->urld.visits > 0));
+
+		if (journal_host == NULL) {
+			/* Whole file: every entry worth keeping */
+			write = keep;
+		} else {
+			/* Journal: changes to entries worth keeping, or
+			 * which the file already holds */
+			write = p->dirty && (keep || p->stored);
+		}
+
+		if (write && urldb_path_name(p, path, sizeof path)) {
+			if (journal_host != NULL && fwrite(journal_host, 1,
+					strlen(journal_host) + 1, fp) !=
+					strlen(journal_host) + 1)
+				return false;
+
+			if (!urldb_store_write_record(fp, p, path))
+				return false;
+
+			if (count)
+				(*count)++;
+			if (newest && p->urld.last_visit > *newest)
+				*newest = p->urld.last_visit;
+
+			p->dirty = false;
+			p->stored = true;
+		} else if (journal_host == NULL) {
+			p->dirty = false;
+			p->stored = false;
+		}
+
+		/* Now, find next node to process. */
+		while (p != root) {
+			if (p->next != NULL) {
+				/* Have a sibling, process that */
+				p = p->next;
+				break;
+			}
+
+			/* Ascend tree */
+			p = p->parent;
+		}
+	} while (p != root);
+
+	return true;
+}
+
+/**
+ * Write changed entries of a search (sub)tree's hosts to a journal
+ *
+ * \param root Root of (sub)tree to write
+ * \param fp File to write to
+ * \param expiry Expiry time of URLs
+ * \return true on success, false on error
+ */
+bool urldb_store_write_journal(struct search_node *root, FILE *fp,
+		time_t expiry)
+{
+	char host[256];
+
+	if (root == &empty)
+		return true;
+
+	if (!urldb_store_write_journal(root->left, fp, expiry))
+		return false;
+
+	if (urldb_host_name(root->data, host, sizeof host) &&
+			!urldb_store_write_host(fp, root->data, host,
+			expiry, NULL, NULL))
+		return false;
+
+	return urldb_store_write_journal(root->right, fp, expiry);
+}
+
+/**
+ * Collect the hosts in a search (sub)tree, for writing a binary URL file
+ *
+ * \param root Root of (sub)tree
+ * \param hosts Pointer to array of hosts, updated
+ * \param count Pointer to number of hosts in array, updated
+ * \param alloc Pointer to allocated size of array, updated
+ * \return true on success, false on memory exhaustion
+ */
+bool urldb_store_collect_hosts(struct search_node *root,
+		struct url_store_host **hosts, uint32_t *count,
+		uint32_t *alloc)
+{
+	char host[256];
+
+	if (root == &empty)
+		return true;
+
+	if (!urldb_store_collect_hosts(root->left, hosts, count, alloc))
+		return false;
+
+	if (urldb_host_name(root->data, host, sizeof host) &&
+			root->data->paths.children != NULL) {
+		if (*count == *alloc) {
+			uint32_t size = *alloc ? *alloc * 2 : 256;
+			struct url_store_host *temp = realloc(*hosts,
+					size * sizeof(struct url_store_host));
+			if (!temp)
+				return false;
+
+			*hosts = temp;
+			*alloc = size;
+		}
+
+		(*hosts)[*count].name = strdup(host);
+		if (!(*hosts)[*count].name)
+			return false;
+
+		(*hosts)[*count].h = root->data;
+		(*hosts)[*count].count = 0;
+		(*hosts)[*count].newest = 0;
+		(*count)++;
+	}
+
+	return urldb_store_collect_hosts(root->right, hosts, count, alloc);
+}
+
+/**
+ * Host name comparator callback for qsort
+ */
+int urldb_store_host_cmp(const void *a, const void *b)
+{
+	return strcasecmp(((const struct url_store_host *) a)->name,
+			((const struct url_store_host *) b)->name);
+}
+
+/**
+ * Write the whole database to a binary URL file
+ *
+ * \param filename Name of file to write
+ */
+void urldb_store_compact(const char *filename)
+{
+	struct url_store_host *hosts = NULL;
+	uint32_t count = 0, alloc = 0, written = 0, i;
+	uint32_t generation;
+	long table = 0, length = 0;
+	char *temp, *journal, *name;
+	time_t expiry;
+	FILE *fp = NULL;
+	bool ok = true;
+
+	expiry = time(NULL) - ((60 * 60 * 24) * nsoption_int(expire_url));
+
+	generation = (uint32_t) time(NULL);
+	if (generation == url_store.generation)
+		generation++;
+
+	urldb_store_materialise_all();
+
+	for (i = 0; ok && i != NUM_SEARCH_TREES; i++)
+		ok = urldb_store_collect_hosts(search_trees[i], &hosts,
+				&count, &alloc);
+
+	temp = malloc(strlen(filename) + SLEN("-new") + 1);
+	journal = urldb_store_journal_name(filename);
+	name = strdup(filename);
+	if (!ok || !temp || !journal || !name) {
+		LOG(("Failed to save URL file: out of memory"));
+		url_store.compact = true;
+		goto out;
+	}
+
+	if (count > 0)
+		qsort(hosts, count, sizeof(struct url_store_host),
+				urldb_store_host_cmp);
+
+	/* Write to a temporary file and move it into place once complete,
+	 * leaving the existing file intact on failure */
+	sprintf(temp, "%s-new", filename);
+	fp = fopen(temp, "wb");
+	if (!fp) {
+		LOG(("Failed to open file '%s' for writing", temp));
+		url_store.compact = true;
+		goto out;
+	}
+
+	/* Header is written once the host table's location is known */
+	for (i = 0; ok && i < URL_STORE_HEADER_SIZE / 4; i++)
+		ok = urldb_store_put_u32(fp, 0);
+
+	for (i = 0; ok && i < count; i++) {
+		hosts[i].offset = ftell(fp);
+		ok = urldb_store_write_host(fp, hosts[i].h, NULL, expiry,
+				&hosts[i].count, &hosts[i].newest);
+	}
+
+	for (i = 0; ok && i < count; i++) {
+		if (hosts[i].count == 0)
+			continue;
+
+		hosts[i].name_offset = ftell(fp);
+		ok = fwrite(hosts[i].name, 1, strlen(hosts[i].name) + 1, fp) ==
+				strlen(hosts[i].name) + 1;
+	}
+
+	table = ftell(fp);
+
+	for (i = 0; ok && i < count; i++) {
+		if (hosts[i].count == 0)
+			continue;
+
+		ok = urldb_store_put_u32(fp, hosts[i].name_offset) &&
+				urldb_store_put_u32(fp, hosts[i].offset) &&
+				urldb_store_put_u32(fp, hosts[i].count) &&
+				urldb_store_put_time(fp, hosts[i].newest);
+		written++;
+	}
+
+	length = ftell(fp);
+
+	ok = ok && table >= 0 && length >= 0 && fseek(fp, 0, SEEK_SET) == 0 &&
+			fwrite(URL_STORE_MAGIC, 1, SLEN(URL_STORE_MAGIC), fp) ==
+				SLEN(URL_STORE_MAGIC) &&
+			urldb_store_put_u32(fp, URL_STORE_VERSION) &&
+			urldb_store_put_u32(fp, generation) &&
+			urldb_store_put_u32(fp, written) &&
+			urldb_store_put_u32(fp, table);
+
+	if (fclose(fp) != 0)
+		ok = false;
+
+	if (!ok || rename(temp, filename) != 0) {
+		/* Entries are marked as saved, so try again next time */
+		LOG(("Failed to save URL file '%s'", filename));
+		url_store.compact = true;
+		remove(temp);
+		goto out;
+	}
+
+	/* The journal belonged to the file replaced */
+	remove(journal);
+
+	urldb_store_release();
+	free(url_store.filename);
+
+	url_store.filename = name;
+	url_store.generation = generation;
+	url_store.length = length;
+	url_store.journal_length = 0;
+	url_store.compact = false;
+	name = NULL;
+
+out:
+	for (i = 0; i < count; i++)
+		free(hosts[i].name);
+	free(hosts);
+	free(name);
+	free(journal);
+	free(temp);
+}
+
+/**
+ * Append changes to the database to the journal of a binary URL file
+ *
+ * \param filename Name of file
+ */
+void urldb_store_append(const char *filename)
+{
+	char *journal;
+	time_t expiry;
+	long length;
+	FILE *fp;
+	bool ok = true;
+	int i;
+
+	expiry = time(NULL) - ((60 * 60 * 24) * nsoption_int(expire_url));
+
+	journal = urldb_store_journal_name(filename);
+	if (!journal)
+		return;
+
+	/* Replace any journal not belonging to the file */
+	fp = fopen(journal, url_store.journal_length == 0 ? "wb" : "ab");
+	if (!fp) {
+		LOG(("Failed to open file '%s' for writing", journal));
+		free(journal);
+		return;
+	}
+
+	if (url_store.journal_length == 0) {
+		ok = fwrite(URL_JOURNAL_MAGIC, 1, SLEN(URL_JOURNAL_MAGIC),
+				fp) == SLEN(URL_JOURNAL_MAGIC) &&
+				urldb_store_put_u32(fp, URL_STORE_VERSION) &&
+				urldb_store_put_u32(fp, url_store.generation);
+	}
 
-				/* Ascend tree */
-				p = p->parent;
-			}
-		}
-	} while (p != parent);
+	for (i = 0; ok && i != NUM_SEARCH_TREES; i++)
+		ok = urldb_store_write_journal(search_trees[i], fp, expiry);
+
+	length = ftell(fp);
+
+	if (fclose(fp) != 0 || !ok || length < 0) {
+		/* Entries may have been partly written, so make sure
+		 * they're saved next time */
+		LOG(("Failed to save URL file journal '%s'", journal));
+		url_store.compact = true;
+	} else {
+		url_store.journal_length = length;
+	}
+
+	free(journal);
 }
 
 /**
@@ -754,6 +1937,7 @@ void urldb_set_url_persistence(const char *url, bool persist)
 		return;
 
 	p->persistent = persist;
+	p->dirty = true;
 }
 
 /**
@@ -822,6 +2006,19 @@ bool urldb_add_url(const char *url)
 	return (p != NULL);
 }
 
+/**
+ * Insert an URL into the database
+ *
+ * \param url Absolute URL to insert
+ * \return true on success, false otherwise
+ */
+bool urldb_nsurl_add(const nsurl *url)
+{
+	assert(url);
+
+	return (urldb_add_nsurl(url) != NULL);
+}
+
 /**
  * Set an URL's title string, replacing any existing one
  *
@@ -845,6 +2042,33 @@ void urldb_set_url_title(const char *url, const char *title)
 
 	free(p->urld.title);
 	p->urld.title = temp;
+	p->dirty = true;
+}
+
+/**
+ * Set an URL's title string, replacing any existing one
+ *
+ * \param url The URL to look for
+ * \param title The title string to use (copied)
+ */
+void urldb_nsurl_set_title(const nsurl *url, const char *title)
+{
+	struct path_data *p;
+	char *temp;
+
+	assert(url && title);
+
+	p = urldb_find_nsurl(url);
+	if (!p)
+		return;
+
+	temp = strdup(title);
+	if (!temp)
+		return;
+
+	free(p->urld.title);
+	p->urld.title = temp;
+	p->dirty = true;
 }
 
 /**
@@ -864,6 +2088,27 @@ void urldb_set_url_content_type(const char *url, content_type type)
 		return;
 
 	p->urld.type = type;
+	p->dirty = true;
+}
+
+/**
+ * Set an URL's content type
+ *
+ * \param url The URL to look for
+ * \param type The type to set
+ */
+void urldb_nsurl_set_content_type(const nsurl *url, content_type type)
+{
+	struct path_data *p;
+
+	assert(url);
+
+	p = urldb_find_nsurl(url);
+	if (!p)
+		return;
+
+	p->urld.type = type;
+	p->dirty = true;
 }
 
 /**
@@ -883,6 +2128,27 @@ void urldb_update_url_visit_data(const char *url)
 
 	p->urld.last_visit = time(NULL);
 	p->urld.visits++;
+	p->dirty = true;
+}
+
+/**
+ * Update an URL's visit data
+ *
+ * \param url The URL to update
+ */
+void urldb_nsurl_update_visit_data(const nsurl *url)
+{
+	struct path_data *p;
+
+	assert(url);
+
+	p = urldb_find_nsurl(url);
+	if (!p)
+		return;
+
+	p->urld.last_visit = time(NULL);
+	p->urld.visits++;
+	p->dirty = true;
 }
 
 /**
@@ -902,6 +2168,7 @@ void urldb_reset_url_visit_data(const char *url)
 
 	p->urld.last_visit = (time_t)0;
 	p->urld.visits = 0;
+	p->dirty = true;
 }
 
 
@@ -927,6 +2194,25 @@ const struct url_data *urldb_get_url_data(const char *url)
 	return (const struct url_data *) u;
 }
 
+/**
+ * Find data for an URL.
+ *
+ * \param url Absolute URL to look for
+ * \return Pointer to result struct, or NULL
+ */
+const struct url_data *urldb_nsurl_get_data(const nsurl *url)
+{
+	struct path_data *p;
+
+	assert(url);
+
+	p = urldb_find_nsurl(url);
+	if (!p)
+		return NULL;
+
+	return (const struct url_data *) &p->urld;
+}
+
 /**
  * Extract an URL from the db
  *
@@ -946,6 +2232,25 @@ const char *urldb_get_url(const char *url)
 	return p->url;
 }
 
+/**
+ * Extract an URL from the db
+ *
+ * \param url URL to extract
+ * \return Pointer to database's copy of URL or NULL if not found
+ */
+const char *urldb_nsurl_get_url(const nsurl *url)
+{
+	struct path_data *p;
+
+	assert(url);
+
+	p = urldb_find_nsurl(url);
+	if (!p)
+		return NULL;
+
+	return p->url;
+}
+
 /**
  * Look up authentication details in database
  *
@@ -956,7 +2261,7 @@ const char *urldb_get_url(const char *url)
  */
 const char *urldb_get_auth_details(const char *url, const char *realm)
 {
-	struct path_data *p, *p_cur, *p_top;
+	struct path_data *p;
 
 	assert(url);
 
@@ -967,6 +2272,45 @@ const char *urldb_get_auth_details(const char *url, const char *realm)
 	if (!p)
 		return NULL;
 
+	return urldb_lookup_auth_details(p, realm);
+}
+
+/**
+ * Look up authentication details in database
+ *
+ * \param url Absolute URL to search for
+ * \param realm When non-NULL, it is realm which can be used to determine
+ * the protection space when that's not been done before for given URL.
+ * \return Pointer to authentication details, or NULL if not found
+ */
+const char *urldb_nsurl_get_auth_details(const nsurl *url, const char *realm)
+{
+	struct path_data *p;
+
+	assert(url);
+
+	/* add to the db, if missing, so our lookup will work */
+	p = urldb_find_nsurl(url);
+	if (!p)
+		p = urldb_add_nsurl(url);
+	if (!p)
+		return NULL;
+
+	return urldb_lookup_auth_details(p, realm);
+}
+
+/**
+ * Look up authentication details for a path
+ *
+ * \param p Path data of URL
+ * \param realm When non-NULL, it is realm which can be used to determine
+ * the protection space when that's not been done before for given URL.
+ * \return Pointer to authentication details, or NULL if not found
+ */
+const char *urldb_lookup_auth_details(struct path_data *p, const char *realm)
+{
+	struct path_data *p_cur, *p_top;
+
 	/* Check for any auth details attached to the path_data node or any of
 	 * its parents. */
 	for (p_cur = p; p_cur != NULL; p_top = p_cur, p_cur = p_cur->parent) {
@@ -1006,7 +2350,6 @@ const char *urldb_get_auth_details(const char *url, const char *realm)
 bool urldb_get_cert_permissions(const char *url)
 {
 	struct path_data *p;
-	const struct host_part *h;
 
 	assert(url);
 
@@ -1014,6 +2357,40 @@ bool urldb_get_cert_permissions(const char *url)
 	if (!p)
 		return false;
 
+	return urldb_lookup_cert_permissions(p);
+}
+
+/**
+ * Retrieve certificate verification permissions from database
+ *
+ * \param url Absolute URL to search for
+ * \return true to permit connections to hosts with invalid certificates,
+ * false otherwise.
+ */
+bool urldb_nsurl_get_cert_permissions(const nsurl *url)
+{
+	struct path_data *p;
+
+	assert(url);
+
+	p = urldb_find_nsurl(url);
+	if (!p)
+		return false;
+
+	return urldb_lookup_cert_permissions(p);
+}
+
+/**
+ * Retrieve certificate verification permissions for a path
+ *
+ * \param p Path data of URL
+ * \return true to permit connections to hosts with invalid certificates,
+ * false otherwise.
+ */
+bool urldb_lookup_cert_permissions(const struct path_data *p)
+{
+	const struct host_part *h;
+
 	for (; p && p->parent; p = p->parent)
 		/* do nothing */;
 	assert(p);
@@ -1186,7 +2563,6 @@ void urldb_iterate_partial(const char *prefix,
 		prefix = scheme_sep + 3;
 
 	slash = strchr(prefix, '/');
-	tree = urldb_get_search_tree(prefix);
 
 	if (slash) {
 		/* if there's a slash in the input, then we can
@@ -1194,12 +2570,16 @@ void urldb_iterate_partial(const char *prefix,
 		snprintf(host, sizeof host, "%.*s",
 				(int) (slash - prefix), prefix);
 
+		urldb_store_materialise(host);
+		tree = urldb_get_search_tree(prefix);
+
 		h = urldb_search_find(tree, host);
 		if (!h) {
 			int len = slash - prefix;
 
 			if (len <= 3 || strncasecmp(host, "www.", 4) != 0) {
 				snprintf(buf, sizeof buf, "www.%s", host);
+				urldb_store_materialise(buf);
 				h = urldb_search_find(
 					search_trees[ST_DN + 'w' - 'a'],
 					buf);
@@ -1219,12 +2599,16 @@ void urldb_iterate_partial(const char *prefix,
 		int len = strlen(prefix);
 
 		/* looking for hosts */
+		urldb_store_materialise_prefix(prefix);
+		tree = urldb_get_search_tree(prefix);
+
 		if (!urldb_iterate_partial_host(tree, prefix, callback))
 			return;
 
 		if (len <= 3 || strncasecmp(prefix, "www.", 4) != 0) {
 			/* now look for www.prefix */
 			snprintf(buf, sizeof buf, "www.%s", prefix);
+			urldb_store_materialise_prefix(buf);
 			if(!urldb_iterate_partial_host(
 					search_trees[ST_DN + 'w' - 'a'],
 					buf, callback))
@@ -1379,6 +2763,35 @@ void urldb_iterate_entries(bool (*callback)(const char *url,
 
 	assert(callback);
 
+	urldb_store_materialise_all();
+
+	for (i = 0; i < NUM_SEARCH_TREES; i++) {
+		if (!urldb_iterate_entries_host(search_trees[i],
+				callback, NULL))
+			break;
+	}
+}
+
+/**
+ * Iterate over entries in database, skipping saved entries visited long ago
+ *
+ * \param since Time of earliest visit of interest
+ * \param callback Function to callback for each entry
+ *
+ * Saved entries are only loaded for hosts visited since \a since, so this
+ * is cheaper than urldb_iterate_entries() for a large database. Entries
+ * already loaded are all passed to \a callback, whenever visited.
+ */
+void urldb_iterate_entries_since(time_t since,
+		bool (*callback)(const char *url,
+		const struct url_data *data))
+{
+	int i;
+
+	assert(callback);
+
+	urldb_store_materialise_since(since);
+
 	for (i = 0; i < NUM_SEARCH_TREES; i++) {
 		if (!urldb_iterate_entries_host(search_trees[i],
 				callback, NULL))
@@ -1549,6 +2962,9 @@ struct host_part *urldb_add_host(const char *host)
 
 	assert(host);
 
+	/* Insert any saved entries for the host first */
+	urldb_store_materialise(host);
+
 	if (url_host_is_ip_address(host)) {
 		/* Host is an IP, so simply add as TLD */
 
@@ -1786,6 +3202,7 @@ struct path_data *urldb_add_path(const char *scheme, unsigned int port,
 		d->url = strdup(url);
 		if (!d->url)
 			return NULL;
+		d->dirty = true;
 		/** remove fragment */
 		segment = strrchr(d->url, '#');
 		if (segment)
@@ -1845,6 +3262,66 @@ struct path_data *urldb_add_path_fragment(struct path_data *segment,
 	return segment;
 }
 
+/**
+ * Insert an URL into the database
+ *
+ * \param url Absolute URL to insert
+ * \return Pointer to leaf node, or NULL on failure
+ */
+struct path_data *urldb_add_nsurl(const nsurl *url)
+{
+	struct host_part *h;
+	struct path_data *p = NULL;
+	lwc_string *scheme, *host, *port, *path, *query, *fragment;
+	const char *query_str;
+
+	assert(url);
+
+	scheme = nsurl_get_component(url, NSURL_SCHEME);
+	if (scheme == NULL)
+		return NULL;
+
+	host = nsurl_get_component(url, NSURL_HOST);
+	port = nsurl_get_component(url, NSURL_PORT);
+	path = nsurl_get_component(url, NSURL_PATH);
+	query = nsurl_get_component(url, NSURL_QUERY);
+	fragment = nsurl_get_component(url, NSURL_FRAGMENT);
+
+	/* Get host entry; file urls have no host, so manufacture one */
+	if (strcasecmp(lwc_string_data(scheme), "file") == 0)
+		h = urldb_add_host("localhost");
+	else if (host != NULL)
+		h = urldb_add_host(lwc_string_data(host));
+	else
+		h = NULL;
+
+	if (h != NULL) {
+		/* nsurl's query includes its leading '?' */
+		query_str = (query != NULL) ? lwc_string_data(query) + 1 : NULL;
+
+		p = urldb_add_path(lwc_string_data(scheme),
+				(port != NULL) ? atoi(lwc_string_data(port)) : 0,
+				h, (path != NULL) ? lwc_string_data(path) : "",
+				query_str, (fragment != NULL) ?
+				lwc_string_data(fragment) : NULL,
+				nsurl_access(url));
+	}
+
+	lwc_string_unref(scheme);
+	if (host != NULL)
+		lwc_string_unref(host);
+	if (port != NULL)
+		lwc_string_unref(port);
+	if (path != NULL)
+		lwc_string_unref(path);
+	if (query != NULL)
+		lwc_string_unref(query);
+	if (fragment != NULL)
+		lwc_string_unref(fragment);
+
+	return p;
+}
+
 /**
  * Find an URL in the database
  *
@@ -1896,6 +3373,8 @@ struct path_data *urldb_find_url(const char *url)
 	if (strcasecmp(components.scheme, "file") == 0)
 		host = "localhost";
 
+	urldb_store_materialise(host);
+
 	tree = urldb_get_search_tree(host);
 	h = urldb_search_find(tree, host);
 	if (!h) {
@@ -1930,15 +3409,100 @@ struct path_data *urldb_find_url(const char *url)
 		copy += SLEN("/");
 	}
 
-	if (components.query) {
-		*copy++ = '?';
-		strcpy(copy, components.query);
+	if (components.query) {
+		*copy++ = '?';
+		strcpy(copy, components.query);
+	}
+
+	p = urldb_match_path(&h->paths, plq, components.scheme, port);
+
+	url_destroy_components(&components);
+	free(plq);
+
+	return p;
+}
+
+/**
+ * Find an URL in the database
+ *
+ * \param url Absolute URL to find
+ * \return Pointer to path data, or NULL if not found
+ *
+ * Unlike urldb_find_url(), this uses the URL's components directly,
+ * so it neither parses nor copies the URL in the common case.
+ */
+struct path_data *urldb_find_nsurl(const nsurl *url)
+{
+	const struct host_part *h;
+	struct path_data *p = NULL;
+	lwc_string *scheme, *host, *port, *path, *query;
+	const char *host_str;
+	char buf[256];
+	char *plq = buf;
+	size_t path_len, query_len;
+
+	assert(url);
+
+	scheme = nsurl_get_component(url, NSURL_SCHEME);
+	if (scheme == NULL)
+		return NULL;
+
+	host = nsurl_get_component(url, NSURL_HOST);
+
+	/* file urls have no host, so manufacture one */
+	if (strcasecmp(lwc_string_data(scheme), "file") == 0)
+		host_str = "localhost";
+	else if (host != NULL)
+		host_str = lwc_string_data(host);
+	else
+		goto out;
+
+	urldb_store_materialise(host_str);
+
+	h = urldb_search_find(urldb_get_search_tree(host_str), host_str);
+	if (!h)
+		goto out;
+
+	port = nsurl_get_component(url, NSURL_PORT);
+	path = nsurl_get_component(url, NSURL_PATH);
+	query = nsurl_get_component(url, NSURL_QUERY);
+
+	/* generate plq; nsurl's query includes its leading '?' */
+	path_len = (path != NULL) ? lwc_string_length(path) : SLEN("/");
+	query_len = (query != NULL) ? lwc_string_length(query) : 0;
+
+	if (path_len + query_len + 1 > sizeof buf)
+		plq = malloc(path_len + query_len + 1);
+
+	if (plq != NULL) {
+		memcpy(plq, (path != NULL) ? lwc_string_data(path) : "/",
+				path_len);
+		if (query != NULL)
+			memcpy(plq + path_len, lwc_string_data(query),
+					query_len);
+		plq[path_len + query_len] = '\0';
+
+		if (plq[0] == '/')
+			p = urldb_match_path(&h->paths, plq,
+					lwc_string_data(scheme),
+					(port != NULL) ?
+					atoi(lwc_string_data(port)) : 0);
+
+		if (plq != buf)
+			free(plq);
 	}
 
-	p = urldb_match_path(&h->paths, plq, components.scheme, port);
+	if (port != NULL)
+		lwc_string_unref(port);
+	if (path != NULL)
+		lwc_string_unref(path);
+	if (query != NULL)
+		lwc_string_unref(query);
 
-	url_destroy_components(&components);
-	free(plq);
+out:
+	if (host != NULL)
+		lwc_string_unref(host);
+	lwc_string_unref(scheme);
 
 	return p;
 }
@@ -2024,6 +3588,8 @@ void urldb_dump(void)
 {
 	int i;
 
+	urldb_store_materialise_all();
+
 	urldb_dump_hosts(&db_root);
 
 	for (i = 0; i != NUM_SEARCH_TREES; i++)
@@ -2431,19 +3997,10 @@ struct search_node *urldb_search_split(struct search_node *root)
  */
 char *urldb_get_cookie(const char *url)
 {
-	const struct path_data *p, *q;
-	const struct host_part *h;
-	struct cookie_internal_data *c;
-	int count = 0, version = COOKIE_RFC2965;
-	struct cookie_internal_data **matched_cookies;
-	int matched_cookies_size = 20;
-	int ret_alloc = 4096, ret_used = 1;
+	const struct path_data *p;
 	char *path;
 	char *ret;
-	char *scheme;
-	time_t now;
 	url_func_result res;
-	int i;
 
 	assert(url != NULL);
 
@@ -2453,177 +4010,115 @@ char *urldb_get_cookie(const char *url)
 	if (!p)
 		return NULL;
 
-	scheme = p->scheme;
-
-	matched_cookies = malloc(matched_cookies_size * 
-			sizeof(struct cookie_internal_data *));
-	if (!matched_cookies)
-		return NULL;
-
-#define GROW_MATCHED_COOKIES						\
-	do {								\
-		if (count == matched_cookies_size) {			\
-			struct cookie_internal_data **temp;		\
-			temp = realloc(matched_cookies,			\
-				(matched_cookies_size + 20) *		\
-				sizeof(struct cookie_internal_data *));	\
-									\
-			if (temp == NULL) {				\
-				free(path);				\
-				free(ret);				\
-				free(matched_cookies);			\
-				return NULL;				\
-			}						\
-									\
-			matched_cookies = temp;				\
-			matched_cookies_size += 20;			\
-		}							\
-	} while(0)
-
-	ret = malloc(ret_alloc);
-	if (!ret) {
-		free(matched_cookies);
-		return NULL;
-	}
-
-	ret[0] = '\0';
-
 	res = url_path(url, &path);
-	if (res != URL_FUNC_OK) {
-		free(ret);
-		free(matched_cookies);
+	if (res != URL_FUNC_OK)
 		return NULL;
-	}
 
-	now = time(NULL);
+	ret = urldb_lookup_cookie(p, path);
 
-	if (*(p->segment) != '\0') {
-		/* Match exact path, unless directory, when prefix matching
-		 * will handle this case for us. */
-		for (q = p->parent->children; q; q = q->next) {
-			if (strcmp(q->segment, p->segment))
-				continue;
+	free(path);
 
-			/* Consider all cookies associated with
-			 * this exact path */
-			for (c = q->cookies; c; c = c->next) {
-				if (c->expires != -1 && c->expires < now)
-					/* cookie has expired => ignore */
-					continue;
+	return ret;
+}
 
-				if (c->secure && strcasecmp(
-						q->scheme, "https"))
-					/* secure cookie for insecure host.
-					 * ignore */
-					continue;
+/**
+ * Retrieve cookies for an URL
+ *
+ * \param url URL being fetched
+ * \return Cookies string for libcurl (on heap), or NULL on error/no cookies
+ */
+char *urldb_nsurl_get_cookie(const nsurl *url)
+{
+	const struct path_data *p;
+	lwc_string *path;
+	char *ret;
 
-				matched_cookies[count++] = c;
+	assert(url != NULL);
 
-				GROW_MATCHED_COOKIES;
+	/* add to the db, if missing, so our lookup will work */
+	p = urldb_find_nsurl(url);
+	if (!p)
+		p = urldb_add_nsurl(url);
+	if (!p)
+		return NULL;
 
-				if (c->version < (unsigned int)version)
-					version = c->version;
+	path = nsurl_get_component(url, NSURL_PATH);
+	if (path == NULL)
+		return NULL;
 
-				c->last_used = now;
-				cookies_schedule_update((struct cookie_data *)c);
-			}
-		}
-	}
+	ret = urldb_lookup_cookie(p, lwc_string_data(path));
 
-	/* Now consider cookies whose paths prefix-match ours */
-	for (p = p->parent; p; p = p->parent) {
-		/* Find directory's path entry(ies) */
-		/* There are potentially multiple due to differing schemes */
-		for (q = p->children; q; q = q->next) {
-			if (*(q->segment) != '\0')
-				continue;
+	lwc_string_unref(path);
 
-			for (c = q->cookies; c; c = c->next) {
-				if (c->expires != -1 && c->expires < now)
-					/* cookie has expired => ignore */
-					continue;
+	return ret;
+}
 
-				if (c->secure && strcasecmp(
-						q->scheme, "https"))
-					/* Secure cookie for insecure server
-					 * => ignore */
-					continue;
+/**
+ * Retrieve cookies for a path
+ *
+ * \param p Path data of URL being fetched
+ * \param path Path of URL being fetched
+ * \return Cookies string for libcurl (on heap), or NULL on error/no cookies
+ */
+char *urldb_lookup_cookie(const struct path_data *p, const char *path)
+{
+	const struct path_data *root;
+	const struct host_part *host, *h;
+	struct cookie_internal_data *c;
+	unsigned int count = 0, i;
+	int version = COOKIE_RFC2965;
+	int used = 1;
+	bool secure;
+	char *ret;
+	time_t now;
 
-				matched_cookies[count++] = c;
+	for (root = p; root->parent; root = root->parent)
+		; /* do nothing */
+	host = (const struct host_part *) root;
 
-				GROW_MATCHED_COOKIES;
+	secure = strcasecmp(p->scheme, "https") == 0;
 
-				if (c->version < (unsigned int) version)
-					version = c->version;
+	now = time(NULL);
 
-				c->last_used = now;
-				cookies_schedule_update((struct cookie_data *)c);
-			}
-		}
+	/* Consider the host's own cookies, then domain cookies for hosts
+	 * which domain match ours.  Each index is already in the order the
+	 * cookies are to be sent. */
+	for (h = host; h && h != &db_root; h = h->parent) {
+		const struct cookie_index *index = &h->cookie_index;
 
-		if (!p->parent) {
-			/* No parent, so bail here. This can't go in
-			 * the loop exit condition as we also want to
-			 * process the top-level node.
-                         *
-                         * If p->parent is NULL then p->cookies are
-                         * the domain cookies and thus we don't even
-                         * try matching against them.
-                         */
-			break;
-		}
+		for (i = (h == host) ? 0 : index->host_count;
+				i < index->count; i++) {
+			c = index->cookies[i];
 
-		/* Consider p itself - may be the result of Path=/foo */
-		for (c = p->cookies; c; c = c->next) {
 			if (c->expires != -1 && c->expires < now)
 				/* cookie has expired => ignore */
 				continue;
 
-			/* Ensure cookie path is a prefix of the resource */
-			if (strncmp(c->path, path, strlen(c->path)) != 0)
+			if (!urldb_cookie_path_match(c->path, path))
 				/* paths don't match => ignore */
 				continue;
 
-			if (c->secure && strcasecmp(p->scheme, "https"))
-				/* Secure cookie for insecure server
-				 * => ignore */
+			if (c->secure && !secure)
+				/* secure cookie for insecure host. ignore */
 				continue;
 
-			matched_cookies[count++] = c;
-
-			GROW_MATCHED_COOKIES;
-
-			if (c->version < (unsigned int) version)
-				version = c->version;
-
-			c->last_used = now;
-			cookies_schedule_update((struct cookie_data *)c);
-		}
-
-	}
-
-	/* Finally consider domain cookies for hosts which domain match ours */
-	for (h = (const struct host_part *)p; h && h != &db_root;
-			h = h->parent) {
-		for (c = h->paths.cookies; c; c = c->next) {
-			if (c->expires != -1 && c->expires < now)
-				/* cookie has expired => ignore */
-				continue;
+			if (count == matched_cookies_alloc) {
+				struct cookie_internal_data **temp;
+				unsigned int alloc = matched_cookies_alloc ?
+						matched_cookies_alloc * 2 : 32;
 
-			/* Ensure cookie path is a prefix of the resource */
-			if (strncmp(c->path, path, strlen(c->path)) != 0)
-				/* paths don't match => ignore */
-				continue;
+				temp = realloc(matched_cookies, alloc *
+						sizeof(*matched_cookies));
+				if (temp == NULL)
+					return NULL;
 
-			if (c->secure && strcasecmp(scheme, "https"))
-				/* secure cookie for insecure host. ignore */
-				continue;
+				matched_cookies = temp;
+				matched_cookies_alloc = alloc;
+			}
 
 			matched_cookies[count++] = c;
 
-			GROW_MATCHED_COOKIES;
-
-			if (c->version < (unsigned int)version)
+			if (c->version < (unsigned int) version)
 				version = c->version;
 
 			c->last_used = now;
@@ -2631,55 +4126,64 @@ char *urldb_get_cookie(const char *url)
 		}
 	}
 
-	if (count == 0) {
+	if (count == 0)
 		/* No cookies found */
-		free(path);
-		free(ret);
-		free(matched_cookies);
 		return NULL;
+
+	if (cookie_header == NULL) {
+		cookie_header = malloc(4096);
+		if (cookie_header == NULL)
+			return NULL;
+		cookie_header_alloc = 4096;
 	}
 
 	/* and build output string */
+	cookie_header[0] = '\0';
+
 	if (version > COOKIE_NETSCAPE) {
-		sprintf(ret, "$Version=%d", version);
-		ret_used = strlen(ret) + 1;
+		sprintf(cookie_header, "$Version=%d", version);
+		used = strlen(cookie_header) + 1;
 	}
 
 	for (i = 0; i < count; i++) {
 		if (!urldb_concat_cookie(matched_cookies[i], version,
-				&ret_used, &ret_alloc, &ret)) {
-			free(path);
-			free(ret);
-			free(matched_cookies);
+				&used, &cookie_header_alloc, &cookie_header))
 			return NULL;
-		}
 	}
 
 	if (version == COOKIE_NETSCAPE) {
 		/* Old-style cookies => no version & skip "; " */
-		memmove(ret, ret + 2, ret_used - 2);
-		ret_used -= 2;
+		ret = malloc(used - 2);
+		if (ret != NULL)
+			memcpy(ret, cookie_header + 2, used - 2);
+	} else {
+		ret = malloc(used);
+		if (ret != NULL)
+			memcpy(ret, cookie_header, used);
 	}
 
-	/* Now, shrink the output buffer to the required size */
-	{
-		char *temp = realloc(ret, ret_used);
-		if (!temp) {
-			free(path);
-			free(ret);
-			free(matched_cookies);
-			return NULL;
-		}
-
-		ret = temp;
-	}
+	return ret;
+}
 
-	free(path);
-	free(matched_cookies);
+/**
+ * Determine whether a cookie's path matches the path of a resource
+ *
+ * \param cookie_path Path of cookie
+ * \param path Path of resource
+ * \return true if the cookie should be sent for the resource
+ *
+ * The cookie path must be the resource path, or a prefix of it ending at
+ * a directory boundary.
+ */
+bool urldb_cookie_path_match(const char *cookie_path, const char *path)
+{
+	size_t len = strlen(cookie_path);
 
-	return ret;
+	if (strncmp(cookie_path, path, len) != 0)
+		return false;
 
-#undef GROW_MATCHED_COOKIES
+	return path[len] == '\0' || path[len] == '/' ||
+			(len > 0 && cookie_path[len - 1] == '/');
 }
 
 /**
@@ -3304,14 +4808,15 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, const char *scheme,
 		const char *url)
 {
 	struct cookie_internal_data *d;
-	const struct host_part *h;
+	struct host_part *h;
 	struct path_data *p;
+	unsigned int i;
 	time_t now = time(NULL);
 
 	assert(c && scheme && url);
 
 	if (c->domain[0] == '.') {
-		h = urldb_search_find(
+		h = (struct host_part *) urldb_search_find(
 			urldb_get_search_tree(&(c->domain[1])),
 			c->domain + 1);
 		if (!h) {
@@ -3324,7 +4829,7 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, const char *scheme,
 
 		p = (struct path_data *) &h->paths;
 	} else {
-		h = urldb_search_find(
+		h = (struct host_part *) urldb_search_find(
 				urldb_get_search_tree(c->domain),
 				c->domain);
 
@@ -3356,20 +4861,20 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, const char *scheme,
 	if (d) {
 		if (c->expires != -1 && c->expires < now) {
 			/* remove cookie */
-			if (d->next)
-				d->next->prev = d->prev;
-			else
-				p->cookies_end = d->prev;
-			if (d->prev)
-				d->prev->next = d->next;
-			else
-				p->cookies = d->next;
+			urldb_unlink_cookie(d);
 			
 			cookies_remove((struct cookie_data *)d);
 			urldb_free_cookie(d);
 			urldb_free_cookie(c);
 		} else {
 			/* replace d with c */
+			if (!urldb_expiry_insert(c)) {
+				urldb_free_cookie(c);
+				return false;
+			}
+			urldb_expiry_remove(d);
+
+			c->owner = p;
 			c->prev = d->prev;
 			c->next = d->next;
 			if (c->next)
@@ -3380,6 +4885,14 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, const char *scheme,
 				c->prev->next = c;
 			else
 				p->cookies = c;
+
+			/* d's place in the index suits c, too */
+			for (i = 0; i < h->cookie_index.count; i++) {
+				if (h->cookie_index.cookies[i] == d) {
+					h->cookie_index.cookies[i] = c;
+					break;
+				}
+			}
 			
 			cookies_remove((struct cookie_data *)d);
 			urldb_free_cookie(d);
@@ -3387,6 +4900,18 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, const char *scheme,
 			cookies_schedule_update((struct cookie_data *)c);
 		}
 	} else {
+		if (!urldb_expiry_insert(c)) {
+			urldb_free_cookie(c);
+			return false;
+		}
+
+		if (!urldb_index_cookie(h, c)) {
+			urldb_expiry_remove(c);
+			urldb_free_cookie(c);
+			return false;
+		}
+
+		c->owner = p;
 		c->prev = p->cookies_end;
 		c->next = NULL;
 		if (p->cookies_end)
@@ -3401,6 +4926,255 @@ bool urldb_insert_cookie(struct cookie_internal_data *c, const char *scheme,
 	return true;
 }
 
+/**
+ * Find the host a cookie is held by
+ *
+ * \param c Cookie in database
+ * \return Host tree entry indexing the cookie
+ */
+struct host_part *urldb_cookie_host(const struct cookie_internal_data *c)
+{
+	struct path_data *p;
+
+	for (p = c->owner; p->parent; p = p->parent)
+		; /* do nothing */
+
+	return (struct host_part *) p;
+}
+
+/**
+ * Add a cookie to a host's cookie index
+ *
+ * \param h Host holding cookie
+ * \param c Cookie to add
+ * \return true on success, false on memory exhaustion
+ */
+bool urldb_index_cookie(struct host_part *h, struct cookie_internal_data *c)
+{
+	struct cookie_index *index = &h->cookie_index;
+	bool domain = c->domain[0] == '.';
+	size_t len = strlen(c->path);
+	unsigned int i, end;
+
+	if (index->count == index->alloc) {
+		struct cookie_internal_data **temp;
+		unsigned int alloc = index->alloc ? index->alloc * 2 : 4;
+
+		temp = realloc(index->cookies, alloc * sizeof(*temp));
+		if (temp == NULL)
+			return false;
+
+		index->cookies = temp;
+		index->alloc = alloc;
+	}
+
+	/* Insert after cookies in the same group with paths at least as
+	 * long, so that equal paths stay oldest first */
+	i = domain ? index->host_count : 0;
+	end = domain ? index->count : index->host_count;
+	while (i < end && strlen(index->cookies[i]->path) >= len)
+		i++;
+
+	memmove(index->cookies + i + 1, index->cookies + i,
+			(index->count - i) * sizeof(*index->cookies));
+	index->cookies[i] = c;
+	index->count++;
+	if (!domain)
+		index->host_count++;
+
+	return true;
+}
+
+/**
+ * Remove a cookie from a host's cookie index
+ *
+ * \param h Host holding cookie
+ * \param c Cookie to remove
+ */
+void urldb_unindex_cookie(struct host_part *h, struct cookie_internal_data *c)
+{
+	struct cookie_index *index = &h->cookie_index;
+	unsigned int i;
+
+	for (i = 0; i < index->count; i++) {
+		if (index->cookies[i] == c)
+			break;
+	}
+
+	assert(i < index->count);
+
+	memmove(index->cookies + i, index->cookies + i + 1,
+			(index->count - i - 1) * sizeof(*index->cookies));
+	index->count--;
+	if (i < index->host_count)
+		index->host_count--;
+}
+
+/**
+ * Remove a cookie from the database, without freeing it
+ *
+ * \param c Cookie to remove
+ */
+void urldb_unlink_cookie(struct cookie_internal_data *c)
+{
+	struct path_data *p = c->owner;
+
+	if (c->prev)
+		c->prev->next = c->next;
+	else
+		p->cookies = c->next;
+
+	if (c->next)
+		c->next->prev = c->prev;
+	else
+		p->cookies_end = c->prev;
+
+	urldb_unindex_cookie(urldb_cookie_host(c), c);
+	urldb_expiry_remove(c);
+}
+
+/**
+ * Add a cookie to the expiry heap, unless it's a session cookie
+ *
+ * \param c Cookie to add
+ * \return true on success, false on memory exhaustion
+ */
+bool urldb_expiry_insert(struct cookie_internal_data *c)
+{
+	if (c->expires == -1)
+		return true;
+
+	if (cookie_expiry.count == cookie_expiry.alloc) {
+		struct cookie_internal_data **temp;
+		unsigned int alloc = cookie_expiry.alloc ?
+				cookie_expiry.alloc * 2 : 64;
+
+		temp = realloc(cookie_expiry.heap, alloc * sizeof(*temp));
+		if (temp == NULL)
+			return false;
+
+		cookie_expiry.heap = temp;
+		cookie_expiry.alloc = alloc;
+	}
+
+	c->expiry_index = cookie_expiry.count;
+	cookie_expiry.heap[cookie_expiry.count++] = c;
+	urldb_expiry_sift(c->expiry_index);
+
+	if (c->expiry_index == 0)
+		/* Expires before any other cookie */
+		urldb_expiry_schedule();
+
+	return true;
+}
+
+/**
+ * Remove a cookie from the expiry heap, if it's in it
+ *
+ * \param c Cookie to remove
+ */
+void urldb_expiry_remove(struct cookie_internal_data *c)
+{
+	unsigned int i = c->expiry_index;
+
+	if (c->expires == -1)
+		return;
+
+	assert(i < cookie_expiry.count && cookie_expiry.heap[i] == c);
+
+	cookie_expiry.count--;
+	if (i == cookie_expiry.count)
+		return;
+
+	/* Move the last cookie into the gap, and restore heap order */
+	cookie_expiry.heap[i] = cookie_expiry.heap[cookie_expiry.count];
+	cookie_expiry.heap[i]->expiry_index = i;
+	urldb_expiry_sift(i);
+}
+
+/**
+ * Move an entry of the expiry heap to its correct place
+ *
+ * \param i Position of entry in heap
+ */
+void urldb_expiry_sift(unsigned int i)
+{
+	struct cookie_internal_data **heap = cookie_expiry.heap;
+	struct cookie_internal_data *c = heap[i];
+	unsigned int child;
+
+	/* Towards the root, while expiring before the parent */
+	while (i > 0 && c->expires < heap[(i - 1) / 2]->expires) {
+		heap[i] = heap[(i - 1) / 2];
+		heap[i]->expiry_index = i;
+		i = (i - 1) / 2;
+	}
+
+	/* Away from the root, while expiring after a child */
+	while ((child = 2 * i + 1) < cookie_expiry.count) {
+		if (child + 1 < cookie_expiry.count &&
+				heap[child + 1]->expires <
+				heap[child]->expires)
+			child++;
+
+		if (c->expires <= heap[child]->expires)
+			break;
+
+		heap[i] = heap[child];
+		heap[i]->expiry_index = i;
+		i = child;
+	}
+
+	heap[i] = c;
+	c->expiry_index = i;
+}
+
+/**
+ * Schedule removal of the next cookie to expire
+ */
+void urldb_expiry_schedule(void)
+{
+	time_t now = time(NULL);
+	time_t wait;
+
+	schedule_remove(urldb_reap_cookies, NULL);
+
+	if (cookie_expiry.count == 0)
+		return;
+
+	/* Check at least hourly, which keeps the delay in range */
+	wait = cookie_expiry.heap[0]->expires - now + 1;
+	if (wait < 0)
+		wait = 0;
+	else if (wait > COOKIE_REAP_INTERVAL)
+		wait = COOKIE_REAP_INTERVAL;
+
+	schedule(wait * 100, urldb_reap_cookies, NULL);
+}
+
+/**
+ * Remove expired cookies from the database
+ *
+ * \param p Unused
+ */
+void urldb_reap_cookies(void *p)
+{
+	time_t now = time(NULL);
+	struct cookie_internal_data *c;
+
+	while (cookie_expiry.count > 0 &&
+			cookie_expiry.heap[0]->expires < now) {
+		c = cookie_expiry.heap[0];
+
+		urldb_unlink_cookie(c);
+
+		cookies_remove((struct cookie_data *)c);
+		urldb_free_cookie(c);
+	}
+
+	urldb_expiry_schedule();
+}
+
 /**
  * Free a cookie
  *
@@ -3753,15 +5527,7 @@ void urldb_delete_cookie_paths(const char *domain, const char *path,
 			if (strcmp(c->domain, domain) == 0 && 
 					strcmp(c->path, path) == 0 &&
 					strcmp(c->name, name) == 0) {
-				if (c->prev)
-					c->prev->next = c->next;
-				else
-					p->cookies = c->next;
-
-				if (c->next)
-					c->next->prev = c->prev;
-				else
-					p->cookies_end = c->prev;
+				urldb_unlink_cookie(c);
 
 				cookies_remove((struct cookie_data *)c);
 				urldb_free_cookie(c);
@@ -3904,6 +5670,7 @@ void urldb_destroy(void)
 	for (i = 0; i < NUM_SEARCH_TREES; i++) {
 		if (search_trees[i] != &empty)
 			urldb_destroy_search_tree(search_trees[i]);
+		search_trees[i] = &empty;
 	}
 
 	/* And database */
@@ -3911,6 +5678,24 @@ void urldb_destroy(void)
 		b = a->next;
 		urldb_destroy_host_tree(a);
 	}
+	db_root.children = NULL;
+
+	/* The cookies went with it */
+	schedule_remove(urldb_reap_cookies, NULL);
+	free(cookie_expiry.heap);
+	cookie_expiry.heap = NULL;
+	cookie_expiry.count = cookie_expiry.alloc = 0;
+	free(matched_cookies);
+	matched_cookies = NULL;
+	matched_cookies_alloc = 0;
+	free(cookie_header);
+	cookie_header = NULL;
+	cookie_header_alloc = 0;
+
+	/* And any saved database */
+	urldb_store_release();
+	free(url_store.filename);
+	url_store.filename = NULL;
 }
 
 /**
@@ -3945,6 +5730,8 @@ void urldb_destroy_host_tree(struct host_part *root)
 		urldb_destroy_prot_space(s);
 	}
 
+	free(root->cookie_index.cookies);
+
 	/* And ourselves */
 	free(root->part);
 	free(root);
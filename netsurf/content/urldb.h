@@ -27,6 +27,7 @@
 #include <time.h>
 #include "content/content.h"
 #include "content/content_type.h"
+#include "utils/nsurl.h"
 
 typedef enum {
 	COOKIE_NETSCAPE = 0,
@@ -69,6 +70,8 @@ void urldb_destroy(void);
 /* Persistence support */
 void urldb_load(const char *filename);
 void urldb_save(const char *filename);
+void urldb_import(const char *filename);
+void urldb_export(const char *filename);
 void urldb_set_url_persistence(const char *url, bool persist);
 
 /* URL insertion */
@@ -108,8 +111,22 @@ void urldb_iterate_partial(const char *prefix,
 /* Iteration */
 void urldb_iterate_entries(bool (*callback)(const char *url,
 		const struct url_data *data));
+void urldb_iterate_entries_since(time_t since,
+		bool (*callback)(const char *url,
+		const struct url_data *data));
 void urldb_iterate_cookies(bool (*callback)(const struct cookie_data *cookie));
 
+/* URL insertion / lookup, keyed on parsed URLs */
+bool urldb_nsurl_add(const nsurl *url);
+void urldb_nsurl_set_title(const nsurl *url, const char *title);
+void urldb_nsurl_set_content_type(const nsurl *url, content_type type);
+void urldb_nsurl_update_visit_data(const nsurl *url);
+const struct url_data *urldb_nsurl_get_data(const nsurl *url);
+const char *urldb_nsurl_get_url(const nsurl *url);
+const char *urldb_nsurl_get_auth_details(const nsurl *url, const char *realm);
+bool urldb_nsurl_get_cert_permissions(const nsurl *url);
+char *urldb_nsurl_get_cookie(const nsurl *url);
+
 /* Debug */
 void urldb_dump(void);
 
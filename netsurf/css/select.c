@@ -1571,7 +1571,7 @@ css_error node_is_visited(void *pw, void *node, bool *match)
 			return CSS_NOMEM;
 		}
 
-		data = urldb_get_url_data(nsurl_access(url));
+		data = urldb_nsurl_get_data(url);
 
 		/* Visited if in the db and has
 		 * non-zero visit count */
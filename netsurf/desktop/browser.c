@@ -892,7 +892,7 @@ void browser_window_go_post(struct browser_window *bw, const char *url,
 
 		error = llcache_handle_retrieve(nsurl, fetch_flags, nsref, 
 				fetch_is_post ? &post : NULL,
-				NULL, NULL, &l);
+				FETCH_PRIORITY_DOCUMENT, NULL, NULL, &l);
 		if (error == NSERROR_NO_FETCH_HANDLER) {
 			gui_launch_url(nsurl_access(nsurl));
 		} else if (error != NSERROR_OK) {
@@ -992,6 +992,11 @@ void browser_window_go_post(struct browser_window *bw, const char *url,
 		return;
 	}
 
+	/* Fetches in the context of a parent content (e.g. frames) are
+	 * still documents, which hlcache can't tell from objects */
+	if (parent != NULL)
+		hlcache_handle_set_priority(c, FETCH_PRIORITY_DOCUMENT);
+
 	bw->loading_content = c;
 	browser_window_start_throbber(bw);
 	browser_window_refresh_url_bar(bw, nsurl, NULL);
@@ -1245,17 +1250,17 @@ nserror browser_window_callback(hlcache_handle *c,
 
 		/* history */
 		if (bw->history_add && bw->history) {
-			const char *url = nsurl_access(hlcache_handle_get_url(c));
+			nsurl *url = hlcache_handle_get_url(c);
 
 			history_add(bw->history, c, bw->frag_id == NULL ? NULL :
 					lwc_string_data(bw->frag_id));
-			if (urldb_add_url(url)) {
-				urldb_set_url_title(url, content_get_title(c));
-				urldb_update_url_visit_data(url);
-				urldb_set_url_content_type(url, 
+			if (urldb_nsurl_add(url)) {
+				urldb_nsurl_set_title(url, content_get_title(c));
+				urldb_nsurl_update_visit_data(url);
+				urldb_nsurl_set_content_type(url, 
 						content_get_type(c));
 				/* This is safe as we've just added the URL */
-				global_history_add(urldb_get_url(url));
+				global_history_add(urldb_nsurl_get_url(url));
 			}
 		}
 
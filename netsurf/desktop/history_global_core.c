@@ -280,6 +280,9 @@ static bool history_global_initialise_nodes(void)
  */
 bool history_global_initialise(struct tree *tree, const char* folder_icon_name)
 {
+	time_t oldest;
+	int i;
+
 	folder_icon = tree_load_icon(folder_icon_name);
 	tree_url_node_init(folder_icon_name);
 
@@ -292,8 +295,15 @@ bool history_global_initialise(struct tree *tree, const char* folder_icon_name)
 	if (!history_global_initialise_nodes())
 		return false;
 
+	/* Entries older than the oldest base node aren't shown, so needn't
+	 * be loaded */
+	oldest = time(NULL);
+	for (i = 0; i < global_history_base_node_count; i++)
+		if (global_history_base_node_time[i] < oldest)
+			oldest = global_history_base_node_time[i];
+
 	global_history_initialised = true;
-	urldb_iterate_entries(global_history_add_internal);
+	urldb_iterate_entries_since(oldest, global_history_add_internal);
 	global_history_initialised = false;
 	tree_set_node_expanded(global_history_tree, global_history_tree_root,
 			       false, true, true);
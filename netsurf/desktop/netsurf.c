@@ -28,6 +28,7 @@
 
 #include "utils/config.h"
 #include "utils/utsname.h"
+#include "content/backing_store.h"
 #include "content/content_factory.h"
 #include "content/fetch.h"
 #include "content/hlcache.h"
@@ -217,6 +218,20 @@ nserror netsurf_init(int *pargc,
 	setlocale(LC_ALL, "C");
 
 	fetch_init();
+
+	/* Initialise the llcache's backing store, if one is configured */
+	if (nsoption_charp(disc_cache_path) != NULL &&
+			nsoption_int(disc_cache_size) > 0) {
+		struct backing_store_parameters store_parameters = {
+			.path = nsoption_charp(disc_cache_path),
+			.limit = nsoption_int(disc_cache_size),
+			.hysteresis = nsoption_int(disc_cache_size) / 10,
+			.max_age = nsoption_int(disc_cache_age) * 24 * 60 * 60
+		};
+
+		if (backing_store_initialise(&store_parameters) != NSERROR_OK)
+			LOG(("Failed to initialise backing store"));
+	}
 	
 	/* Initialise the hlcache and allow it to init the llcache for us */
 	hlcache_initialise(&hlcache_parameters);
@@ -264,6 +279,10 @@ void netsurf_exit(void)
 	LOG(("Finalising high-level cache"));
 	hlcache_finalise();
 
+	/* The llcache persists objects on finalisation, so this must follow */
+	LOG(("Finalising backing store"));
+	backing_store_finalise();
+
 	LOG(("Closing fetches"));
 	fetch_quit();
 
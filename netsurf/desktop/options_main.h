@@ -68,6 +68,16 @@
 	int memory_cache_size;					\
 	/** Preferred expiry age of disc cache / days. */	\
 	int disc_cache_age;					\
+	/** Preferred maximum size of disc cache / bytes. */	\
+	int disc_cache_size;					\
+	/** Directory holding the disc cache, or NULL to disable it. */ \
+	char *disc_cache_path;					\
+	/** Longest time a stale cached object may be used while it	\
+	 * is revalidated in the background / seconds.  Frequently	\
+	 * used objects are also revalidated shortly before they	\
+	 * become stale.  Zero disables both.			\
+	 */							\
+	int stale_while_revalidate;				\
 	/** Whether to block advertisements */			\
 	bool block_ads;						\
 	/** Disable website tracking, see	\
@@ -162,6 +172,26 @@
 	 * plus option_max_fetchers.					\
 	 */								\
 	int max_cached_fetch_handles;					\
+	/** Maximum number of connections being opened speculatively	\
+	 * at once, to hosts which documents refer to.  Zero disables	\
+	 * preconnection, which is the default: a connection is opened	\
+	 * by sending a real HEAD request for the host's root, which	\
+	 * the server sees and logs like any other.			\
+	 */								\
+	int max_preconnects;						\
+	/** Open a connection to a link's host when it is hovered.	\
+	 * Requires max_preconnects, and makes a HEAD request to any	\
+	 * host the pointer passes over a link to.			\
+	 */								\
+	bool preconnect_hover;						\
+	/** Directory to record HTTP responses into, or NULL */	\
+	char *fetch_record_path;					\
+	/** Directory of recorded HTTP responses to serve in place of	\
+	 * the network, or NULL.  Read at startup only.		\
+	 */								\
+	char *fetch_replay_path;					\
+	/** Replay recorded responses at the speed they arrived */	\
+	bool fetch_replay_timing;					\
 	/** Suppress debug output from cURL. */				\
 	bool suppress_curl_debug;					\
 									\
@@ -219,6 +249,9 @@
 	.accept_charset = NULL,				\
 	.memory_cache_size = 12 * 1024 * 1024,		\
 	.disc_cache_age = 28,				\
+	.disc_cache_size = 1024 * 1024 * 1024,		\
+	.disc_cache_path = NULL,			\
+	.stale_while_revalidate = 0,			\
 	.block_ads = false,				\
 	.do_not_track = false,				\
 	.minimum_gif_delay = 10,			\
@@ -260,6 +293,11 @@
 	.max_fetchers = 24,				\
 	.max_fetchers_per_host = 5,			\
 	.max_cached_fetch_handles = 6,			\
+	.max_preconnects = 0,				\
+	.preconnect_hover = false,			\
+	.fetch_record_path = NULL,			\
+	.fetch_replay_path = NULL,			\
+	.fetch_replay_timing = false,			\
 	.suppress_curl_debug = true,			\
 	.target_blank = true,				\
 	.button_2_tab = true
@@ -313,6 +351,9 @@
 	{ "accept_charset",	OPTION_STRING,	&nsoptions.accept_charset }, \
 	{ "memory_cache_size",	OPTION_INTEGER,	&nsoptions.memory_cache_size },	\
 	{ "disc_cache_age",	OPTION_INTEGER,	&nsoptions.disc_cache_age }, \
+	{ "disc_cache_size",	OPTION_INTEGER,	&nsoptions.disc_cache_size }, \
+	{ "disc_cache_path",	OPTION_STRING,	&nsoptions.disc_cache_path }, \
+	{ "stale_while_revalidate", OPTION_INTEGER, &nsoptions.stale_while_revalidate }, \
 	{ "block_advertisements", OPTION_BOOL,	&nsoptions.block_ads },	\
 	{ "do_not_track", OPTION_BOOL,	&nsoptions.do_not_track },	\
 	{ "minimum_gif_delay",	OPTION_INTEGER,	&nsoptions.minimum_gif_delay },	\
@@ -345,6 +386,11 @@
 	{ "max_fetchers",	OPTION_INTEGER,	&nsoptions.max_fetchers }, \
 	{ "max_fetchers_per_host", OPTION_INTEGER, &nsoptions.max_fetchers_per_host }, \
 	{ "max_cached_fetch_handles", OPTION_INTEGER, &nsoptions.max_cached_fetch_handles }, \
+	{ "max_preconnects",	OPTION_INTEGER,	&nsoptions.max_preconnects }, \
+	{ "preconnect_hover",	OPTION_BOOL,	&nsoptions.preconnect_hover }, \
+	{ "fetch_record_path",	OPTION_STRING,	&nsoptions.fetch_record_path }, \
+	{ "fetch_replay_path",	OPTION_STRING,	&nsoptions.fetch_replay_path }, \
+	{ "fetch_replay_timing", OPTION_BOOL,	&nsoptions.fetch_replay_timing }, \
 	{ "suppress_curl_debug",OPTION_BOOL,	&nsoptions.suppress_curl_debug }, \
 	{ "target_blank",	OPTION_BOOL,	&nsoptions.target_blank }, \
 	{ "button_2_tab",	OPTION_BOOL,	&nsoptions.button_2_tab }, \
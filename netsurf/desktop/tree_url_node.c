@@ -529,12 +529,12 @@ static void tree_url_load_entry(xmlNode *li, struct tree *tree,
 	/* No longer need this */
 	xmlFree(url1);
 
-	data = urldb_get_url_data(nsurl_access(url));
+	data = urldb_nsurl_get_data(url);
 	if (data == NULL) {
 		/* No entry in database, so add one */
-		urldb_add_url(nsurl_access(url));
+		urldb_nsurl_add(url);
 		/* now attempt to get url data */
-		data = urldb_get_url_data(nsurl_access(url));
+		data = urldb_nsurl_get_data(url);
 	}
 	if (data == NULL) {
 		xmlFree(title);
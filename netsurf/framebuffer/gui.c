@@ -60,6 +60,10 @@
 
 #define NSFB_TOOLBAR_DEFAULT_LAYOUT "blfsrut"
 
+/** Longest time to wait on watched file descriptors before checking for
+ * input events, in milliseconds */
+#define FB_FD_WAIT 10
+
 fbtk_widget_t *fbtk;
 
 struct gui_window *input_window = NULL;
@@ -520,6 +524,7 @@ gui_poll(bool active)
 {
 	nsfb_event_t event;
 	int timeout; /* timeout in miliseconds */
+	int fdtimeout; /* timeout waiting on file descriptors */
 
 	/* run the scheduler and discover how long to wait for the next event */
 	timeout = schedule_run();
@@ -532,6 +537,19 @@ gui_poll(bool active)
 	if (fbtk_get_redraw_pending(fbtk))
 		timeout = 0;
 
+	/* The framebuffer library cannot wait on our file descriptors, so
+	 * wait on those being watched for a while first and only check for
+	 * input events afterwards.  Network data is handled the moment it
+	 * arrives, at the cost of a little input latency.
+	 */
+	if ((timeout < 0) || (timeout > FB_FD_WAIT))
+		fdtimeout = FB_FD_WAIT;
+	else
+		fdtimeout = timeout;
+
+	if (schedule_fd_run(fdtimeout))
+		timeout = 0;
+
 	if (fbtk_event(fbtk, &event, timeout)) {
 		if ((event.type == NSFB_EVENT_CONTROL) &&
 		    (event.value.controlcode ==  NSFB_CONTROL_QUIT))
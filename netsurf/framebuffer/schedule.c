@@ -19,6 +19,7 @@
 #include <sys/time.h>
 #include <time.h>
 #include <stdlib.h>
+#include <poll.h>
 
 #include "utils/schedule.h"
 #include "framebuffer/schedule.h"
@@ -39,6 +40,25 @@ struct nscallback
 	void *p;
 };
 
+/* linked list of watched file descriptors */
+static struct nsfdwatch *fdwatch_list = NULL;
+
+/* poll array for watched file descriptors */
+static struct pollfd *fdwatch_pollfds = NULL;
+static int fdwatch_pollfds_alloc = 0;
+
+/**
+ * file descriptor watch.
+ */
+struct nsfdwatch
+{
+	struct nsfdwatch *next;
+	int fd;
+	int events;
+	schedule_fd_callback_fn callback;
+	void *p;
+};
+
 
 /**
  * Schedule a callback.
@@ -193,6 +213,136 @@ schedule_run(void)
         return (rettime.tv_sec * 1000) + (rettime.tv_usec / 1000);
 }
 
+/**
+ * Watch a file descriptor for readiness.
+ *
+ * \param  fd        file descriptor to watch
+ * \param  events    bitmap of conditions to watch for
+ * \param  callback  callback function
+ * \param  p         user parameter, passed to callback function
+ * \return true on success, false on memory exhaustion
+ */
+
+bool schedule_fd(int fd, int events, schedule_fd_callback_fn callback,
+		void *p)
+{
+	struct nsfdwatch *watch;
+
+	for (watch = fdwatch_list; watch != NULL; watch = watch->next) {
+		if (watch->fd == fd)
+			break;
+	}
+
+	if (watch == NULL) {
+		watch = calloc(1, sizeof(struct nsfdwatch));
+		if (watch == NULL)
+			return false;
+
+		watch->fd = fd;
+		watch->next = fdwatch_list;
+		fdwatch_list = watch;
+	}
+
+	watch->events = events;
+	watch->callback = callback;
+	watch->p = p;
+
+	return true;
+}
+
+/**
+ * Stop watching a file descriptor.
+ *
+ * \param  fd  file descriptor to stop watching
+ */
+
+void schedule_fd_remove(int fd)
+{
+	struct nsfdwatch **link;
+	struct nsfdwatch *watch;
+
+	for (link = &fdwatch_list; *link != NULL; link = &(*link)->next) {
+		if ((*link)->fd == fd) {
+			watch = *link;
+			*link = watch->next;
+			free(watch);
+			return;
+		}
+	}
+}
+
+/**
+ * Wait for watched file descriptors to become ready and make their
+ * callbacks.
+ *
+ * \param  timeout  maximum time to wait in milliseconds
+ * \return false if no file descriptors are being watched, so no wait
+ *         occurred, otherwise true.
+ */
+
+bool schedule_fd_run(int timeout)
+{
+	struct nsfdwatch *watch;
+	int count = 0;
+	int i;
+
+	for (watch = fdwatch_list; watch != NULL; watch = watch->next)
+		count++;
+
+	if (count == 0)
+		return false;
+
+	if (count > fdwatch_pollfds_alloc) {
+		struct pollfd *pollfds;
+
+		pollfds = realloc(fdwatch_pollfds,
+				count * sizeof(struct pollfd));
+		if (pollfds == NULL)
+			return false;
+
+		fdwatch_pollfds = pollfds;
+		fdwatch_pollfds_alloc = count;
+	}
+
+	for (watch = fdwatch_list, i = 0; watch != NULL;
+			watch = watch->next, i++) {
+		fdwatch_pollfds[i].fd = watch->fd;
+		fdwatch_pollfds[i].events = 0;
+		if (watch->events & SCHEDULE_FD_READ)
+			fdwatch_pollfds[i].events |= POLLIN;
+		if (watch->events & SCHEDULE_FD_WRITE)
+			fdwatch_pollfds[i].events |= POLLOUT;
+		fdwatch_pollfds[i].revents = 0;
+	}
+
+	if (poll(fdwatch_pollfds, count, timeout) <= 0)
+		return true;
+
+	for (i = 0; i < count; i++) {
+		int events = 0;
+
+		if (fdwatch_pollfds[i].revents == 0)
+			continue;
+
+		if (fdwatch_pollfds[i].revents & POLLIN)
+			events |= SCHEDULE_FD_READ;
+		if (fdwatch_pollfds[i].revents & POLLOUT)
+			events |= SCHEDULE_FD_WRITE;
+		if (fdwatch_pollfds[i].revents & (POLLERR | POLLHUP | POLLNVAL))
+			events |= SCHEDULE_FD_ERROR;
+
+		/* earlier callbacks may have changed the watches */
+		for (watch = fdwatch_list; watch != NULL; watch = watch->next) {
+			if (watch->fd == fdwatch_pollfds[i].fd) {
+				watch->callback(watch->fd, events, watch->p);
+				break;
+			}
+		}
+	}
+
+	return true;
+}
+
 void list_schedule(void)
 {
 	struct timeval tv;
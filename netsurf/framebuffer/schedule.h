@@ -19,7 +19,10 @@
 #ifndef FRAMEBUFFER_SCHEDULE_H
 #define FRAMEBUFFER_SCHEDULE_H
 
+#include <stdbool.h>
+
 int schedule_run(void);
+bool schedule_fd_run(int timeout);
 void list_schedule(void);
 
 #endif
@@ -45,6 +45,17 @@ static GList *queued_callbacks = NULL;
 /** List of callbacks which are about to be run in this ::schedule_run. */
 static GList *this_run = NULL;
 
+/** File descriptor watch embodiment. */
+typedef struct {
+        int fd;				/**< The file descriptor. */
+        guint source;			/**< The GLib event source. */
+        schedule_fd_callback_fn callback; /**< The callback function. */
+        void *context;			/**< The context for the callback. */
+} _monkey_fd_watch_t;
+
+/** List of file descriptor watches. */
+static GList *fd_watches = NULL;
+
 static gboolean
 nsgtk_schedule_generic_callback(gpointer data)
 {
@@ -106,6 +117,79 @@ schedule(int t, void (*callback)(void *p), void *p)
         g_timeout_add(msec_timeout, nsgtk_schedule_generic_callback, cb);
 }
 
+static gboolean
+monkey_schedule_fd_callback(GIOChannel *source, GIOCondition condition,
+                            gpointer data)
+{
+        _monkey_fd_watch_t *watch = (_monkey_fd_watch_t *)(data);
+        int events = 0;
+
+        if (condition & (G_IO_IN | G_IO_PRI))
+                events |= SCHEDULE_FD_READ;
+        if (condition & G_IO_OUT)
+                events |= SCHEDULE_FD_WRITE;
+        if (condition & (G_IO_ERR | G_IO_HUP | G_IO_NVAL))
+                events |= SCHEDULE_FD_ERROR;
+
+        LOG(("FD %d ready (%x)", watch->fd, events));
+        /* The callback may remove this watch, freeing it */
+        watch->callback(watch->fd, events, watch->context);
+
+        return TRUE;
+}
+
+void
+schedule_fd_remove(int fd)
+{
+        GList *l;
+
+        for (l = fd_watches; l != NULL; l = l->next) {
+                _monkey_fd_watch_t *watch = (_monkey_fd_watch_t *)(l->data);
+                if (watch->fd == fd) {
+                        LOG(("Removing watch on FD %d", fd));
+                        fd_watches = g_list_delete_link(fd_watches, l);
+                        /* Frees the watch */
+                        g_source_remove(watch->source);
+                        return;
+                }
+        }
+}
+
+bool
+schedule_fd(int fd, int events, schedule_fd_callback_fn callback, void *p)
+{
+        GIOCondition condition = G_IO_ERR | G_IO_HUP;
+        GIOChannel *channel;
+        _monkey_fd_watch_t *watch = malloc(sizeof(_monkey_fd_watch_t));
+
+        if (watch == NULL)
+                return false;
+
+        /* Replace any existing watch on this descriptor. */
+        schedule_fd_remove(fd);
+
+        if (events & SCHEDULE_FD_READ)
+                condition |= G_IO_IN | G_IO_PRI;
+        if (events & SCHEDULE_FD_WRITE)
+                condition |= G_IO_OUT;
+
+        watch->fd = fd;
+        watch->callback = callback;
+        watch->context = p;
+
+        channel = g_io_channel_unix_new(fd);
+        watch->source = g_io_add_watch_full(channel, G_PRIORITY_DEFAULT,
+                                            condition,
+                                            monkey_schedule_fd_callback,
+                                            watch, free);
+        g_io_channel_unref(channel);
+
+        LOG(("Watching FD %d for %x", fd, events));
+        fd_watches = g_list_prepend(fd_watches, watch);
+
+        return true;
+}
+
 bool
 schedule_run(void)
 {
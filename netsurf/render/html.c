@@ -63,6 +63,9 @@
 #define ALWAYS_DUMP_FRAMESET 0
 #define ALWAYS_DUMP_BOX 0
 
+/** Maximum number of bytes of source data to parse in one go */
+#define HTML_PARSE_STEP (32 * 1024)
+
 static const char empty_document[] =
 	"<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.01//EN\""
 	"	\"http://www.w3.org/TR/html4/strict.dtd\">"
@@ -83,6 +86,8 @@ static const char *html_types[] = {
 
 /* forward declared functions */
 static void html_object_refresh(void *p);
+static void html_parse_callback(void *p);
+static bool html_convert_document(html_content *htmlc);
 
 /* pre-interned character set */
 static lwc_string *html_charset;
@@ -135,6 +140,12 @@ html_create_html_data(html_content *c, const http_parameter *params)
 	nserror nerror;
 
 	c->parser_binding = NULL;
+	c->source_received = 0;
+	c->source_parsed = 0;
+	c->source_preloaded = 0;
+	c->parse_scheduled = false;
+	c->convert_pending = false;
+	c->preload = NULL;
 	c->document = NULL;
 	c->quirks = BINDING_QUIRKS_MODE_NONE;
 	c->encoding = NULL;
@@ -193,6 +204,10 @@ html_create_html_data(html_content *c, const http_parameter *params)
 	if (error != BINDING_OK)
 		goto error;
 
+	/* Preloading is optional, so carry on without it on failure */
+	if (html_preload_create(c, &c->preload) != NSERROR_OK)
+		c->preload = NULL;
+
 	return NSERROR_OK;
 
 error:
@@ -264,33 +279,20 @@ html_create(const content_handler *handler,
 
 
 /**
- * Process data for CONTENT_HTML.
+ * Restart parsing using the encoding the parser has detected
+ *
+ * \param html  Content to restart parsing of
+ * \return true on success, false on failure
+ *
+ * On failure, an error has been broadcast.
  */
 
-static bool 
-html_process_data(struct content *c, const char *data, unsigned int size)
+static bool html_change_encoding(html_content *html)
 {
-	html_content *html = (html_content *) c;
+	struct content *c = &html->base;
 	binding_error err;
 	const char *encoding;
 
-	err = binding_parse_chunk(html->parser_binding,
-			(const uint8_t *) data, size);
-	if (err == BINDING_ENCODINGCHANGE) {
-		goto encoding_change;
-	} else if (err != BINDING_OK) {
-		union content_msg_data msg_data;
-
-		msg_data.error = messages_get("NoMemory");
-		content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
-
-		return false;
-	}
-
-	return true;
-
-encoding_change:
-
 	/* Retrieve new encoding */
 	encoding = binding_get_encoding(
 			html->parser_binding,
@@ -343,19 +345,201 @@ encoding_change:
 		return false;
 	}
 
-	{
-		const char *source_data;
-		unsigned long source_size;
+	/* Reprocess all the data.  This is safe because the encoding is
+	 * now specified at parser start which means it cannot be changed
+	 * again. */
+	html->source_parsed = 0;
+
+	/* The preload scanner made the same assumption, so must also
+	 * start again */
+	if (html->preload != NULL) {
+		html_preload_restart(html->preload);
+		html->source_preloaded = 0;
+	}
+
+	return true;
+}
+
+/**
+ * Abandon preloading for a document which will not be displayed
+ *
+ * \param html  Content to abandon preloading for
+ */
+
+static void html_abort_preload(html_content *html)
+{
+	if (html->preload != NULL) {
+		html_preload_abort(html->preload);
+		html_preload_destroy(html->preload);
+		html->preload = NULL;
+	}
+}
+
+/**
+ * Pass received source data to the preload scanner
+ *
+ * \param html   Content to scan source of
+ * \param limit  Maximum number of bytes to scan
+ */
+
+static void html_preload_source(html_content *html, size_t limit)
+{
+	while (limit > 0 && html->source_preloaded < html->source_received) {
+		const char *data;
+		unsigned long len;
+
+		data = content__get_source_span(&html->base,
+				html->source_preloaded, &len);
+		if (data == NULL) {
+			/* Source has gone: there is nothing more to scan */
+			html_preload_stop(html->preload);
+			break;
+		}
+
+		if (len > html->source_received - html->source_preloaded)
+			len = html->source_received - html->source_preloaded;
+		if (len > limit)
+			len = limit;
+
+		html_preload_scan(html->preload, (const uint8_t *) data, len);
+
+		html->source_preloaded += len;
+		limit -= len;
+	}
+}
+
+/**
+ * Pass received source data to the parser
+ *
+ * \param html   Content to parse source of
+ * \param limit  Maximum number of bytes to parse
+ * \return true on success, false on failure
+ *
+ * On failure, an error has been broadcast.
+ */
+
+static bool html_parse_source(html_content *html, size_t limit)
+{
+	while (limit > 0 && html->source_parsed < html->source_received) {
+		const char *data;
+		unsigned long len;
+		binding_error err;
+
+		data = content__get_source_span(&html->base,
+				html->source_parsed, &len);
+		if (data == NULL) {
+			/* Source has gone: there is nothing more to parse */
+			html->source_received = html->source_parsed;
+			break;
+		}
+
+		if (len > html->source_received - html->source_parsed)
+			len = html->source_received - html->source_parsed;
+		if (len > limit)
+			len = limit;
+
+		err = binding_parse_chunk(html->parser_binding,
+				(const uint8_t *) data, len);
+		if (err == BINDING_ENCODINGCHANGE) {
+			if (html_change_encoding(html) == false)
+				return false;
+
+			continue;
+		} else if (err != BINDING_OK) {
+			union content_msg_data msg_data;
+
+			msg_data.error = messages_get("NoMemory");
+			content_broadcast(&html->base, CONTENT_MSG_ERROR, 
+					msg_data);
+
+			return false;
+		}
+
+		html->source_parsed += len;
+		limit -= len;
+	}
+
+	return true;
+}
+
+/**
+ * Ensure that parsing of received source data is scheduled
+ */
+
+static void html_schedule_parse(html_content *html)
+{
+	if (html->parse_scheduled == false) {
+		html->parse_scheduled = true;
+		schedule(0, html_parse_callback, html);
+	}
+}
+
+/**
+ * schedule() callback for parsing source data
+ *
+ * Source data is parsed a step at a time, returning to the main loop in
+ * between, so that fetches and user input aren't held up while a large
+ * document is parsed.  Each step is first passed to the preload scanner,
+ * which therefore keeps ahead of the parser.  Conversion waits for
+ * parsing to catch up.
+ */
+
+static void html_parse_callback(void *p)
+{
+	html_content *html = p;
+	struct content *c = &html->base;
+
+	html->parse_scheduled = false;
+
+	if (html->preload != NULL && html->aborted == false)
+		html_preload_source(html, HTML_PARSE_STEP);
+
+	if (html->aborted) {
+		/* Conversion will fail, so don't bother parsing the rest */
+		html->source_parsed = html->source_received;
+	} else if (html_parse_source(html, HTML_PARSE_STEP) == false) {
+		/* Conversion owns the content once it is pending; otherwise
+		 * stop the fetch, as content_llcache_callback would */
+		if (html->convert_pending == false)
+			llcache_handle_abort(c->llcache);
+
+		html->convert_pending = false;
+		html_abort_preload(html);
+		content_set_error(c);
+		return;
+	}
 
-		source_data = content__get_source_data(c, &source_size);
+	if (html->source_parsed < html->source_received) {
+		html_schedule_parse(html);
+	} else if (html->convert_pending) {
+		html->convert_pending = false;
 
-		/* Recurse to reprocess all the data.  This is safe because
-		 * the encoding is now specified at parser start which means
-		 * it cannot be changed again. */
-		return html_process_data(c, source_data, source_size);
+		if (html_convert_document(html) == false) {
+			html_abort_preload(html);
+			content_set_error(c);
+		}
 	}
 }
 
+/**
+ * Process data for CONTENT_HTML.
+ *
+ * The data is left in the content's source, to be scanned and parsed
+ * shortly.
+ */
+
+static bool 
+html_process_data(struct content *c, const char *data, unsigned int size)
+{
+	html_content *html = (html_content *) c;
+
+	html->source_received += size;
+
+	html_schedule_parse(html);
+
+	return true;
+}
+
 /** process link node */
 static bool html_process_link(html_content *c, dom_node *node)
 {
@@ -1089,6 +1273,9 @@ static bool html_replace_object(struct content_html_object *object, nsurl *url)
 		object->box->object = NULL;
 	}
 
+	/* Priority is raised again if the replacement is seen */
+	object->visible = false;
+
 	/* initialise fetch */
 	error = hlcache_handle_retrieve(url, HLCACHE_RETRIEVE_SNIFF_TYPE, 
 			content_get_url(&c->base), NULL, 
@@ -1170,6 +1357,13 @@ static void html_box_convert_done(html_content *c, bool success)
 
 	LOG(("Done XML to box (%p)", c));
 
+	/* Everything the document uses has been requested by now, so the
+	 * preloaded objects are no longer needed */
+	if (c->preload != NULL) {
+		html_preload_destroy(c->preload);
+		c->preload = NULL;
+	}
+
 	/* Clean up and report error if unsuccessful or aborted */
 	if ((success == false) || c->aborted) {
 		html_destroy_objects(c);
@@ -1831,22 +2025,18 @@ no_memory:
  *
  * On exit, the content status will be either CONTENT_STATUS_DONE if the
  * document is completely loaded or CONTENT_STATUS_READY if objects are still
- * being fetched.
+ * being fetched.  If source data remains to be parsed, the content stays
+ * in CONTENT_STATUS_LOADING until parsing has caught up.
  */
 
 static bool html_convert(struct content *c)
 {
 	html_content *htmlc = (html_content *) c;
 	binding_error err;
-	dom_node *html, *head;
-	union content_msg_data msg_data;
 	unsigned long size;
-	struct form *f;
-	dom_exception exc; /* returned by libdom functions */
-	dom_string *node_name = NULL;
 
 	/* finish parsing */
-	content__get_source_data(c, &size);
+	size = content__get_source_size(c);
 	if (size == 0) {
 		/* Destroy current binding */
 		binding_destroy_tree(htmlc->parser_binding);
@@ -1873,11 +2063,57 @@ static bool html_convert(struct content *c)
 		}
 
 		/* Process the error page */
-		if (html_process_data(c, (char *) empty_document, 
-				SLEN(empty_document)) == false)
+		err = binding_parse_chunk(htmlc->parser_binding,
+				(const uint8_t *) empty_document,
+				SLEN(empty_document));
+		if (err != BINDING_OK) {
+			union content_msg_data msg_data;
+
+			msg_data.error = messages_get("NoMemory");
+			content_broadcast(c, CONTENT_MSG_ERROR, msg_data);
 			return false;
+		}
 	}
 
+	if (htmlc->source_parsed < htmlc->source_received) {
+		/* Finish once the parser has caught up */
+		htmlc->convert_pending = true;
+		html_schedule_parse(htmlc);
+		return true;
+	}
+
+	if (html_convert_document(htmlc) == false) {
+		html_abort_preload(htmlc);
+		return false;
+	}
+
+	return true;
+}
+
+/**
+ * Convert a fully parsed CONTENT_HTML for display.
+ *
+ * \param htmlc  Content to convert
+ * \return true on success, false on failure
+ *
+ * On failure, an error has been broadcast.
+ */
+
+static bool html_convert_document(html_content *htmlc)
+{
+	struct content *c = &htmlc->base;
+	binding_error err;
+	dom_node *html, *head;
+	union content_msg_data msg_data;
+	struct form *f;
+	dom_exception exc; /* returned by libdom functions */
+	dom_string *node_name = NULL;
+
+	/* The parser has seen all the source, so the preload scanner has
+	 * nothing left to find */
+	if (htmlc->preload != NULL)
+		html_preload_stop(htmlc->preload);
+
 	err = binding_parse_completed(htmlc->parser_binding);
 	if (err != BINDING_OK) {
 		union content_msg_data msg_data;
@@ -2077,6 +2313,7 @@ bool html_fetch_object(html_content *c, nsurl *url, struct box *box,
 	object->box = box;
 	object->permitted_types = permitted_types;
 	object->background = background;
+	object->visible = false;
  
 	error = hlcache_handle_retrieve(url, 
 			HLCACHE_RETRIEVE_SNIFF_TYPE, 
@@ -2122,6 +2359,10 @@ static void html_stop(struct content *c)
 		/* Still loading; simply flag that we've been aborted
 		 * html_convert/html_finish_conversion will do the rest */
 		htmlc->aborted = true;
+
+		/* The document won't be displayed, so nothing it would
+		 * have used is wanted */
+		html_abort_preload(htmlc);
 		break;
 	case CONTENT_STATUS_READY:
 		for (object = htmlc->object_list; object != NULL; 
@@ -2313,6 +2554,11 @@ static void html_destroy(struct content *c)
 	if (html->base_url)
 		nsurl_unref(html->base_url);
 
+	schedule_remove(html_parse_callback, html);
+
+	if (html->preload != NULL)
+		html_preload_destroy(html->preload);
+
 	if (html->parser_binding != NULL)
 		binding_destroy_tree(html->parser_binding);
 
@@ -69,6 +69,7 @@ struct content_html_object {
 	/** Bitmap of acceptable content types */
 	content_type permitted_types;
 	bool background;  /**< This object is a background image. */
+	bool visible;  /**< This object has been in a redraw area. */
 };
 
 struct html_scrollbar_data {
@@ -29,6 +29,7 @@
 #include <dom/dom.h>
 
 #include "content/content.h"
+#include "content/fetch.h"
 #include "desktop/browser.h"
 #include "desktop/frames.h"
 #include "desktop/mouse.h"
@@ -571,8 +572,12 @@ void html_mouse_action(struct content *c, struct browser_window *bw,
 				gui_window_save_link(bw->window,
 						nsurl_access(url), title);
 		} else if (mouse & (BROWSER_MOUSE_CLICK_1 |
-				BROWSER_MOUSE_CLICK_2))
+				BROWSER_MOUSE_CLICK_2)) {
 			action = ACTION_GO;
+		} else if (nsoption_bool(preconnect_hover)) {
+			/* The link may well be followed soon */
+			fetch_preconnect(url);
+		}
 
 	} else {
 		bool done = false;
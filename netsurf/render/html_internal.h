@@ -33,6 +33,18 @@ typedef struct html_content {
 
 	/** Parser object handle */
 	void *parser_binding;
+	/** Bytes of source data received */
+	size_t source_received;
+	/** Bytes of source data passed to the parser */
+	size_t source_parsed;
+	/** Bytes of source data passed to the preload scanner */
+	size_t source_preloaded;
+	/** Parsing of received source data is scheduled */
+	bool parse_scheduled;
+	/** Conversion is waiting for parsing to complete */
+	bool convert_pending;
+	/** Preload scanner, or NULL if none */
+	struct html_preload *preload;
 	/** Document tree */
 	dom_document *document;
 	/** Quirkyness of document */
@@ -124,6 +136,62 @@ void html_set_search(struct content *c, struct search_context *s);
 bool html_redraw(struct content *c, struct content_redraw_data *data,
 		const struct rect *clip, const struct redraw_context *ctx);
 
+/* in render/html_preload.c */
+struct html_preload;
+
+/**
+ * Create a preload scanner for a document
+ *
+ * \param c       Document to scan
+ * \param result  Pointer to location to receive scanner
+ * \return NSERROR_OK on success, appropriate error otherwise
+ */
+nserror html_preload_create(html_content *c, struct html_preload **result);
+
+/**
+ * Scan a chunk of source data, starting fetches for any subresources found
+ *
+ * \param preload  Scanner to use
+ * \param data     Source data, in the document's encoding
+ * \param len      Byte length of \a data
+ */
+void html_preload_scan(struct html_preload *preload,
+		const uint8_t *data, size_t len);
+
+/**
+ * Restart scanning from the beginning, in the document's current encoding
+ *
+ * \param preload  Scanner to restart
+ *
+ * Fetches already started are kept, and are not repeated.  A stopped
+ * scanner stays stopped.
+ */
+void html_preload_restart(struct html_preload *preload);
+
+/**
+ * Stop scanning, keeping the fetches already started
+ *
+ * \param preload  Scanner to stop
+ */
+void html_preload_stop(struct html_preload *preload);
+
+/**
+ * Stop scanning, aborting and releasing the fetches already started
+ *
+ * \param preload  Scanner to abort
+ *
+ * Used when the document will not be displayed, so the objects will not
+ * be wanted.  The scanner must still be destroyed.
+ */
+void html_preload_abort(struct html_preload *preload);
+
+/**
+ * Destroy a preload scanner, releasing the objects it fetched
+ *
+ * \param preload  Scanner to destroy
+ */
+void html_preload_destroy(struct html_preload *preload);
+
 /* in render/html_interaction.c */
 void html_mouse_track(struct content *c, struct browser_window *bw,
 			browser_mouse_state mouse, int x, int y);
@@ -0,0 +1,607 @@
+/*
+ * Copyright 2012 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Speculative preloading of HTML subresources (implementation).
+ *
+ * Source data is tokenised as it arrives, ahead of the tree builder, and
+ * fetches are started for the stylesheets and images the document will
+ * need.  The fetches are made through the low-level cache at the priority
+ * the document's real consumers will use; when those consumers request
+ * the same URLs, they pick up the objects already in flight.
+ *
+ * Scanning is driven by the HTML content's parse callback, a step at a
+ * time ahead of the tree builder, and is restarted when the tree builder
+ * discovers the document's encoding differs from that assumed.
+ */
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <hubbub/parser.h>
+
+#include "content/fetch.h"
+#include "content/llcache.h"
+#include "desktop/options.h"
+#include "render/box.h"
+#include "render/html_internal.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+/** Maximum amount of an inline style element to examine for imports */
+#define HTML_PRELOAD_STYLE_MAX 4096
+
+/** Preload scanner context */
+struct html_preload {
+	html_content *html;		/**< Document being scanned */
+	hubbub_parser *parser;		/**< Tokeniser, or NULL once stopped */
+	nsurl *base;			/**< Base URL for relative links */
+
+	bool in_style;			/**< Collecting a style element */
+	char style[HTML_PRELOAD_STYLE_MAX];	/**< Start of style element */
+	size_t style_len;		/**< Byte length of style data */
+
+	llcache_handle **handles;	/**< Preloaded objects */
+	unsigned int count;		/**< Number of preloaded objects */
+	unsigned int alloc;		/**< Allocated size of handles */
+};
+
+/**
+ * Low-level cache callback for preloaded objects
+ *
+ * The data is only wanted by the real consumers, so events are ignored.
+ */
+
+static nserror html_preload_callback(llcache_handle *handle,
+		const llcache_event *event, void *pw)
+{
+	return NSERROR_OK;
+}
+
+/**
+ * Start a fetch of a URL, unless it has already been preloaded
+ *
+ * \param preload   Preload scanner context
+ * \param url       URL to fetch
+ * \param priority  Priority the document's consumer would fetch it at
+ */
+
+static void html_preload_fetch(struct html_preload *preload, nsurl *url,
+		fetch_priority priority)
+{
+	unsigned int i;
+	nserror error;
+
+	for (i = 0; i < preload->count; i++) {
+		if (nsurl_compare(url, llcache_handle_get_url(
+				preload->handles[i]), NSURL_COMPLETE))
+			return;
+	}
+
+	if (fetch_can_fetch(url) == false)
+		return;
+
+	if (preload->count == preload->alloc) {
+		unsigned int alloc = preload->alloc == 0 ? 16 :
+				preload->alloc * 2;
+		llcache_handle **handles;
+
+		handles = realloc(preload->handles,
+				alloc * sizeof(*handles));
+		if (handles == NULL)
+			return;
+
+		preload->handles = handles;
+		preload->alloc = alloc;
+	}
+
+	error = llcache_handle_retrieve(url, 0,
+			content_get_url(&preload->html->base), NULL,
+			priority, html_preload_callback, preload,
+			&preload->handles[preload->count]);
+	if (error != NSERROR_OK)
+		return;
+
+	LOG(("preloading '%s'", nsurl_access(url)));
+
+	preload->count++;
+}
+
+/**
+ * Find an attribute of a tag
+ *
+ * \param tag   Tag to search
+ * \param name  Name of attribute, in lower case
+ * \return Copy of attribute value, or NULL if not present or on memory
+ *         exhaustion.  The client must free the copy.
+ */
+
+static char *html_preload_attribute(const hubbub_tag *tag, const char *name)
+{
+	size_t len = strlen(name);
+	uint32_t i;
+
+	for (i = 0; i < tag->n_attributes; i++) {
+		const hubbub_attribute *attr = &tag->attributes[i];
+		char *value;
+
+		if (attr->name.len != len ||
+				strncmp((const char *) attr->name.ptr,
+						name, len) != 0)
+			continue;
+
+		value = malloc(attr->value.len + 1);
+		if (value != NULL) {
+			memcpy(value, attr->value.ptr, attr->value.len);
+			value[attr->value.len] = '\0';
+		}
+
+		return value;
+	}
+
+	return NULL;
+}
+
+/**
+ * Determine whether a tag has a given name
+ */
+
+static bool html_preload_tag_is(const hubbub_tag *tag, const char *name)
+{
+	size_t len = strlen(name);
+
+	return tag->name.len == len &&
+			strncmp((const char *) tag->name.ptr, name, len) == 0;
+}
+
+/**
+ * Determine whether a stylesheet applies to the media we render for
+ *
+ * \param tag  Link or style tag for the stylesheet
+ * \return true if the stylesheet would be used
+ *
+ * This follows the checks made by html_find_stylesheets().
+ */
+
+static bool html_preload_stylesheet_wanted(const hubbub_tag *tag)
+{
+	char *value;
+	bool wanted = true;
+
+	value = html_preload_attribute(tag, "type");
+	if (value != NULL) {
+		if (strcmp(value, "text/css") != 0)
+			wanted = false;
+		free(value);
+	}
+
+	value = html_preload_attribute(tag, "media");
+	if (value != NULL) {
+		if (strcasestr(value, "screen") == NULL &&
+				strcasestr(value, "all") == NULL)
+			wanted = false;
+		free(value);
+	}
+
+	return wanted;
+}
+
+/**
+ * Handle a base tag
+ */
+
+static void html_preload_base(struct html_preload *preload,
+		const hubbub_tag *tag)
+{
+	char *href;
+	nsurl *url;
+
+	/* As html_process_base(), which only accepts absolute URLs */
+	href = html_preload_attribute(tag, "href");
+	if (href == NULL)
+		return;
+
+	if (nsurl_create(href, &url) == NSERROR_OK) {
+		nsurl_unref(preload->base);
+		preload->base = url;
+	}
+
+	free(href);
+}
+
+/**
+ * Handle a link tag
+ */
+
+static void html_preload_link(struct html_preload *preload,
+		const hubbub_tag *tag)
+{
+	char *rel, *href;
+	nsurl *url;
+
+	/* rel=<space separated list, including 'stylesheet'> */
+	rel = html_preload_attribute(tag, "rel");
+	if (rel == NULL)
+		return;
+
+	if (strcasestr(rel, "stylesheet") == NULL ||
+			strcasestr(rel, "alternate") != NULL) {
+		free(rel);
+		return;
+	}
+
+	free(rel);
+
+	if (html_preload_stylesheet_wanted(tag) == false)
+		return;
+
+	href = html_preload_attribute(tag, "href");
+	if (href == NULL)
+		return;
+
+	if (nsurl_join(preload->base, href, &url) == NSERROR_OK) {
+		html_preload_fetch(preload, url, FETCH_PRIORITY_STYLESHEET);
+		nsurl_unref(url);
+	}
+
+	free(href);
+}
+
+/**
+ * Handle an img tag
+ */
+
+static void html_preload_img(struct html_preload *preload,
+		const hubbub_tag *tag)
+{
+	char *src;
+	nsurl *url = NULL;
+
+	if (nsoption_bool(foreground_images) == false)
+		return;
+
+	src = html_preload_attribute(tag, "src");
+	if (src == NULL)
+		return;
+
+	/* As box construction will */
+	if (box_extract_link(src, preload->base, &url) && url != NULL) {
+		html_preload_fetch(preload, url, FETCH_PRIORITY_NORMAL);
+		nsurl_unref(url);
+	}
+
+	free(src);
+}
+
+/**
+ * Skip whitespace, comments and SGML comment delimiters in CSS
+ *
+ * \param s    Pointer to data
+ * \param end  End of data
+ * \return Pointer to first significant character
+ */
+
+static const char *html_preload_css_skip(const char *s, const char *end)
+{
+	while (s < end) {
+		if (isspace((unsigned char) *s)) {
+			s++;
+		} else if (end - s >= 2 && strncmp(s, "/*", 2) == 0) {
+			for (s += 2; s < end; s++) {
+				if (end - s >= 2 && strncmp(s, "*/", 2) == 0) {
+					s += 2;
+					break;
+				}
+			}
+		} else if (end - s >= 4 && strncmp(s, "<!--", 4) == 0) {
+			s += 4;
+		} else if (end - s >= 3 && strncmp(s, "-->", 3) == 0) {
+			s += 3;
+		} else {
+			break;
+		}
+	}
+
+	return s;
+}
+
+/**
+ * Preload the stylesheets imported by a style element
+ *
+ * Imports must come before any other rules, so only the start of the
+ * element's content is examined.
+ */
+
+static void html_preload_style(struct html_preload *preload)
+{
+	const char *s = preload->style;
+	const char *end = s + preload->style_len;
+
+	s = html_preload_css_skip(s, end);
+
+	if (end - s >= 8 && strncasecmp(s, "@charset", 8) == 0) {
+		while (s < end && *s != ';')
+			s++;
+		if (s < end)
+			s++;
+		s = html_preload_css_skip(s, end);
+	}
+
+	while (end - s >= 7 && strncasecmp(s, "@import", 7) == 0) {
+		const char *href;
+		char quote = '\0';
+		char *copy;
+		nsurl *url;
+
+		s = html_preload_css_skip(s + 7, end);
+
+		if (end - s >= 4 && strncasecmp(s, "url(", 4) == 0) {
+			s = html_preload_css_skip(s + 4, end);
+			quote = ')';
+		}
+
+		if (s < end && (*s == '"' || *s == '\'')) {
+			quote = *s++;
+		} else if (quote == '\0') {
+			/* Not something we understand */
+			return;
+		}
+
+		for (href = s; s < end && *s != quote; s++) {
+			if (quote == ')' && isspace((unsigned char) *s))
+				break;
+		}
+
+		/* Truncated, or an empty URL */
+		if (s == end || s == href)
+			return;
+
+		copy = strndup(href, s - href);
+		if (copy == NULL)
+			return;
+
+		if (nsurl_join(preload->base, copy, &url) == NSERROR_OK) {
+			html_preload_fetch(preload, url,
+					FETCH_PRIORITY_STYLESHEET);
+			nsurl_unref(url);
+		}
+
+		free(copy);
+
+		while (s < end && *s != ';')
+			s++;
+		if (s < end)
+			s++;
+		s = html_preload_css_skip(s, end);
+	}
+}
+
+/**
+ * Hubbub token handler for the preload scanner
+ */
+
+static hubbub_error html_preload_token(const hubbub_token *token, void *pw)
+{
+	struct html_preload *preload = pw;
+	const hubbub_tag *tag = &token->data.tag;
+	hubbub_parser_optparams params;
+
+	switch (token->type) {
+	case HUBBUB_TOKEN_START_TAG:
+		if (html_preload_tag_is(tag, "link")) {
+			html_preload_link(preload, tag);
+		} else if (html_preload_tag_is(tag, "img")) {
+			html_preload_img(preload, tag);
+		} else if (html_preload_tag_is(tag, "base")) {
+			html_preload_base(preload, tag);
+		} else if (html_preload_tag_is(tag, "style")) {
+			preload->in_style =
+					html_preload_stylesheet_wanted(tag);
+			preload->style_len = 0;
+
+			params.content_model.model =
+					HUBBUB_CONTENT_MODEL_CDATA;
+			hubbub_parser_setopt(preload->parser,
+					HUBBUB_PARSER_CONTENT_MODEL, &params);
+		} else if (html_preload_tag_is(tag, "script") ||
+				html_preload_tag_is(tag, "xmp") ||
+				html_preload_tag_is(tag, "iframe") ||
+				html_preload_tag_is(tag, "noembed") ||
+				html_preload_tag_is(tag, "noframes")) {
+			/* Don't mistake their content for markup */
+			params.content_model.model =
+					HUBBUB_CONTENT_MODEL_CDATA;
+			hubbub_parser_setopt(preload->parser,
+					HUBBUB_PARSER_CONTENT_MODEL, &params);
+		} else if (html_preload_tag_is(tag, "title") ||
+				html_preload_tag_is(tag, "textarea")) {
+			params.content_model.model =
+					HUBBUB_CONTENT_MODEL_RCDATA;
+			hubbub_parser_setopt(preload->parser,
+					HUBBUB_PARSER_CONTENT_MODEL, &params);
+		} else if (html_preload_tag_is(tag, "plaintext")) {
+			params.content_model.model =
+					HUBBUB_CONTENT_MODEL_PLAINTEXT;
+			hubbub_parser_setopt(preload->parser,
+					HUBBUB_PARSER_CONTENT_MODEL, &params);
+		}
+		break;
+	case HUBBUB_TOKEN_END_TAG:
+		if (preload->in_style) {
+			html_preload_style(preload);
+			preload->in_style = false;
+		}
+		break;
+	case HUBBUB_TOKEN_CHARACTER:
+		if (preload->in_style) {
+			size_t len = token->data.character.len;
+
+			if (len > sizeof(preload->style) - preload->style_len)
+				len = sizeof(preload->style) -
+						preload->style_len;
+
+			memcpy(preload->style + preload->style_len,
+					token->data.character.ptr, len);
+			preload->style_len += len;
+		}
+		break;
+	case HUBBUB_TOKEN_DOCTYPE:
+	case HUBBUB_TOKEN_COMMENT:
+	case HUBBUB_TOKEN_EOF:
+		break;
+	}
+
+	return HUBBUB_OK;
+}
+
+/**
+ * Start scanning from the beginning of the document
+ *
+ * \param preload  Preload scanner context, which must be stopped
+ * \return NSERROR_OK on success, appropriate error otherwise
+ *
+ * The document's current encoding is used, or detected if unknown.
+ */
+
+static nserror html_preload_start(struct html_preload *preload)
+{
+	html_content *c = preload->html;
+	hubbub_parser_optparams params;
+	hubbub_error error;
+
+	error = hubbub_parser_create(c->encoding, true, ns_realloc, NULL,
+			&preload->parser);
+	if (error != HUBBUB_OK) {
+		preload->parser = NULL;
+		return error == HUBBUB_NOMEM ? NSERROR_NOMEM
+					     : NSERROR_BAD_ENCODING;
+	}
+
+	/* Tokens only: there is no tree to build */
+	params.token_handler.handler = html_preload_token;
+	params.token_handler.pw = preload;
+	error = hubbub_parser_setopt(preload->parser,
+			HUBBUB_PARSER_TOKEN_HANDLER, &params);
+	if (error != HUBBUB_OK) {
+		hubbub_parser_destroy(preload->parser);
+		preload->parser = NULL;
+		return NSERROR_NOMEM;
+	}
+
+	nsurl_unref(preload->base);
+	preload->base = nsurl_ref(content_get_url(&c->base));
+	preload->in_style = false;
+	preload->style_len = 0;
+
+	return NSERROR_OK;
+}
+
+/* See html_internal.h for documentation */
+nserror html_preload_create(html_content *c, struct html_preload **result)
+{
+	struct html_preload *preload;
+	nserror error;
+
+	preload = calloc(1, sizeof(*preload));
+	if (preload == NULL)
+		return NSERROR_NOMEM;
+
+	preload->html = c;
+	preload->base = nsurl_ref(content_get_url(&c->base));
+
+	error = html_preload_start(preload);
+	if (error != NSERROR_OK) {
+		nsurl_unref(preload->base);
+		free(preload);
+		return error;
+	}
+
+	*result = preload;
+
+	return NSERROR_OK;
+}
+
+/* See html_internal.h for documentation */
+void html_preload_scan(struct html_preload *preload,
+		const uint8_t *data, size_t len)
+{
+	if (preload->parser == NULL)
+		return;
+
+	if (hubbub_parser_parse_chunk(preload->parser, data, len) !=
+			HUBBUB_OK) {
+		/* Preloading is only an optimisation, so just give up */
+		html_preload_stop(preload);
+	}
+}
+
+/* See html_internal.h for documentation */
+void html_preload_restart(struct html_preload *preload)
+{
+	/* Only restart a scanner which is still going */
+	if (preload->parser == NULL)
+		return;
+
+	html_preload_stop(preload);
+
+	/* Preloading is only an optimisation, so stay stopped on failure */
+	html_preload_start(preload);
+}
+
+/* See html_internal.h for documentation */
+void html_preload_stop(struct html_preload *preload)
+{
+	if (preload->parser != NULL) {
+		hubbub_parser_destroy(preload->parser);
+		preload->parser = NULL;
+	}
+}
+
+/* See html_internal.h for documentation */
+void html_preload_abort(struct html_preload *preload)
+{
+	unsigned int i;
+
+	html_preload_stop(preload);
+
+	/* Objects shared with the document's consumers are snapshotted by
+	 * the low-level cache, leaving their fetches alone */
+	for (i = 0; i < preload->count; i++) {
+		llcache_handle_abort(preload->handles[i]);
+		llcache_handle_release(preload->handles[i]);
+	}
+
+	preload->count = 0;
+}
+
+/* See html_internal.h for documentation */
+void html_preload_destroy(struct html_preload *preload)
+{
+	unsigned int i;
+
+	html_preload_stop(preload);
+
+	for (i = 0; i < preload->count; i++)
+		llcache_handle_release(preload->handles[i]);
+
+	free(preload->handles);
+	nsurl_unref(preload->base);
+	free(preload);
+}
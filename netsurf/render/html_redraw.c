@@ -97,6 +97,9 @@ static bool html_redraw_text_decoration_inline(struct box *box, int x, int y,
 static bool html_redraw_text_decoration_block(struct box *box, int x, int y,
 		float scale, colour colour, float ratio,
 		const struct redraw_context *ctx);
+static void html_redraw_prioritise_objects(html_content *html,
+		const struct content_redraw_data *data,
+		const struct rect *clip);
 
 bool html_redraw_debug = false;
 
@@ -127,6 +130,11 @@ bool html_redraw(struct content *c, struct content_redraw_data *data,
 	box = html->layout;
 	assert(box);
 
+	/* Objects still being fetched which are now on screen should be
+	 * fetched ahead of the rest */
+	if (ctx->interactive && html->base.active > 0)
+		html_redraw_prioritise_objects(html, data, clip);
+
 	/* The select menu needs special treating because, when opened, it
 	 * reaches beyond its layout box.
 	 */
@@ -173,6 +181,48 @@ bool html_redraw(struct content *c, struct content_redraw_data *data,
 
 }
 
+/**
+ * Raise the fetch priority of objects which appear in a redraw area
+ *
+ * \param  html  html content being redrawn
+ * \param  data  redraw data for this content redraw
+ * \param  clip  current clip region, in target coordinates
+ */
+
+void html_redraw_prioritise_objects(html_content *html,
+		const struct content_redraw_data *data,
+		const struct rect *clip)
+{
+	struct content_html_object *object;
+	struct rect r;
+	int x, y;
+
+	for (object = html->object_list; object != NULL;
+			object = object->next) {
+		struct box *box = object->box;
+
+		if (object->content == NULL || box == NULL || object->visible)
+			continue;
+
+		box_coords(box, &x, &y);
+
+		r.x0 = data->x + x * data->scale;
+		r.y0 = data->y + y * data->scale;
+		r.x1 = r.x0 + (box->padding[LEFT] + box->width +
+				box->padding[RIGHT]) * data->scale;
+		r.y1 = r.y0 + (box->padding[TOP] + box->height +
+				box->padding[BOTTOM]) * data->scale;
+
+		if (r.x1 < clip->x0 || r.y1 < clip->y0 ||
+				clip->x1 < r.x0 || clip->y1 < r.y0)
+			continue;
+
+		object->visible = true;
+		hlcache_handle_set_priority(object->content,
+				FETCH_PRIORITY_VISIBLE);
+	}
+}
+
 /**
  * Determine if a box has a background that needs drawing
  *
@@ -0,0 +1,289 @@
+#define _XOPEN_SOURCE 700
+
+#include <assert.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+
+#include "content/backing_store.h"
+#include "desktop/netsurf.h"
+#include "utils/log.h"
+#include "utils/nsurl.h"
+#include "utils/utils.h"
+
+/* desktop/netsurf.h */
+bool verbose_log = true;
+
+/* Number of URLs used by the tests */
+#define TEST_URLS 16
+
+static char store_path[] = "/tmp/nsbstoreXXXXXX";
+static nsurl *urls[TEST_URLS];
+
+static int passed = 0;
+static int count = 0;
+
+static void check(bool ok, const char *what)
+{
+	if (ok) {
+		LOG(("\tPASS: %s", what));
+		passed++;
+	} else {
+		LOG(("\tFAIL: %s", what));
+	}
+	count++;
+}
+
+/**
+ * Reference FNV-1a, which the store identifiers must match
+ */
+static uint32_t fnv1a(const char *s)
+{
+	uint32_t hash = 0x811c9dc5;
+
+	while (*s != '\0') {
+		hash ^= (uint8_t) *s++;
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+static void item_fname(int i, char kind, char *buf, size_t len)
+{
+	uint32_t ident = fnv1a(nsurl_access(urls[i]));
+
+	snprintf(buf, len, "%s/%c/%02x/%08x", store_path, kind,
+			ident & 0xff, ident);
+}
+
+static void init(size_t limit, size_t hysteresis, time_t max_age)
+{
+	struct backing_store_parameters params;
+
+	params.path = store_path;
+	params.limit = limit;
+	params.hysteresis = hysteresis;
+	params.max_age = max_age;
+
+	assert(backing_store_initialise(&params) == NSERROR_OK);
+}
+
+static void store(int i, size_t len)
+{
+	static uint8_t data[512];
+
+	assert(len <= sizeof(data));
+	memset(data, i, len);
+
+	assert(backing_store_store(urls[i], BACKING_STORE_NONE,
+			data, len) == NSERROR_OK);
+}
+
+/* Whether URL i is in the store with size len (which refreshes it) */
+static bool present(int i, size_t len)
+{
+	uint8_t *data;
+	size_t size;
+	bool ok;
+
+	if (backing_store_fetch(urls[i], BACKING_STORE_NONE,
+			&data, &size) != NSERROR_OK)
+		return false;
+
+	ok = size == len && (len == 0 || data[len - 1] == i);
+	free(data);
+
+	return ok;
+}
+
+static int remove_item(const char *fpath, const struct stat *sb,
+		int typeflag, struct FTW *ftwbuf)
+{
+	return remove(fpath);
+}
+
+static void empty_store(void)
+{
+	nftw(store_path, remove_item, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void test_ident(void)
+{
+	struct stat st;
+	char fname[256];
+	int i;
+
+	LOG(("Testing identifiers"));
+
+	/* Published FNV-1a test vectors */
+	check(fnv1a("") == 0x811c9dc5, "fnv1a(\"\")");
+	check(fnv1a("a") == 0xe40c292c, "fnv1a(\"a\")");
+	check(fnv1a("foobar") == 0xbf9cf968, "fnv1a(\"foobar\")");
+
+	init(64 * 1024, 0, 0);
+
+	for (i = 0; i < 4; i++) {
+		uint8_t meta = 0;
+
+		store(i, 10);
+		assert(backing_store_store(urls[i], BACKING_STORE_META,
+				&meta, 1) == NSERROR_OK);
+
+		item_fname(i, 'd', fname, sizeof(fname));
+		check(stat(fname, &st) == 0 && st.st_size == 10, fname);
+
+		item_fname(i, 'm', fname, sizeof(fname));
+		check(stat(fname, &st) == 0 && st.st_size == 1, fname);
+	}
+
+	assert(backing_store_invalidate(urls[0]) == NSERROR_OK);
+	item_fname(0, 'd', fname, sizeof(fname));
+	check(stat(fname, &st) != 0 && present(0, 10) == false,
+			"invalidate removes items");
+
+	assert(backing_store_finalise() == NSERROR_OK);
+	empty_store();
+}
+
+static void test_evict(void)
+{
+	static uint8_t big[501];
+	int i, n;
+
+	LOG(("Testing eviction"));
+
+	init(1000, 200, 0);
+
+	for (i = 0; i < 10; i++)
+		store(i, 100);
+
+	for (i = 0, n = 0; i < 10; i++)
+		n += present(i, 100) ? 1 : 0;
+	check(n == 10, "store at limit is not evicted");
+
+	/* Exceeding the limit trims to the hysteresis below it */
+	store(10, 100);
+
+	for (i = 0, n = 0; i <= 10; i++)
+		n += present(i, 100) ? 1 : 0;
+	check(n == 8, "eviction trims store to limit less hysteresis");
+
+	/* Which leaves room for more without further eviction */
+	store(11, 100);
+	store(12, 100);
+
+	for (i = 0, n = 0; i <= 12; i++)
+		n += present(i, 100) ? 1 : 0;
+	check(n == 10, "store within hysteresis is not evicted");
+
+	check(backing_store_store(urls[13], BACKING_STORE_NONE,
+			big, sizeof(big)) == NSERROR_SAVE_FAILED,
+			"items over half the limit are refused");
+
+	assert(backing_store_finalise() == NSERROR_OK);
+	empty_store();
+}
+
+static void test_index(void)
+{
+	struct stat st;
+	struct utimbuf times;
+	char fname[256];
+	time_t now = time(NULL);
+	int i;
+
+	LOG(("Testing index"));
+
+	init(1000, 200, 3600);
+
+	for (i = 0; i < 6; i++)
+		store(i, 100);
+
+	assert(backing_store_finalise() == NSERROR_OK);
+
+	snprintf(fname, sizeof(fname), "%s/index", store_path);
+	check(stat(fname, &st) == 0, "finalise writes index");
+
+	init(1000, 200, 3600);
+	check(stat(fname, &st) != 0, "initialise consumes index");
+	for (i = 0; i < 6; i++)
+		check(present(i, 100), "entry read from index");
+	assert(backing_store_finalise() == NSERROR_OK);
+
+	/* Lose the index, as if the browser had crashed, and age the
+	 * items so their order of use is known */
+	unlink(fname);
+
+	for (i = 0; i < 6; i++) {
+		times.actime = times.modtime = now - 100 * (6 - i);
+		if (i == 5)
+			times.actime = times.modtime = now - 7200;
+
+		item_fname(i, 'd', fname, sizeof(fname));
+		assert(utime(fname, &times) == 0);
+	}
+
+	init(1000, 200, 3600);
+
+	/* Item 5 has exceeded the maximum age; 0 to 4 total 500 bytes.
+	 * Taking the store to 1050 bytes must evict the three least
+	 * recently used items to get within 800 */
+	store(6, 450);
+	store(7, 100);
+
+	check(present(5, 100) == false, "expired item discarded");
+	for (i = 0; i < 3; i++)
+		check(present(i, 100) == false, "oldest item evicted");
+	for (i = 3; i < 5; i++)
+		check(present(i, 100), "rebuilt item kept");
+	check(present(6, 450) && present(7, 100), "new items kept");
+
+	item_fname(0, 'd', fname, sizeof(fname));
+	check(stat(fname, &st) != 0, "evicted item removed from disc");
+
+	assert(backing_store_finalise() == NSERROR_OK);
+	empty_store();
+}
+
+/**
+ * Test backing store
+ */
+int main(int argc, char **argv)
+{
+	char url[64];
+	int i;
+
+	for (i = 0; i < TEST_URLS; i++) {
+		snprintf(url, sizeof(url), "http://www.example.org/%d", i);
+		assert(nsurl_create(url, &urls[i]) == NSERROR_OK);
+	}
+
+	if (mkdtemp(store_path) == NULL) {
+		LOG(("Failed to create %s", store_path));
+		return 1;
+	}
+
+	test_ident();
+	test_evict();
+	test_index();
+
+	rmdir(store_path);
+
+	for (i = 0; i < TEST_URLS; i++)
+		nsurl_unref(urls[i]);
+
+	if (passed == count) {
+		LOG(("Testing complete: SUCCESS"));
+	} else {
+		LOG(("Testing complete: FAILURE"));
+		LOG(("Failed %d out of %d", count - passed, count));
+	}
+
+	return passed == count ? 0 : 1;
+}
@@ -0,0 +1,308 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "desktop/netsurf.h"
+#include "utils/chunkbuf.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+/* desktop/netsurf.h */
+bool verbose_log = true;
+
+static int passed = 0;
+static int count = 0;
+
+static void check(bool ok, const char *what)
+{
+	if (ok) {
+		LOG(("\tPASS: %s", what));
+		passed++;
+	} else {
+		LOG(("\tFAIL: %s", what));
+	}
+	count++;
+}
+
+/* Reference data, which buffers hold a prefix of */
+static uint8_t pattern[256 * 1024];
+
+/**
+ * Check a buffer holds the reference data from an offset, by walking it
+ * a span at a time
+ */
+static bool contents(struct chunkbuf *buf, size_t from, size_t len)
+{
+	const uint8_t *span;
+	size_t offset = 0, slen;
+
+	if (buf->len != len)
+		return false;
+
+	while ((span = chunkbuf_span(buf, offset, &slen)) != NULL) {
+		if (slen == 0 || offset + slen > len ||
+				memcmp(span, pattern + from + offset,
+				slen) != 0)
+			return false;
+		offset += slen;
+	}
+
+	return offset == len;
+}
+
+/* Number of spans making up a buffer */
+static unsigned int spans(struct chunkbuf *buf)
+{
+	size_t offset = 0, slen;
+	unsigned int n = 0;
+
+	while (chunkbuf_span(buf, offset, &slen) != NULL) {
+		offset += slen;
+		n++;
+	}
+
+	return n;
+}
+
+static void test_append(void)
+{
+	struct chunkbuf buf, copy;
+	size_t len;
+	int i;
+
+	LOG(("Testing append"));
+
+	memset(&buf, 0, sizeof(buf));
+
+	check(chunkbuf_span(&buf, 0, &len) == NULL, "empty buffer");
+	check(chunkbuf_flatten(&buf) == NULL, "flatten empty buffer");
+
+	/* Small appends fill the unshared tail chunk */
+	for (i = 0; i < 100; i++)
+		assert(chunkbuf_append(&buf, pattern + i * 10,
+				10) == NSERROR_OK);
+	check(contents(&buf, 0, 1000) && spans(&buf) == 1,
+			"append to unshared tail");
+
+	/* Appending to a shared tail must not be visible in the copy */
+	memset(&copy, 0, sizeof(copy));
+	assert(chunkbuf_share(&buf, &copy) == NSERROR_OK);
+	check(contents(&copy, 0, 1000), "share");
+
+	assert(chunkbuf_append(&buf, pattern + 1000, 1000) == NSERROR_OK);
+	check(contents(&buf, 0, 2000) && spans(&buf) == 2,
+			"append to shared tail");
+	check(contents(&copy, 0, 1000), "copy unchanged by append");
+
+	assert(chunkbuf_append(&copy, pattern + 1000, 500) == NSERROR_OK);
+	check(contents(&copy, 0, 1500) && contents(&buf, 0, 2000),
+			"append to copy");
+
+	/* The copy keeps the chunks it shares once the original is gone */
+	chunkbuf_finalise(&buf);
+	check(buf.len == 0 && buf.count == 0, "finalise");
+	check(contents(&copy, 0, 1500), "copy outlives original");
+
+	chunkbuf_finalise(&copy);
+
+	/* Large appends are split no more than necessary */
+	memset(&buf, 0, sizeof(buf));
+	assert(chunkbuf_append(&buf, pattern, 10) == NSERROR_OK);
+	assert(chunkbuf_append(&buf, pattern + 10,
+			sizeof(pattern) - 10) == NSERROR_OK);
+	check(contents(&buf, 0, sizeof(pattern)) && spans(&buf) == 2,
+			"large append");
+
+	chunkbuf_trim(&buf);
+	check(contents(&buf, 0, sizeof(pattern)), "trim");
+
+	chunkbuf_finalise(&buf);
+}
+
+/* Number of times each test block has been released */
+static int released[2];
+
+static void release_block(void *data, size_t len, void *pw)
+{
+	int *which = pw;
+
+	released[*which]++;
+}
+
+static void test_share(void)
+{
+	static int which[2] = { 0, 1 };
+	struct chunkbuf buf, copy;
+
+	LOG(("Testing sharing"));
+
+	memset(&buf, 0, sizeof(buf));
+	memset(&copy, 0, sizeof(copy));
+	memset(released, 0, sizeof(released));
+
+	assert(chunkbuf_adopt_block(&buf, pattern, 100,
+			release_block, &which[0]) == NSERROR_OK);
+	assert(chunkbuf_adopt_block(&buf, pattern + 100, 100,
+			release_block, &which[1]) == NSERROR_OK);
+	check(contents(&buf, 0, 200) && spans(&buf) == 2, "adopt_block");
+
+	check(chunkbuf_adopt_block(&buf, pattern, 0, release_block,
+			&which[0]) == NSERROR_OK && released[0] == 1 &&
+			buf.len == 200, "adopt empty block");
+	released[0] = 0;
+
+	assert(chunkbuf_share(&buf, &copy) == NSERROR_OK);
+
+	/* Discarding a whole chunk from one buffer leaves the other's */
+	chunkbuf_discard(&buf, 150);
+	check(contents(&buf, 150, 50) && released[0] == 0,
+			"discard shared chunk");
+
+	chunkbuf_discard(&copy, 100);
+	check(contents(&copy, 100, 100) && released[0] == 1,
+			"discard releases unused chunk");
+
+	/* Partial discard keeps the chunk */
+	chunkbuf_discard(&copy, 10);
+	check(contents(&copy, 110, 90) && released[1] == 0,
+			"partial discard");
+
+	chunkbuf_finalise(&buf);
+	check(released[1] == 0, "chunk kept while shared");
+
+	chunkbuf_discard(&copy, 1000);
+	check(copy.len == 0 && released[1] == 1,
+			"discard everything");
+
+	chunkbuf_finalise(&copy);
+	check(released[0] == 1 && released[1] == 1, "released once");
+}
+
+static void test_flatten(void)
+{
+	static int which[2] = { 0, 1 };
+	struct chunkbuf buf, copy;
+	const uint8_t *data;
+	uint8_t *block;
+	size_t len;
+
+	LOG(("Testing flatten"));
+
+	memset(&buf, 0, sizeof(buf));
+	memset(&copy, 0, sizeof(copy));
+	memset(released, 0, sizeof(released));
+
+	/* Single chunk needs no work */
+	assert(chunkbuf_append(&buf, pattern, 100) == NSERROR_OK);
+	data = chunkbuf_span(&buf, 0, &len);
+	check(chunkbuf_flatten(&buf) == data, "flatten single chunk");
+
+	/* Unshared chunks are coalesced in place */
+	block = malloc(1000);
+	assert(block != NULL);
+	memcpy(block, pattern + 100, 1000);
+	assert(chunkbuf_adopt(&buf, block, 1000) == NSERROR_OK);
+	assert(chunkbuf_adopt_block(&buf, pattern + 1100, 100,
+			release_block, &which[0]) == NSERROR_OK);
+	check(spans(&buf) == 3, "adopt");
+
+	data = chunkbuf_flatten(&buf);
+	check(data != NULL && memcmp(data, pattern, 1200) == 0 &&
+			spans(&buf) == 1 && contents(&buf, 0, 1200) &&
+			released[0] == 1, "flatten with refcnt 1");
+
+	/* Shared chunks are copied, leaving the other buffer alone */
+	assert(chunkbuf_append(&buf, pattern + 1200, 100) == NSERROR_OK);
+	assert(chunkbuf_adopt_block(&buf, pattern + 1300, 100,
+			release_block, &which[1]) == NSERROR_OK);
+	assert(chunkbuf_share(&buf, &copy) == NSERROR_OK);
+
+	data = chunkbuf_flatten(&copy);
+	check(data != NULL && memcmp(data, pattern, 1400) == 0 &&
+			spans(&copy) == 1 && released[1] == 0,
+			"flatten with refcnt > 1");
+	check(contents(&buf, 0, 1400) && spans(&buf) == 3,
+			"sharer unchanged by flatten");
+
+	/* Flattening a discarded buffer must skip the discarded data */
+	chunkbuf_discard(&buf, 50);
+	data = chunkbuf_flatten(&buf);
+	check(data != NULL && memcmp(data, pattern + 50, 1350) == 0 &&
+			released[1] == 1, "flatten after discard");
+
+	chunkbuf_finalise(&buf);
+	chunkbuf_finalise(&copy);
+}
+
+static void test_span(void)
+{
+	struct chunkbuf buf;
+	const uint8_t *data;
+	size_t len;
+	bool ok = true;
+	int i;
+
+	LOG(("Testing spans"));
+
+	memset(&buf, 0, sizeof(buf));
+
+	for (i = 0; i < 8; i++) {
+		uint8_t *block = malloc(100);
+
+		assert(block != NULL);
+		memcpy(block, pattern + i * 100, 100);
+		assert(chunkbuf_adopt(&buf, block, 100) == NSERROR_OK);
+	}
+
+	/* Forwards, backwards and within a chunk */
+	for (i = 0; i < 800; i += 7) {
+		data = chunkbuf_span(&buf, i, &len);
+		ok &= data != NULL && *data == pattern[i] &&
+				len == 100 - (size_t) i % 100;
+	}
+	check(ok, "span forwards");
+
+	for (i = 799; i >= 0; i -= 13) {
+		data = chunkbuf_span(&buf, i, &len);
+		ok &= data != NULL && *data == pattern[i] &&
+				len == 100 - (size_t) i % 100;
+	}
+	check(ok, "span backwards");
+
+	check(chunkbuf_span(&buf, 800, &len) == NULL, "span past end");
+
+	/* Offsets are relative to the start once data is discarded */
+	chunkbuf_discard(&buf, 250);
+	data = chunkbuf_span(&buf, 0, &len);
+	check(data != NULL && *data == pattern[250] && len == 50,
+			"span after discard");
+	check(contents(&buf, 250, 550), "span walk after discard");
+
+	chunkbuf_finalise(&buf);
+}
+
+/**
+ * Test chunked buffers
+ */
+int main(int argc, char **argv)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(pattern); i++)
+		pattern[i] = (i * 7 + i / 251) & 0xff;
+
+	test_append();
+	test_share();
+	test_flatten();
+	test_span();
+
+	if (passed == count) {
+		LOG(("Testing complete: SUCCESS"));
+	} else {
+		LOG(("Testing complete: FAILURE"));
+		LOG(("Failed %d out of %d", count - passed, count));
+	}
+
+	return passed == count ? 0 : 1;
+}
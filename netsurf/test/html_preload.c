@@ -0,0 +1,427 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "content/fetch.h"
+#include "content/llcache.h"
+#include "desktop/netsurf.h"
+#include "desktop/options.h"
+#include "render/box.h"
+#include "render/html_internal.h"
+#include "utils/log.h"
+#include "utils/nsurl.h"
+#include "utils/utils.h"
+
+/* desktop/netsurf.h */
+bool verbose_log = true;
+
+/* desktop/options.h -- only foreground_images is consulted */
+struct ns_options nsoptions;
+
+/* utils/utils.h -- the rest of utils.c pulls in too much */
+void *ns_realloc(void *ptr, size_t size, void *pw)
+{
+	if (size == 0) {
+		free(ptr);
+		return NULL;
+	}
+
+	return realloc(ptr, size);
+}
+
+/* Document being scanned */
+static nsurl *doc_url;
+
+/* content/content.h */
+nsurl *content_get_url(struct content *c)
+{
+	return doc_url;
+}
+
+/* content/fetch.h */
+bool fetch_can_fetch(const nsurl *url)
+{
+	const char *s = nsurl_access((nsurl *) url);
+
+	return strncmp(s, "http:", 5) == 0 || strncmp(s, "https:", 6) == 0;
+}
+
+/* render/box.h -- as box_extract_link(), less the whitespace handling */
+bool box_extract_link(const char *rel, nsurl *base, nsurl **result)
+{
+	if (nsurl_join(base, rel, result) != NSERROR_OK)
+		*result = NULL;
+
+	return true;
+}
+
+/* content/llcache.h -- handles record the fetches made */
+struct llcache_handle {
+	nsurl *url;
+	fetch_priority priority;
+};
+
+#define MAX_FETCHES 256
+
+static struct llcache_handle *fetched[MAX_FETCHES];
+static unsigned int fetched_count;
+static unsigned int aborted_count;
+static unsigned int released_count;
+
+nserror llcache_handle_retrieve(nsurl *url, uint32_t flags, nsurl *referer,
+		const llcache_post_data *post, fetch_priority priority,
+		llcache_handle_callback cb, void *pw,
+		llcache_handle **result)
+{
+	struct llcache_handle *handle;
+
+	assert(fetched_count < MAX_FETCHES);
+
+	handle = malloc(sizeof(*handle));
+	assert(handle != NULL);
+
+	handle->url = nsurl_ref(url);
+	handle->priority = priority;
+
+	fetched[fetched_count++] = handle;
+	*result = handle;
+
+	return NSERROR_OK;
+}
+
+nserror llcache_handle_abort(llcache_handle *handle)
+{
+	aborted_count++;
+
+	return NSERROR_OK;
+}
+
+nserror llcache_handle_release(llcache_handle *handle)
+{
+	nsurl_unref(handle->url);
+	free(handle);
+	released_count++;
+
+	return NSERROR_OK;
+}
+
+nsurl *llcache_handle_get_url(const llcache_handle *handle)
+{
+	return handle->url;
+}
+
+static int passed = 0;
+static int count = 0;
+
+static void check(bool ok, const char *what)
+{
+	if (ok) {
+		LOG(("\tPASS: %s", what));
+		passed++;
+	} else {
+		LOG(("\tFAIL: %s", what));
+	}
+	count++;
+}
+
+struct fetch_wanted {
+	const char *url;
+	fetch_priority priority;
+};
+
+struct test {
+	const char *name;
+	const char *encoding;		/**< Document encoding, or NULL */
+	const char *data;		/**< Document source */
+	struct fetch_wanted wanted[6];	/**< Fetches, in order, then NULL */
+};
+
+#define DOC "http://www.example.org/dir/"
+#define S FETCH_PRIORITY_STYLESHEET
+#define N FETCH_PRIORITY_NORMAL
+
+static const struct test tests[] = {
+	{ "link and img", NULL,
+	  "<html><head><link rel=stylesheet href=a.css>"
+	  "<link rel=\"Alternate Stylesheet\" href=alt.css>"
+	  "<link rel=icon href=favicon.ico>"
+	  "<link rel=stylesheet media=print href=print.css>"
+	  "<link rel=stylesheet media=\"screen, print\" href=screen.css>"
+	  "<link rel=stylesheet type=text/plain href=plain.css>"
+	  "</head><body><img src='/i.png'><img alt=none>",
+	  { { DOC "a.css", S }, { DOC "screen.css", S },
+	    { "http://www.example.org/i.png", N } } },
+
+	{ "base href", NULL,
+	  "<img src=before.png>"
+	  "<base target=_blank><img src=nohref.png>"
+	  "<base href=\"http://cdn.example.com/x/\"><img src=abs.png>"
+	  "<link rel=stylesheet href=../s.css>",
+	  { { DOC "before.png", N }, { DOC "nohref.png", N },
+	    { "http://cdn.example.com/x/abs.png", N },
+	    { "http://cdn.example.com/s.css", S } } },
+
+	{ "declared charset", "ISO-8859-7",
+	  "<img src=\"\xe1.png\">",
+	  { { DOC "%CE%B1.png", N } } },
+
+	{ "script raw text", NULL,
+	  "<script>document.write('<img src=\"no.png\">');"
+	  "if (a<b) x = '<link rel=stylesheet href=no.css>';</script>"
+	  "<img src=yes.png>",
+	  { { DOC "yes.png", N } } },
+
+	{ "other raw text", NULL,
+	  "<title><img src=no.png></title>"
+	  "<textarea><img src=no.png></textarea>"
+	  "<xmp><img src=no.png></xmp>"
+	  "<noframes><img src=no.png></noframes>"
+	  "<img src=yes.png>"
+	  "<plaintext><img src=no.png>",
+	  { { DOC "yes.png", N } } },
+
+	{ "style imports", NULL,
+	  "<style><!-- @charset \"utf-8\"; /* c */ @import \"i1.css\";"
+	  "@import url( 'i2.css' ) screen; @import url(i3.css);"
+	  "p { background: url(no.png) } @import \"late.css\"; --></style>"
+	  "<style media=print>@import \"print.css\";</style>"
+	  "<style>p { color: red }</style><img src=after.png>",
+	  { { DOC "i1.css", S }, { DOC "i2.css", S }, { DOC "i3.css", S },
+	    { DOC "after.png", N } } },
+
+	{ "duplicate URLs", NULL,
+	  "<img src=d.png><img src=\"d.png\"><img src=./d.png>"
+	  "<img src=d.png#frag><link rel=stylesheet href=d.png>"
+	  "<link rel=stylesheet href=d.css><style>@import 'd.css';</style>"
+	  "<img src=" DOC "d.png>",
+	  { { DOC "d.png", N }, { DOC "d.css", S } } },
+
+	{ "unfetchable URLs", NULL,
+	  "<img src=\"javascript:void(0)\"><img src=\"mailto:a@b\">"
+	  "<img src=ok.png>",
+	  { { DOC "ok.png", N } } },
+};
+
+/**
+ * Scan a document, checking the fetches made
+ *
+ * \param t     Test to run
+ * \param step  Size of chunks to pass to the scanner
+ */
+
+static void run_test(const struct test *t, size_t step)
+{
+	static html_content html;
+	struct html_preload *preload;
+	size_t len = strlen(t->data), i;
+	unsigned int n;
+	bool ok = true;
+	char what[80];
+
+	memset(&html, 0, sizeof(html));
+	html.encoding = (char *) t->encoding;
+
+	fetched_count = released_count = 0;
+
+	assert(html_preload_create(&html, &preload) == NSERROR_OK);
+
+	for (i = 0; i < len; i += step) {
+		html_preload_scan(preload, (const uint8_t *) t->data + i,
+				len - i < step ? len - i : step);
+	}
+
+	for (n = 0; t->wanted[n].url != NULL; n++) {
+		if (n >= fetched_count) {
+			LOG(("\tmissing %s", t->wanted[n].url));
+			ok = false;
+		} else if (strcmp(nsurl_access(fetched[n]->url),
+				t->wanted[n].url) != 0 ||
+				fetched[n]->priority != t->wanted[n].priority) {
+			LOG(("\tfetched %s at %d, wanted %s at %d",
+					nsurl_access(fetched[n]->url),
+					fetched[n]->priority,
+					t->wanted[n].url,
+					t->wanted[n].priority));
+			ok = false;
+		}
+	}
+
+	for (; n < fetched_count; n++) {
+		LOG(("\tunexpected %s", nsurl_access(fetched[n]->url)));
+		ok = false;
+	}
+
+	html_preload_destroy(preload);
+
+	snprintf(what, sizeof(what), "%s (%u byte chunks)", t->name,
+			(unsigned int) step);
+	check(ok && released_count == fetched_count, what);
+}
+
+static void test_many(void)
+{
+	static html_content html;
+	struct html_preload *preload;
+	char img[64];
+	bool ok = true;
+	int i;
+
+	LOG(("Testing many URLs"));
+
+	memset(&html, 0, sizeof(html));
+	fetched_count = released_count = 0;
+
+	assert(html_preload_create(&html, &preload) == NSERROR_OK);
+
+	for (i = 0; i < 200; i++) {
+		snprintf(img, sizeof(img), "<img src=%d.png><img src=%d.png>",
+				i, i / 2);
+		html_preload_scan(preload, (const uint8_t *) img, strlen(img));
+	}
+
+	for (i = 0; i < 200; i++) {
+		snprintf(img, sizeof(img), DOC "%d.png", i);
+		ok &= i < (int) fetched_count &&
+				strcmp(nsurl_access(fetched[i]->url), img) == 0;
+	}
+	check(ok && fetched_count == 200, "each URL fetched once");
+
+	html_preload_destroy(preload);
+	check(released_count == 200, "all fetches released");
+}
+
+static void test_detect(void)
+{
+	static html_content html;
+	struct html_preload *preload;
+	const char *data;
+
+	LOG(("Testing encoding detection"));
+
+	memset(&html, 0, sizeof(html));
+	fetched_count = released_count = 0;
+
+	assert(html_preload_create(&html, &preload) == NSERROR_OK);
+
+	/* Detection only examines the first chunk, as for the tree builder,
+	 * which restarts the scanner if it finds the encoding later on */
+	data = "<meta charset=\"iso-8859-7\"><img src=\"\xe1.png\">";
+	html_preload_scan(preload, (const uint8_t *) data, strlen(data));
+	check(fetched_count == 1 && strcmp(nsurl_access(fetched[0]->url),
+			DOC "%CE%B1.png") == 0, "meta charset");
+
+	html_preload_destroy(preload);
+}
+
+static void test_restart(void)
+{
+	static html_content html;
+	struct html_preload *preload;
+	const char *data;
+
+	LOG(("Testing restart"));
+
+	memset(&html, 0, sizeof(html));
+	html.encoding = (char *) "Windows-1252";
+	fetched_count = released_count = 0;
+
+	assert(html_preload_create(&html, &preload) == NSERROR_OK);
+
+	data = "<base href=\"http://cdn.example.com/\">"
+			"<img src=\"\xe1.png\"><script>";
+	html_preload_scan(preload, (const uint8_t *) data, strlen(data));
+	check(fetched_count == 1 && strcmp(nsurl_access(fetched[0]->url),
+			"http://cdn.example.com/%C3%A1.png") == 0,
+			"fetch in initial encoding");
+
+	/* As the tree builder finding a later meta charset */
+	html.encoding = (char *) "ISO-8859-7";
+	html_preload_restart(preload);
+
+	data = "<img src=\"\xe1.png\"><img src=b.png>";
+	html_preload_scan(preload, (const uint8_t *) data, strlen(data));
+	check(fetched_count == 3 && strcmp(nsurl_access(fetched[1]->url),
+			DOC "%CE%B1.png") == 0 &&
+			strcmp(nsurl_access(fetched[2]->url),
+			DOC "b.png") == 0,
+			"restart uses new encoding, base and content model");
+
+	html_preload_stop(preload);
+	html_preload_restart(preload);
+
+	data = "<img src=c.png>";
+	html_preload_scan(preload, (const uint8_t *) data, strlen(data));
+	check(fetched_count == 3, "stopped scanner stays stopped");
+
+	html_preload_destroy(preload);
+	check(released_count == 3, "fetches kept until destroyed");
+}
+
+static void test_abort(void)
+{
+	static html_content html;
+	struct html_preload *preload;
+	const char *data;
+
+	LOG(("Testing abort"));
+
+	memset(&html, 0, sizeof(html));
+	fetched_count = aborted_count = released_count = 0;
+
+	assert(html_preload_create(&html, &preload) == NSERROR_OK);
+
+	data = "<link rel=stylesheet href=a.css><img src=b.png>";
+	html_preload_scan(preload, (const uint8_t *) data, strlen(data));
+	check(fetched_count == 2 && aborted_count == 0, "fetches started");
+
+	/* As the user stopping the document, or its conversion failing */
+	html_preload_abort(preload);
+	check(aborted_count == 2 && released_count == 2,
+			"abort aborts and releases fetches");
+
+	data = "<img src=c.png>";
+	html_preload_scan(preload, (const uint8_t *) data, strlen(data));
+	check(fetched_count == 2, "aborted scanner stops scanning");
+
+	html_preload_destroy(preload);
+	check(aborted_count == 2 && released_count == 2,
+			"destroy after abort releases nothing more");
+}
+
+/**
+ * Test HTML preload scanner
+ */
+int main(int argc, char **argv)
+{
+	static const size_t steps[] = { 4096, 7, 1 };
+	unsigned int i, j;
+
+	assert(nsurl_create("http://www.example.org/dir/page.html",
+			&doc_url) == NSERROR_OK);
+
+	nsoptions.foreground_images = true;
+
+	LOG(("Testing documents"));
+
+	for (i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+		for (j = 0; j < sizeof(steps) / sizeof(steps[0]); j++)
+			run_test(&tests[i], steps[j]);
+	}
+
+	test_many();
+	test_detect();
+	test_restart();
+	test_abort();
+
+	nsurl_unref(doc_url);
+
+	if (passed == count) {
+		LOG(("Testing complete: SUCCESS"));
+	} else {
+		LOG(("Testing complete: FAILURE"));
+		LOG(("Failed %d out of %d", count - passed, count));
+	}
+
+	return passed == count ? 0 : 1;
+}
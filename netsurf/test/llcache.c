@@ -1,11 +1,16 @@
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
 
 #include <curl/curl.h>
 
 #include "content/fetch.h"
 #include "content/llcache.h"
+#include "desktop/options.h"
 #include "utils/ring.h"
 #include "utils/nsurl.h"
 #include "utils/schedule.h"
@@ -47,20 +52,69 @@ char *filename_from_path(char *path)
 	return strdup(leafname);
 }
 
+/* Maximum number of scheduled callbacks */
+#define SCHEDULE_SLOTS 16
+
+static struct {
+	schedule_callback_fn cb;
+	void *pw;
+	struct timeval when;
+} scheduled[SCHEDULE_SLOTS];
+
 /* utils/schedule.h */
-void schedule(int t, schedule_callback_fn cb, void *pw)
+void schedule_remove(schedule_callback_fn cb, void *pw)
 {
+	int i;
+
+	for (i = 0; i < SCHEDULE_SLOTS; i++) {
+		if (scheduled[i].cb == cb && scheduled[i].pw == pw)
+			scheduled[i].cb = NULL;
+	}
 }
 
 /* utils/schedule.h */
-void schedule_remove(schedule_callback_fn cb, void *pw)
+void schedule(int t, schedule_callback_fn cb, void *pw)
 {
+	struct timeval delay = { t / 100, (t % 100) * 10000 };
+	struct timeval now;
+	int i;
+
+	schedule_remove(cb, pw);
+
+	for (i = 0; i < SCHEDULE_SLOTS; i++) {
+		if (scheduled[i].cb == NULL) {
+			gettimeofday(&now, NULL);
+			timeradd(&now, &delay, &scheduled[i].when);
+			scheduled[i].cb = cb;
+			scheduled[i].pw = pw;
+			return;
+		}
+	}
+}
+
+/* Run any scheduled callbacks which are due */
+void schedule_run(void)
+{
+	struct timeval now;
+	schedule_callback_fn cb;
+	int i;
+
+	gettimeofday(&now, NULL);
+
+	for (i = 0; i < SCHEDULE_SLOTS; i++) {
+		if (scheduled[i].cb != NULL &&
+				timercmp(&scheduled[i].when, &now, <=)) {
+			cb = scheduled[i].cb;
+			scheduled[i].cb = NULL;
+			cb(scheduled[i].pw);
+		}
+	}
 }
 
 /* content/fetch.h */
 const char *fetch_filetype(const char *unix_path)
 {
-	return NULL;
+	return "application/octet-stream";
 }
 
 /* content/fetch.h */
@@ -69,6 +123,17 @@ char *fetch_mimetype(const char *ro_path)
 	return NULL;
 }
 
+/* utils/utils.h */
+bool path_add_part(char *path, int length, const char *newpart)
+{
+	if (path[strlen(path) - 1] != '/')
+		strncat(path, "/", length);
+
+	strncat(path, newpart, length);
+
+	return true;
+}
+
 /* utils/url.h */
 char *path_to_url(const char *path)
 {
@@ -108,6 +173,7 @@ char *url_to_path(const char *url)
 #include "desktop/cookies.h"
 #include "desktop/gui.h"
 #include "desktop/tree.h"
+#include "image/image.h"
 
 /* desktop/cookies.h -- used by urldb 
  *
@@ -135,20 +201,23 @@ void bitmap_destroy(void *bitmap)
 {
 }
 
-/* content/fetchers/fetch_file.h -- used by fetcher core
- *
- * Simpler to stub this than haul in all the file fetcher's dependencies
- */
-void fetch_file_register(void)
-{
-}
-
 /* desktop/gui.h -- used by image_cache through about: handler */
 nsurl* gui_get_resource_url(const char *path)
 {
 	return NULL;
 }
 
+/* image/image.h -- used by image_cache
+ *
+ * image_cache plots converted bitmaps, but nothing is ever redrawn here.
+ */
+bool image_bitmap_plot(struct bitmap *bitmap,
+		struct content_redraw_data *data, const struct rect *clip,
+		const struct redraw_context *ctx)
+{
+	return false;
+}
+
 /******************************************************************************
  * test: protocol handler                                                     *
  ******************************************************************************/
@@ -156,15 +225,23 @@ nsurl* gui_get_resource_url(const char *path)
 typedef struct test_context {
 	struct fetch *parent;
 
+	bool started;
 	bool aborted;
 	bool locked;
 
+	bool stale;		/* Respond with an immediately stale object */
+	bool conditional;	/* Request is a revalidation */
+	struct timeval due;	/* Time at which to respond */
+
 	struct test_context *r_prev;
 	struct test_context *r_next;
 } test_context;
 
 static test_context *ring;
 
+/* Simulated server latency, in ms */
+static int test_latency;
+
 bool test_initialise(lwc_string *scheme)
 {
 	/* Nothing to do */
@@ -176,18 +253,34 @@ void test_finalise(lwc_string *scheme)
 	/* Nothing to do */
 }
 
+bool test_can_fetch(const nsurl *url)
+{
+	return true;
+}
+
 void *test_setup_fetch(struct fetch *parent, nsurl *url, bool only_2xx, 
 		const char *post_urlenc, 
 		const struct fetch_multipart_data *post_multipart, 
 		const char **headers)
 {
 	test_context *ctx = calloc(1, sizeof(test_context));
+	int i;
 
 	if (ctx == NULL)
 		return NULL;
 
 	ctx->parent = parent;
 
+	/* Objects under /stale/ need revalidating as soon as they're
+	 * fetched, and are never modified */
+	ctx->stale = strstr(nsurl_access(url), "/stale/") != NULL;
+
+	for (i = 0; headers != NULL && headers[i] != NULL; i++) {
+		if (strncmp(headers[i], "If-None-Match:", 
+				SLEN("If-None-Match:")) == 0)
+			ctx->conditional = true;
+	}
+
 	RING_INSERT(ring, ctx);
 
 	return ctx;
@@ -195,7 +288,16 @@ void *test_setup_fetch(struct fetch *parent, nsurl *url, bool only_2xx,
 
 bool test_start_fetch(void *handle)
 {
-	/* Nothing to do */
+	test_context *ctx = handle;
+	struct timeval delay = { test_latency / 1000, 
+			(test_latency % 1000) * 1000 };
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	timeradd(&now, &delay, &ctx->due);
+
+	ctx->started = true;
+
 	return true;
 }
 
@@ -217,21 +319,67 @@ void test_free_fetch(void *handle)
 
 void test_process(test_context *ctx)
 {
-	/** \todo Implement */
+	static const char header[] = "Cache-Control: max-age=3600";
+	static const char stale_header[] = "Cache-Control: max-age=0";
+	static const char etag[] = "ETag: \"1\"";
+	static const char data[] = "test data";
+	fetch_msg msg;
+
+	if (ctx->conditional) {
+		fetch_set_http_code(ctx->parent, 304);
+
+		msg.type = FETCH_NOTMODIFIED;
+		fetch_send_callback(&msg, ctx->parent);
+		return;
+	}
+
+	/* Respond with a small, cacheable object */
+	fetch_set_http_code(ctx->parent, 200);
+
+	msg.type = FETCH_HEADER;
+	if (ctx->stale) {
+		msg.data.header_or_data.buf = (const uint8_t *) stale_header;
+		msg.data.header_or_data.len = SLEN(stale_header);
+		fetch_send_callback(&msg, ctx->parent);
+
+		msg.data.header_or_data.buf = (const uint8_t *) etag;
+		msg.data.header_or_data.len = SLEN(etag);
+	} else {
+		msg.data.header_or_data.buf = (const uint8_t *) header;
+		msg.data.header_or_data.len = SLEN(header);
+	}
+	fetch_send_callback(&msg, ctx->parent);
+
+	msg.type = FETCH_DATA;
+	msg.data.header_or_data.buf = (const uint8_t *) data;
+	msg.data.header_or_data.len = SLEN(data);
+	fetch_send_callback(&msg, ctx->parent);
+
+	msg.type = FETCH_FINISHED;
+	fetch_send_callback(&msg, ctx->parent);
 }
 
 void test_poll(lwc_string *scheme)
 {
-	test_context *ctx, *next;
+	test_context *ctx, *next, *last;
+	struct timeval now;
+	bool done;
 
 	if (ring == NULL)
 		return;
 
+	gettimeofday(&now, NULL);
+
+	/* Fetches may be removed from the ring as we go, so determine the
+	 * last one to process up-front */
 	ctx = ring;
+	last = ring->r_prev;
 	do {
 		next = ctx->r_next;
+		done = (ctx == last);
 
-		if (ctx->locked)
+		if (ctx->locked || ctx->started == false ||
+				timercmp(&now, &ctx->due, <))
 			continue;
 
 		if (ctx->aborted == false) {
@@ -240,7 +388,7 @@ void test_poll(lwc_string *scheme)
 
 		fetch_remove_from_queues(ctx->parent);
 		fetch_free(ctx->parent);
-	} while ((ctx = next) != ring && ring != NULL);
+	} while ((ctx = next, done == false));
 }
 
 /******************************************************************************
@@ -274,6 +422,383 @@ nserror event_handler(llcache_handle *handle,
 	return NSERROR_OK;
 }
 
+nserror bench_event_handler(llcache_handle *handle, 
+		const llcache_event *event, void *pw)
+{
+	int *outstanding = pw;
+
+	if (event->type == LLCACHE_EVENT_DONE || 
+			event->type == LLCACHE_EVENT_ERROR)
+		(*outstanding)--;
+
+	return NSERROR_OK;
+}
+
+/* Number of objects to fetch at once when populating the cache */
+#define BENCH_BATCH 256
+
+/* Number of retrievals to time at each cache size */
+#define BENCH_RETRIEVES 10000
+
+/**
+ * Measure latency of retrieving fresh objects from a populated cache
+ *
+ * \param objects  Number of objects to populate the cache with
+ * \return true on success, false on failure
+ */
+bool bench_retrieve(unsigned int objects)
+{
+	llcache_handle *handles[BENCH_BATCH];
+	nsurl *urls[BENCH_RETRIEVES];
+	char buf[64];
+	nsurl *url;
+	unsigned int i, j, batch;
+	int outstanding;
+	clock_t start, end;
+
+	if (llcache_initialise(query_handler, NULL, 
+			1024 * 1024) != NSERROR_OK)
+		return false;
+
+	/* Populate the cache, a batch at a time */
+	for (i = 0; i < objects; i += batch) {
+		batch = min(BENCH_BATCH, objects - i);
+		outstanding = batch;
+
+		for (j = 0; j < batch; j++) {
+			snprintf(buf, sizeof(buf), "test://host%u/object/%u",
+					(i + j) % 64, i + j);
+			if (nsurl_create(buf, &url) != NSERROR_OK)
+				return false;
+
+			if (llcache_handle_retrieve(url, 0, NULL, NULL,
+					FETCH_PRIORITY_NORMAL,
+					bench_event_handler, &outstanding,
+					&handles[j]) != NSERROR_OK)
+				return false;
+
+			nsurl_unref(url);
+		}
+
+		while (outstanding > 0)
+			llcache_poll();
+
+		for (j = 0; j < batch; j++)
+			llcache_handle_release(handles[j]);
+	}
+
+	/* Choose objects to retrieve, spread across the cache */
+	for (i = 0; i < BENCH_RETRIEVES; i++) {
+		unsigned int target = (i * 7919) % objects;
+
+		snprintf(buf, sizeof(buf), "test://host%u/object/%u",
+				target % 64, target);
+		if (nsurl_create(buf, &urls[i]) != NSERROR_OK)
+			return false;
+	}
+
+	/* Time retrieval of the cached objects */
+	start = clock();
+
+	for (i = 0; i < BENCH_RETRIEVES; i++) {
+		if (llcache_handle_retrieve(urls[i], 0, NULL, NULL,
+				FETCH_PRIORITY_NORMAL,
+				bench_event_handler, &outstanding,
+				&handles[0]) != NSERROR_OK)
+			return false;
+
+		llcache_handle_release(handles[0]);
+	}
+
+	end = clock();
+
+	for (i = 0; i < BENCH_RETRIEVES; i++)
+		nsurl_unref(urls[i]);
+
+	fprintf(stdout, "%7u objects: %.3f us per retrieve\n", objects,
+			(double) (end - start) * 1000000 / CLOCKS_PER_SEC / 
+			BENCH_RETRIEVES);
+
+	llcache_finalise();
+
+	return true;
+}
+
+/* Time for which to leave a preconnection to complete, in centiseconds */
+#define PRECONNECT_WAIT 50
+
+/* Times of the events of a fetch, from its start, in milliseconds */
+struct fetch_times {
+	struct timeval start;
+	double data;
+	double done;
+};
+
+double elapsed_ms(const struct timeval *start)
+{
+	struct timeval now, diff;
+
+	gettimeofday(&now, NULL);
+	timersub(&now, start, &diff);
+
+	return diff.tv_sec * 1000.0 + diff.tv_usec / 1000.0;
+}
+
+nserror time_event_handler(llcache_handle *handle, 
+		const llcache_event *event, void *pw)
+{
+	struct fetch_times *times = pw;
+
+	if (event->type == LLCACHE_EVENT_HAD_DATA && times->data < 0)
+		times->data = elapsed_ms(&times->start);
+	else if (event->type == LLCACHE_EVENT_DONE || 
+			event->type == LLCACHE_EVENT_ERROR)
+		times->done = elapsed_ms(&times->start);
+
+	return NSERROR_OK;
+}
+
+/**
+ * Measure latency of a fetch, optionally preconnecting to its host first
+ *
+ * \param url_s       URL to fetch
+ * \param preconnect  Whether to preconnect to the URL's host first
+ * \return true on success, false on failure
+ *
+ * Run this against a local HTTP/1.1 server, with and without \a preconnect,
+ * and compare.  Network latency may be simulated on the loopback interface,
+ * with, for example, "tc qdisc add dev lo root netem delay 50ms".
+ */
+bool bench_preconnect(const char *url_s, bool preconnect)
+{
+	struct fetch_times times = { { 0, 0 }, -1, -1 };
+	llcache_handle *handle;
+	nsurl *url;
+
+	if (llcache_initialise(query_handler, NULL, 
+			1024 * 1024) != NSERROR_OK)
+		return false;
+
+	if (nsurl_create(url_s, &url) != NSERROR_OK)
+		return false;
+
+	/* Give the preconnection as long as it might get while the page
+	 * referring to the URL is processed */
+	if (preconnect) {
+		nsoption_int(max_preconnects) = 4;
+		fetch_preconnect(url);
+
+		gettimeofday(&times.start, NULL);
+		while (elapsed_ms(&times.start) < PRECONNECT_WAIT * 10) {
+			schedule_run();
+			usleep(1000);
+		}
+	}
+
+	gettimeofday(&times.start, NULL);
+
+	if (llcache_handle_retrieve(url, 0, NULL, NULL,
+			FETCH_PRIORITY_DOCUMENT, time_event_handler, &times,
+			&handle) != NSERROR_OK)
+		return false;
+
+	while (times.done < 0) {
+		schedule_run();
+		llcache_poll();
+	}
+
+	fprintf(stdout, "%s: %.1f ms to first data, %.1f ms to done\n",
+			preconnect ? "preconnected" : "cold", 
+			times.data, times.done);
+
+	llcache_handle_release(handle);
+	nsurl_unref(url);
+
+	llcache_finalise();
+
+	return true;
+}
+
+/* Simulated server latency when benchmarking stale retrievals, in ms */
+#define STALE_LATENCY 50
+
+/**
+ * Measure latency of retrieving a stale object
+ *
+ * \param use_stale  Whether to use stale objects while revalidating them
+ * \return true on success, false on failure
+ */
+bool bench_stale(bool use_stale)
+{
+	struct fetch_times times;
+	llcache_handle *handle;
+	char summary[32];
+	nsurl *url;
+	int i;
+
+	nsoption_int(stale_while_revalidate) = use_stale ? 60 : 0;
+	test_latency = STALE_LATENCY;
+
+	if (llcache_initialise(query_handler, NULL, 
+			1024 * 1024) != NSERROR_OK)
+		return false;
+
+	if (nsurl_create("test://host/stale/object", &url) != NSERROR_OK)
+		return false;
+
+	/* The first retrieval fetches the object; the second finds it
+	 * stale, and has to revalidate it */
+	for (i = 0; i < 2; i++) {
+		times.data = times.done = -1;
+		gettimeofday(&times.start, NULL);
+
+		if (llcache_handle_retrieve(url, 0, NULL, NULL,
+				FETCH_PRIORITY_DOCUMENT, time_event_handler, 
+				&times, &handle) != NSERROR_OK)
+			return false;
+
+		while (times.done < 0) {
+			schedule_run();
+			llcache_poll();
+		}
+
+		llcache_handle_release(handle);
+	}
+
+	/* Let any background revalidation finish */
+	gettimeofday(&times.start, NULL);
+	while (elapsed_ms(&times.start) < STALE_LATENCY * 2) {
+		llcache_poll();
+		usleep(1000);
+	}
+
+	llcache_snsummaryf(summary, sizeof(summary), "%g/%l");
+
+	fprintf(stdout, "%s: %.1f ms to done, %s revalidated/background\n",
+			use_stale ? "stale-while-revalidate" : "revalidate",
+			times.done, summary);
+
+	nsurl_unref(url);
+
+	llcache_finalise();
+
+	test_latency = 0;
+
+	return true;
+}
+
+/* Sizes of files to benchmark fetching, in MB */
+static const unsigned int bench_file_sizes[] = { 1, 16, 128, 500 };
+
+/* Amount of data to fetch for each file size, in MB */
+#define BENCH_FILE_TOTAL 2048
+
+nserror file_event_handler(llcache_handle *handle, 
+		const llcache_event *event, void *pw)
+{
+	unsigned int *sum = pw;
+	size_t i;
+
+	/* Touch every cache line of the data, as a consumer would */
+	if (event->type == LLCACHE_EVENT_HAD_DATA) {
+		for (i = 0; i < event->data.data.len; i += 64)
+			*sum += event->data.data.buf[i];
+	} else if (event->type == LLCACHE_EVENT_DONE || 
+			event->type == LLCACHE_EVENT_ERROR) {
+		*sum |= 1u << 31;
+	}
+
+	return NSERROR_OK;
+}
+
+/**
+ * Measure throughput of fetching files of various sizes
+ *
+ * \param dir  Directory in which to create the files
+ * \return true on success, false on failure
+ *
+ * Each file is fetched once before timing, so it's in the OS's cache.
+ */
+bool bench_file(const char *dir)
+{
+	char path[PATH_MAX], url_s[PATH_MAX + 8];
+	static uint8_t block[1024 * 1024];
+	llcache_handle *handle;
+	struct timeval start;
+	unsigned int i, j, n, sum;
+	double ms;
+	nsurl *url;
+	FILE *fp;
+
+	if (llcache_initialise(query_handler, NULL, 
+			1024 * 1024) != NSERROR_OK)
+		return false;
+
+	for (i = 0; i < sizeof(block); i++)
+		block[i] = i * 7;
+
+	for (i = 0; i < sizeof(bench_file_sizes) / sizeof(unsigned int); i++) {
+		snprintf(path, sizeof(path), "%s/llcache-bench-%u", dir, 
+				bench_file_sizes[i]);
+		snprintf(url_s, sizeof(url_s), "file://%s", path);
+
+		fp = fopen(path, "wb");
+		if (fp == NULL)
+			return false;
+		for (j = 0; j < bench_file_sizes[i]; j++) {
+			if (fwrite(block, sizeof(block), 1, fp) != 1) {
+				fclose(fp);
+				remove(path);
+				return false;
+			}
+		}
+		fclose(fp);
+
+		if (nsurl_create(url_s, &url) != NSERROR_OK) {
+			remove(path);
+			return false;
+		}
+
+		n = max(BENCH_FILE_TOTAL / bench_file_sizes[i], 3);
+
+		for (j = 0; j <= n; j++) {
+			/* The first fetch is untimed */
+			if (j == 1)
+				gettimeofday(&start, NULL);
+
+			sum = 0;
+			if (llcache_handle_retrieve(url, 
+					LLCACHE_RETRIEVE_FORCE_FETCH, NULL, 
+					NULL, FETCH_PRIORITY_NORMAL, 
+					file_event_handler, &sum, 
+					&handle) != NSERROR_OK)
+				break;
+
+			while ((sum & (1u << 31)) == 0)
+				llcache_poll();
+
+			llcache_handle_release(handle);
+			llcache_clean();
+		}
+
+		ms = elapsed_ms(&start);
+
+		nsurl_unref(url);
+		remove(path);
+
+		if (j <= n)
+			return false;
+
+		fprintf(stdout, "%4u MB: %8.2f ms per fetch, %6.0f MB/s\n",
+				bench_file_sizes[i], ms / n, 
+				bench_file_sizes[i] * n * 1000.0 / ms);
+	}
+
+	llcache_finalise();
+
+	return true;
+}
+
 int main(int argc, char **argv)
 {
 	nserror error;
@@ -283,6 +808,19 @@ int main(int argc, char **argv)
 	nsurl *url;
 	bool done = false;
 
+	/* Record responses into, or replay them from, an archive directory:
+	 * "--record DIR --fetch URL", then "--replay DIR --fetch URL" */
+	while (argc > 2 && (strcmp(argv[1], "--record") == 0 ||
+			strcmp(argv[1], "--replay") == 0)) {
+		if (strcmp(argv[1], "--record") == 0)
+			nsoption_charp(fetch_record_path) = argv[2];
+		else
+			nsoption_charp(fetch_replay_path) = argv[2];
+
+		argc -= 2;
+		argv += 2;
+	}
+
 	/* Initialise subsystems */
 	fetch_init();
 
@@ -291,9 +829,61 @@ int main(int argc, char **argv)
 		return 1;
 	}
 
-	fetch_add_fetcher(scheme, test_initialise, test_setup_fetch, 
-			test_start_fetch, test_abort_fetch, test_free_fetch, 
-			test_poll, test_finalise);
+	fetch_add_fetcher(scheme, test_initialise, test_can_fetch,
+			test_setup_fetch, test_start_fetch, test_abort_fetch,
+			test_free_fetch, test_poll, NULL, test_finalise);
+
+	/* Benchmark cache retrieval, if requested */
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+		if (bench_retrieve(100) == false ||
+				bench_retrieve(10000) == false ||
+				bench_retrieve(100000) == false) {
+			fprintf(stderr, "Benchmark failed\n");
+			return 1;
+		}
+
+		fetch_quit();
+
+		return 0;
+	}
+
+	/* Benchmark file: fetches, if requested */
+	if (argc > 1 && strcmp(argv[1], "--bench-file") == 0) {
+		if (bench_file(argc > 2 ? argv[2] : "/tmp") == false) {
+			fprintf(stderr, "Benchmark failed\n");
+			return 1;
+		}
+
+		fetch_quit();
+
+		return 0;
+	}
+
+	/* Time a fetch, if requested */
+	if (argc > 2 && (strcmp(argv[1], "--fetch") == 0 ||
+			strcmp(argv[1], "--preconnect") == 0)) {
+		if (bench_preconnect(argv[2], 
+				strcmp(argv[1], "--preconnect") == 0) == false) {
+			fprintf(stderr, "Benchmark failed\n");
+			return 1;
+		}
+
+		fetch_quit();
+
+		return 0;
+	}
+
+	/* Time retrieval of a stale object, if requested */
+	if (argc > 1 && strcmp(argv[1], "--stale") == 0) {
+		if (bench_stale(false) == false || bench_stale(true) == false) {
+			fprintf(stderr, "Benchmark failed\n");
+			return 1;
+		}
+
+		fetch_quit();
+
+		return 0;
+	}
 
 	/* Initialise low-level cache */
 	error = llcache_initialise(query_handler, NULL, 1024 * 1024);
@@ -310,6 +900,7 @@ int main(int argc, char **argv)
 	/* Retrieve an URL from the low-level cache (may trigger fetch) */
 	error = llcache_handle_retrieve(url, 
 			LLCACHE_RETRIEVE_VERIFIABLE, NULL, NULL,
+			FETCH_PRIORITY_DOCUMENT,
 			event_handler, &done, &handle);
 	if (error != NSERROR_OK) {
 		fprintf(stderr, "llcache_handle_retrieve: %d\n", error);
@@ -324,6 +915,7 @@ int main(int argc, char **argv)
 	done = false;
 	error = llcache_handle_retrieve(url,
 			LLCACHE_RETRIEVE_VERIFIABLE, NULL, NULL,
+			FETCH_PRIORITY_DOCUMENT,
 			event_handler, &done, &handle2);
 	if (error != NSERROR_OK) {
 		fprintf(stderr, "llcache_handle_retrieve: %d\n", error);
@@ -0,0 +1,350 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libwapcaplet/libwapcaplet.h>
+
+#include "content/content_factory.h"
+#include "content/llcache.h"
+#include "content/mimesniff.h"
+#include "desktop/netsurf.h"
+#include "utils/log.h"
+#include "utils/utils.h"
+
+/* desktop/netsurf.h */
+bool verbose_log = true;
+
+/* Content-Type header of the object being sniffed, or NULL if none */
+static const char *header;
+
+/* content/llcache.h */
+const char *llcache_handle_get_header(const llcache_handle *handle,
+		const char *key)
+{
+	return header;
+}
+
+/* content/content_factory.h */
+content_type content_factory_type_from_mime_type(lwc_string *mime_type)
+{
+	if (strncasecmp(lwc_string_data(mime_type), "image/",
+			SLEN("image/")) == 0 && strcasecmp(
+			lwc_string_data(mime_type), "image/svg+xml") != 0)
+		return CONTENT_IMAGE;
+
+	return CONTENT_NONE;
+}
+
+struct test {
+	const char *content_type;	/**< Content-Type header, or NULL */
+	const char *data;		/**< Data received */
+	size_t len;			/**< Length of data */
+	bool complete;			/**< Whether that is all the data */
+	bool sniff_allowed;
+	bool image_only;
+	nserror result;			/**< Expected result */
+	const char *type;		/**< Expected type, for NSERROR_OK */
+	size_t wanted;			/**< Expected need, for NSERROR_NEED_DATA */
+};
+
+#define D(s) s, SLEN(s)
+
+/* Sniffing with no Content-Type, for each signature class, first with
+ * all of the signature and then with only some of it */
+#define UNKNOWN(s, c, r, t, w) { NULL, D(s), c, true, false, r, t, w }
+
+static const struct test unknown_tests[] = {
+	/* Exact signatures */
+	UNKNOWN("GIF89a...", true, NSERROR_OK, "image/gif", 0),
+	UNKNOWN("GIF8", false, NSERROR_NEED_DATA, NULL, 6),
+	UNKNOWN("GIF8", true, NSERROR_OK, "text/plain", 0),
+	UNKNOWN("\x89PNG\r\n\x1a\n", true, NSERROR_OK, "image/png", 0),
+	UNKNOWN("\x89PN", false, NSERROR_NEED_DATA, NULL, 8),
+	UNKNOWN("\xff\xd8\xff\xe0", false, NSERROR_OK, "image/jpeg", 0),
+	UNKNOWN("\xff", false, NSERROR_NEED_DATA, NULL, 3),
+	UNKNOWN("BM", false, NSERROR_OK, "image/bmp", 0),
+	UNKNOWN("\x00\x00\x01\x00", false, NSERROR_OK,
+			"image/vnd.microsoft.icon", 0),
+	UNKNOWN("\x00\x00\x01", false, NSERROR_NEED_DATA, NULL, 4),
+	UNKNOWN("\x00\x00\x01", true, NSERROR_OK,
+			"application/octet-stream", 0),
+	UNKNOWN("PK\x03\x04", false, NSERROR_OK, "application/zip", 0),
+	UNKNOWN("\x1f\x8b\x08", false, NSERROR_OK, "application/x-gzip", 0),
+	UNKNOWN("%!PS-Adobe-3.0", false, NSERROR_OK,
+			"application/postscript", 0),
+	UNKNOWN("%!PS-Ad", false, NSERROR_NEED_DATA, NULL, 11),
+	UNKNOWN("%PDF-1.4", false, NSERROR_OK, "application/pdf", 0),
+	UNKNOWN("%PD", false, NSERROR_NEED_DATA, NULL, 5),
+
+	/* RIFF containers */
+	UNKNOWN("RIFF\x10\x00\x00\x00WEBPVP8 ", false, NSERROR_OK,
+			"image/webp", 0),
+	UNKNOWN("RIFF\x10\x00\x00\x00WAVEfmt ", false, NSERROR_OK,
+			"audio/wave", 0),
+	UNKNOWN("RIFF\x10\x00\x00\x00WEB", false, NSERROR_NEED_DATA,
+			NULL, 14),
+	UNKNOWN("RIFF\x10\x00\x00\x00WEB", true, NSERROR_OK,
+			"application/octet-stream", 0),
+
+	/* Byte order marks */
+	UNKNOWN("\xef\xbb\xbfhello", false, NSERROR_OK, "text/plain", 0),
+	UNKNOWN("\xfe\xff", false, NSERROR_OK, "text/plain", 0),
+	UNKNOWN("\xef\xbb", false, NSERROR_NEED_DATA, NULL, 3),
+
+	/* Markup, after optional whitespace */
+	UNKNOWN(" \n<html>", false, NSERROR_OK, "text/html", 0),
+	UNKNOWN("<!DOCTYPE html>", false, NSERROR_OK, "text/html", 0),
+	UNKNOWN("<p ", false, NSERROR_OK, "text/html", 0),
+	UNKNOWN("<?xml version", false, NSERROR_OK, "text/xml", 0),
+	UNKNOWN("<htm", false, NSERROR_NEED_DATA, NULL, 5),
+	UNKNOWN("<html", false, NSERROR_NEED_DATA, NULL, 6),
+	UNKNOWN("<html", true, NSERROR_OK, "text/plain", 0),
+	UNKNOWN("<htmlx>", false, NSERROR_NEED_DATA, NULL, 512),
+	UNKNOWN("   ", false, NSERROR_NEED_DATA, NULL, 4),
+	UNKNOWN("   ", true, NSERROR_OK, "text/plain", 0),
+
+	/* MP4 */
+	UNKNOWN("\x00\x00\x00\x10" "ftypmp42\x00\x00\x00\x00", true,
+			NSERROR_OK, "video/mp4", 0),
+	UNKNOWN("\x00\x00\x00\x18" "ftypisom\x00\x00\x00\x00mp41", false,
+			NSERROR_NEED_DATA, NULL, 24),
+	UNKNOWN("\x00\x00\x00\x18" "ftypisom\x00\x00\x00\x00mp41", true,
+			NSERROR_OK, "application/octet-stream", 0),
+	UNKNOWN("\x00\x00\x00\x18" "ftypisom\x00\x00\x00\x00mp41isom",
+			true, NSERROR_OK, "video/mp4", 0),
+	UNKNOWN("\x00\x00\x00\x18" "fty", false, NSERROR_NEED_DATA, NULL, 8),
+
+	/* Neither; text is only known once the whole header is seen */
+	UNKNOWN("hello, world", false, NSERROR_NEED_DATA, NULL, 512),
+	UNKNOWN("hello, world", true, NSERROR_OK, "text/plain", 0),
+	UNKNOWN("hello\x01world", false, NSERROR_OK,
+			"application/octet-stream", 0),
+
+	/* Empty input */
+	UNKNOWN("", false, NSERROR_NEED_DATA, NULL, 6),
+	UNKNOWN("", true, NSERROR_OK, "text/plain", 0),
+
+	{ NULL, NULL, 0, false, false, false, NSERROR_OK, NULL, 0 }
+};
+
+#undef UNKNOWN
+
+#define TYPED(ct, s, c, i, r, t, w) { ct, D(s), c, true, i, r, t, w }
+
+static const struct test typed_tests[] = {
+	/* Text types are checked for binary data */
+	TYPED("text/plain", "hello", true, false, NSERROR_OK,
+			"text/plain", 0),
+	TYPED("text/plain", "hello", false, false, NSERROR_NEED_DATA,
+			NULL, 512),
+	TYPED("text/plain", "GIF89a\x01", false, false, NSERROR_OK,
+			"image/gif", 0),
+	TYPED("text/plain", "%PDF-\x01", false, false, NSERROR_OK,
+			"application/octet-stream", 0),
+	TYPED("text/plain; charset=UTF-8", "\xfe\xff\x00\x01", false,
+			false, NSERROR_OK, "text/plain", 0),
+	TYPED("text/plain; charset=utf-8", "\x00\x01", false, false,
+			NSERROR_OK, "text/plain", 0),
+
+	/* Unknown types are sniffed as if there were no header */
+	TYPED("application/unknown", "GIF87a", false, false, NSERROR_OK,
+			"image/gif", 0),
+	TYPED("*/*", "\x89PN", false, false, NSERROR_NEED_DATA, NULL, 8),
+
+	/* XML types are believed */
+	TYPED("application/foo+xml", "GIF87a", false, false, NSERROR_OK,
+			"application/foo+xml", 0),
+	TYPED("text/xml", "<html>", false, false, NSERROR_OK,
+			"text/xml", 0),
+
+	/* Images are only sniffed as other images */
+	TYPED("image/png", "GIF89a", false, false, NSERROR_OK,
+			"image/gif", 0),
+	TYPED("image/png", "GIF", false, false, NSERROR_NEED_DATA, NULL, 6),
+	TYPED("image/png", "GIF", true, false, NSERROR_OK, "image/png", 0),
+	TYPED("image/png", "RIFF\0\0\0\0WEBPVP8 ", false, false, NSERROR_OK,
+			"image/webp", 0),
+	TYPED("image/png", "RIFF\0\0\0\0WE", false, false,
+			NSERROR_NEED_DATA, NULL, 14),
+	TYPED("image/png", "<html>", false, false, NSERROR_OK,
+			"image/png", 0),
+	TYPED("text/html", "\xff\xd8\xff", false, true, NSERROR_OK,
+			"image/jpeg", 0),
+	TYPED("image/svg+xml", "GIF89a", false, true, NSERROR_OK,
+			"image/svg+xml", 0),
+
+	/* HTML may turn out to be a feed */
+	TYPED("text/html", "<rss version=\"2.0\">", false, false, NSERROR_OK,
+			"application/rss+xml", 0),
+	TYPED("text/html", "\xef\xbb\xbf<?xml?>\n<!-- x --><feed", false,
+			false, NSERROR_OK, "application/atom+xml", 0),
+	TYPED("text/html", "<rdf:RDF xmlns=\"http://purl.org/rss/1.0\" "
+			"xmlns:rdf=\"http://www.w3.org/1999/02/22-rdf-syntax-ns#\"",
+			false, false, NSERROR_OK, "application/rss+xml", 0),
+	TYPED("text/html", "<!DOCTYPE html><html>", false, false, NSERROR_OK,
+			"text/html", 0),
+	TYPED("text/html", "<rs", false, false, NSERROR_NEED_DATA, NULL, 4),
+	TYPED("text/html", "<rs", true, false, NSERROR_OK, "text/html", 0),
+	TYPED("text/html", "<!-- x -", false, false, NSERROR_NEED_DATA,
+			NULL, 10),
+	TYPED("text/html", "\xef\xbb", false, false, NSERROR_NEED_DATA,
+			NULL, 3),
+	TYPED("text/html", "", false, false, NSERROR_NEED_DATA, NULL, 1),
+	TYPED("text/html", "", true, false, NSERROR_OK, "text/html", 0),
+
+	/* Anything else is believed */
+	TYPED("text/css", "<html>", false, false, NSERROR_OK,
+			"text/css", 0),
+
+	{ NULL, NULL, 0, false, false, false, NSERROR_OK, NULL, 0 }
+};
+
+#undef TYPED
+
+static const struct test forbidden_tests[] = {
+	{ NULL, D("GIF89a"), true, false, false, NSERROR_NOT_FOUND, NULL, 0 },
+	{ "text/plain", D("GIF89a"), false, false, false, NSERROR_OK,
+			"text/plain", 0 },
+	{ "image/png", D("GIF89a"), false, false, true, NSERROR_OK,
+			"image/png", 0 },
+	{ NULL, NULL, 0, false, false, false, NSERROR_OK, NULL, 0 }
+};
+
+static int passed = 0;
+static int count = 0;
+
+static void check(bool ok, const char *what, const struct test *test)
+{
+	const char *ct = test->content_type ? test->content_type : "-";
+
+	if (ok) {
+		LOG(("\tPASS: %s \"%s\" (%u%s)", ct, what,
+				(unsigned int) test->len,
+				test->complete ? ", complete" : ""));
+		passed++;
+	} else {
+		LOG(("\tFAIL: %s \"%s\" (%u%s)", ct, what,
+				(unsigned int) test->len,
+				test->complete ? ", complete" : ""));
+	}
+	count++;
+}
+
+static void run(const struct test *test, const uint8_t *data, size_t len,
+		const char *what)
+{
+	lwc_string *type = NULL;
+	size_t wanted = 0;
+	nserror error;
+	bool ok;
+
+	header = test->content_type;
+
+	error = mimesniff_compute_effective_type(NULL, data, len,
+			test->complete, test->sniff_allowed, test->image_only,
+			&type, &wanted);
+
+	ok = error == test->result;
+	if (ok && error == NSERROR_OK)
+		ok = strcmp(lwc_string_data(type), test->type) == 0;
+	if (ok && error == NSERROR_NEED_DATA)
+		ok = wanted == test->wanted;
+
+	check(ok, what, test);
+
+	if (error == NSERROR_OK)
+		lwc_string_unref(type);
+}
+
+static void run_tests(const struct test *tests)
+{
+	const struct test *test;
+
+	for (test = tests; test->data != NULL; test++)
+		run(test, (const uint8_t *) test->data, test->len, test->data);
+}
+
+/**
+ * Check the resource header is taken to end after 512 octets
+ */
+static void test_header_boundary(void)
+{
+	static const struct test tests[] = {
+		{ NULL, "511 text", 511, false, true, false,
+				NSERROR_NEED_DATA, NULL, 512 },
+		{ NULL, "512 text", 512, false, true, false,
+				NSERROR_OK, "text/plain", 0 },
+		{ NULL, "600 text", 600, false, true, false,
+				NSERROR_OK, "text/plain", 0 },
+		{ NULL, "binary at 511", 600, false, true, false,
+				NSERROR_OK, "application/octet-stream", 0 },
+		{ NULL, "binary at 512", 600, false, true, false,
+				NSERROR_OK, "text/plain", 0 },
+		{ NULL, "mp4 box of 512", 512, false, true, false,
+				NSERROR_OK, "video/mp4", 0 },
+		{ NULL, "mp4 box of 516", 600, false, true, false,
+				NSERROR_OK, "application/octet-stream", 0 },
+		{ NULL, "mp4 box of 512, short", 300, false, true, false,
+				NSERROR_NEED_DATA, NULL, 512 },
+		{ "text/html", "long comment", 600, false, true, false,
+				NSERROR_OK, "text/html", 0 },
+	};
+	uint8_t data[600];
+	size_t i;
+
+	LOG(("Testing resource header boundary"));
+
+	for (i = 0; i < NOF_ELEMENTS(tests); i++) {
+		memset(data, 'a', sizeof(data));
+
+		if (strcmp(tests[i].data, "binary at 511") == 0) {
+			data[511] = 0x01;
+		} else if (strcmp(tests[i].data, "binary at 512") == 0) {
+			data[512] = 0x01;
+		} else if (strncmp(tests[i].data, "mp4", 3) == 0) {
+			size_t box = strstr(tests[i].data, "516") ? 516 : 512;
+
+			memset(data, 0, sizeof(data));
+			data[2] = box >> 8;
+			data[3] = box & 0xff;
+			memcpy(data + 4, "ftypisom", 8);
+			memcpy(data + box - 4, "mp42", 4);
+		} else if (strcmp(tests[i].data, "long comment") == 0) {
+			memcpy(data, "<!--", 4);
+			memcpy(data + 590, "--><rss", 7);
+		}
+
+		run(&tests[i], data, tests[i].len, tests[i].data);
+	}
+}
+
+/**
+ * Test MIME type sniffing
+ */
+int main(int argc, char **argv)
+{
+	assert(mimesniff_init() == NSERROR_OK);
+
+	LOG(("Testing unknown types"));
+	run_tests(unknown_tests);
+
+	LOG(("Testing typed content"));
+	run_tests(typed_tests);
+
+	LOG(("Testing with sniffing forbidden"));
+	run_tests(forbidden_tests);
+
+	test_header_boundary();
+
+	mimesniff_fini();
+
+	if (passed == count) {
+		LOG(("Testing complete: SUCCESS"));
+	} else {
+		LOG(("Testing complete: FAILURE"));
+		LOG(("Failed %d out of %d", count - passed, count));
+	}
+
+	return passed == count ? 0 : 1;
+}
@@ -40,12 +40,30 @@
 #endif
 #include "utils/log.h"
 #include "utils/filename.h"
+#include "utils/nsurl.h"
+#include "utils/schedule.h"
 #include "utils/url.h"
 #include "utils/utils.h"
 
 int option_expire_url = 0;
 bool verbose_log = true;
 
+/* Callback most recently scheduled, if any */
+static schedule_callback_fn scheduled_callback;
+static void *scheduled_p;
+
+void schedule(int t, schedule_callback_fn callback, void *p)
+{
+	scheduled_callback = callback;
+	scheduled_p = p;
+}
+
+void schedule_remove(schedule_callback_fn callback, void *p)
+{
+	if (scheduled_callback == callback && scheduled_p == p)
+		scheduled_callback = NULL;
+}
+
 bool cookies_schedule_update(const struct cookie_data *data)
 {
 	return true;
@@ -81,15 +99,348 @@ char *path_to_url(const char *path)
 	return r;
 }
 
-int main(void)
+/* Number of cookies called "gone" in the database */
+static unsigned int gone_count;
+
+static bool count_gone(const struct cookie_data *data)
+{
+	if (strcmp(data->name, "gone") == 0)
+		gone_count++;
+	return true;
+}
+
+/* Number of URLs in the database for benchmarking */
+#define BENCH_URLS 10000
+
+/* Number of lookups to time, for each interface */
+#define BENCH_LOOKUPS 200000
+
+/**
+ * Time lookups by URL string against lookups by nsurl
+ */
+static bool bench_lookup(void)
+{
+	static nsurl *urls[BENCH_URLS];
+	static char *strings[BENCH_URLS];
+	char buf[128];
+	unsigned int i;
+	clock_t start, end;
+	double string_rate, nsurl_rate;
+
+	for (i = 0; i < BENCH_URLS; i++) {
+		snprintf(buf, sizeof(buf), 
+				"http://www.host%u.example.com/dir%u/page%u.html"
+				"?id=%u", i % 500, i % 20, i, i);
+		if (nsurl_create(buf, &urls[i]) != NSERROR_OK)
+			return false;
+		strings[i] = strdup(nsurl_access(urls[i]));
+		if (strings[i] == NULL)
+			return false;
+
+		if (urldb_add_url(strings[i]) == false)
+			return false;
+
+		/* Give each host a cookie */
+		if (i < 500)
+			urldb_set_cookie("session=abc; path=/\r\n", strings[i],
+					NULL);
+	}
+
+	/* URL data, as used for :visited */
+	start = clock();
+	for (i = 0; i < BENCH_LOOKUPS; i++)
+		if (urldb_get_url_data(strings[(i * 7919) % BENCH_URLS]) == NULL)
+			return false;
+	end = clock();
+	string_rate = BENCH_LOOKUPS / ((double) (end - start) / CLOCKS_PER_SEC);
+
+	start = clock();
+	for (i = 0; i < BENCH_LOOKUPS; i++)
+		if (urldb_nsurl_get_data(urls[(i * 7919) % BENCH_URLS]) == NULL)
+			return false;
+	end = clock();
+	nsurl_rate = BENCH_LOOKUPS / ((double) (end - start) / CLOCKS_PER_SEC);
+
+	printf("url data: %10.0f lookups/s by string, "
+			"%10.0f lookups/s by nsurl\n", string_rate, nsurl_rate);
+
+	/* Cookies, as used for every fetch */
+	start = clock();
+	for (i = 0; i < BENCH_LOOKUPS; i++)
+		free(urldb_get_cookie(strings[(i * 7919) % BENCH_URLS]));
+	end = clock();
+	string_rate = BENCH_LOOKUPS / ((double) (end - start) / CLOCKS_PER_SEC);
+
+	start = clock();
+	for (i = 0; i < BENCH_LOOKUPS; i++)
+		free(urldb_nsurl_get_cookie(urls[(i * 7919) % BENCH_URLS]));
+	end = clock();
+	nsurl_rate = BENCH_LOOKUPS / ((double) (end - start) / CLOCKS_PER_SEC);
+
+	printf("cookies:  %10.0f lookups/s by string, "
+			"%10.0f lookups/s by nsurl\n", string_rate, nsurl_rate);
+
+	for (i = 0; i < BENCH_URLS; i++) {
+		nsurl_unref(urls[i]);
+		free(strings[i]);
+	}
+
+	return true;
+}
+
+/* Number of pages on the host used for benchmarking cookies */
+#define BENCH_COOKIE_PAGES 2000
+
+/* Number of cookies on the host used for benchmarking cookies */
+#define BENCH_COOKIES 40
+
+/**
+ * Time cookie lookups for a busy host with many cookies
+ */
+static bool bench_cookies(void)
+{
+	static char *strings[BENCH_COOKIE_PAGES];
+	char buf[128];
+	unsigned int i;
+	clock_t start, end;
+
+	for (i = 0; i < BENCH_COOKIE_PAGES; i++) {
+		snprintf(buf, sizeof(buf), "http://busy.example.com/"
+				"section%u/page%u.html", i % 10, i);
+		strings[i] = strdup(buf);
+		if (strings[i] == NULL || urldb_add_url(buf) == false)
+			return false;
+	}
+
+	for (i = 0; i < BENCH_COOKIES; i++) {
+		/* A quarter are domain cookies, the rest for a section */
+		if (i % 4 == 0)
+			snprintf(buf, sizeof(buf), "c%u=%u; path=/; "
+					"domain=.example.com\r\n", i, i);
+		else
+			snprintf(buf, sizeof(buf), "c%u=%u; "
+					"path=/section%u/\r\n", i, i, i % 10);
+		if (urldb_set_cookie(buf, strings[i % 10], NULL) == false)
+			return false;
+	}
+
+	start = clock();
+	for (i = 0; i < BENCH_LOOKUPS; i++)
+		free(urldb_get_cookie(strings[(i * 7919) % 
+				BENCH_COOKIE_PAGES]));
+	end = clock();
+
+	printf("busy host cookies: %10.0f lookups/s\n", BENCH_LOOKUPS / 
+			((double) (end - start) / CLOCKS_PER_SEC));
+
+	for (i = 0; i < BENCH_COOKIE_PAGES; i++)
+		free(strings[i]);
+
+	return true;
+}
+
+/* Files used for testing saving and loading */
+#define STORE_FILE "urldbtest-urls"
+#define STORE_JOURNAL "urldbtest-urls-journal"
+#define STORE_TEXT "urldbtest-urls.txt"
+
+/* Number of URLs in the database for benchmarking saving and loading */
+#define BENCH_STORE_URLS 200000
+
+static unsigned int entry_count;
+
+static bool count_entry(const char *url, const struct url_data *data)
+{
+	entry_count++;
+
+	return true;
+}
+
+static long file_length(const char *filename)
+{
+	FILE *fp = fopen(filename, "rb");
+	long length;
+
+	if (fp == NULL)
+		return -1;
+
+	fseek(fp, 0, SEEK_END);
+	length = ftell(fp);
+	fclose(fp);
+
+	return length;
+}
+
+/**
+ * Test saving and loading the database, in both formats
+ */
+static void test_store(void)
+{
+	const struct url_data *u;
+	char url[64];
+	long length;
+	int i;
+
+	remove(STORE_FILE);
+	remove(STORE_JOURNAL);
+
+	for (i = 0; i < 100; i++) {
+		snprintf(url, sizeof url, "http://host%d.example.com/page%d",
+				i % 10, i);
+		assert(urldb_add_url(url));
+		urldb_update_url_visit_data(url);
+	}
+
+	urldb_set_url_title("http://host1.example.com/page1", "one");
+
+	/* Never visited, so not saved */
+	assert(urldb_add_url("http://unvisited.example.com/"));
+
+	urldb_save(STORE_FILE);
+	urldb_export(STORE_TEXT);
+	urldb_destroy();
+
+	/* Entries are loaded as their hosts are looked up */
+	urldb_load(STORE_FILE);
+	u = urldb_get_url_data("http://host1.example.com/page1");
+	assert(u && u->visits == 1 && strcmp(u->title, "one") == 0);
+	assert(urldb_get_url_data("http://unvisited.example.com/") == NULL);
+
+	/* Changes are saved to the journal, leaving the file alone */
+	length = file_length(STORE_FILE);
+	urldb_update_url_visit_data("http://host1.example.com/page1");
+	assert(urldb_add_url("http://host2.example.com/new"));
+	urldb_update_url_visit_data("http://host2.example.com/new");
+	urldb_save(STORE_FILE);
+	assert(file_length(STORE_FILE) == length);
+	assert(file_length(STORE_JOURNAL) > 0);
+	urldb_destroy();
+
+	urldb_load(STORE_FILE);
+	u = urldb_get_url_data("http://host1.example.com/page1");
+	assert(u && u->visits == 2 && strcmp(u->title, "one") == 0);
+	assert(urldb_get_url_data("http://host2.example.com/new") != NULL);
+	entry_count = 0;
+	urldb_iterate_entries(count_entry);
+	assert(entry_count == 101);
+
+	/* Saving elsewhere writes a whole file */
+	urldb_save(STORE_FILE "2");
+	urldb_destroy();
+	urldb_load(STORE_FILE "2");
+	entry_count = 0;
+	urldb_iterate_entries(count_entry);
+	assert(entry_count == 101);
+	urldb_destroy();
+
+	/* Text format */
+	urldb_load(STORE_TEXT);
+	u = urldb_get_url_data("http://host1.example.com/page1");
+	assert(u && u->visits == 1 && strcmp(u->title, "one") == 0);
+	entry_count = 0;
+	urldb_iterate_entries(count_entry);
+	assert(entry_count == 100);
+	urldb_destroy();
+
+	remove(STORE_FILE);
+	remove(STORE_JOURNAL);
+	remove(STORE_FILE "2");
+	remove(STORE_TEXT);
+}
+
+/**
+ * Time loading and saving in the binary format against the text format
+ */
+static bool bench_store(void)
+{
+	char url[128];
+	unsigned int i;
+	clock_t start, end;
+
+	for (i = 0; i < BENCH_STORE_URLS; i++) {
+		snprintf(url, sizeof url, "http://www.host%u.example.com/"
+				"dir%u/page%u.html", i % 20000, i % 7, i);
+		if (urldb_add_url(url) == false)
+			return false;
+		urldb_update_url_visit_data(url);
+	}
+
+	remove(STORE_FILE);
+	remove(STORE_JOURNAL);
+
+	start = clock();
+	urldb_export(STORE_TEXT);
+	end = clock();
+	printf("save:   %8.3f s text, ", (double) (end - start) /
+			CLOCKS_PER_SEC);
+
+	start = clock();
+	urldb_save(STORE_FILE);
+	end = clock();
+	printf("%8.3f s binary, ", (double) (end - start) / CLOCKS_PER_SEC);
+
+	urldb_update_url_visit_data("http://www.host1.example.com/dir1/"
+			"page1.html");
+
+	start = clock();
+	urldb_save(STORE_FILE);
+	end = clock();
+	printf("%8.3f s journal\n", (double) (end - start) / CLOCKS_PER_SEC);
+
+	urldb_destroy();
+
+	start = clock();
+	urldb_load(STORE_TEXT);
+	end = clock();
+	printf("load:   %8.3f s text, ", (double) (end - start) /
+			CLOCKS_PER_SEC);
+
+	urldb_destroy();
+
+	start = clock();
+	urldb_load(STORE_FILE);
+	if (urldb_get_url_data("http://www.host1.example.com/dir1/"
+			"page1.html") == NULL)
+		return false;
+	end = clock();
+	printf("%8.3f s binary, ", (double) (end - start) / CLOCKS_PER_SEC);
+
+	start = clock();
+	urldb_iterate_entries(count_entry);
+	end = clock();
+	printf("%8.3f s to load remainder\n", (double) (end - start) /
+			CLOCKS_PER_SEC);
+
+	urldb_destroy();
+
+	remove(STORE_FILE);
+	remove(STORE_JOURNAL);
+	remove(STORE_TEXT);
+
+	return true;
+}
+
+int main(int argc, char **argv)
 {
 	struct host_part *h;
 	struct path_data *p;
 	const struct url_data *u;
+	nsurl *url;
+	char *cookie;
 	int i;
 
 	url_init();
 
+	if (argc > 1 && strcmp(argv[1], "--bench") == 0) {
+		if (bench_lookup() == false || bench_cookies() == false ||
+				bench_store() == false) {
+			printf("FAIL\n");
+			return 1;
+		}
+
+		return 0;
+	}
+
 	h = urldb_add_host("127.0.0.1");
 	if (!h) {
 		LOG(("failed adding host"));
@@ -253,8 +604,66 @@ int main(void)
 	assert(urldb_set_cookie("foo=bar; expires=Thu, 01-Jan-1970 00:00:01 GMT\r\n", "http://expires.com/", NULL));
 	assert(urldb_get_cookie("http://expires.com/") == NULL);
 
+	/* Test expired cookies are removed in the background */
+	assert(urldb_set_cookie("gone=1; expires=Thu, 01-Jan-1970 00:00:01 GMT\r\n", "http://reap.com/", NULL));
+	assert(urldb_set_cookie("kept=1; expires=Thur, 31-Dec-2099 00:00:00 GMT\r\n", "http://reap.com/", NULL));
+	urldb_iterate_cookies(count_gone);
+	assert(gone_count == 1);
+	assert(scheduled_callback != NULL);
+	scheduled_callback(scheduled_p);
+	gone_count = 0;
+	urldb_iterate_cookies(count_gone);
+	assert(gone_count == 0);
+	assert(strcmp(urldb_get_cookie("http://reap.com/"), "kept=1") == 0);
+
+	/* Test cookies are sent longest path first */
+	assert(urldb_set_cookie("a=1; path=/\r\n", "http://order.com/dir/page", NULL));
+	assert(urldb_set_cookie("b=2; path=/dir/\r\n", "http://order.com/dir/page", NULL));
+	assert(urldb_set_cookie("c=3; path=/dir/page\r\n", "http://order.com/dir/page", NULL));
+	assert(urldb_set_cookie("d=4; domain=.order.com\r\n", "http://order.com/dir/page", NULL));
+	assert(strcmp(urldb_get_cookie("http://order.com/dir/page?x=y"), "c=3; b=2; a=1; d=4") == 0);
+
+	/* Test paths only match at directory boundaries */
+	assert(urldb_set_cookie("e=5; path=/dir\r\n", "http://order.com/dir/page", NULL));
+	assert(strcmp(urldb_get_cookie("http://order.com/dir/other"), "b=2; e=5; a=1; d=4") == 0);
+	assert(strcmp(urldb_get_cookie("http://order.com/directory"), "a=1") == 0);
+
+	/* Test lookups by nsurl agree with lookups by string */
+	assert(nsurl_create("http://www.example.org/foo/bar/baz/quux.htm",
+			&url) == NSERROR_OK);
+	cookie = urldb_nsurl_get_cookie(url);
+	assert(cookie != NULL && strcmp(cookie, urldb_get_cookie(
+			"http://www.example.org/foo/bar/baz/quux.htm")) == 0);
+	free(cookie);
+	assert(urldb_nsurl_get_url(url) == urldb_get_url(
+			"http://www.example.org/foo/bar/baz/quux.htm"));
+	nsurl_unref(url);
+
+	assert(nsurl_create("http://netsurf.strcprstskrzkrk.co.uk/"
+			"path/to/resource.htm?a=b", &url) == NSERROR_OK);
+	assert(urldb_nsurl_get_data(url) != NULL);
+	assert(urldb_nsurl_get_data(url) == urldb_get_url_data(
+			nsurl_access(url)));
+	nsurl_unref(url);
+
+	assert(nsurl_create("http://www.example.org:8080/new/page.html",
+			&url) == NSERROR_OK);
+	assert(urldb_nsurl_get_data(url) == NULL);
+	assert(urldb_nsurl_add(url));
+	urldb_nsurl_set_title(url, "bar");
+	urldb_nsurl_update_visit_data(url);
+	u = urldb_get_url_data("http://www.example.org:8080/new/page.html");
+	assert(u && u == urldb_nsurl_get_data(url));
+	assert(strcmp(u->title, "bar") == 0 && u->visits == 1);
+	assert(urldb_get_url_data("http://www.example.org/new/page.html") ==
+			NULL);
+	nsurl_unref(url);
+
 	urldb_dump();
 
+	urldb_destroy();
+	test_store();
+
 	printf("PASS\n");
 
 	return 0;
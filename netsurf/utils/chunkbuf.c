@@ -0,0 +1,438 @@
+/*
+ * Copyright 2012 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Chunked byte buffers (implementation).
+ */
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils/chunkbuf.h"
+#include "utils/utils.h"
+
+/** Smallest chunk allocated when appending */
+#define CHUNKBUF_MIN_CHUNK (16 * 1024)
+
+/** Largest chunk allocated when appending, unless the data is bigger */
+#define CHUNKBUF_MAX_CHUNK (1024 * 1024)
+
+/** Reference counted block of data */
+struct chunkbuf_chunk {
+	unsigned int refcnt;	/**< Number of buffers using chunk */
+	size_t used;		/**< Bytes of data written */
+	size_t size;		/**< Bytes of data allocated */
+	uint8_t *data;		/**< Chunk data */
+	chunkbuf_release_fn release;	/**< Function to release data, or
+					     NULL if allocated with malloc */
+	void *pw;		/**< Client data for release */
+};
+
+/**
+ * Create a chunk
+ *
+ * \param data  Heap block to use as chunk data, or NULL to allocate
+ * \param size  Byte size of chunk data
+ * \return New chunk with one reference, or NULL on memory exhaustion
+ */
+static struct chunkbuf_chunk *chunkbuf_chunk_create(uint8_t *data,
+		size_t size)
+{
+	struct chunkbuf_chunk *chunk;
+
+	chunk = malloc(sizeof(struct chunkbuf_chunk));
+	if (chunk == NULL)
+		return NULL;
+
+	if (data == NULL) {
+		data = malloc(size);
+		if (data == NULL) {
+			free(chunk);
+			return NULL;
+		}
+		chunk->used = 0;
+	} else {
+		chunk->used = size;
+	}
+
+	chunk->refcnt = 1;
+	chunk->size = size;
+	chunk->data = data;
+	chunk->release = NULL;
+	chunk->pw = NULL;
+
+	return chunk;
+}
+
+/**
+ * Drop a reference to a chunk, destroying it if it is no longer in use
+ *
+ * \param chunk  Chunk to release
+ */
+static void chunkbuf_chunk_unref(struct chunkbuf_chunk *chunk)
+{
+	if (--chunk->refcnt == 0) {
+		if (chunk->release != NULL)
+			chunk->release(chunk->data, chunk->size, chunk->pw);
+		else
+			free(chunk->data);
+		free(chunk);
+	}
+}
+
+/**
+ * Add a chunk to the end of a buffer
+ *
+ * \param buf    Buffer to add to
+ * \param chunk  Chunk to add, whose reference passes to the buffer
+ * \return NSERROR_OK on success, NSERROR_NOMEM on memory exhaustion
+ */
+static nserror chunkbuf_push(struct chunkbuf *buf,
+		struct chunkbuf_chunk *chunk)
+{
+	struct chunkbuf_entry *entry;
+
+	if (buf->count == buf->alloc) {
+		unsigned int alloc = buf->alloc == 0 ? 4 : buf->alloc * 2;
+
+		entry = realloc(buf->entries,
+				alloc * sizeof(struct chunkbuf_entry));
+		if (entry == NULL)
+			return NSERROR_NOMEM;
+
+		buf->entries = entry;
+		buf->alloc = alloc;
+	}
+
+	entry = &buf->entries[buf->count++];
+	entry->chunk = chunk;
+	entry->start = chunk->used;
+	entry->len = 0;
+
+	return NSERROR_OK;
+}
+
+/* exported interface documented in utils/chunkbuf.h */
+nserror chunkbuf_append(struct chunkbuf *buf, const uint8_t *data,
+		size_t len)
+{
+	struct chunkbuf_chunk *chunk;
+	unsigned int tail = buf->count;
+	size_t fill = 0;
+	nserror error;
+
+	if (len == 0)
+		return NSERROR_OK;
+
+	/* Data may only be written to the tail chunk if nothing else is
+	 * using it, and this buffer's data runs to the end of it. */
+	if (buf->count > 0) {
+		struct chunkbuf_entry *entry = &buf->entries[buf->count - 1];
+
+		chunk = entry->chunk;
+		if (chunk->refcnt == 1 &&
+				entry->start + entry->len == chunk->used) {
+			tail = buf->count - 1;
+			fill = min(chunk->size - chunk->used, len);
+		}
+	}
+
+	/* Make room for what won't fit in the tail chunk first, so that
+	 * failure leaves the buffer unchanged.  Chunk sizes grow with the
+	 * buffer, so large buffers don't consist of many chunks. */
+	if (fill < len) {
+		chunk = chunkbuf_chunk_create(NULL, max(len - fill,
+				min(max(buf->len, CHUNKBUF_MIN_CHUNK),
+				CHUNKBUF_MAX_CHUNK)));
+		if (chunk == NULL)
+			return NSERROR_NOMEM;
+
+		error = chunkbuf_push(buf, chunk);
+		if (error != NSERROR_OK) {
+			chunkbuf_chunk_unref(chunk);
+			return error;
+		}
+	}
+
+	buf->len += len;
+
+	for (; len > 0; tail++) {
+		struct chunkbuf_entry *entry = &buf->entries[tail];
+
+		chunk = entry->chunk;
+		fill = min(chunk->size - chunk->used, len);
+
+		memcpy(chunk->data + chunk->used, data, fill);
+		chunk->used += fill;
+		entry->len += fill;
+
+		data += fill;
+		len -= fill;
+	}
+
+	return NSERROR_OK;
+}
+
+/* exported interface documented in utils/chunkbuf.h */
+nserror chunkbuf_adopt(struct chunkbuf *buf, uint8_t *data, size_t len)
+{
+	struct chunkbuf_chunk *chunk;
+	nserror error;
+
+	if (len == 0) {
+		free(data);
+		return NSERROR_OK;
+	}
+
+	chunk = chunkbuf_chunk_create(data, len);
+	if (chunk == NULL)
+		return NSERROR_NOMEM;
+
+	error = chunkbuf_push(buf, chunk);
+	if (error != NSERROR_OK) {
+		/* Caller keeps the data */
+		free(chunk);
+		return error;
+	}
+
+	buf->entries[buf->count - 1].start = 0;
+	buf->entries[buf->count - 1].len = len;
+	buf->len += len;
+
+	return NSERROR_OK;
+}
+
+/* exported interface documented in utils/chunkbuf.h */
+nserror chunkbuf_adopt_block(struct chunkbuf *buf, const uint8_t *data,
+		size_t len, chunkbuf_release_fn release, void *pw)
+{
+	struct chunkbuf_chunk *chunk;
+	nserror error;
+
+	assert(release != NULL);
+
+	if (len == 0) {
+		release((void *) data, len, pw);
+		return NSERROR_OK;
+	}
+
+	/* Full chunks are never written to, so the block is safe from
+	 * modification */
+	chunk = chunkbuf_chunk_create((uint8_t *) data, len);
+	if (chunk == NULL)
+		return NSERROR_NOMEM;
+
+	chunk->release = release;
+	chunk->pw = pw;
+
+	error = chunkbuf_push(buf, chunk);
+	if (error != NSERROR_OK) {
+		/* Caller keeps the data */
+		free(chunk);
+		return error;
+	}
+
+	buf->entries[buf->count - 1].start = 0;
+	buf->entries[buf->count - 1].len = len;
+	buf->len += len;
+
+	return NSERROR_OK;
+}
+
+/* exported interface documented in utils/chunkbuf.h */
+nserror chunkbuf_share(const struct chunkbuf *src, struct chunkbuf *dst)
+{
+	unsigned int i;
+
+	assert(dst->count == 0);
+
+	if (src->count == 0)
+		return NSERROR_OK;
+
+	dst->entries = malloc(src->count * sizeof(struct chunkbuf_entry));
+	if (dst->entries == NULL)
+		return NSERROR_NOMEM;
+
+	memcpy(dst->entries, src->entries,
+			src->count * sizeof(struct chunkbuf_entry));
+	dst->count = dst->alloc = src->count;
+	dst->len = src->len;
+	dst->cursor = 0;
+	dst->cursor_offset = 0;
+
+	for (i = 0; i < src->count; i++)
+		src->entries[i].chunk->refcnt++;
+
+	return NSERROR_OK;
+}
+
+/* exported interface documented in utils/chunkbuf.h */
+const uint8_t *chunkbuf_span(struct chunkbuf *buf, size_t offset,
+		size_t *len)
+{
+	unsigned int i = 0;
+	size_t start = 0;
+
+	if (offset >= buf->len)
+		return NULL;
+
+	/* Data is usually read in order, so carry on from the last lookup */
+	if (buf->cursor < buf->count && offset >= buf->cursor_offset) {
+		i = buf->cursor;
+		start = buf->cursor_offset;
+	}
+
+	while (offset >= start + buf->entries[i].len) {
+		start += buf->entries[i].len;
+		i++;
+	}
+
+	buf->cursor = i;
+	buf->cursor_offset = start;
+
+	*len = buf->entries[i].len - (offset - start);
+
+	return buf->entries[i].chunk->data + buf->entries[i].start +
+			(offset - start);
+}
+
+/* exported interface documented in utils/chunkbuf.h */
+const uint8_t *chunkbuf_flatten(struct chunkbuf *buf)
+{
+	struct chunkbuf_entry *first = &buf->entries[0];
+	struct chunkbuf_chunk *chunk;
+	size_t offset;
+	unsigned int i;
+
+	if (buf->len == 0)
+		return NULL;
+
+	if (buf->count > 1) {
+		if (first->chunk->refcnt == 1 && first->start == 0 &&
+				first->chunk->release == NULL) {
+			/* Extend the first chunk in place, which may avoid
+			 * copying its contents */
+			uint8_t *data = realloc(first->chunk->data, buf->len);
+			if (data == NULL)
+				return NULL;
+
+			chunk = first->chunk;
+			chunk->data = data;
+			chunk->size = buf->len;
+			i = 1;
+		} else {
+			chunk = chunkbuf_chunk_create(NULL, buf->len);
+			if (chunk == NULL)
+				return NULL;
+			i = 0;
+		}
+
+		/* Copy in the remaining chunks, releasing them as we go */
+		for (offset = first->len * i; i < buf->count; i++) {
+			struct chunkbuf_entry *entry = &buf->entries[i];
+
+			memcpy(chunk->data + offset,
+					entry->chunk->data + entry->start,
+					entry->len);
+			offset += entry->len;
+
+			chunkbuf_chunk_unref(entry->chunk);
+		}
+
+		chunk->used = buf->len;
+
+		first->chunk = chunk;
+		first->start = 0;
+		first->len = buf->len;
+		buf->count = 1;
+		buf->cursor = 0;
+		buf->cursor_offset = 0;
+	}
+
+	return first->chunk->data + first->start;
+}
+
+/* exported interface documented in utils/chunkbuf.h */
+void chunkbuf_discard(struct chunkbuf *buf, size_t len)
+{
+	unsigned int i = 0;
+
+	len = min(len, buf->len);
+	buf->len -= len;
+
+	/* Release entirely discarded chunks */
+	while (i < buf->count && len >= buf->entries[i].len) {
+		len -= buf->entries[i].len;
+		chunkbuf_chunk_unref(buf->entries[i].chunk);
+		i++;
+	}
+
+	/* And skip over the discarded part of the next */
+	if (i < buf->count) {
+		buf->entries[i].start += len;
+		buf->entries[i].len -= len;
+	}
+
+	if (i > 0) {
+		memmove(buf->entries, buf->entries + i,
+				(buf->count - i) * sizeof(struct chunkbuf_entry));
+		buf->count -= i;
+	}
+
+	buf->cursor = 0;
+	buf->cursor_offset = 0;
+}
+
+/* exported interface documented in utils/chunkbuf.h */
+void chunkbuf_trim(struct chunkbuf *buf)
+{
+	struct chunkbuf_entry *tail;
+	struct chunkbuf_chunk *chunk;
+	uint8_t *data;
+
+	if (buf->count == 0)
+		return;
+
+	tail = &buf->entries[buf->count - 1];
+	chunk = tail->chunk;
+
+	/* Only chunks which this buffer alone is using may be resized */
+	if (chunk->refcnt != 1 || chunk->used == chunk->size ||
+			tail->start + tail->len != chunk->used)
+		return;
+
+	data = realloc(chunk->data, chunk->used);
+	if (data != NULL) {
+		chunk->data = data;
+		chunk->size = chunk->used;
+	}
+}
+
+/* exported interface documented in utils/chunkbuf.h */
+void chunkbuf_finalise(struct chunkbuf *buf)
+{
+	unsigned int i;
+
+	for (i = 0; i < buf->count; i++)
+		chunkbuf_chunk_unref(buf->entries[i].chunk);
+
+	free(buf->entries);
+
+	memset(buf, 0, sizeof(struct chunkbuf));
+}
@@ -0,0 +1,177 @@
+/*
+ * Copyright 2012 The NetSurf Browser Project
+ *
+ * This file is part of NetSurf, http://www.netsurf-browser.org/
+ *
+ * NetSurf is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License.
+ *
+ * NetSurf is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/** \file
+ * Chunked byte buffers (interface).
+ *
+ * A chunkbuf holds a byte sequence as a list of separately allocated,
+ * reference counted chunks.  Appending never moves existing data, so a
+ * buffer may grow without the repeated copying that reallocating a single
+ * block involves.  Buffers may share chunks, making copies cheap.  A
+ * contiguous view of the whole buffer is only created when asked for.
+ */
+
+#ifndef _NETSURF_UTILS_CHUNKBUF_H_
+#define _NETSURF_UTILS_CHUNKBUF_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "utils/errors.h"
+
+struct chunkbuf_chunk;
+
+/**
+ * Release a block of data adopted by a buffer
+ *
+ * \param data  Block to release
+ * \param len   Byte length of \a data
+ * \param pw    Client data passed to chunkbuf_adopt_block()
+ */
+typedef void (*chunkbuf_release_fn)(void *data, size_t len, void *pw);
+
+/** A buffer's use of part of a chunk */
+struct chunkbuf_entry {
+	struct chunkbuf_chunk *chunk;	/**< Chunk holding data */
+	size_t start;			/**< Offset of data in chunk */
+	size_t len;			/**< Byte length of data */
+};
+
+/** Chunked byte buffer
+ *
+ * Clients may embed this, but should treat it as opaque other than
+ * reading \a len.  A zero-filled chunkbuf is a valid empty buffer.
+ */
+struct chunkbuf {
+	struct chunkbuf_entry *entries;	/**< Chunks making up buffer */
+	unsigned int count;		/**< Number of entries in use */
+	unsigned int alloc;		/**< Number of entries allocated */
+	size_t len;			/**< Byte length of buffer contents */
+
+	unsigned int cursor;		/**< Entry of last span lookup */
+	size_t cursor_offset;		/**< Buffer offset of cursor entry */
+};
+
+/**
+ * Append data to a buffer
+ *
+ * \param buf   Buffer to append to
+ * \param data  Data to append
+ * \param len   Byte length of \a data
+ * \return NSERROR_OK on success, NSERROR_NOMEM on memory exhaustion
+ *
+ * On failure, the buffer is unchanged.
+ */
+nserror chunkbuf_append(struct chunkbuf *buf, const uint8_t *data,
+		size_t len);
+
+/**
+ * Append a heap block to a buffer without copying it
+ *
+ * \param buf   Buffer to append to
+ * \param data  Block to append, allocated with malloc
+ * \param len   Byte length of \a data
+ * \return NSERROR_OK on success, NSERROR_NOMEM on memory exhaustion
+ *
+ * On success, the buffer takes ownership of \a data.  On failure, the
+ * buffer is unchanged and the caller retains ownership of \a data.
+ */
+nserror chunkbuf_adopt(struct chunkbuf *buf, uint8_t *data, size_t len);
+
+/**
+ * Append a block of data to a buffer without copying it
+ *
+ * \param buf      Buffer to append to
+ * \param data     Block to append
+ * \param len      Byte length of \a data
+ * \param release  Function to release \a data once no buffer uses it
+ * \param pw       Client data for \a release
+ * \return NSERROR_OK on success, NSERROR_NOMEM on memory exhaustion
+ *
+ * This is as chunkbuf_adopt(), for data which wasn't allocated with malloc,
+ * such as a mapped file.  The block is never modified.
+ */
+nserror chunkbuf_adopt_block(struct chunkbuf *buf, const uint8_t *data,
+		size_t len, chunkbuf_release_fn release, void *pw);
+
+/**
+ * Make a buffer share the contents of another
+ *
+ * \param src  Buffer to copy
+ * \param dst  Empty buffer to receive copy
+ * \return NSERROR_OK on success, NSERROR_NOMEM on memory exhaustion
+ *
+ * No data is copied.  The buffers may be modified independently
+ * afterwards.
+ */
+nserror chunkbuf_share(const struct chunkbuf *src, struct chunkbuf *dst);
+
+/**
+ * Get a contiguous span of a buffer
+ *
+ * \param buf     Buffer to examine
+ * \param offset  Offset into buffer of start of span
+ * \param len     Pointer to location to receive length of span
+ * \return Pointer to span data, or NULL if \a offset is beyond the data
+ *
+ * The span extends from \a offset to the end of the chunk containing it.
+ * Walking a buffer from start to end, a span at a time, is cheap.
+ */
+const uint8_t *chunkbuf_span(struct chunkbuf *buf, size_t offset,
+		size_t *len);
+
+/**
+ * Get a contiguous view of a whole buffer
+ *
+ * \param buf  Buffer to flatten
+ * \return Pointer to buffer data, or NULL if empty or on memory exhaustion
+ *
+ * If the data is held in more than one chunk, it is coalesced into a
+ * single chunk first.  The view remains valid until the buffer is
+ * next modified.
+ */
+const uint8_t *chunkbuf_flatten(struct chunkbuf *buf);
+
+/**
+ * Discard data from the start of a buffer
+ *
+ * \param buf  Buffer to discard from
+ * \param len  Number of bytes to discard
+ *
+ * Chunks which become empty are released.  Subsequent offsets into the
+ * buffer are relative to the new start.
+ */
+void chunkbuf_discard(struct chunkbuf *buf, size_t len);
+
+/**
+ * Release any unused space held by a buffer
+ *
+ * \param buf  Buffer to trim
+ *
+ * Call this once nothing more will be appended to the buffer.
+ */
+void chunkbuf_trim(struct chunkbuf *buf);
+
+/**
+ * Empty a buffer, releasing its chunks
+ *
+ * \param buf  Buffer to empty
+ */
+void chunkbuf_finalise(struct chunkbuf *buf);
+
+#endif
@@ -111,6 +111,8 @@ char *realpath(const char *path, char *resolved_path);
     	/* Not even BONE has it. */
     	#define NO_IPV6 1
     #endif
+#elif defined(_WIN32)
+    /* No mmap() */
 #else
     /* We're likely to have a working mmap() */
     #define WITH_MMAP
@@ -23,6 +23,8 @@
 #include <assert.h>
 #include <ctype.h>
 #include <libwapcaplet/libwapcaplet.h>
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -154,12 +156,40 @@ struct nsurl {
 	struct nsurl_components components;
 
 	int count;	/* Number of references to NetSurf URL object */
+	uint32_t hash;	/* Hash value of URL, excluding fragment */
+
+	uint32_t string_hash;	/* Hash value of string */
+	bool stable;	/* Creating a URL from string gives this URL */
+	struct nsurl *next;	/* Next URL in intern table bucket */
 
 	size_t length;	/* Length of string */
 	char string[FLEX_ARRAY_LEN_DECL];	/* Full URL as a string */
 };
 
 
+/** Number of buckets the intern table starts with (power of two) */
+#define NSURL_INTERN_INITIAL_SIZE 1024
+
+/** Size of scratch buffer to use without allocating one */
+#define NSURL_SCRATCH_SIZE 256
+
+static nsurl *nsurl__intern_initial[NSURL_INTERN_INITIAL_SIZE];
+
+/**
+ * Table of every NetSurf URL object, keyed by string
+ *
+ * Identical URLs share an object, which makes creating a URL seen before
+ * cheap, and makes comparing whole URLs a pointer comparison.
+ */
+static struct {
+	nsurl **buckets;	/* Chains of URLs, by string hash */
+	uint32_t size;		/* Number of buckets */
+	uint32_t count;		/* Number of URLs in table */
+} nsurl__interned = {
+	nsurl__intern_initial, NSURL_INTERN_INITIAL_SIZE, 0
+};
+
+
 /** Marker set, indicating positions of sections within a URL string */
 struct url_markers {
 	size_t start; /** start of URL */
@@ -348,6 +378,10 @@ static void nsurl__get_string_markers(const char * const url_s,
 				/* Assuming no scheme == http */
 				marker.scheme_type = NSURL_SCHEME_HTTP;
 				is_http = true;
+			} else {
+				/* Relative reference starts with a path, so
+				 * "a//b" has no authority */
+				pos = url_s + marker.start;
 			}
 		}
 	}
@@ -451,14 +485,13 @@ static void nsurl__get_string_markers(const char * const url_s,
 
 	/* We got to the end of url_s.
 	 * Need to skip back over trailing whitespace to find end of URL */
-	pos--;
-	if (isspace(*pos)) {
+	if (pos > url_s && isspace(*(pos - 1))) {
 		trailing_whitespace = true;
-		while (isspace(*pos))
+		while (pos > url_s && isspace(*(pos - 1)))
 			pos--;
 	}
 
-	marker.end = pos + 1 - url_s;
+	marker.end = pos - url_s;
 
 	if (trailing_whitespace == true) {
 		/* Ensure last url section doesn't pass end */
@@ -1173,6 +1206,47 @@ static void nsurl_get_string(const struct nsurl_components *url, char *url_s,
 }
 
 
+/**
+ * Mix a URL component's hash into a NetSurf URL's hash
+ *
+ * \param hash		Hash value so far
+ * \param component	Component to mix in, or NULL if not present
+ * \return the updated hash value
+ */
+static inline uint32_t nsurl__hash_component(uint32_t hash,
+		lwc_string *component)
+{
+	uint32_t value = (component != NULL) ?
+			lwc_string_hash_value(component) : 0;
+
+	return hash ^ (value + 0x9e3779b9 + (hash << 6) + (hash >> 2));
+}
+
+
+/**
+ * Calculate a NetSurf URL's hash value
+ *
+ * \param url		NetSurf URL to calculate hash for
+ *
+ * The fragment is not included, so URLs which differ only by fragment
+ * share a hash value.
+ */
+static void nsurl__calc_hash(nsurl *url)
+{
+	uint32_t hash = 0;
+
+	hash = nsurl__hash_component(hash, url->components.scheme);
+	hash = nsurl__hash_component(hash, url->components.username);
+	hash = nsurl__hash_component(hash, url->components.password);
+	hash = nsurl__hash_component(hash, url->components.host);
+	hash = nsurl__hash_component(hash, url->components.port);
+	hash = nsurl__hash_component(hash, url->components.path);
+	hash = nsurl__hash_component(hash, url->components.query);
+
+	url->hash = hash;
+}
+
+
 #ifdef NSURL_DEBUG
 /**
  * Dump a NetSurf URL's internal components
@@ -1207,6 +1281,392 @@ static void nsurl__dump(const nsurl *url)
 }
 #endif
 
+
+/**
+ * Calculate the hash value of a URL string
+ *
+ * \param url_s	URL string
+ * \param len		Returns length of url_s, or NULL if not wanted
+ * \return the hash value
+ */
+static uint32_t nsurl__hash_string(const char *url_s, size_t *len)
+{
+	size_t remaining = strlen(url_s);
+	const char *pos = url_s;
+	uint64_t hash = remaining * 0x9e3779b97f4a7c15ULL;
+	uint64_t word;
+
+	if (len != NULL)
+		*len = remaining;
+
+	/* Mix in the string a word at a time */
+	while (remaining >= sizeof(word)) {
+		memcpy(&word, pos, sizeof(word));
+		hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 32;
+		pos += sizeof(word);
+		remaining -= sizeof(word);
+	}
+
+	if (remaining > 0) {
+		word = 0;
+		memcpy(&word, pos, remaining);
+		hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+		hash ^= hash >> 32;
+	}
+
+	return (uint32_t) hash;
+}
+
+
+/**
+ * Find an interned NetSurf URL by string
+ *
+ * \param url_s	URL string
+ * \param len		Length of url_s
+ * \param hash		Hash value of url_s
+ * \return the NetSurf URL with the string, or NULL if none
+ */
+static nsurl *nsurl__intern_find(const char *url_s, size_t len, uint32_t hash)
+{
+	nsurl *url;
+
+	for (url = nsurl__interned.buckets[hash & (nsurl__interned.size - 1)];
+			url != NULL; url = url->next) {
+		if (url->string_hash == hash && url->length == len &&
+				memcmp(url->string, url_s, len) == 0)
+			return url;
+	}
+
+	return NULL;
+}
+
+
+/**
+ * Double the number of buckets in the intern table
+ *
+ * On memory exhaustion the table is left as it is, with longer chains.
+ */
+static void nsurl__intern_grow(void)
+{
+	uint32_t size = nsurl__interned.size * 2;
+	nsurl **buckets;
+	nsurl *url, *next;
+	uint32_t i;
+
+	buckets = calloc(size, sizeof(nsurl *));
+	if (buckets == NULL)
+		return;
+
+	for (i = 0; i < nsurl__interned.size; i++) {
+		for (url = nsurl__interned.buckets[i]; url != NULL;
+				url = next) {
+			next = url->next;
+			url->next = buckets[url->string_hash & (size - 1)];
+			buckets[url->string_hash & (size - 1)] = url;
+		}
+	}
+
+	if (nsurl__interned.buckets != nsurl__intern_initial)
+		free(nsurl__interned.buckets);
+
+	nsurl__interned.buckets = buckets;
+	nsurl__interned.size = size;
+}
+
+
+/**
+ * Release a set of NetSurf URL components
+ *
+ * \param c		Components to release
+ */
+static void nsurl__release_components(struct nsurl_components *c)
+{
+	/* Release lwc strings */
+	if (c->scheme)
+		lwc_string_unref(c->scheme);
+
+	if (c->username)
+		lwc_string_unref(c->username);
+
+	if (c->password)
+		lwc_string_unref(c->password);
+
+	if (c->host)
+		lwc_string_unref(c->host);
+
+	if (c->port)
+		lwc_string_unref(c->port);
+
+	if (c->path)
+		lwc_string_unref(c->path);
+
+	if (c->query)
+		lwc_string_unref(c->query);
+
+	if (c->fragment)
+		lwc_string_unref(c->fragment);
+}
+
+
+/**
+ * Release a NetSurf URL's components and free it
+ *
+ * \param url		NetSurf URL to destroy
+ */
+static void nsurl__destroy(nsurl *url)
+{
+#ifdef NSURL_DEBUG
+	nsurl__dump(url);
+#endif
+
+	nsurl__release_components(&url->components);
+
+	/* Free the NetSurf URL */
+	free(url);
+}
+
+
+/**
+ * Intern a newly built NetSurf URL
+ *
+ * \param url		NetSurf URL, with string and reference count set up
+ * \param hash		Hash value of the URL's string
+ * \param stable	Whether creating a URL from the string gives this URL
+ * \return the NetSurf URL to use in place of url
+ *
+ * If an identical URL already exists, url is destroyed and a new reference
+ * to the existing URL is returned.
+ */
+static nsurl *nsurl__intern(nsurl *url, uint32_t hash, bool stable)
+{
+	nsurl *existing;
+	uint32_t bucket;
+
+	url->string_hash = hash;
+	url->stable = stable;
+
+	existing = nsurl__intern_find(url->string, url->length,
+			url->string_hash);
+	if (existing != NULL) {
+		nsurl__destroy(url);
+		if (stable)
+			existing->stable = true;
+		return nsurl_ref(existing);
+	}
+
+	if (nsurl__interned.count >= nsurl__interned.size)
+		nsurl__intern_grow();
+
+	bucket = url->string_hash & (nsurl__interned.size - 1);
+	url->next = nsurl__interned.buckets[bucket];
+	nsurl__interned.buckets[bucket] = url;
+	nsurl__interned.count++;
+
+	return url;
+}
+
+
+/**
+ * Remove a NetSurf URL from the intern table
+ *
+ * \param url		NetSurf URL to remove
+ */
+static void nsurl__intern_remove(nsurl *url)
+{
+	nsurl **prev;
+
+	for (prev = &nsurl__interned.buckets[url->string_hash &
+			(nsurl__interned.size - 1)];
+			*prev != url; prev = &(*prev)->next)
+		assert(*prev != NULL);
+
+	*prev = url->next;
+	nsurl__interned.count--;
+}
+
+
+/**
+ * Join a base URL to a simple relative reference
+ *
+ * \param base	  NetSurf URL containing the base to join rel to
+ * \param rel	  String containing the relative link part
+ * \param joined  Returns joined NetSurf URL
+ * \return true on success, false if rel needs joining the general way
+ *
+ * This handles the common case of a same-origin reference with a path,
+ * query and fragment which need no escaping or unescaping.  The joined
+ * URL shares the base's scheme and authority, and the start of its
+ * string, so only the path needs more than copying.
+ */
+static bool nsurl__join_simple(const nsurl *base, const char *rel,
+		nsurl **joined)
+{
+	struct nsurl_components c;
+	const char *pos;
+	const char *query = NULL;
+	const char *fragment = NULL;
+	const char *base_path;
+	size_t base_dir_len;
+	size_t path_len, query_len, frag_len;
+	size_t prefix_len;
+	size_t length;
+	char merged[NSURL_SCRATCH_SIZE];
+	char path[NSURL_SCRATCH_SIZE];
+	char string[NSURL_SCRATCH_SIZE * 2];
+	nsurl *existing;
+	uint32_t hash;
+	char *s;
+
+	if (base->components.host == NULL || base->components.path == NULL ||
+			base->components.scheme_type == NSURL_SCHEME_MAILTO)
+		return false;
+
+	base_path = lwc_string_data(base->components.path);
+	if (base_path[0] != '/')
+		return false;
+
+	if (rel[0] == '/' && rel[1] == '/')
+		/* Network-path reference */
+		return false;
+
+	/* Find the query and fragment, checking the characters are left
+	 * alone by normalisation.  A colon in the path may end a scheme. */
+	for (pos = rel; *pos != '\0'; pos++) {
+		if (*pos == '#' && fragment == NULL) {
+			fragment = pos;
+		} else if (*pos == '?' && query == NULL && fragment == NULL) {
+			query = pos;
+		} else if (*pos == '%' || nsurl__is_no_escape(*pos) == false ||
+				(*pos == ':' && query == NULL &&
+				fragment == NULL)) {
+			return false;
+		}
+	}
+
+	path_len = (query != NULL ? query : fragment != NULL ? fragment : pos) -
+			rel;
+	query_len = (query == NULL) ? 0 :
+			(fragment != NULL ? fragment : pos) - query;
+	frag_len = (fragment == NULL) ? 0 : pos - fragment - 1;
+
+	if (path_len == 0) {
+		/* Base path, and base query unless rel has one */
+		length = lwc_string_length(base->components.path);
+		memcpy(path, base_path, length);
+		if (query == NULL && base->components.query != NULL) {
+			query = lwc_string_data(base->components.query);
+			query_len = lwc_string_length(base->components.query);
+		}
+	} else {
+		/* Merge rel path with all but the last segment of the base
+		 * path, unless it's absolute */
+		base_dir_len = 0;
+		if (rel[0] != '/') {
+			base_dir_len = lwc_string_length(
+					base->components.path);
+			while (base_path[base_dir_len - 1] != '/')
+				base_dir_len--;
+		}
+
+		if (base_dir_len + path_len >= sizeof(merged))
+			return false;
+
+		memcpy(merged, base_path, base_dir_len);
+		memcpy(merged + base_dir_len, rel, path_len);
+		merged[base_dir_len + path_len] = '\0';
+
+		length = nsurl__remove_dot_segments(merged, path);
+		if (length == 0 || path[0] != '/')
+			return false;
+	}
+	path_len = length;
+
+	/* The joined URL's string starts as the base URL's does, up to the
+	 * path */
+	prefix_len = base->length - lwc_string_length(base->components.path) -
+			((base->components.query != NULL) ? lwc_string_length(
+			base->components.query) : 0) -
+			((base->components.fragment != NULL) ? 1 +
+			lwc_string_length(base->components.fragment) : 0);
+
+	length = prefix_len + path_len + query_len +
+			((frag_len != 0) ? 1 + frag_len : 0);
+	if (length >= sizeof(string))
+		return false;
+
+	/* Fill out the url string */
+	s = string;
+	memcpy(s, base->string, prefix_len);
+	s += prefix_len;
+	memcpy(s, path, path_len);
+	s += path_len;
+	if (query_len != 0) {
+		memcpy(s, query, query_len);
+		s += query_len;
+	}
+	if (frag_len != 0) {
+		*s++ = '#';
+		memcpy(s, fragment + 1, frag_len);
+		s += frag_len;
+	}
+	*s = '\0';
+
+	/* Links are often resolved again, so the URL may exist already */
+	hash = nsurl__hash_string(string, NULL);
+	existing = nsurl__intern_find(string, length, hash);
+	if (existing != NULL) {
+		*joined = nsurl_ref(existing);
+		return true;
+	}
+
+	/* Take the scheme and authority from the base */
+	c.scheme_type = base->components.scheme_type;
+	c.scheme = nsurl__component_copy(base->components.scheme);
+	c.username = nsurl__component_copy(base->components.username);
+	c.password = nsurl__component_copy(base->components.password);
+	c.host = nsurl__component_copy(base->components.host);
+	c.port = nsurl__component_copy(base->components.port);
+	c.path = NULL;
+	c.query = NULL;
+	c.fragment = NULL;
+
+	if (lwc_intern_string(path, path_len, &c.path) != lwc_error_ok)
+		goto fail;
+
+	if (query_len != 0 && lwc_intern_string(query, query_len,
+			&c.query) != lwc_error_ok)
+		goto fail;
+
+	if (frag_len != 0 && lwc_intern_string(fragment + 1, frag_len,
+			&c.fragment) != lwc_error_ok)
+		goto fail;
+
+	/* Create NetSurf URL object */
+	*joined = malloc(sizeof(nsurl) + length + 1); /* Add 1 for \0 */
+	if (*joined == NULL)
+		goto fail;
+
+	(*joined)->components = c;
+	(*joined)->length = length;
+	memcpy((*joined)->string, string, length + 1);
+
+	/* Compute the URL's hash value */
+	nsurl__calc_hash(*joined);
+
+	/* Give the URL a reference */
+	(*joined)->count = 1;
+
+	*joined = nsurl__intern(*joined, hash, false);
+
+	return true;
+
+fail:
+	nsurl__release_components(&c);
+	return false;
+}
+
+
 /******************************************************************************
  * NetSurf URL Public API                                                     *
  ******************************************************************************/
@@ -1218,22 +1678,38 @@ nserror nsurl_create(const char * const url_s, nsurl **url)
 	struct nsurl_components c;
 	size_t length;
 	char *buff;
+	char scratch[NSURL_SCRATCH_SIZE];
 	struct nsurl_component_lengths str_len = { 0, 0, 0, 0,  0, 0, 0, 0 };
 	enum nsurl_string_flags str_flags = 0;
 	nserror e = NSERROR_OK;
+	nsurl *existing;
+	uint32_t hash;
+	size_t url_l;
 
 	assert(url_s != NULL);
 
+	/* If url_s is known to be normalised already, reuse its URL */
+	hash = nsurl__hash_string(url_s, &url_l);
+	existing = nsurl__intern_find(url_s, url_l, hash);
+	if (existing != NULL && existing->stable) {
+		*url = nsurl_ref(existing);
+		return NSERROR_OK;
+	}
+
 	/* Peg out the URL sections */
 	nsurl__get_string_markers(url_s, &m, false);
 
 	/* Get the length of the longest section */
 	length = nsurl__get_longest_section(&m);
 
-	/* Allocate enough memory to url escape the longest section */
-	buff = malloc(length * 3 + 1);
-	if (buff == NULL)
-		return NSERROR_NOMEM;
+	/* Get enough memory to url escape the longest section */
+	if (length * 3 + 1 <= sizeof(scratch)) {
+		buff = scratch;
+	} else {
+		buff = malloc(length * 3 + 1);
+		if (buff == NULL)
+			return NSERROR_NOMEM;
+	}
 
 	/* Set scheme type */
 	c.scheme_type = m.scheme_type;
@@ -1247,7 +1723,8 @@ nserror nsurl_create(const char * const url_s, nsurl **url)
 	e |= nsurl__create_from_section(url_s, URL_FRAGMENT, &m, buff, &c);
 
 	/* Finished with buffer */
-	free(buff);
+	if (buff != scratch)
+		free(buff);
 
 	if (e != NSERROR_OK)
 		return NSERROR_NOMEM;
@@ -1267,9 +1744,20 @@ nserror nsurl_create(const char * const url_s, nsurl **url)
 	/* Fill out the url string */
 	nsurl_get_string(&c, (*url)->string, &str_len, str_flags);
 
+	/* Compute the URL's hash value */
+	nsurl__calc_hash(*url);
+
 	/* Give the URL a reference */
 	(*url)->count = 1;
 
+	/* Share any identical URL.  If url_s was normalised already, it may
+	 * be looked up in future. */
+	if (length == url_l && memcmp((*url)->string, url_s, url_l) == 0)
+		*url = nsurl__intern(*url, hash, true);
+	else
+		*url = nsurl__intern(*url, nsurl__hash_string((*url)->string,
+				NULL), false);
+
 	return NSERROR_OK;
 }
 
@@ -1294,37 +1782,8 @@ void nsurl_unref(nsurl *url)
 	if (--url->count > 0)
 		return;
 
-#ifdef NSURL_DEBUG
-	nsurl__dump(url);
-#endif
-
-	/* Release lwc strings */
-	if (url->components.scheme)
-		lwc_string_unref(url->components.scheme);
-
-	if (url->components.username)
-		lwc_string_unref(url->components.username);
-
-	if (url->components.password)
-		lwc_string_unref(url->components.password);
-
-	if (url->components.host)
-		lwc_string_unref(url->components.host);
-
-	if (url->components.port)
-		lwc_string_unref(url->components.port);
-
-	if (url->components.path)
-		lwc_string_unref(url->components.path);
-
-	if (url->components.query)
-		lwc_string_unref(url->components.query);
-
-	if (url->components.fragment)
-		lwc_string_unref(url->components.fragment);
-
-	/* Free the NetSurf URL */
-	free(url);
+	nsurl__intern_remove(url);
+	nsurl__destroy(url);
 }
 
 
@@ -1336,6 +1795,18 @@ bool nsurl_compare(const nsurl *url1, const nsurl *url2, nsurl_component parts)
 	assert(url1 != NULL);
 	assert(url2 != NULL);
 
+	if (url1 == url2)
+		return true;
+
+	/* Identical URLs share an object */
+	if ((parts & NSURL_WITH_FRAGMENT) == NSURL_WITH_FRAGMENT)
+		return false;
+
+	/* URLs differing in hash value differ in more than fragment */
+	if ((parts & NSURL_COMPLETE) == NSURL_COMPLETE &&
+			url1->hash != url2->hash)
+		return false;
+
 	/* Compare URL components */
 
 	/* Path, host and query first, since they're most likely to differ */
@@ -1563,6 +2034,15 @@ size_t nsurl_length(const nsurl *url)
 }
 
 
+/* exported interface, documented in nsurl.h */
+uint32_t nsurl_hash(const nsurl *url)
+{
+	assert(url != NULL);
+
+	return url->hash;
+}
+
+
 /* exported interface, documented in nsurl.h */
 nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
 {
@@ -1572,6 +2052,7 @@ nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
 	char *buff;
 	char *buff_pos;
 	char *buff_start;
+	char scratch[NSURL_SCRATCH_SIZE];
 	struct nsurl_component_lengths str_len = { 0, 0, 0, 0,  0, 0, 0, 0 };
 	enum nsurl_string_flags str_flags = 0;
 	nserror error = 0;
@@ -1587,6 +2068,10 @@ nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
 	assert(base != NULL);
 	assert(rel != NULL);
 
+	/* Most links are simple */
+	if (nsurl__join_simple(base, rel, joined))
+		return NSERROR_OK;
+
 	/* Peg out the URL sections */
 	nsurl__get_string_markers(rel, &m, true);
 
@@ -1639,9 +2124,13 @@ nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
 	length += (m.query - m.path) + ((base->components.path != NULL) ?
 			lwc_string_length(base->components.path) : 0);
 
-	buff = malloc(length + 5);
-	if (buff == NULL)
-		return NSERROR_NOMEM;
+	if (length + 5 <= sizeof(scratch)) {
+		buff = scratch;
+	} else {
+		buff = malloc(length + 5);
+		if (buff == NULL)
+			return NSERROR_NOMEM;
+	}
 
 	buff_start = buff_pos = buff;
 
@@ -1748,7 +2237,8 @@ nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
 			buff, &c);
 
 	/* Free temporary buffer */
-	free(buff);
+	if (buff != scratch)
+		free(buff);
 
 	if (error != NSERROR_OK)
 		return NSERROR_NOMEM;
@@ -1768,9 +2258,16 @@ nserror nsurl_join(const nsurl *base, const char *rel, nsurl **joined)
 	/* Fill out the url string */
 	nsurl_get_string(&c, (*joined)->string, &str_len, str_flags);
 
+	/* Compute the URL's hash value */
+	nsurl__calc_hash(*joined);
+
 	/* Give the URL a reference */
 	(*joined)->count = 1;
 
+	/* Share any identical URL */
+	*joined = nsurl__intern(*joined, nsurl__hash_string((*joined)->string,
+			NULL), false);
+
 	return NSERROR_OK;
 }
 
@@ -1820,9 +2317,16 @@ nserror nsurl_defragment(const nsurl *url, nsurl **no_frag)
 	pos += length;
 	*pos = '\0';
 
+	/* Compute the URL's hash value */
+	nsurl__calc_hash(*no_frag);
+
 	/* Give the URL a reference */
 	(*no_frag)->count = 1;
 
+	/* Share any identical URL */
+	*no_frag = nsurl__intern(*no_frag, nsurl__hash_string((*no_frag)->string,
+			NULL), false);
+
 	return NSERROR_OK;
 }
 
@@ -1885,9 +2389,16 @@ nserror nsurl_refragment(const nsurl *url, lwc_string *frag, nsurl **new_url)
 
 	(*new_url)->components.scheme_type = url->components.scheme_type;
 
+	/* Compute the URL's hash value */
+	nsurl__calc_hash(*new_url);
+
 	/* Give the URL a reference */
 	(*new_url)->count = 1;
 
+	/* Share any identical URL */
+	*new_url = nsurl__intern(*new_url, nsurl__hash_string((*new_url)->string,
+			NULL), false);
+
 	return NSERROR_OK;
 }
 
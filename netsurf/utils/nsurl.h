@@ -59,6 +59,9 @@ typedef enum nsurl_component {
  *
  * It is up to the client to call nsurl_destroy when they are finished with
  * the created object.
+ *
+ * Identical URLs share a single object, however they were created.
+ * Creating a URL again from the string of an existing one is cheap.
  */
 nserror nsurl_create(const char * const url_s, nsurl **url);
 
@@ -94,6 +97,10 @@ void nsurl_unref(nsurl *url);
  * \return NSERROR_OK on success, appropriate error otherwise
  *
  * If return value != NSERROR_OK, match will be false.
+ *
+ * As identical URLs share an object, comparing with NSURL_WITH_FRAGMENT is
+ * just a pointer comparison.  Comparing with NSURL_COMPLETE checks hash
+ * values before components.
  */
 bool nsurl_compare(const nsurl *url1, const nsurl *url2, nsurl_component parts);
 
@@ -193,6 +200,19 @@ const char *nsurl_access(const nsurl *url);
 size_t nsurl_length(const nsurl *url);
 
 
+/**
+ * Get a hash value for a NetSurf URL object
+ *
+ * \param url	  NetSurf URL to get hash value for.
+ * \return the hash value
+ *
+ * The hash value excludes any fragment, so URLs which compare equal with
+ * NSURL_COMPLETE have the same hash value.  The value is computed when the
+ * URL is created, so this is cheap.  It is not stable between runs.
+ */
+uint32_t nsurl_hash(const nsurl *url);
+
+
 /**
  * Join a base url to a relative link part, creating a new NetSurf URL object
  *
@@ -23,10 +23,50 @@
 #ifndef _NETSURF_UTILS_SCHEDULE_H_
 #define _NETSURF_UTILS_SCHEDULE_H_
 
+#include <stdbool.h>
+
 /* In platform specific schedule.c. */
 typedef void (*schedule_callback_fn)(void *p);
 
 void schedule(int t, schedule_callback_fn callback, void *p);
 void schedule_remove(schedule_callback_fn callback, void *p);
 
+/* File descriptor watches.
+ *
+ * Frontends which can wait for file descriptor readiness alongside their
+ * other events provide these, and are built with WITH_SCHEDULE_FD defined.
+ * Core code must only use them when that is defined. */
+
+/** File descriptor readiness conditions */
+enum schedule_fd_events {
+	SCHEDULE_FD_READ = (1 << 0),	/**< Data may be read */
+	SCHEDULE_FD_WRITE = (1 << 1),	/**< Data may be written */
+	SCHEDULE_FD_ERROR = (1 << 2)	/**< Error or hangup (always watched) */
+};
+
+typedef void (*schedule_fd_callback_fn)(int fd, int events, void *p);
+
+/**
+ * Watch a file descriptor for readiness.
+ *
+ * \param fd        File descriptor to watch
+ * \param events    Bitmap of ::schedule_fd_events to watch for
+ * \param callback  Function to call when \a fd is ready
+ * \param p         Client data for \a callback
+ * \return true on success, false on memory exhaustion
+ *
+ * The callback is made from the frontend's main loop, as for scheduled
+ * callbacks, with the conditions which hold.  It continues to be made
+ * while the conditions hold.  Any existing watch on \a fd is replaced.
+ */
+bool schedule_fd(int fd, int events, schedule_fd_callback_fn callback,
+		void *p);
+
+/**
+ * Stop watching a file descriptor.
+ *
+ * \param fd  File descriptor to stop watching
+ */
+void schedule_fd_remove(int fd);
+
 #endif